@@ -21,10 +21,19 @@
 #define NVME_CC_IOSQES	(6 << 16)
 #define NVME_CC_IOCQES	(4 << 20)
 
-#define NVME_QUEUE_SIZE 2
+#define NVME_ADMIN_QUEUE_SIZE 2
+#define NVME_QUEUE_SIZE 64 // I/O queue, also limited by CAP.MQES
 #define NVME_SQ_ENTRY_SIZE 64
 #define NVME_CQ_ENTRY_SIZE 16
 
+#define NVME_MAX_BLOCKS 512
+/* A transfer of NVME_MAX_BLOCKS blocks spans at most this many pages after the first. */
+#define NVME_PRP_LIST_ENTRIES (NVME_MAX_BLOCKS * 512 / 0x1000)
+
+#define NVME_OPC_FLUSH	0x00
+#define NVME_OPC_WRITE	0x01
+#define NVME_OPC_READ	0x02
+
 struct nvme_dev {
 	storage_dev_t storage_dev;
 
@@ -33,11 +42,21 @@ struct nvme_dev {
 	struct {
 		void *base;
 		uint32_t *bell;
-		uint16_t idx; // bool pos 0 or 1
-		uint16_t round; // bool round 0 or 1+0xd
+		uint16_t size;
+		uint16_t idx;
+		uint16_t round; // phase tag of the last round of completions
 	} queue[4];
 
-	uint64_t *prp_list;
+	/* I/O commands in flight, indexed by command identifier. */
+	struct {
+		bool busy;
+		uint16_t status;
+		size_t off; // block offset of the command in the current transfer
+	} io[NVME_QUEUE_SIZE];
+	uint16_t io_inflight;
+
+	/* One PRP list of NVME_PRP_LIST_ENTRIES per command identifier. */
+	uint64_t *prp_lists;
 };
 
 
@@ -70,22 +89,80 @@ static int nvme_cmd(
 
 	void *s_entry = nvme->queue[sq].base + (nvme->queue[sq].idx * NVME_SQ_ENTRY_SIZE);
 	memcpy(s_entry, cmd, NVME_SQ_ENTRY_SIZE);
-	nvme->queue[sq].idx = (nvme->queue[sq].idx + 1) & (NVME_QUEUE_SIZE - 1);
+	nvme->queue[sq].idx = (nvme->queue[sq].idx + 1) % nvme->queue[sq].size;
 	write32(nvme->queue[sq].bell, nvme->queue[sq].idx);
 
 	struct nvme_c_queue_entry *c_entry = nvme->queue[cq].base +
 		(nvme->queue[cq].idx * NVME_CQ_ENTRY_SIZE);
 	while (((read32(&c_entry->dw[3]) >> 16) & 0x1) == nvme->queue[cq].round)
 		;
-	nvme->queue[cq].idx = (nvme->queue[cq].idx + 1) & (NVME_QUEUE_SIZE - 1);
+	nvme->queue[cq].idx = (nvme->queue[cq].idx + 1) % nvme->queue[cq].size;
 	write32(nvme->queue[cq].bell, nvme->queue[cq].idx);
 	if (nvme->queue[cq].idx == 0)
 		nvme->queue[cq].round = (nvme->queue[cq].round + 1) & 1;
 	return c_entry->dw[3] >> 17;
 }
 
+/*
+ * Allocate a command identifier for an I/O command. The caller has to make
+ * sure that nvme->io_inflight is below the I/O queue size minus one.
+ */
+static uint16_t nvme_alloc_io(struct nvme_dev *nvme, size_t off)
+{
+	uint16_t cid = 0;
+	while (nvme->io[cid].busy)
+		++cid;
+
+	nvme->io[cid].busy = true;
+	nvme->io[cid].off = off;
+	nvme->io_inflight++;
+	return cid;
+}
+
+/* Place an I/O command in the submission queue without ringing the doorbell,
+   so that several commands can be submitted at once. */
+static void nvme_queue_io(struct nvme_dev *nvme, struct nvme_s_queue_entry *cmd, uint16_t cid)
+{
+	cmd->dw[0] |= cid << 16;
+	void *s_entry = nvme->queue[ios].base + (nvme->queue[ios].idx * NVME_SQ_ENTRY_SIZE);
+	memcpy(s_entry, cmd, NVME_SQ_ENTRY_SIZE);
+	nvme->queue[ios].idx = (nvme->queue[ios].idx + 1) % nvme->queue[ios].size;
+}
+
+static void nvme_ring_io(struct nvme_dev *nvme)
+{
+	write32(nvme->queue[ios].bell, nvme->queue[ios].idx);
+}
+
+/* Wait for the next I/O completion, in any order, and return its command identifier. */
+static uint16_t nvme_complete_io(struct nvme_dev *nvme)
+{
+	struct nvme_c_queue_entry *c_entry = nvme->queue[ioc].base +
+		(nvme->queue[ioc].idx * NVME_CQ_ENTRY_SIZE);
+	uint32_t dw3;
+	while (((dw3 = read32(&c_entry->dw[3])) >> 16 & 0x1) == nvme->queue[ioc].round)
+		;
+	nvme->queue[ioc].idx = (nvme->queue[ioc].idx + 1) % nvme->queue[ioc].size;
+	write32(nvme->queue[ioc].bell, nvme->queue[ioc].idx);
+	if (nvme->queue[ioc].idx == 0)
+		nvme->queue[ioc].round = (nvme->queue[ioc].round + 1) & 1;
+
+	const uint16_t cid = dw3 & 0xffff;
+	if (cid >= NVME_QUEUE_SIZE || !nvme->io[cid].busy) {
+		printf("NVMe ERROR: Completion for unknown command %u\n", cid);
+		return cid;
+	}
+	nvme->io[cid].busy = false;
+	nvme->io[cid].status = dw3 >> 17;
+	nvme->io_inflight--;
+	return cid;
+}
+
 static int delete_io_submission_queue(struct nvme_dev *nvme)
 {
+	if (!nvme->queue[ios].base)
+		return 0;
+
 	const struct nvme_s_queue_entry e = {
 		.dw[0]  = 0,
 		.dw[10] = ios,
@@ -102,6 +179,9 @@ static int delete_io_submission_queue(struct nvme_dev *nvme)
 
 static int delete_io_completion_queue(struct nvme_dev *nvme)
 {
+	if (!nvme->queue[ioc].base)
+		return 0;
+
 	const struct nvme_s_queue_entry e = {
 		.dw[0]  = 1,
 		.dw[10] = ioc,
@@ -167,16 +247,16 @@ static void nvme_detach_device(struct storage_dev *dev)
 	uint16_t command = pci_read_config16(nvme->pci_dev, PCI_COMMAND);
 	pci_write_config16(nvme->pci_dev, PCI_COMMAND, command & ~PCI_COMMAND_MASTER);
 
-	free(nvme->prp_list);
+	free(nvme->prp_lists);
 }
 
-static int nvme_read(struct nvme_dev *nvme, unsigned char *buffer, uint64_t base, uint16_t count)
+/* Queue a read or write of count blocks, setting up the PRPs for the buffer. */
+static void nvme_queue_rw(struct nvme_dev *nvme, uint8_t opcode, const unsigned char *buffer,
+			  uint64_t base, uint16_t count, size_t off)
 {
-	if (count == 0 || count > 512)
-		return -1;
-
+	const uint16_t cid = nvme_alloc_io(nvme, off);
 	struct nvme_s_queue_entry e = {
-		.dw[0] = 0x02,
+		.dw[0] = opcode,
 		.dw[1] = 0x1,
 		.dw[6] = virt_to_phys(buffer),
 		.dw[10] = base,
@@ -192,45 +272,99 @@ static int nvme_read(struct nvme_dev *nvme, unsigned char *buffer, uint64_t base
 		/* Crossing exactly one page boundary, PRP2 is second page */
 		e.dw[8] = virt_to_phys(buffer + 0x1000) & ~0xfff;
 	} else {
-		/* Use a single page as PRP list, PRP2 points to the list */
+		/* Use the command's own PRP list, PRP2 points to the list */
+		uint64_t *const prp_list = nvme->prp_lists + cid * NVME_PRP_LIST_ENTRIES;
 		unsigned int i;
 		for (i = 0; i < end_page - start_page; ++i) {
 			buffer += 0x1000;
-			nvme->prp_list[i] = virt_to_phys(buffer) & ~0xfff;
+			prp_list[i] = virt_to_phys(buffer) & ~0xfff;
+		}
+		e.dw[8] = virt_to_phys(prp_list);
+	}
+
+	nvme_queue_io(nvme, &e, cid);
+}
+
+/*
+ * Split a transfer into commands of up to NVME_MAX_BLOCKS blocks and keep as
+ * many of them in flight as the I/O queue allows. Returns the number of blocks
+ * from start that were transferred without error.
+ */
+static ssize_t nvme_transfer(struct nvme_dev *nvme, uint8_t opcode, const lba_t start,
+			     const size_t count, const unsigned char *const buf)
+{
+	const uint16_t max_inflight = nvme->queue[ios].size - 1;
+	size_t off = 0, done = count;
+
+	while (nvme->io_inflight || (off < count && done == count)) {
+		bool queued = false;
+		while (off < count && done == count && nvme->io_inflight < max_inflight) {
+			const unsigned int blocks = MIN(count - off, NVME_MAX_BLOCKS);
+			nvme_queue_rw(nvme, opcode, buf + (off * 512), start + off, blocks, off);
+			off += blocks;
+			queued = true;
+		}
+		if (queued)
+			nvme_ring_io(nvme);
+
+		const uint16_t cid = nvme_complete_io(nvme);
+		if (cid < NVME_QUEUE_SIZE && nvme->io[cid].status) {
+			printf("NVMe ERROR: Command failed with status 0x%x\n",
+			       nvme->io[cid].status);
+			done = MIN(done, nvme->io[cid].off);
 		}
-		e.dw[8] = virt_to_phys(nvme->prp_list);
 	}
+	return done;
+}
+
+static int nvme_flush(struct nvme_dev *nvme)
+{
+	struct nvme_s_queue_entry e = {
+		.dw[0] = NVME_OPC_FLUSH,
+		.dw[1] = 0x1,
+	};
 
-	return nvme_cmd(nvme, ios, &e);
+	nvme_queue_io(nvme, &e, nvme_alloc_io(nvme, 0));
+	nvme_ring_io(nvme);
+	const uint16_t cid = nvme_complete_io(nvme);
+	return cid < NVME_QUEUE_SIZE ? nvme->io[cid].status : -1;
 }
 
 static ssize_t nvme_read_blocks512(
 		struct storage_dev *const dev,
 		const lba_t start, const size_t count, unsigned char *const buf)
 {
-	unsigned int off = 0;
-	while (off < count) {
-		const unsigned int blocks = MIN(count - off, 512);
-		if (nvme_read((struct nvme_dev *)dev, buf + (off * 512), start + off, blocks))
-			return off;
-		off += blocks;
+	return nvme_transfer((struct nvme_dev *)dev, NVME_OPC_READ, start, count, buf);
+}
+
+static ssize_t nvme_write_blocks512(
+		struct storage_dev *const dev,
+		const lba_t start, const size_t count, const unsigned char *const buf)
+{
+	struct nvme_dev *const nvme = (struct nvme_dev *)dev;
+
+	const ssize_t done = nvme_transfer(nvme, NVME_OPC_WRITE, start, count, buf);
+	if (done && nvme_flush(nvme)) {
+		printf("NVMe ERROR: Failed to flush volatile write cache\n");
+		return 0;
 	}
-	return count;
+	return done;
 }
 
 static int create_io_submission_queue(struct nvme_dev *nvme)
 {
-	void *sq_buffer = memalign(0x1000, NVME_SQ_ENTRY_SIZE * NVME_QUEUE_SIZE);
+	const uint16_t size = nvme->queue[ioc].size;
+	void *sq_buffer = memalign(0x1000, NVME_SQ_ENTRY_SIZE * size);
 	if (!sq_buffer) {
 		printf("NVMe ERROR: Failed to allocate memory for io submission queue.\n");
 		return -1;
 	}
-	memset(sq_buffer, 0, NVME_SQ_ENTRY_SIZE * NVME_QUEUE_SIZE);
+	memset(sq_buffer, 0, NVME_SQ_ENTRY_SIZE * size);
 
 	struct nvme_s_queue_entry e = {
 		.dw[0]  = 0x01,
 		.dw[6]  = virt_to_phys(sq_buffer),
-		.dw[10] = ((NVME_QUEUE_SIZE - 1) << 16) | ios >> 1,
+		.dw[10] = ((size - 1) << 16) | ios >> 1,
 		.dw[11] = (1 << 16) | 1,
 	};
 
@@ -244,23 +378,26 @@ static int create_io_submission_queue(struct nvme_dev *nvme)
 	uint8_t cap_dstrd = (read64(nvme->config) >> 32) & 0xf;
 	nvme->queue[ios].base = sq_buffer;
 	nvme->queue[ios].bell = nvme->config + 0x1000 + (ios * (4 << cap_dstrd));
+	nvme->queue[ios].size = size;
 	nvme->queue[ios].idx = 0;
 	return 0;
 }
 
 static int create_io_completion_queue(struct nvme_dev *nvme)
 {
-	void *const cq_buffer = memalign(0x1000, NVME_CQ_ENTRY_SIZE * NVME_QUEUE_SIZE);
+	/* CAP.MQES is the maximum queue size supported, minus one. */
+	const uint16_t size = MIN(NVME_QUEUE_SIZE, (read64(nvme->config) & 0xffff) + 1);
+	void *const cq_buffer = memalign(0x1000, NVME_CQ_ENTRY_SIZE * size);
 	if (!cq_buffer) {
 		printf("NVMe ERROR: Failed to allocate memory for io completion queue.\n");
 		return -1;
 	}
-	memset(cq_buffer, 0, NVME_CQ_ENTRY_SIZE * NVME_QUEUE_SIZE);
+	memset(cq_buffer, 0, NVME_CQ_ENTRY_SIZE * size);
 
 	const struct nvme_s_queue_entry e = {
 		.dw[0]  = 0x05,
 		.dw[6]  = virt_to_phys(cq_buffer),
-		.dw[10] = ((NVME_QUEUE_SIZE - 1) << 16) | ioc >> 1,
+		.dw[10] = ((size - 1) << 16) | ioc >> 1,
 		.dw[11] = 1,
 	};
 
@@ -274,6 +411,7 @@ static int create_io_completion_queue(struct nvme_dev *nvme)
 	uint8_t cap_dstrd = (read64(nvme->config) >> 32) & 0xf;
 	nvme->queue[ioc].base  = cq_buffer;
 	nvme->queue[ioc].bell  = nvme->config + 0x1000 + (ioc * (4 << cap_dstrd));
+	nvme->queue[ioc].size  = size;
 	nvme->queue[ioc].idx   = 0;
 	nvme->queue[ioc].round = 0;
 
@@ -283,31 +421,34 @@ static int create_io_completion_queue(struct nvme_dev *nvme)
 static int create_admin_queues(struct nvme_dev *nvme)
 {
 	uint8_t cap_dstrd = (read64(nvme->config) >> 32) & 0xf;
-	write32(nvme->config + 0x24, (NVME_QUEUE_SIZE - 1) << 16 | (NVME_QUEUE_SIZE - 1));
+	write32(nvme->config + 0x24,
+		(NVME_ADMIN_QUEUE_SIZE - 1) << 16 | (NVME_ADMIN_QUEUE_SIZE - 1));
 
-	void *sq_buffer = memalign(0x1000, NVME_SQ_ENTRY_SIZE * NVME_QUEUE_SIZE);
+	void *sq_buffer = memalign(0x1000, NVME_SQ_ENTRY_SIZE * NVME_ADMIN_QUEUE_SIZE);
 	if (!sq_buffer) {
 		printf("NVMe ERROR: Failed to allocated memory for admin submission queue\n");
 		return -1;
 	}
-	memset(sq_buffer, 0, NVME_SQ_ENTRY_SIZE * NVME_QUEUE_SIZE);
+	memset(sq_buffer, 0, NVME_SQ_ENTRY_SIZE * NVME_ADMIN_QUEUE_SIZE);
 	write64(nvme->config + 0x28, virt_to_phys(sq_buffer));
 
 	nvme->queue[ads].base = sq_buffer;
 	nvme->queue[ads].bell = nvme->config + 0x1000 + (ads * (4 << cap_dstrd));
+	nvme->queue[ads].size = NVME_ADMIN_QUEUE_SIZE;
 	nvme->queue[ads].idx = 0;
 
-	void *cq_buffer = memalign(0x1000, NVME_CQ_ENTRY_SIZE * NVME_QUEUE_SIZE);
+	void *cq_buffer = memalign(0x1000, NVME_CQ_ENTRY_SIZE * NVME_ADMIN_QUEUE_SIZE);
 	if (!cq_buffer) {
 		printf("NVMe ERROR: Failed to allocate memory for admin completion queue\n");
 		free(cq_buffer);
 		return -1;
 	}
-	memset(cq_buffer, 0, NVME_CQ_ENTRY_SIZE * NVME_QUEUE_SIZE);
+	memset(cq_buffer, 0, NVME_CQ_ENTRY_SIZE * NVME_ADMIN_QUEUE_SIZE);
 	write64(nvme->config + 0x30, virt_to_phys(cq_buffer));
 
 	nvme->queue[adc].base = cq_buffer;
 	nvme->queue[adc].bell = nvme->config + 0x1000 + (adc * (4 << cap_dstrd));
+	nvme->queue[adc].size = NVME_ADMIN_QUEUE_SIZE;
 	nvme->queue[adc].idx = 0;
 	nvme->queue[adc].round = 0;
 
@@ -325,7 +466,7 @@ static void nvme_init(pcidev_t dev)
 		printf("NVMe ERROR: PCIe device does not support the NVMe command set\n");
 		return;
 	}
-	struct nvme_dev *nvme = malloc(sizeof(*nvme));
+	struct nvme_dev *nvme = calloc(1, sizeof(*nvme));
 	if (!nvme) {
 		printf("NVMe ERROR: Failed to allocate buffer for nvme driver struct\n");
 		return;
@@ -333,14 +474,15 @@ static void nvme_init(pcidev_t dev)
 	nvme->storage_dev.port_type		= PORT_TYPE_NVME;
 	nvme->storage_dev.poll			= nvme_poll;
 	nvme->storage_dev.read_blocks512	= nvme_read_blocks512;
-	nvme->storage_dev.write_blocks512	= NULL;
+	nvme->storage_dev.write_blocks512	= nvme_write_blocks512;
 	nvme->storage_dev.detach_device		= nvme_detach_device;
 	nvme->pci_dev				= dev;
 	nvme->config				= pci_bar0;
-	nvme->prp_list				= memalign(0x1000, 0x1000);
+	nvme->prp_lists				= memalign(0x1000,
+		NVME_QUEUE_SIZE * NVME_PRP_LIST_ENTRIES * sizeof(*nvme->prp_lists));
 
-	if (!nvme->prp_list) {
-		printf("NVMe ERROR: Failed to allocate buffer for PRP list\n");
+	if (!nvme->prp_lists) {
+		printf("NVMe ERROR: Failed to allocate buffer for PRP lists\n");
 		goto abort;
 	}
 
@@ -393,7 +535,7 @@ abort:
 	delete_io_submission_queue(nvme);
 	delete_io_completion_queue(nvme);
 	delete_admin_queues(nvme);
-	free(nvme->prp_list);
+	free(nvme->prp_lists);
 	free(nvme);
 }
 
@@ -100,6 +100,28 @@ ssize_t storage_read_blocks512(const size_t dev_num,
 		return -1;
 }
 
+/**
+ * Write 512-byte blocks
+ *
+ * Writes count blocks of 512 bytes from buf to block start of drive
+ * dev_num.
+ *
+ * @dev_num device number counted from 0
+ * @start number of first block to write to
+ * @count number of blocks to write
+ * @buf buffer containing the data to be written
+ */
+ssize_t storage_write_blocks512(const size_t dev_num,
+				const lba_t start, const size_t count,
+				const unsigned char *const buf)
+{
+	if ((dev_num < dev_count) && devices[dev_num]->write_blocks512)
+		return devices[dev_num]->write_blocks512(
+				devices[dev_num], start, count, buf);
+	else
+		return -1;
+}
+
 /**
  * Initializes storage controllers
  *
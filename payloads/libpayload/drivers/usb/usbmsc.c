@@ -326,6 +326,15 @@ typedef struct {
 	unsigned char control;	//5
 } __packed cmdblock6_t;
 
+typedef struct {
+	unsigned char command;	//0
+	unsigned char res1;	//1
+	unsigned long long block;	//2-9
+	unsigned int numblocks;	//10-13
+	unsigned char res2;	//14
+	unsigned char control;	//15 - the block is 16 bytes long
+} __packed cmdblock16_t;
+
 /**
  * Like readwrite_blocks, but for soft-sectors of 512b size. Converts the
  * start and count from 512b units.
@@ -340,7 +349,7 @@ typedef struct {
  * @return 0 on success, 1 on failure
  */
 int
-readwrite_blocks_512 (usbdev_t *dev, int start, int n,
+readwrite_blocks_512 (usbdev_t *dev, u64 start, int n,
 	cbw_direction dir, u8 *buf)
 {
 	int blocksize_divider = MSC_INST(dev)->blocksize / 512;
@@ -350,19 +359,31 @@ readwrite_blocks_512 (usbdev_t *dev, int start, int n,
 
 /**
  * Reads or writes a number of sequential blocks on a USB storage device.
- * As it uses the READ(10) SCSI-2 command, it's limited to storage devices
- * of at most 2TB. It assumes sectors of 512 bytes.
+ * It uses READ(10)/WRITE(10), or READ(16)/WRITE(16) for blocks beyond
+ * the reach of a 32-bit LBA.
  *
  * @param dev device to access
  * @param start first sector to access
- * @param n number of sectors to access
+ * @param n number of sectors to access, at most 65535
  * @param dir direction of access: cbw_direction_data_in == read, cbw_direction_data_out == write
  * @param buf buffer to read into or write from. Must be at least n*sectorsize bytes
- * @return 0 on success, 1 on failure
+ * @return MSC_COMMAND_OK on success, MSC_COMMAND_FAIL or MSC_COMMAND_DETACHED on failure
  */
 static int
-readwrite_chunk (usbdev_t *dev, int start, int n, cbw_direction dir, u8 *buf)
+readwrite_chunk (usbdev_t *dev, u64 start, int n, cbw_direction dir, u8 *buf)
 {
+	const int datalen = n * MSC_INST(dev)->blocksize;
+
+	if (start + n - 1 > 0xffffffff) {
+		cmdblock16_t cb;
+		memset (&cb, 0, sizeof (cb));
+		cb.command = dir == cbw_direction_data_in ? 0x88 : 0x8a;
+		cb.block = htonll (start);
+		cb.numblocks = htonl (n);
+		return execute_command (dev, dir, (u8 *) &cb, sizeof (cb), buf,
+					datalen, 0);
+	}
+
 	cmdblock_t cb;
 	memset (&cb, 0, sizeof (cb));
 	if (dir == cbw_direction_data_in) {
@@ -376,16 +397,16 @@ readwrite_chunk (usbdev_t *dev, int start, int n, cbw_direction dir, u8 *buf)
 	cb.numblocks = htonw (n);
 
 	return execute_command (dev, dir, (u8 *) &cb, sizeof (cb), buf,
-				n * MSC_INST(dev)->blocksize, 0)
-		!= MSC_COMMAND_OK ? 1 : 0;
+				datalen, 0);
 }
 
 /**
  * Reads or writes a number of sequential blocks on a USB storage device
- * that is split into MAX_CHUNK_BYTES size requests.
- *
- * As it uses the READ(10) SCSI-2 command, it's limited to storage devices
- * of at most 2TB. It assumes sectors of 512 bytes.
+ * that is split into requests of up to max_chunk_bytes. These are as large
+ * as the host controller can take in one transfer if
+ * CONFIG_LP_USB_MSC_LARGE_TRANSFERS is set, until the device fails one.
+ * Buffers that aren't DMA-coherent go through the controller's 64KB
+ * bounce buffer and are always split into MAX_CHUNK_BYTES requests.
  *
  * @param dev device to access
  * @param start first sector to access
@@ -397,27 +418,29 @@ readwrite_chunk (usbdev_t *dev, int start, int n, cbw_direction dir, u8 *buf)
  * @return 0 on success, 1 on failure
  */
 int
-readwrite_blocks (usbdev_t *dev, int start, int n, cbw_direction dir, u8 *buf)
+readwrite_blocks (usbdev_t *dev, u64 start, int n, cbw_direction dir, u8 *buf)
 {
-	int chunk_size = MAX_CHUNK_BYTES / MSC_INST(dev)->blocksize;
-	int chunk;
-
-	/* Read as many full chunks as needed. */
-	for (chunk = 0; chunk < (n / chunk_size); chunk++) {
-		if (readwrite_chunk (dev, start + (chunk * chunk_size),
-				     chunk_size, dir,
-				     buf + (chunk * MAX_CHUNK_BYTES))
-		    != MSC_COMMAND_OK)
+	usbmsc_inst_t *const msc = MSC_INST (dev);
+	const int max_bytes = dma_coherent (buf) ? msc->max_chunk_bytes : MAX_CHUNK_BYTES;
+
+	while (n > 0) {
+		const int chunk_size = MIN (MIN (max_bytes, msc->max_chunk_bytes)
+					    / msc->blocksize, 0xffff);
+		const int blocks = MIN (n, chunk_size);
+
+		const int ret = readwrite_chunk (dev, start, blocks, dir, buf);
+		if (ret == MSC_COMMAND_FAIL && msc->max_chunk_bytes > MAX_CHUNK_BYTES) {
+			usb_debug ("MSC: large request failed, using %d byte chunks\n",
+				   MAX_CHUNK_BYTES);
+			msc->max_chunk_bytes = MAX_CHUNK_BYTES;
+			continue;
+		}
+		if (ret != MSC_COMMAND_OK)
 			return 1;
-	}
 
-	/* Read any remaining partial chunk at the end. */
-	if (n % chunk_size) {
-		if (readwrite_chunk (dev, start + (chunk * chunk_size),
-				     n % chunk_size, dir,
-				     buf + (chunk * MAX_CHUNK_BYTES))
-		    != MSC_COMMAND_OK)
-			return 1;
+		start += blocks;
+		n -= blocks;
+		buf += blocks * msc->blocksize;
 	}
 
 	return 0;
@@ -512,7 +535,26 @@ read_capacity (usbdev_t *dev)
 		}
 		break;
 	}
-	if (count >= 20) {
+	if (count < 20 && buf[0] == 0xffffffff) {
+		/* Too large for READ CAPACITY(10), ask with SERVICE ACTION IN(16) */
+		cmdblock16_t cb16;
+		u32 buf16[8];
+		memset (&cb16, 0, sizeof (cb16));
+		cb16.command = 0x9e;
+		cb16.res1 = 0x10;	// READ CAPACITY(16)
+		cb16.numblocks = htonl (sizeof (buf16));	// allocation length
+		if (execute_command (dev, cbw_direction_data_in, (u8 *) &cb16,
+				     sizeof (cb16), (u8 *) buf16, sizeof (buf16), 1)
+		    == MSC_COMMAND_OK) {
+			MSC_INST (dev)->numblocks =
+				((u64) ntohl (buf16[0]) << 32 | ntohl (buf16[1])) + 1;
+			MSC_INST (dev)->blocksize = ntohl (buf16[2]);
+		} else {
+			usb_debug ("  READ CAPACITY(16) failed, only using the first 2^32 sectors.\n");
+			MSC_INST (dev)->numblocks = 0x100000000ULL;
+			MSC_INST (dev)->blocksize = ntohl(buf[1]);
+		}
+	} else if (count >= 20) {
 		// still not successful, assume 2tb in 512byte sectors, which is just the same garbage as any other number, but probably more usable.
 		usb_debug ("  assuming 2 TB with 512-byte sectors as READ CAPACITY didn't answer.\n");
 		MSC_INST (dev)->numblocks = 0xffffffff;
@@ -521,12 +563,11 @@ read_capacity (usbdev_t *dev)
 		MSC_INST (dev)->numblocks = ntohl(buf[0]) + 1;
 		MSC_INST (dev)->blocksize = ntohl(buf[1]);
 	}
-	usb_debug ("  %d %d-byte sectors (%d MB)\n", MSC_INST (dev)->numblocks,
+	usb_debug ("  %llu %d-byte sectors (%llu MB)\n",
+		(unsigned long long) MSC_INST (dev)->numblocks,
 		MSC_INST (dev)->blocksize,
-		/* round down high block counts to avoid integer overflow */
-		MSC_INST (dev)->numblocks > 1000000
-			? (MSC_INST (dev)->numblocks / 1000) * MSC_INST (dev)->blocksize / 1000 :
-		MSC_INST (dev)->numblocks * MSC_INST (dev)->blocksize / 1000 / 1000);
+		(unsigned long long) MSC_INST (dev)->numblocks
+			* MSC_INST (dev)->blocksize / 1000 / 1000);
 	return MSC_COMMAND_OK;
 }
 
@@ -649,6 +690,10 @@ void usb_msc_force_init (usbdev_t *dev, u32 quirks)
 	MSC_INST (dev)->bulk_out = 0;
 	MSC_INST (dev)->usbdisk_created = 0;
 	MSC_INST (dev)->quirks = quirks;
+	MSC_INST (dev)->max_chunk_bytes = MAX_CHUNK_BYTES;
+	if (CONFIG(LP_USB_MSC_LARGE_TRANSFERS))
+		MSC_INST (dev)->max_chunk_bytes =
+			MAX (dev->controller->max_bulk_size, MAX_CHUNK_BYTES);
 
 	for (i = 1; i <= dev->num_endp; i++) {
 		if (dev->endpoints[i].endpoint == 0)
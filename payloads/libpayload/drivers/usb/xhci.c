@@ -165,6 +165,8 @@ xhci_init (unsigned long physical_bar)
 	controller->init		= xhci_reinit;
 	controller->shutdown		= xhci_shutdown;
 	controller->bulk		= xhci_bulk;
+	/* xhci_bulk() needs one TRB per 64KiB boundary crossed. */
+	controller->max_bulk_size	= (TRANSFER_RING_SIZE - 3) << 16;
 	controller->control		= xhci_control;
 	controller->set_address		= xhci_set_address;
 	controller->finish_device_config= xhci_finish_device_config;
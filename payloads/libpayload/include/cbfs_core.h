@@ -274,6 +274,10 @@ struct cbfs_handle {
  * Caller is responsible to free() returned handle after use. */
 struct cbfs_handle *cbfs_get_handle(struct cbfs_media *media, const char *name);
 
+/* Drops the index of the default CBFS (see CONFIG_LP_CBFS_INDEX), so that it gets rebuilt
+ * from the media on the next lookup. Must be called after changing that CBFS. */
+void cbfs_invalidate_index(void);
+
 /* Given a cbfs_handle and an attribute tag, return a mapping for the first
  * instance of the attribute or NULL if none found. */
 void *cbfs_get_attr(struct cbfs_handle *handle, uint32_t tag);
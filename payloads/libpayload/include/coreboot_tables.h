@@ -293,6 +293,19 @@ struct cb_boot_media_params {
 	uint64_t boot_media_size;
 };
 
+struct cb_cbmem_entry {
+	uint32_t tag;
+	uint32_t size;
+
+	uint64_t address;
+	uint32_t entry_size;
+	uint32_t id;
+};
+
+/* CBMEM IDs of the CBFS metadata caches left behind by coreboot, see cbfs_core.c. */
+#define CBMEM_ID_CBFS_RO_MCACHE	0x524d5346
+#define CBMEM_ID_CBFS_RW_MCACHE	0x574d5346
+
 struct cb_tsc_info {
 	uint32_t tag;
 	uint32_t size;
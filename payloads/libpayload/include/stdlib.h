@@ -144,6 +144,19 @@ void init_dma_memory(void *start, u32 size);
 int dma_initialized(void);
 int dma_coherent(void *ptr);
 
+/*
+ * Slab caches for fixed-size objects, e.g. driver descriptors. Objects are
+ * aligned to align, which must be a power of two (0 for pointer alignment).
+ * dma_slab_create() takes its slabs from the DMA-coherent pool.
+ */
+struct slab_cache;
+struct slab_cache *slab_create(size_t size, size_t align);
+struct slab_cache *dma_slab_create(size_t size, size_t align);
+void *slab_alloc(struct slab_cache *cache);
+void slab_free(struct slab_cache *cache, void *ptr);
+/* Frees the cache and all of its slabs, including objects still in use. */
+void slab_destroy(struct slab_cache *cache);
+
 static inline void *xmalloc_work(size_t size, const char *file,
 				 const char *func, int line)
 {
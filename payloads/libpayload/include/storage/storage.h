@@ -70,5 +70,7 @@ int storage_attach_device(storage_dev_t *dev);
 
 storage_poll_t storage_probe(size_t dev_num);
 ssize_t storage_read_blocks512(size_t dev_num, lba_t start, size_t count, unsigned char *buf);
+ssize_t storage_write_blocks512(size_t dev_num, lba_t start, size_t count,
+				const unsigned char *buf);
 
 #endif
@@ -145,6 +145,12 @@ struct sysinfo_t {
 	/* Pointer to FMAP cache in CBMEM */
 	uintptr_t fmap_cache;
 
+	/* Pointers to the CBFS metadata caches in CBMEM */
+	uintptr_t cbfs_ro_mcache_offset;
+	uint32_t cbfs_ro_mcache_size;
+	uintptr_t cbfs_rw_mcache_offset;
+	uint32_t cbfs_rw_mcache_size;
+
 #if CONFIG(LP_PCI)
 	struct pci_access pacc;
 #endif
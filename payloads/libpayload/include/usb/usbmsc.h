@@ -30,7 +30,8 @@
 #define __USBMSC_H
 typedef struct {
 	unsigned int blocksize;
-	unsigned int numblocks;
+	u64 numblocks;
+	unsigned int max_chunk_bytes;
 	endpoint_t *bulk_in;
 	endpoint_t *bulk_out;
 	u8 quirks		: 7;
@@ -63,8 +64,8 @@ enum {
 typedef enum { cbw_direction_data_in = 0x80, cbw_direction_data_out = 0
 } cbw_direction;
 
-int readwrite_blocks_512 (usbdev_t *dev, int start, int n, cbw_direction dir, u8 *buf);
-int readwrite_blocks (usbdev_t *dev, int start, int n, cbw_direction dir, u8 *buf);
+int readwrite_blocks_512 (usbdev_t *dev, u64 start, int n, cbw_direction dir, u8 *buf);
+int readwrite_blocks (usbdev_t *dev, u64 start, int n, cbw_direction dir, u8 *buf);
 
 /* Force a device to enumerate as MSC, without checking class/protocol types.
    It must still have a bulk endpoint pair and respond to MSC commands. */
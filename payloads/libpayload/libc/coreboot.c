@@ -236,6 +236,22 @@ static void cb_parse_boot_media_params(unsigned char *ptr,
 	info->boot_media_size = bmp->boot_media_size;
 }
 
+static void cb_parse_cbmem_entry(void *ptr, struct sysinfo_t *info)
+{
+	const struct cb_cbmem_entry *cbmem_entry = ptr;
+
+	switch (cbmem_entry->id) {
+	case CBMEM_ID_CBFS_RO_MCACHE:
+		info->cbfs_ro_mcache_offset = cbmem_entry->address;
+		info->cbfs_ro_mcache_size = cbmem_entry->entry_size;
+		break;
+	case CBMEM_ID_CBFS_RW_MCACHE:
+		info->cbfs_rw_mcache_offset = cbmem_entry->address;
+		info->cbfs_rw_mcache_size = cbmem_entry->entry_size;
+		break;
+	}
+}
+
 static void cb_parse_vpd(void *ptr, struct sysinfo_t *info)
 {
 	info->chromeos_vpd = get_cbmem_addr(ptr);
@@ -409,6 +425,9 @@ int cb_parse_header(void *addr, int len, struct sysinfo_t *info)
 		case CB_TAG_BOOT_MEDIA_PARAMS:
 			cb_parse_boot_media_params(ptr, info);
 			break;
+		case CB_TAG_CBMEM_ENTRY:
+			cb_parse_cbmem_entry(ptr, info);
+			break;
 #if CONFIG(LP_TIMER_RDTSC)
 		case CB_TAG_TSC_INFO:
 			cb_parse_tsc_info(ptr, info);
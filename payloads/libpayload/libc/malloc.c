@@ -28,27 +28,59 @@
  */
 
 /*
- * This is a classically weak malloc() implementation. We have a relatively
- * small and static heap, so we take the easy route with an O(N) loop
- * through the tree for every malloc() and free(). Obviously, this doesn't
- * scale past a few hundred KB (if that).
+ * Size-segregated best-fit allocator. The heap and, if the payload set one up,
+ * the DMA-coherent pool are each a contiguous sequence of blocks that start
+ * with a struct heap_block header, terminated by a zero-sized, always used
+ * sentinel block. Free blocks are kept on one list per size class: exact
+ * classes in HEAP_ALIGN steps for small blocks and power-of-two classes above
+ * that. A bitmap records which classes are non-empty, so malloc() finds a
+ * block without walking the heap, and free() coalesces a block with both of
+ * its neighbours in constant time: every header records whether the block
+ * before it is free, and if so, that block's size.
  *
- * We're also susceptible to the usual buffer overrun poisoning, though the
- * risk is within acceptable ranges for this implementation (don't overrun
- * your buffers, kids!).
+ * Fixed-size driver objects can come from slab caches instead, see
+ * slab_create().
  */
 
 #define IN_MALLOC_C
 #include <libpayload.h>
 #include <stdint.h>
 
+#define BLOCK_USED		(1 << 0)
+#define BLOCK_PREV_FREE		(1 << 1)
+#define BLOCK_FLAGS		(BLOCK_USED | BLOCK_PREV_FREE)
+
+#define HEAP_ALIGN		sizeof(u64)
+
+struct heap_block {
+	size_t prev_size;	/* Only valid if BLOCK_PREV_FREE is set. */
+	size_t size;		/* Including this header, ORed with BLOCK_* flags. */
+	/* The payload starts here. Free blocks keep their list pointers in it. */
+	struct heap_block *next_free;
+	struct heap_block *prev_free;
+};
+
+#define BLOCK_HEADER_SIZE	offsetof(struct heap_block, next_free)
+#define MIN_BLOCK_SIZE		ALIGN_UP(sizeof(struct heap_block), HEAP_ALIGN)
+
+/* Blocks smaller than this have one class per size, larger ones per power of two. */
+#define SMALL_BLOCK_LIMIT	256
+#define NUM_SMALL_BINS		(SMALL_BLOCK_LIMIT / HEAP_ALIGN)
+#define NUM_BINS		64
+
 struct memory_type {
 	void *start;
 	void *end;
-	struct align_region_t* align_regions;
+	struct heap_block *first;
+	struct heap_block *sentinel;	/* NULL until the first allocation */
+	struct heap_block *bins[NUM_BINS];
+	u64 bin_bitmap;
 #if CONFIG(LP_DEBUG_MALLOC)
-	int magic_initialized;
-	size_t minimal_free;
+	size_t live;		/* Number of live allocations */
+	size_t used;		/* Bytes in used blocks, including headers */
+	size_t peak;		/* Highest value of used */
+	unsigned long allocs;
+	unsigned long frees;
 	const char *name;
 #endif
 };
@@ -56,33 +88,14 @@ struct memory_type {
 extern char _heap, _eheap;	/* Defined in the ldscript. */
 
 static struct memory_type default_type =
-	{ (void *)&_heap, (void *)&_eheap, NULL
+	{ .start = (void *)&_heap, .end = (void *)&_eheap
 #if CONFIG(LP_DEBUG_MALLOC)
-	, 0, 0, "HEAP"
+	, .name = "HEAP"
 #endif
 	};
 static struct memory_type *const heap = &default_type;
 static struct memory_type *dma = &default_type;
 
-typedef u64 hdrtype_t;
-#define HDRSIZE (sizeof(hdrtype_t))
-
-#define SIZE_BITS ((HDRSIZE << 3) - 7)
-#define MAGIC     (((hdrtype_t)0x2a) << (SIZE_BITS + 1))
-#define FLAG_FREE (((hdrtype_t)0x01) << (SIZE_BITS + 0))
-#define MAX_SIZE  ((((hdrtype_t)0x01) << SIZE_BITS) - 1)
-
-#define SIZE(_h) ((_h) & MAX_SIZE)
-
-#define _HEADER(_s, _f) ((hdrtype_t) (MAGIC | (_f) | ((_s) & MAX_SIZE)))
-
-#define FREE_BLOCK(_s) _HEADER(_s, FLAG_FREE)
-#define USED_BLOCK(_s) _HEADER(_s, 0)
-
-#define IS_FREE(_h) (((_h) & (MAGIC | FLAG_FREE)) == (MAGIC | FLAG_FREE))
-#define HAS_MAGIC(_h) (((_h) & MAGIC) == MAGIC)
-
-static int free_aligned(void* addr, struct memory_type *type);
 void print_malloc_map(void);
 
 void init_dma_memory(void *start, u32 size)
@@ -93,19 +106,15 @@ void init_dma_memory(void *start, u32 size)
 	}
 
 	/*
-	 * DMA memory might not be zeroed by coreboot on stage loading, so make
-	 * sure we clear the magic cookie from last boot.
+	 * DMA memory might not be zeroed by coreboot on stage loading. Its
+	 * block headers are only set up on first use, so nothing left over
+	 * from the last boot is ever trusted.
 	 */
-	*(hdrtype_t *)start = 0;
-
-	dma = malloc(sizeof(*dma));
+	dma = calloc(1, sizeof(*dma));
 	dma->start = start;
 	dma->end = start + size;
-	dma->align_regions = NULL;
 
 #if CONFIG(LP_DEBUG_MALLOC)
-	dma->minimal_free = 0;
-	dma->magic_initialized = 0;
 	dma->name = "DMA";
 
 	printf("Initialized cache-coherent DMA memory at [%p:%p]\n", start, start + size);
@@ -123,171 +132,276 @@ int dma_coherent(void *ptr)
 	return !dma_initialized() || (dma->start <= ptr && dma->end > ptr);
 }
 
-/* Find free block of size >= len */
-static hdrtype_t volatile *find_free_block(int len, struct memory_type *type)
+static inline size_t block_size(const struct heap_block *b)
+{
+	return b->size & ~BLOCK_FLAGS;
+}
+
+static inline struct heap_block *next_block(const struct heap_block *b)
 {
-	hdrtype_t header;
-	hdrtype_t volatile *ptr = (hdrtype_t volatile *)type->start;
+	return (void *)b + block_size(b);
+}
 
-	/* Align the size. */
-	len = ALIGN_UP(len, HDRSIZE);
+static inline void *block_payload(struct heap_block *b)
+{
+	return (void *)b + BLOCK_HEADER_SIZE;
+}
+
+static inline unsigned int bin_index(size_t size)
+{
+	if (size < SMALL_BLOCK_LIMIT)
+		return size / HEAP_ALIGN;
 
-	if (!len || len > MAX_SIZE)
-		return (void *)NULL;
+	const unsigned int idx = NUM_SMALL_BINS + __builtin_clzl(SMALL_BLOCK_LIMIT)
+		- __builtin_clzl(size);
+	return MIN(idx, NUM_BINS - 1);
+}
+
+static void insert_free(struct memory_type *type, struct heap_block *b)
+{
+	const unsigned int idx = bin_index(block_size(b));
+	struct heap_block *next = next_block(b);
+
+	b->prev_free = NULL;
+	b->next_free = type->bins[idx];
+	if (b->next_free)
+		b->next_free->prev_free = b;
+	type->bins[idx] = b;
+	type->bin_bitmap |= 1ULL << idx;
+
+	next->prev_size = block_size(b);
+	next->size |= BLOCK_PREV_FREE;
+}
+
+static void remove_free(struct memory_type *type, struct heap_block *b)
+{
+	const unsigned int idx = bin_index(block_size(b));
+
+	if (b->prev_free)
+		b->prev_free->next_free = b->next_free;
+	else
+		type->bins[idx] = b->next_free;
+	if (b->next_free)
+		b->next_free->prev_free = b->prev_free;
+
+	if (!type->bins[idx])
+		type->bin_bitmap &= ~(1ULL << idx);
+}
+
+/* Find the best fitting free block of at least |size| bytes without walking the heap. */
+static struct heap_block *find_free(struct memory_type *type, size_t size)
+{
+	const unsigned int idx = bin_index(size);
+	struct heap_block *b, *best = NULL;
+	u64 mask;
+
+	if (idx < NUM_SMALL_BINS) {
+		/* Every block in a small class has the same size. */
+		if (type->bins[idx])
+			return type->bins[idx];
+	} else {
+		for (b = type->bins[idx]; b; b = b->next_free) {
+			if (block_size(b) < size)
+				continue;
+			if (!best || block_size(b) < block_size(best))
+				best = b;
+			if (block_size(b) == size)
+				break;
+		}
+		if (best)
+			return best;
+	}
+
+	/* Every block in a larger class is large enough, use the smallest class. */
+	if (idx + 1 >= NUM_BINS)
+		return NULL;
+	mask = type->bin_bitmap & (~0ULL << (idx + 1));
+	if (!mask)
+		return NULL;
+
+	return type->bins[__builtin_ctzll(mask)];
+}
 
-	/* Make sure the region is setup correctly. */
-	if (!HAS_MAGIC(*ptr)) {
-		size_t size = (type->end - type->start) - HDRSIZE;
-		*ptr = FREE_BLOCK(size);
+static void account(struct memory_type *type, struct heap_block *b, int live)
+{
 #if CONFIG(LP_DEBUG_MALLOC)
-		type->magic_initialized = 1;
-		type->minimal_free = size;
-#endif
+	if (live > 0) {
+		type->live++;
+		type->allocs++;
+		type->used += block_size(b);
+		if (type->used > type->peak)
+			type->peak = type->used;
+	} else if (live < 0) {
+		type->live--;
+		type->frees++;
+		type->used -= block_size(b);
 	}
+#endif
+}
 
-	/* Find some free space. */
-	do {
-		header = *ptr;
-		int size = SIZE(header);
+/* Coalesce the (used) block |b| with its free neighbours and put it on the free lists. */
+static void release_block(struct memory_type *type, struct heap_block *b)
+{
+	struct heap_block *next;
 
-		if (!HAS_MAGIC(header) || size == 0) {
-			printf("memory allocator panic. (%s%s)\n",
-			       !HAS_MAGIC(header) ? " no magic " : "",
-				   size == 0 ? " size=0 " : "");
-			halt();
-		}
+	b->size &= ~BLOCK_USED;
 
-		if ((header & FLAG_FREE) && len <= size)
-			return ptr;
+	next = next_block(b);
+	if (!(next->size & BLOCK_USED)) {
+		remove_free(type, next);
+		b->size += block_size(next);
+	}
 
-		ptr = (hdrtype_t volatile *)((uintptr_t)ptr + HDRSIZE + size);
+	if (b->size & BLOCK_PREV_FREE) {
+		struct heap_block *prev = (void *)b - b->prev_size;
 
-	} while (ptr < (hdrtype_t *) type->end);
+		remove_free(type, prev);
+		prev->size += block_size(b);
+		b = prev;
+	}
 
-	/* Nothing available. */
-	return NULL;
+	insert_free(type, b);
 }
 
-/* Mark the block with length 'len' as used */
-static void use_block(hdrtype_t volatile *ptr, int len)
+/* Return the tail of the used block |b| beyond |size| bytes to the free lists. */
+static void shrink_block(struct memory_type *type, struct heap_block *b, size_t size)
 {
-	/* Align the size. */
-	len = ALIGN_UP(len, HDRSIZE);
+	const size_t total = block_size(b);
+	struct heap_block *rest;
+
+	if (total - size < MIN_BLOCK_SIZE)
+		return;
 
-	hdrtype_t volatile *nptr = (hdrtype_t volatile *)
-		((uintptr_t)ptr + HDRSIZE + len);
-	int size = SIZE(*ptr);
-	int nsize = size - (HDRSIZE + len);
+	rest = (void *)b + size;
+	rest->size = (total - size) | BLOCK_USED;
+	b->size = size | (b->size & BLOCK_FLAGS);
+	release_block(type, rest);
+}
 
-	/*
-	 * If there is still room in this block, then mark it as such otherwise
-	 * account the whole space for that block.
-	 */
-	if (nsize > 0) {
-		/* Mark the block as used. */
-		*ptr = USED_BLOCK(len);
+/* Mark the (already unlisted) free block |b| used, returning any excess to the free lists. */
+static void take_block(struct memory_type *type, struct heap_block *b, size_t size)
+{
+	const size_t total = block_size(b);
 
-		/* Create a new free block. */
-		*nptr = FREE_BLOCK(nsize);
+	if (total - size >= MIN_BLOCK_SIZE) {
+		struct heap_block *rest = (void *)b + size;
+
+		rest->size = total - size;
+		b->size = size | (b->size & BLOCK_PREV_FREE);
+		insert_free(type, rest);
 	} else {
-		/* Mark the block as used. */
-		*ptr = USED_BLOCK(size);
+		next_block(b)->size &= ~BLOCK_PREV_FREE;
 	}
+
+	b->size |= BLOCK_USED;
+	account(type, b, 1);
 }
 
-static void *alloc(int len, struct memory_type *type)
+static void init_type(struct memory_type *type)
 {
-	hdrtype_t volatile *ptr = find_free_block(len, type);
+	uintptr_t start = ALIGN_UP((uintptr_t)type->start, HEAP_ALIGN);
+	uintptr_t end = ALIGN_DOWN((uintptr_t)type->end, HEAP_ALIGN) - BLOCK_HEADER_SIZE;
 
-	if (ptr == NULL)
-		return NULL;
+	if (end < start + MIN_BLOCK_SIZE) {
+		printf("memory allocator panic. (%p-%p too small)\n", type->start, type->end);
+		halt();
+	}
 
-	use_block(ptr, len);
-	return (void *)((uintptr_t)ptr + HDRSIZE);
+	type->first = (struct heap_block *)start;
+	type->sentinel = (struct heap_block *)end;
+	type->sentinel->size = BLOCK_USED;
+
+	type->first->size = end - start;
+	insert_free(type, type->first);
 }
 
-static void _consolidate(struct memory_type *type)
+static struct memory_type *type_of(void *ptr)
 {
-	void *ptr = type->start;
-
-	while (ptr < type->end) {
-		void *nptr;
-		hdrtype_t hdr = *((hdrtype_t *) ptr);
-		unsigned int size = 0;
+	if (ptr >= heap->start && ptr < heap->end)
+		return heap;
+	if (ptr >= dma->start && ptr < dma->end)
+		return dma;
+	return NULL;
+}
 
-		if (!IS_FREE(hdr)) {
-			ptr += HDRSIZE + SIZE(hdr);
-			continue;
-		}
+static void *alloc_aligned(size_t align, size_t size, struct memory_type *type)
+{
+	struct heap_block *b;
+	size_t block_sz;
 
-		size = SIZE(hdr);
-		nptr = ptr + HDRSIZE + SIZE(hdr);
+	if (!type->sentinel)
+		init_type(type);
 
-		while (nptr < type->end) {
-			hdrtype_t nhdr = *((hdrtype_t *) nptr);
+	if (align < HEAP_ALIGN)
+		align = HEAP_ALIGN;
 
-			if (!(IS_FREE(nhdr)))
-				break;
+	const size_t total = (void *)type->sentinel - (void *)type->first;
+	if (size == 0 || size >= total || align >= total)
+		return NULL;
 
-			size += SIZE(nhdr) + HDRSIZE;
+	block_sz = ALIGN_UP(MAX(size + BLOCK_HEADER_SIZE, MIN_BLOCK_SIZE), HEAP_ALIGN);
+	/* Leave room to split off a free block in front of the aligned payload. */
+	b = find_free(type, align > HEAP_ALIGN ? block_sz + align + MIN_BLOCK_SIZE : block_sz);
+	if (!b)
+		return NULL;
 
-			*((hdrtype_t *) nptr) = 0;
+	remove_free(type, b);
 
-			nptr += (HDRSIZE + SIZE(nhdr));
-		}
+	if (!IS_ALIGNED((uintptr_t)block_payload(b), align)) {
+		uintptr_t payload = ALIGN_UP((uintptr_t)block_payload(b) + MIN_BLOCK_SIZE,
+					     align);
+		struct heap_block *aligned = (void *)(payload - BLOCK_HEADER_SIZE);
+		const size_t front = (void *)aligned - (void *)b;
 
-		*((hdrtype_t *) ptr) = FREE_BLOCK(size);
-		ptr = nptr;
+		aligned->size = block_size(b) - front;
+		b->size = front | (b->size & BLOCK_PREV_FREE);
+		insert_free(type, b);
+		b = aligned;
 	}
+
+	take_block(type, b, block_sz);
+	return block_payload(b);
 }
 
 void free(void *ptr)
 {
-	hdrtype_t hdr;
-	struct memory_type *type = heap;
+	struct memory_type *type;
+	struct heap_block *b;
 
 	/* No action occurs on NULL. */
 	if (ptr == NULL)
 		return;
 
 	/* Sanity check. */
-	if (ptr < type->start || ptr >= type->end) {
-		type = dma;
-		if (ptr < type->start || ptr >= type->end)
-			return;
-	}
-
-	if (free_aligned(ptr, type)) return;
-
-	ptr -= HDRSIZE;
-	hdr = *((hdrtype_t *) ptr);
-
-	/* Not our header (we're probably poisoned). */
-	if (!HAS_MAGIC(hdr))
+	type = type_of(ptr);
+	if (!type || !type->sentinel || ptr < block_payload(type->first) ||
+	    ptr >= (void *)type->sentinel)
 		return;
 
+	b = ptr - BLOCK_HEADER_SIZE;
+
 	/* Double free. */
-	if (hdr & FLAG_FREE)
+	if (!(b->size & BLOCK_USED))
 		return;
 
-	*((hdrtype_t *) ptr) = FREE_BLOCK(SIZE(hdr));
-	_consolidate(type);
+	account(type, b, -1);
+	release_block(type, b);
 }
 
 void *malloc(size_t size)
 {
-	return alloc(size, heap);
+	return alloc_aligned(HEAP_ALIGN, size, heap);
 }
 
 void *dma_malloc(size_t size)
 {
-	return alloc(size, dma);
+	return alloc_aligned(HEAP_ALIGN, size, dma);
 }
 
 void *calloc(size_t nmemb, size_t size)
 {
 	size_t total = nmemb * size;
-	void *ptr = alloc(total, heap);
+	void *ptr = alloc_aligned(HEAP_ALIGN, total, heap);
 
 	if (ptr)
 		memset(ptr, 0, total);
@@ -297,272 +411,218 @@ void *calloc(size_t nmemb, size_t size)
 
 void *realloc(void *ptr, size_t size)
 {
-	void *ret, *pptr;
-	hdrtype_t volatile *block;
-	unsigned int osize;
-	struct memory_type *type = heap;
+	struct memory_type *type;
+	struct heap_block *b, *next;
+	size_t block_sz;
+	void *ret;
 
 	if (ptr == NULL)
-		return alloc(size, type);
+		return alloc_aligned(HEAP_ALIGN, size, heap);
 
-	pptr = ptr - HDRSIZE;
-
-	if (!HAS_MAGIC(*((hdrtype_t *) pptr)))
+	type = type_of(ptr);
+	if (!type || !type->sentinel)
+		return NULL;
+	b = ptr - BLOCK_HEADER_SIZE;
+	if (!(b->size & BLOCK_USED))
 		return NULL;
 
-	if (ptr < type->start || ptr >= type->end)
-		type = dma;
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
 
-	/* Get the original size of the block. */
-	osize = SIZE(*((hdrtype_t *) pptr));
+	block_sz = ALIGN_UP(MAX(size + BLOCK_HEADER_SIZE, MIN_BLOCK_SIZE), HEAP_ALIGN);
+
+	/* Grow into the next block if it is free and large enough. */
+	next = next_block(b);
+	if (block_sz > block_size(b) && !(next->size & BLOCK_USED) &&
+	    block_size(b) + block_size(next) >= block_sz) {
+		account(type, b, -1);
+		remove_free(type, next);
+		b->size += block_size(next);
+		next_block(b)->size &= ~BLOCK_PREV_FREE;
+		account(type, b, 1);
+	}
 
-	/*
-	 * Free the memory to update the tables - this won't touch the actual
-	 * memory, so we can still use it for the copy after we have
-	 * reallocated the new space.
-	 */
-	free(ptr);
+	if (block_sz <= block_size(b)) {
+		account(type, b, -1);
+		shrink_block(type, b, block_sz);
+		account(type, b, 1);
+		return ptr;
+	}
 
-	block = find_free_block(size, type);
-	if (block == NULL)
+	ret = alloc_aligned(HEAP_ALIGN, size, type);
+	if (ret == NULL)
 		return NULL;
 
-	ret = (void *)((uintptr_t)block + HDRSIZE);
-
-	/*
-	 * If ret == ptr, then no copy is needed. Otherwise, move the memory to
-	 * the new location, which might be before the old one and overlap since
-	 * the free() above includes a _consolidate().
-	 */
-	if (ret != ptr)
-		memmove(ret, ptr, osize > size ? size : osize);
-
-	/* Mark the block as used. */
-	use_block(block, size);
+	memcpy(ret, ptr, block_size(b) - BLOCK_HEADER_SIZE);
+	free(ptr);
 
 	return ret;
 }
 
-struct align_region_t
-{
-	/* If alignment is 0 then the region represents a large region which
-	 * has no metadata for tracking subelements. */
-	int alignment;
-	/* start in memory, and size in bytes */
-	void* start;
-	int size;
-	/* layout within a region:
-	  - num_elements bytes, 0: free, 1: used, 2: used, combines with next
-	  - padding to alignment
-	  - data section
-	  - waste space
-
-	  start_data points to the start of the data section
-	*/
-	void* start_data;
-	/* number of free blocks sized "alignment" */
-	int free;
-	struct align_region_t *next;
-};
-
-static inline int region_is_large(const struct align_region_t *r)
+void *memalign(size_t align, size_t size)
 {
-	return r->alignment == 0;
+	return alloc_aligned(align, size, heap);
 }
 
-static inline int addr_in_region(const struct align_region_t *r, void *addr)
+void *dma_memalign(size_t align, size_t size)
 {
-	return ((addr >= r->start_data) && (addr < r->start_data + r->size));
+	return alloc_aligned(align, size, dma);
 }
 
-/* num_elements == 0 indicates a large aligned region instead of a smaller
- * region comprised of alignment-sized chunks. */
-static struct align_region_t *allocate_region(int alignment, int num_elements,
-					size_t size, struct memory_type *type)
-{
-	struct align_region_t *r;
-	size_t extra_space;
+/*
+ * Slab caches hand out objects of a single size from naturally aligned slabs,
+ * so that neither allocating nor freeing an object ever searches for a block.
+ * A slab starts with a struct slab, followed by its objects. Free objects
+ * form a list through their first word.
+ */
 
-#if CONFIG(LP_DEBUG_MALLOC)
-	printf("%s(old align_regions=%p, alignment=%u, num_elements=%u, size=%zu)\n",
-		__func__, type->align_regions, alignment, num_elements, size);
-#endif
+#define SLAB_MIN_SIZE		4096
+#define SLAB_MIN_OBJECTS	8
 
-	r = malloc(sizeof(*r));
+struct slab {
+	struct slab *next;
+	struct slab *prev;
+	void *free_list;
+	unsigned int inuse;
+};
 
-	if (r == NULL)
-		return NULL;
+struct slab_cache {
+	struct memory_type *type;
+	size_t obj_size;
+	size_t first_obj;	/* Offset of the first object in a slab */
+	size_t slab_size;
+	unsigned int per_slab;
+	struct slab *partial;	/* Slabs with free objects */
+	struct slab *full;
+};
 
-	memset(r, 0, sizeof(*r));
+static void slab_unlink(struct slab **list, struct slab *s)
+{
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		*list = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+}
 
-	if (num_elements != 0) {
-		r->alignment = alignment;
-		r->size = num_elements * alignment;
-		r->free = num_elements;
-		/* Allocate enough memory for alignment requirements and
-		 * metadata for each chunk. */
-		extra_space = num_elements;
-	} else {
-		/* Large aligned allocation. Set alignment = 0. */
-		r->alignment = 0;
-		r->size = size;
-		extra_space = 0;
-	}
+static void slab_push(struct slab **list, struct slab *s)
+{
+	s->prev = NULL;
+	s->next = *list;
+	if (s->next)
+		s->next->prev = s;
+	*list = s;
+}
 
-	r->start = alloc(r->size + alignment + extra_space, type);
+static struct slab_cache *create_slab_cache(size_t size, size_t align,
+					    struct memory_type *type)
+{
+	struct slab_cache *cache;
 
-	if (r->start == NULL) {
-		free(r);
+	if (size == 0)
 		return NULL;
-	}
 
-	r->start_data = (void *)ALIGN_UP((uintptr_t)r->start + extra_space,
-					alignment);
+	align = MAX(align, sizeof(void *));
+	if (align & (align - 1))
+		return NULL;
 
-	/* Clear any (if requested) metadata. */
-	memset(r->start, 0, extra_space);
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
 
-	/* Link the region with the rest. */
-	r->next = type->align_regions;
-	type->align_regions = r;
+	cache->type = type;
+	cache->obj_size = ALIGN_UP(MAX(size, sizeof(void *)), align);
+	cache->first_obj = ALIGN_UP(sizeof(struct slab), align);
+	cache->slab_size = SLAB_MIN_SIZE;
+	while (cache->slab_size < cache->first_obj + SLAB_MIN_OBJECTS * cache->obj_size)
+		cache->slab_size <<= 1;
+	cache->per_slab = (cache->slab_size - cache->first_obj) / cache->obj_size;
 
-	return r;
+	return cache;
 }
 
-static void try_free_region(struct align_region_t **prev_link)
+struct slab_cache *slab_create(size_t size, size_t align)
 {
-	struct align_region_t *r = *prev_link;
-
-	/* All large regions are immediately free-able. Non-large regions
-	 * need to be checked for the fully freed state. */
-	if (!region_is_large(r)) {
-		if (r->free != r->size / r->alignment)
-			return;
-	}
-
-	/* Unlink region from link list. */
-	*prev_link = r->next;
+	return create_slab_cache(size, align, heap);
+}
 
-	/* Free the data and metadata. */
-	free(r->start);
-	free(r);
+struct slab_cache *dma_slab_create(size_t size, size_t align)
+{
+	return create_slab_cache(size, align, dma);
 }
 
-static int free_aligned(void* addr, struct memory_type *type)
+void *slab_alloc(struct slab_cache *cache)
 {
-	struct align_region_t **prev_link = &type->align_regions;
+	struct slab *s = cache->partial;
+	void *obj;
 
-	while (*prev_link != NULL)
-	{
-		if (!addr_in_region(*prev_link, addr)) {
-			prev_link = &((*prev_link)->next);
-			continue;
-		}
+	if (!s) {
+		s = alloc_aligned(cache->slab_size, cache->slab_size, cache->type);
+		if (!s)
+			return NULL;
 
-		if (region_is_large(*prev_link)) {
-			try_free_region(prev_link);
-			return 1;
+		s->free_list = NULL;
+		s->inuse = 0;
+		for (unsigned int i = cache->per_slab; i > 0; i--) {
+			obj = (void *)s + cache->first_obj + (i - 1) * cache->obj_size;
+			*(void **)obj = s->free_list;
+			s->free_list = obj;
 		}
+		slab_push(&cache->partial, s);
+	}
 
-		int i = (addr-(*prev_link)->start_data)/(*prev_link)->alignment;
-		u8 *meta = (*prev_link)->start;
-		while (meta[i] == 2)
-		{
-			meta[i++] = 0;
-			(*prev_link)->free++;
-		}
-		meta[i] = 0;
-		(*prev_link)->free++;
-		try_free_region(prev_link);
-		return 1;
+	obj = s->free_list;
+	s->free_list = *(void **)obj;
+	if (++s->inuse == cache->per_slab) {
+		slab_unlink(&cache->partial, s);
+		slab_push(&cache->full, s);
 	}
-	return 0;
+
+	return obj;
 }
 
-static void *alloc_aligned(size_t align, size_t size, struct memory_type *type)
+void slab_free(struct slab_cache *cache, void *ptr)
 {
-	/* Define a large request to be 1024 bytes for either alignment or
-	 * size of allocation. */
-	const size_t large_request = 1024;
+	struct slab *s;
 
-	if (size == 0) return 0;
-	if (type->align_regions == 0) {
-		type->align_regions = malloc(sizeof(struct align_region_t));
-		if (type->align_regions == NULL)
-			return NULL;
-		memset(type->align_regions, 0, sizeof(struct align_region_t));
-	}
-	struct align_region_t *reg = type->align_regions;
+	if (ptr == NULL)
+		return;
 
-	if (size >= large_request || align >= large_request) {
-		reg = allocate_region(align, 0, size, type);
-		if (reg == NULL)
-			return NULL;
-		return reg->start_data;
+	s = (void *)ALIGN_DOWN((uintptr_t)ptr, cache->slab_size);
+	if (s->inuse == cache->per_slab) {
+		slab_unlink(&cache->full, s);
+		slab_push(&cache->partial, s);
 	}
 
-look_further:
-	while (reg != 0)
-	{
-		if ((reg->alignment == align) && (reg->free >= (size + align - 1)/align))
-		{
-#if CONFIG(LP_DEBUG_MALLOC)
-			printf("  found memalign region. %u free, %zu required\n", reg->free, (size + align - 1)/align);
-#endif
-			break;
-		}
-		reg = reg->next;
-	}
-	if (reg == 0)
-	{
-#if CONFIG(LP_DEBUG_MALLOC)
-		printf("  need to allocate a new memalign region\n");
-#endif
-		/* get align regions */
-		reg = allocate_region(align, large_request/align, size, type);
-#if CONFIG(LP_DEBUG_MALLOC)
-		printf("  ... returned %p\n", reg);
-#endif
-	}
-	if (reg == 0) {
-		/* Nothing available. */
-		return (void *)NULL;
-	}
+	*(void **)ptr = s->free_list;
+	s->free_list = ptr;
 
-	int i, count = 0, target = (size+align-1)/align;
-	for (i = 0; i < (reg->size/align); i++)
-	{
-		if (((u8*)reg->start)[i] == 0)
-		{
-			count++;
-			if (count == target) {
-				count = i+1-count;
-				for (i=0; i<target-1; i++)
-				{
-					((u8*)reg->start)[count+i]=2;
-				}
-				((u8*)reg->start)[count+target-1]=1;
-				reg->free -= target;
-				return reg->start_data+(align*count);
-			}
-		} else {
-			count = 0;
-		}
+	/* Keep the last partial slab around for the next allocation. */
+	if (--s->inuse == 0 && (s->prev || s->next)) {
+		slab_unlink(&cache->partial, s);
+		free(s);
 	}
-	/* The free space in this region is fragmented,
-	   so we will move on and try the next one: */
-	reg = reg->next;
-	goto look_further; // end condition is once a new region is allocated - it always has enough space
 }
 
-void *memalign(size_t align, size_t size)
+void slab_destroy(struct slab_cache *cache)
 {
-	return alloc_aligned(align, size, heap);
-}
+	struct slab *s;
 
-void *dma_memalign(size_t align, size_t size)
-{
-	return alloc_aligned(align, size, dma);
+	if (cache == NULL)
+		return;
+
+	while ((s = cache->partial)) {
+		cache->partial = s->next;
+		free(s);
+	}
+	while ((s = cache->full)) {
+		cache->full = s->next;
+		free(s);
+	}
+	free(cache);
 }
 
 /* This is for debugging purposes. */
@@ -570,41 +630,45 @@ void *dma_memalign(size_t align, size_t size)
 void print_malloc_map(void)
 {
 	struct memory_type *type = heap;
-	void *ptr;
-	int free_memory;
+	struct heap_block *b;
+	size_t free_memory, largest_free;
+	unsigned int free_blocks;
 
 again:
-	ptr = type->start;
-	free_memory = 0;
+	free_memory = largest_free = 0;
+	free_blocks = 0;
 
-	while (ptr < type->end) {
-		hdrtype_t hdr = *((hdrtype_t *) ptr);
+	if (!type->sentinel) {
+		printf("%s: No allocations yet\n", type->name);
+		goto next;
+	}
 
-		if (!HAS_MAGIC(hdr)) {
-			if (type->magic_initialized)
-				printf("%s: Poisoned magic - we're toast\n", type->name);
-			else
-				printf("%s: No magic yet - going to initialize\n", type->name);
+	for (b = type->first; b != type->sentinel; b = next_block(b)) {
+		if (block_size(b) < MIN_BLOCK_SIZE || next_block(b) > type->sentinel) {
+			printf("%s: Poisoned block header at %p - we're toast\n",
+			       type->name, b);
 			break;
 		}
 
-		/* FIXME: Verify the size of the block. */
-
-		printf("%s %x: %s (%llx bytes)\n", type->name,
-		       (unsigned int)(ptr - type->start),
-		       hdr & FLAG_FREE ? "FREE" : "USED", SIZE(hdr));
+		printf("%s %x: %s (%zx bytes)\n", type->name,
+		       (unsigned int)((void *)b - type->start),
+		       b->size & BLOCK_USED ? "USED" : "FREE",
+		       block_size(b) - BLOCK_HEADER_SIZE);
 
-		if (hdr & FLAG_FREE)
-			free_memory += SIZE(hdr);
-
-		ptr += HDRSIZE + SIZE(hdr);
+		if (!(b->size & BLOCK_USED)) {
+			free_memory += block_size(b);
+			largest_free = MAX(largest_free, block_size(b));
+			free_blocks++;
+		}
 	}
 
-	if (free_memory && (type->minimal_free > free_memory))
-		type->minimal_free = free_memory;
-	printf("%s: Maximum memory consumption: %zu bytes\n", type->name,
-		(type->end - type->start) - HDRSIZE - type->minimal_free);
+	printf("%s: %zu live allocations (%lu allocated, %lu freed), %zu bytes used\n",
+	       type->name, type->live, type->allocs, type->frees, type->used);
+	printf("%s: %zu bytes free in %u blocks, largest %zu bytes\n", type->name,
+	       free_memory, free_blocks, largest_free);
+	printf("%s: Maximum memory consumption: %zu bytes\n", type->name, type->peak);
 
+next:
 	if (type != dma) {
 		type = dma;
 		goto again;
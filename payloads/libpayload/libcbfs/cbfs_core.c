@@ -135,38 +135,18 @@ static int get_cbfs_range(uint32_t *offset, uint32_t *cbfs_end,
 	return 0;
 }
 
-/* public API starts here*/
-struct cbfs_handle *cbfs_get_handle(struct cbfs_media *media, const char *name)
+/* Calls walker() for every file in [offset, cbfs_end) of the opened media until it returns
+   non-zero. Returns the walker's result, or 0 after the last file. */
+static int cbfs_walk(struct cbfs_media *media, uint32_t offset, uint32_t cbfs_end,
+		     int (*walker)(const struct cbfs_file *file, const char *filename,
+				   uint32_t offset, void *arg),
+		     void *arg)
 {
 	const char *vardata;
-	uint32_t offset, cbfs_end, vardata_len;
+	uint32_t vardata_len;
 	struct cbfs_file file;
-	struct cbfs_handle *handle = malloc(sizeof(*handle));
-
-	if (!handle)
-		return NULL;
-
-	if (get_cbfs_range(&offset, &cbfs_end, media)) {
-		ERROR("Failed to find cbfs range\n");
-		free(handle);
-		return NULL;
-	}
-
-	if (media == CBFS_DEFAULT_MEDIA) {
-		media = &handle->media;
-		if (init_default_cbfs_media(media) != 0) {
-			ERROR("Failed to initialize default media.\n");
-			free(handle);
-			return NULL;
-		}
-	} else {
-		memcpy(&handle->media, media, sizeof(*media));
-	}
-
-	DEBUG("CBFS location: 0x%x~0x%x\n", offset, cbfs_end);
-	DEBUG("Looking for '%s' starting from 0x%x.\n", name, offset);
+	int ret;
 
-	media->open(media);
 	while (offset < cbfs_end &&
 	       media->read(media, &file, offset, sizeof(file)) == sizeof(file)) {
 		if (memcmp(CBFS_FILE_MAGIC, file.magic,
@@ -190,24 +170,11 @@ struct cbfs_handle *cbfs_get_handle(struct cbfs_media *media, const char *name)
 				media, offset + sizeof(file), vardata_len);
 		if (vardata == CBFS_MEDIA_INVALID_MAP_ADDRESS) {
 			ERROR("ERROR: Failed to get filename: 0x%x.\n", offset);
-		} else if (strcmp(vardata, name) == 0) {
-			int file_offset = ntohl(file.offset),
-			    file_len = ntohl(file.len);
-			DEBUG("Found file (offset=0x%x, len=%d).\n",
-			    offset + file_offset, file_len);
-			media->unmap(media, vardata);
-			media->close(media);
-			handle->type = ntohl(file.type);
-			handle->media_offset = offset;
-			handle->content_offset = file_offset;
-			handle->content_size = file_len;
-			handle->attribute_offset =
-				ntohl(file.attributes_offset);
-			return handle;
 		} else {
-			DEBUG(" (unmatched file @0x%x: %s)\n", offset,
-			      vardata);
+			ret = walker(&file, vardata, offset, arg);
 			media->unmap(media, vardata);
+			if (ret)
+				return ret;
 		}
 
 		// Move to next file.
@@ -221,7 +188,353 @@ struct cbfs_handle *cbfs_get_handle(struct cbfs_media *media, const char *name)
 		}
 		offset = next_offset;
 	}
+	return 0;
+}
+
+static void cbfs_fill_handle(struct cbfs_handle *handle, const struct cbfs_file *file,
+			     uint32_t offset)
+{
+	handle->type = ntohl(file->type);
+	handle->media_offset = offset;
+	handle->content_offset = ntohl(file->offset);
+	handle->content_size = ntohl(file->len);
+	handle->attribute_offset = ntohl(file->attributes_offset);
+}
+
+struct cbfs_find_arg {
+	const char *name;
+	struct cbfs_handle *handle;
+};
+
+static int cbfs_find_walker(const struct cbfs_file *file, const char *filename,
+			    uint32_t offset, void *arg)
+{
+	struct cbfs_find_arg *find = arg;
+
+	if (strcmp(filename, find->name) != 0) {
+		DEBUG(" (unmatched file @0x%x: %s)\n", offset, filename);
+		return 0;
+	}
+	DEBUG("Found file (offset=0x%x, len=%d).\n",
+	      offset + ntohl(file->offset), ntohl(file->len));
+	cbfs_fill_handle(find->handle, file, offset);
+	return 1;
+}
+
+#if CONFIG(LP_CBFS_INDEX)
+/*
+ * Index of the default CBFS. It is filled from the metadata cache coreboot leaves in CBMEM
+ * (see commonlib/bsd/cbfs_mcache.c), and the boot media is only walked for the files the
+ * mcache doesn't cover -- all of them if there is no mcache, or those following the last
+ * cached one if it ran full. That walk happens at most once, on the first lookup that misses.
+ */
+
+/* mcache format, see commonlib/bsd/cbfs_mcache.c */
+#define MCACHE_MAGIC_FILE	0x454c4946	/* 'FILE' */
+#define MCACHE_MAGIC_FULL	0x4c4c5546	/* 'FULL' */
+#define MCACHE_MAGIC_END	0x444e4524	/* '$END' */
+#define MCACHE_ALIGNMENT	sizeof(uint32_t)
+
+struct cbfs_index_entry {
+	uint32_t hash;
+	uint32_t media_offset;
+	uint32_t type;
+	uint32_t attribute_offset;
+	uint32_t content_offset;
+	uint32_t content_size;
+	const char *name;	/* in the mcache, or a copy on the heap */
+	int name_allocated;
+};
+
+static struct {
+	enum {
+		CBFS_INDEX_UNINITIALIZED = 0,
+		CBFS_INDEX_READY,
+		CBFS_INDEX_DISABLED,	/* out of heap, walk the media for every lookup */
+	} state;
+	uint32_t cbfs_offset;
+	uint32_t cbfs_end;
+	/* Files from here to cbfs_end aren't indexed yet. */
+	uint32_t walk_offset;
+	uint32_t count;
+	uint32_t slots;		/* power of two */
+	struct cbfs_index_entry *table;
+} cbfs_index;
+
+/* 32-bit FNV-1a, the same hash the mcache index uses. */
+static uint32_t cbfs_hash_name(const char *name)
+{
+	uint32_t hash = 0x811c9dc5;
+
+	do {
+		hash ^= (uint8_t)*name;
+		hash *= 0x01000193;
+	} while (*name++);
+
+	return hash;
+}
+
+static struct cbfs_index_entry *cbfs_index_slot(struct cbfs_index_entry *table,
+						uint32_t slots, uint32_t hash,
+						const char *name)
+{
+	uint32_t i = hash & (slots - 1);
+
+	while (table[i].name &&
+	       (table[i].hash != hash || strcmp(table[i].name, name) != 0))
+		i = (i + 1) & (slots - 1);
+
+	return &table[i];
+}
+
+static int cbfs_index_grow(void)
+{
+	const uint32_t slots = cbfs_index.slots ? cbfs_index.slots * 2 : 64;
+	struct cbfs_index_entry *table = calloc(slots, sizeof(*table));
+
+	if (!table)
+		return -1;
+
+	for (uint32_t i = 0; i < cbfs_index.slots; i++) {
+		const struct cbfs_index_entry *entry = &cbfs_index.table[i];
+
+		if (entry->name)
+			*cbfs_index_slot(table, slots, entry->hash, entry->name) = *entry;
+	}
+
+	free(cbfs_index.table);
+	cbfs_index.table = table;
+	cbfs_index.slots = slots;
+	return 0;
+}
+
+/* Like a walk of the media, the first of several files with the same name wins. */
+static int cbfs_index_add(const struct cbfs_file *file, const char *filename,
+			  uint32_t offset, int copy_name)
+{
+	const uint32_t hash = cbfs_hash_name(filename);
+	struct cbfs_index_entry *entry;
+
+	/* Keep the table at most 2/3 full so probe sequences stay short. */
+	if ((cbfs_index.count + 1) * 3 > cbfs_index.slots * 2 && cbfs_index_grow())
+		return -1;
+
+	entry = cbfs_index_slot(cbfs_index.table, cbfs_index.slots, hash, filename);
+	if (entry->name)
+		return 0;
+
+	if (copy_name) {
+		entry->name = strdup(filename);
+		if (!entry->name)
+			return -1;
+	} else {
+		entry->name = filename;
+	}
+	entry->name_allocated = copy_name;
+	entry->hash = hash;
+	entry->media_offset = offset;
+	entry->type = ntohl(file->type);
+	entry->attribute_offset = ntohl(file->attributes_offset);
+	entry->content_offset = ntohl(file->offset);
+	entry->content_size = ntohl(file->len);
+	cbfs_index.count++;
+	return 0;
+}
+
+static int cbfs_index_walker(const struct cbfs_file *file, const char *filename,
+			     uint32_t offset, void *arg)
+{
+	return cbfs_index_add(file, filename, offset, 1);
+}
+
+/* Indexes the files in the mcache, and returns where the walk of the media has to resume, or
+   0 when out of heap. */
+static uint32_t cbfs_index_add_mcache(const void *mcache, size_t mcache_size)
+{
+	const void *current = mcache;
+	const void *end = mcache + ALIGN_DOWN(mcache_size, MCACHE_ALIGNMENT);
+	uint32_t walk_offset = cbfs_index.cbfs_offset;
+
+	while (current + sizeof(uint32_t) <= end) {
+		const uint32_t magic = *(const uint32_t *)current;
+
+		if (magic == MCACHE_MAGIC_END)
+			return cbfs_index.cbfs_end;
+		if (magic != MCACHE_MAGIC_FILE) {
+			if (magic != MCACHE_MAGIC_FULL)
+				ERROR("CBFS mcache is corrupted!\n");
+			break;
+		}
+
+		/* The first 8 bytes hold the magic and the file's offset in the CBFS
+		   instead of "LARCHIVE", the rest is the file's metadata as on flash. */
+		const struct cbfs_file *file = current;
+		const uint32_t file_offset = ((const uint32_t *)current)[1];
+		const uint32_t data_offset = ntohl(file->offset);
+
+		if (data_offset <= sizeof(*file) || current + data_offset > end ||
+		    strnlen(file->filename, data_offset - sizeof(*file)) ==
+		    data_offset - sizeof(*file)) {
+			ERROR("CBFS mcache is corrupted!\n");
+			break;
+		}
+		if (cbfs_index_add(file, file->filename,
+				   cbfs_index.cbfs_offset + file_offset, 0))
+			return 0;
+
+		walk_offset = ALIGN_UP(cbfs_index.cbfs_offset + file_offset + data_offset +
+				       ntohl(file->len), CBFS_ALIGNMENT);
+		current += ALIGN_UP(data_offset, MCACHE_ALIGNMENT);
+	}
+
+	return walk_offset;
+}
+
+void cbfs_invalidate_index(void)
+{
+	for (uint32_t i = 0; i < cbfs_index.slots; i++)
+		if (cbfs_index.table[i].name_allocated)
+			free((void *)cbfs_index.table[i].name);
+	free(cbfs_index.table);
+	memset(&cbfs_index, 0, sizeof(cbfs_index));
+}
+
+static void cbfs_index_disable(void)
+{
+	cbfs_invalidate_index();
+	cbfs_index.state = CBFS_INDEX_DISABLED;
+}
+
+static int cbfs_index_init(void)
+{
+	const void *mcache = NULL;
+	size_t mcache_size = 0;
+
+	if (get_cbfs_range(&cbfs_index.cbfs_offset, &cbfs_index.cbfs_end,
+			   CBFS_DEFAULT_MEDIA))
+		return -1;
+	if (cbfs_index_grow())
+		return -1;
+
+	/* coreboot reports the CBFS it booted from, which the RW mcache belongs to if
+	   there is one. Without that report the range came from the master header. */
+	if (lib_sysinfo.cbfs_offset && lib_sysinfo.cbfs_size) {
+		if (lib_sysinfo.cbfs_rw_mcache_offset) {
+			mcache = phys_to_virt(lib_sysinfo.cbfs_rw_mcache_offset);
+			mcache_size = lib_sysinfo.cbfs_rw_mcache_size;
+		} else if (lib_sysinfo.cbfs_ro_mcache_offset) {
+			mcache = phys_to_virt(lib_sysinfo.cbfs_ro_mcache_offset);
+			mcache_size = lib_sysinfo.cbfs_ro_mcache_size;
+		}
+	}
+
+	if (mcache) {
+		cbfs_index.walk_offset = cbfs_index_add_mcache(mcache, mcache_size);
+		if (!cbfs_index.walk_offset)
+			return -1;
+	} else {
+		cbfs_index.walk_offset = cbfs_index.cbfs_offset;
+	}
+
+	cbfs_index.state = CBFS_INDEX_READY;
+	return 0;
+}
+
+/* Returns 1 if the file was found, 0 if it doesn't exist, -1 if the index can't be used. */
+static int cbfs_index_find(struct cbfs_media *media, const char *name,
+			   struct cbfs_handle *handle)
+{
+	const uint32_t hash = cbfs_hash_name(name);
+	const struct cbfs_index_entry *entry;
+	int ret;
+
+	if (cbfs_index.state == CBFS_INDEX_DISABLED)
+		return -1;
+	if (cbfs_index.state == CBFS_INDEX_UNINITIALIZED && cbfs_index_init()) {
+		cbfs_index_disable();
+		return -1;
+	}
+
+	entry = cbfs_index_slot(cbfs_index.table, cbfs_index.slots, hash, name);
+	if (!entry->name && cbfs_index.walk_offset < cbfs_index.cbfs_end) {
+		DEBUG("Indexing CBFS from 0x%x.\n", cbfs_index.walk_offset);
+		media->open(media);
+		ret = cbfs_walk(media, cbfs_index.walk_offset, cbfs_index.cbfs_end,
+				cbfs_index_walker, NULL);
+		media->close(media);
+		if (ret) {
+			cbfs_index_disable();
+			return -1;
+		}
+		cbfs_index.walk_offset = cbfs_index.cbfs_end;
+		entry = cbfs_index_slot(cbfs_index.table, cbfs_index.slots, hash, name);
+	}
+
+	if (!entry->name)
+		return 0;
+
+	DEBUG("Found file in index (offset=0x%x, len=%d).\n",
+	      entry->media_offset + entry->content_offset, entry->content_size);
+	handle->type = entry->type;
+	handle->media_offset = entry->media_offset;
+	handle->content_offset = entry->content_offset;
+	handle->content_size = entry->content_size;
+	handle->attribute_offset = entry->attribute_offset;
+	return 1;
+}
+#else
+void cbfs_invalidate_index(void)
+{
+}
+#endif
+
+/* public API starts here*/
+struct cbfs_handle *cbfs_get_handle(struct cbfs_media *media, const char *name)
+{
+	uint32_t offset, cbfs_end;
+	struct cbfs_handle *handle = malloc(sizeof(*handle));
+	struct cbfs_find_arg find = { .name = name, .handle = handle };
+	int found;
+
+	if (!handle)
+		return NULL;
+
+	if (media == CBFS_DEFAULT_MEDIA) {
+		if (init_default_cbfs_media(&handle->media) != 0) {
+			ERROR("Failed to initialize default media.\n");
+			free(handle);
+			return NULL;
+		}
+#if CONFIG(LP_CBFS_INDEX)
+		found = cbfs_index_find(&handle->media, name, handle);
+		if (found == 1)
+			return handle;
+		if (found == 0) {
+			LOG("WARNING: '%s' not found.\n", name);
+			free(handle);
+			return NULL;
+		}
+#endif
+	} else {
+		memcpy(&handle->media, media, sizeof(*media));
+	}
+
+	if (get_cbfs_range(&offset, &cbfs_end, media)) {
+		ERROR("Failed to find cbfs range\n");
+		free(handle);
+		return NULL;
+	}
+	media = &handle->media;
+
+	DEBUG("CBFS location: 0x%x~0x%x\n", offset, cbfs_end);
+	DEBUG("Looking for '%s' starting from 0x%x.\n", name, offset);
+
+	media->open(media);
+	found = cbfs_walk(media, offset, cbfs_end, cbfs_find_walker, &find);
 	media->close(media);
+	if (found)
+		return handle;
+
 	LOG("WARNING: '%s' not found.\n", name);
 	free(handle);
 	return NULL;
@@ -0,0 +1,307 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Exercises the index of the default CBFS (CONFIG_LP_CBFS_INDEX) on the host against a
+ * synthetic CBFS of 40 files in RAM. Every read of the boot media is counted, so that the
+ * test can tell which lookups were served from the index, and where the walk of the media
+ * resumed after an mcache that ran full.
+ */
+
+#include <libpayload.h>
+#include <cbfs.h>
+#include <sysinfo.h>
+
+#define DEBUG(x...)
+#define LOG(x...)
+#define ERROR(x...) printf(x)
+
+#include "../libcbfs/cbfs_core.c"
+
+#define MEDIA_SIZE	(32 * KiB)
+#define CBFS_OFFSET	0x200
+#define NUM_FILES	40
+
+/* See commonlib/bsd/include/commonlib/bsd/cbfs_serialized.h */
+#define CBFS_TYPE_DELETED	0x00000000
+
+struct sysinfo_t lib_sysinfo;
+unsigned long virtual_offset;
+
+static u8 media_buf[MEDIA_SIZE];
+static u8 mcache[8 * KiB] __aligned(8);
+
+static struct {
+	char name[16];
+	u32 offset;		/* of the file header in the media */
+} files[NUM_FILES];
+
+/* Offsets of the three files named "dup", the last one comes after all of files[]. */
+static u32 dup_offset[3];
+static u32 cbfs_end;
+
+static int media_reads;
+static u32 lowest_read;
+
+static int ram_open(struct cbfs_media *media)
+{
+	return 0;
+}
+
+static int ram_close(struct cbfs_media *media)
+{
+	return 0;
+}
+
+static size_t ram_read(struct cbfs_media *media, void *dest, size_t offset, size_t count)
+{
+	if (offset >= MEDIA_SIZE || count > MEDIA_SIZE - offset)
+		return 0;
+	media_reads++;
+	if (offset < lowest_read)
+		lowest_read = offset;
+	memcpy(dest, &media_buf[offset], count);
+	return count;
+}
+
+static void *ram_map(struct cbfs_media *media, size_t offset, size_t count)
+{
+	if (offset >= MEDIA_SIZE || count > MEDIA_SIZE - offset)
+		return CBFS_MEDIA_INVALID_MAP_ADDRESS;
+	media_reads++;
+	if (offset < lowest_read)
+		lowest_read = offset;
+	return &media_buf[offset];
+}
+
+static void *ram_unmap(struct cbfs_media *media, const void *address)
+{
+	return NULL;
+}
+
+int init_default_cbfs_media(struct cbfs_media *media)
+{
+	media->context = NULL;
+	media->open = ram_open;
+	media->close = ram_close;
+	media->read = ram_read;
+	media->map = ram_map;
+	media->unmap = ram_unmap;
+	return 0;
+}
+
+static int failures;
+
+static void check(int cond, const char *what)
+{
+	if (!cond) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static u32 file_size(u32 offset)
+{
+	const struct cbfs_file *file = (const void *)&media_buf[offset];
+
+	return ntohl(file->len);
+}
+
+static u32 add_file(u32 offset, const char *name, u32 type, u32 len)
+{
+	struct cbfs_file *file = (void *)&media_buf[offset];
+	const u32 data_offset = ALIGN_UP(sizeof(*file) + strlen(name) + 1, 16);
+
+	memcpy(file->magic, CBFS_FILE_MAGIC, sizeof(file->magic));
+	file->len = htonl(len);
+	file->type = htonl(type);
+	file->attributes_offset = 0;
+	file->offset = htonl(data_offset);
+	strcpy(file->filename, name);
+
+	return ALIGN_UP(offset + data_offset + len, CBFS_ALIGNMENT);
+}
+
+/*
+ * Two files named "dup" come first and a third one last, with "file0" to "file39" and some
+ * deleted space in between. Lookups of "dup" must find the first one, as a walk does.
+ */
+static void setup_cbfs(void)
+{
+	u32 offset = CBFS_OFFSET;
+
+	memset(media_buf, 0xff, sizeof(media_buf));
+
+	dup_offset[0] = offset;
+	offset = add_file(offset, "dup", CBFS_TYPE_RAW, 8);
+	dup_offset[1] = offset;
+	offset = add_file(offset, "dup", CBFS_TYPE_RAW, 16);
+	for (int i = 0; i < NUM_FILES; i++) {
+		if (i % 8 == 7)
+			offset = add_file(offset, "", CBFS_TYPE_DELETED, 100);
+		snprintf(files[i].name, sizeof(files[i].name), "file%d", i);
+		files[i].offset = offset;
+		offset = add_file(offset, files[i].name, CBFS_TYPE_RAW, 3 * i + 1);
+	}
+	dup_offset[2] = offset;
+	offset = add_file(offset, "dup", CBFS_TYPE_RAW, 32);
+	cbfs_end = offset;
+
+	memset(&lib_sysinfo, 0, sizeof(lib_sysinfo));
+	lib_sysinfo.cbfs_offset = CBFS_OFFSET;
+	lib_sysinfo.cbfs_size = cbfs_end - CBFS_OFFSET;
+}
+
+/* Copies the metadata of the files in [CBFS_OFFSET, end) into an mcache, the way
+   commonlib/bsd/cbfs_mcache.c lays it out, and terminates it with the given magic. */
+static void build_mcache(u32 end, u32 magic)
+{
+	u8 *current = mcache;
+	u32 offset = CBFS_OFFSET;
+
+	memset(mcache, 0xa5, sizeof(mcache));
+
+	while (offset < end) {
+		const struct cbfs_file *file = (const void *)&media_buf[offset];
+		const u32 data_offset = ntohl(file->offset);
+
+		if (ntohl(file->type) != CBFS_TYPE_DELETED) {
+			memcpy(current, file, data_offset);
+			((u32 *)current)[0] = MCACHE_MAGIC_FILE;
+			((u32 *)current)[1] = offset - CBFS_OFFSET;
+			current += ALIGN_UP(data_offset, MCACHE_ALIGNMENT);
+		}
+		offset = ALIGN_UP(offset + data_offset + file_size(offset), CBFS_ALIGNMENT);
+	}
+	*(u32 *)current = magic;
+
+	lib_sysinfo.cbfs_rw_mcache_offset = (uintptr_t)mcache;
+	lib_sysinfo.cbfs_rw_mcache_size = sizeof(mcache);
+}
+
+static void reset_reads(void)
+{
+	media_reads = 0;
+	lowest_read = MEDIA_SIZE;
+}
+
+static int lookup(const char *name, u32 expected_offset)
+{
+	struct cbfs_handle *handle = cbfs_get_handle(CBFS_DEFAULT_MEDIA, name);
+	int ok;
+
+	if (!handle)
+		return expected_offset == 0;
+
+	ok = expected_offset && handle->media_offset == expected_offset &&
+	     handle->content_size == file_size(expected_offset) &&
+	     handle->type == CBFS_TYPE_RAW &&
+	     handle->content_offset == ALIGN_UP(sizeof(struct cbfs_file) + strlen(name) + 1, 16);
+	free(handle);
+	return ok;
+}
+
+static void check_all_files(int first, const char *what)
+{
+	int ok = 1;
+
+	for (int i = first; i < NUM_FILES; i++)
+		ok &= lookup(files[i].name, files[i].offset);
+	ok &= lookup("dup", dup_offset[0]);
+	check(ok, what);
+}
+
+static void check_misses(void)
+{
+	check(lookup("file", 0), "miss on a prefix");
+	check(lookup("file400", 0), "miss on an extension");
+	check(lookup("missing", 0), "miss");
+}
+
+/* Without an mcache, the first lookup indexes the whole CBFS and later ones never read. */
+static void test_no_mcache(void)
+{
+	setup_cbfs();
+	cbfs_invalidate_index();
+
+	reset_reads();
+	check(lookup(files[NUM_FILES - 1].name, files[NUM_FILES - 1].offset),
+	      "no mcache: first lookup");
+	check(media_reads > NUM_FILES && lowest_read == CBFS_OFFSET,
+	      "no mcache: first lookup walks the CBFS");
+
+	reset_reads();
+	check_all_files(0, "no mcache: lookups");
+	check_misses();
+	check(media_reads == 0, "no mcache: no reads after the first walk");
+}
+
+/* A complete mcache answers everything, including misses, without touching the media. */
+static void test_complete_mcache(void)
+{
+	setup_cbfs();
+	build_mcache(cbfs_end, MCACHE_MAGIC_END);
+	cbfs_invalidate_index();
+
+	reset_reads();
+	check_all_files(0, "complete mcache: lookups");
+	check_misses();
+	check(media_reads == 0, "complete mcache: no reads");
+}
+
+/* An mcache that ran full covers file0 to file19, the walk picks up right after file19. */
+static void test_full_mcache(void)
+{
+	const int num_cached = NUM_FILES / 2;
+	const u32 walk_offset = files[num_cached].offset;
+
+	setup_cbfs();
+	build_mcache(walk_offset, MCACHE_MAGIC_FULL);
+	cbfs_invalidate_index();
+
+	reset_reads();
+	for (int i = 0; i < num_cached; i++)
+		check(lookup(files[i].name, files[i].offset), "full mcache: cached lookup");
+	check(lookup("dup", dup_offset[0]), "full mcache: first dup");
+	check(media_reads == 0, "full mcache: no reads for cached files");
+
+	reset_reads();
+	check(lookup(files[num_cached].name, files[num_cached].offset),
+	      "full mcache: first uncached lookup");
+	check(media_reads > 0 && lowest_read == walk_offset,
+	      "full mcache: walk resumes after the last cached file");
+
+	/* The third "dup" was indexed by the walk, but must not shadow the cached one. */
+	reset_reads();
+	check_all_files(0, "full mcache: lookups");
+	check_misses();
+	check(media_reads == 0, "full mcache: no reads after the walk");
+}
+
+/* A miss on an mcache that ran full has to walk the rest, and only once. */
+static void test_full_mcache_miss(void)
+{
+	setup_cbfs();
+	build_mcache(files[1].offset, MCACHE_MAGIC_FULL);
+	cbfs_invalidate_index();
+
+	reset_reads();
+	check(lookup("missing", 0), "full mcache: miss");
+	check(media_reads > 0 && lowest_read == files[1].offset,
+	      "full mcache: miss walks the uncached files");
+
+	reset_reads();
+	check_all_files(0, "full mcache: lookups after a miss");
+	check(media_reads == 0, "full mcache: no reads after a miss");
+}
+
+int main(void)
+{
+	test_no_mcache();
+	test_complete_mcache();
+	test_full_mcache();
+	test_full_mcache_miss();
+	cbfs_invalidate_index();
+
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures != 0;
+}
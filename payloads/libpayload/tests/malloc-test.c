@@ -0,0 +1,229 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Exercises libc/malloc.c on the host with allocation patterns typical for
+ * payloads (many small driver objects, aligned queues, variable-sized
+ * filesystem buffers) and checks that no allocation overlaps another. The
+ * allocator is linked under lp_* names (see Makefile) so that the host C
+ * library keeps its own malloc().
+ */
+
+#include <libpayload.h>
+
+#define HEAP_SIZE	0x1000000
+#define DMA_SIZE	0x100000
+#define SLOTS		4096
+#define ROUNDS		200000
+
+#define _STR(x)		#x
+#define STR(x)		_STR(x)
+
+__asm__(".bss\n"
+	".balign 16\n"
+	".globl _heap\n_heap:\n"
+	".skip " STR(HEAP_SIZE) "\n"
+	".globl _eheap\n_eheap:\n"
+	".text\n");
+
+static u8 dma_area[DMA_SIZE] __aligned(4096);
+
+static struct {
+	u8 *ptr;
+	size_t size;
+	u8 tag;
+} slots[SLOTS];
+
+static u32 rng_state = 0x12345678;
+
+static u32 rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+void halt(void)
+{
+	printf("malloc-test: allocator halted\n");
+	__builtin_trap();
+}
+
+static int failures;
+
+static void check(int cond, const char *what)
+{
+	if (!cond) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void fill(int i, u8 *ptr, size_t size)
+{
+	slots[i].ptr = ptr;
+	slots[i].size = size;
+	slots[i].tag = rng();
+	memset(ptr, slots[i].tag, size);
+}
+
+/* Check that nothing overwrote the slot's allocation. */
+static int verify(int i)
+{
+	for (size_t j = 0; j < slots[i].size; j++)
+		if (slots[i].ptr[j] != slots[i].tag)
+			return 0;
+	return 1;
+}
+
+/* Random sizes up to 4KiB, freed in random order, with the heap kept about half full. */
+static void test_random(void)
+{
+	for (int r = 0; r < ROUNDS; r++) {
+		const int i = rng() % SLOTS;
+
+		if (slots[i].ptr) {
+			check(verify(i), "random: contents intact");
+			free(slots[i].ptr);
+			slots[i].ptr = NULL;
+		} else {
+			const size_t size = 1 + rng() % 4096;
+			u8 *ptr = malloc(size);
+
+			check(ptr != NULL, "random: malloc");
+			check(IS_ALIGNED((uintptr_t)ptr, sizeof(u64)), "random: alignment");
+			if (ptr)
+				fill(i, ptr, size);
+		}
+	}
+
+	for (int i = 0; i < SLOTS; i++) {
+		if (slots[i].ptr) {
+			check(verify(i), "random: contents intact");
+			free(slots[i].ptr);
+			slots[i].ptr = NULL;
+		}
+	}
+}
+
+static void test_realloc(void)
+{
+	for (int r = 0; r < ROUNDS / 4; r++) {
+		const int i = rng() % 256;
+		const size_t size = 1 + rng() % 16384;
+		const size_t kept = slots[i].ptr ? MIN(size, slots[i].size) : 0;
+		u8 *ptr = realloc(slots[i].ptr, size);
+
+		check(ptr != NULL, "realloc");
+		if (!ptr)
+			continue;
+		for (size_t j = 0; j < kept; j++)
+			if (ptr[j] != slots[i].tag) {
+				check(0, "realloc: contents kept");
+				break;
+			}
+		fill(i, ptr, size);
+	}
+
+	for (int i = 0; i < 256; i++) {
+		free(slots[i].ptr);
+		slots[i].ptr = NULL;
+	}
+}
+
+static void test_memalign(void)
+{
+	static const size_t aligns[] = { 16, 64, 128, 4096 };
+	for (int r = 0; r < ROUNDS / 4; r++) {
+		const int i = rng() % 1024;
+
+		if (slots[i].ptr) {
+			check(verify(i), "memalign: contents intact");
+			free(slots[i].ptr);
+			slots[i].ptr = NULL;
+		} else {
+			const size_t align = aligns[rng() % ARRAY_SIZE(aligns)];
+			const size_t size = 16 + rng() % 2048;
+			u8 *ptr = memalign(align, size);
+
+			check(ptr != NULL, "memalign");
+			check(IS_ALIGNED((uintptr_t)ptr, align), "memalign: alignment");
+			if (ptr)
+				fill(i, ptr, size);
+		}
+	}
+
+	for (int i = 0; i < 1024; i++) {
+		free(slots[i].ptr);
+		slots[i].ptr = NULL;
+	}
+}
+
+/* Transfer descriptor sized objects, from malloc() and from a slab cache. */
+static void test_small(struct slab_cache *cache)
+{
+	for (int r = 0; r < ROUNDS; r++) {
+		const int i = rng() % SLOTS;
+
+		if (slots[i].ptr) {
+			check(verify(i), "small: contents intact");
+			if (cache)
+				slab_free(cache, slots[i].ptr);
+			else
+				free(slots[i].ptr);
+			slots[i].ptr = NULL;
+		} else {
+			u8 *ptr = cache ? slab_alloc(cache) : malloc(64);
+
+			check(ptr != NULL, "small: alloc");
+			check(!cache || IS_ALIGNED((uintptr_t)ptr, 64), "small: slab alignment");
+			if (ptr)
+				fill(i, ptr, 64);
+		}
+	}
+
+	for (int i = 0; i < SLOTS; i++) {
+		if (!slots[i].ptr)
+			continue;
+		if (cache)
+			slab_free(cache, slots[i].ptr);
+		else
+			free(slots[i].ptr);
+		slots[i].ptr = NULL;
+	}
+}
+
+int main(void)
+{
+	struct slab_cache *cache;
+
+	init_dma_memory(dma_area, sizeof(dma_area));
+
+	test_random();
+	test_realloc();
+	test_memalign();
+	test_small(NULL);
+
+	cache = slab_create(64, 64);
+	check(cache != NULL, "slab_create");
+	test_small(cache);
+	slab_destroy(cache);
+
+	cache = dma_slab_create(64, 64);
+	check(cache != NULL, "dma_slab_create");
+	u8 *ptr = slab_alloc(cache);
+	check(dma_coherent(ptr) && (void *)ptr >= (void *)dma_area, "DMA slab in DMA pool");
+	slab_destroy(cache);
+
+	ptr = dma_memalign(4096, 8192);
+	check(ptr >= dma_area && ptr + 8192 <= dma_area + sizeof(dma_area), "dma_memalign");
+	free(ptr);
+
+	/* Everything was freed, so the heap must have coalesced back into one block. */
+	ptr = malloc(HEAP_SIZE - 4096);
+	check(ptr != NULL, "heap coalesced");
+	free(ptr);
+
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures != 0;
+}
@@ -0,0 +1,458 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Runs drivers/storage/nvme.c on the host against a simulated NVMe controller. The
+ * controller takes commands when the driver rings a submission queue doorbell, but only
+ * posts I/O completions while the driver polls for them, newest command first unless a
+ * test asks for submission order. That keeps as many commands in flight as the driver
+ * submits, and completes them out of order.
+ */
+
+#include <libpayload.h>
+#include <pci.h>
+#include <storage/storage.h>
+
+#define read32(addr) sim_read32(addr)
+#define write32(addr, val) sim_write32(addr, val)
+
+static uint32_t sim_read32(const volatile void *addr);
+static void sim_write32(volatile void *addr, uint32_t val);
+
+#include "../drivers/storage/nvme.c"
+
+#define DISK_BLOCKS	16384
+/* CAP.MQES, the I/O queues hold MQES + 1 entries, so MQES commands can be in flight. */
+#define SIM_MQES	7
+#define MAX_PENDING	64
+
+#define OPC_DELETE_SQ	0x00
+#define OPC_CREATE_SQ	0x01
+#define OPC_CREATE_CQ	0x05
+
+unsigned long virtual_offset;
+
+/* The driver passes 32-bit addresses to the controller, see the Makefile for 64-bit hosts. */
+static u8 regs[0x2000] __aligned(0x1000);
+static u8 io_buf[20 * NVME_MAX_BLOCKS * 512 + 0x1000] __aligned(0x1000);
+static u8 disk[DISK_BLOCKS * 512];
+
+static struct sim_queue {
+	u8 *base;
+	u16 size;
+	u16 head;	/* SQ: next entry the controller takes, CQ: next entry it posts */
+	u16 tail;	/* SQ: doorbell written by the driver */
+	u8 phase;
+} sim_sq[2], sim_cq[2];
+
+/* I/O commands taken from the submission queue, but not completed yet. */
+static struct nvme_s_queue_entry pending[MAX_PENDING];
+static int num_pending;
+static bool in_order;
+static int max_pending;
+
+/* Completions posted but not yet consumed, as told by the CQ head doorbell. */
+static u16 io_cq_consumed;
+
+/* What the controller saw. */
+static int num_io_cmds;
+static bool out_of_order;
+static int flushes;
+static bool flush_with_pending_writes;
+static bool write_after_flush;
+/* Commands touching [fail_lba, fail_lba + fail_blocks) fail. */
+static lba_t fail_lba;
+static size_t fail_blocks;
+static bool failure_posted;
+static int cmds_after_failure;
+
+static storage_dev_t *attached;
+
+static struct sim_queue *doorbell_queue(volatile void *addr, bool *is_cq)
+{
+	const size_t off = (uintptr_t)addr - (uintptr_t)regs - 0x1000;
+	const int qid = off / 8;
+
+	*is_cq = off % 8;
+	if (qid > 1)
+		return NULL;
+	return *is_cq ? &sim_cq[qid] : &sim_sq[qid];
+}
+
+static void post_completion(struct sim_queue *cq, u16 cid, u16 status)
+{
+	u32 *entry = (u32 *)(cq->base + cq->head * NVME_CQ_ENTRY_SIZE);
+
+	entry[0] = 0;
+	entry[1] = 0;
+	entry[2] = 0;
+	entry[3] = cid | cq->phase << 16 | status << 17;
+	cq->head++;
+	if (cq->head == cq->size) {
+		cq->head = 0;
+		cq->phase ^= 1;
+	}
+}
+
+static void admin_cmd(const struct nvme_s_queue_entry *cmd)
+{
+	const u8 opc = cmd->dw[0] & 0xff;
+	const u16 qid = cmd->dw[10] & 0xffff;
+	const u16 size = (cmd->dw[10] >> 16) + 1;
+
+	if (qid == 1 && cmd->dw[6] && (opc == OPC_CREATE_CQ || opc == OPC_CREATE_SQ)) {
+		struct sim_queue *q = opc == OPC_CREATE_CQ ? &sim_cq[1] : &sim_sq[1];
+		*q = (struct sim_queue){
+			.base = phys_to_virt(cmd->dw[6]),
+			.size = size,
+			.phase = 1,
+		};
+	} else if (opc == OPC_DELETE_SQ) {
+		memset(&sim_sq[1], 0, sizeof(sim_sq[1]));
+	}
+	post_completion(&sim_cq[0], cmd->dw[0] >> 16, 0);
+}
+
+/* Copy between the disk and the buffer described by the PRPs of a read or write. */
+static void transfer(const struct nvme_s_queue_entry *cmd, bool write)
+{
+	const lba_t slba = cmd->dw[10] | (u64)cmd->dw[11] << 32;
+	const size_t len = ((cmd->dw[12] & 0xffff) + 1) * 512;
+	const u64 *prp_list = NULL;
+	u8 *data = disk + slba * 512;
+	uintptr_t page = cmd->dw[6];
+	size_t done = 0;
+	int i = 0;
+
+	if (slba * 512 + len > DISK_BLOCKS * 512) {
+		printf("FAIL: transfer beyond the disk\n");
+		return;
+	}
+
+	if (len > 0x1000 - (page & 0xfff) + 0x1000)
+		prp_list = phys_to_virt(cmd->dw[8]);
+
+	while (done < len) {
+		const size_t chunk = MIN(len - done, 0x1000 - (page & 0xfff));
+		u8 *buf = phys_to_virt(page);
+
+		if (write)
+			memcpy(data + done, buf, chunk);
+		else
+			memcpy(buf, data + done, chunk);
+		done += chunk;
+		page = prp_list ? prp_list[i++] : cmd->dw[8];
+		if (done < len && (page & 0xfff))
+			printf("FAIL: PRP entry 0x%lx not page aligned\n", (unsigned long)page);
+	}
+}
+
+static void io_cmd(const struct nvme_s_queue_entry *cmd)
+{
+	const u8 opc = cmd->dw[0] & 0xff;
+
+	num_io_cmds++;
+	if (failure_posted)
+		cmds_after_failure++;
+	if (opc == NVME_OPC_FLUSH) {
+		flushes++;
+		for (int i = 0; i < num_pending; i++) {
+			if ((pending[i].dw[0] & 0xff) == NVME_OPC_WRITE)
+				flush_with_pending_writes = true;
+		}
+	} else if (opc == NVME_OPC_WRITE && flushes) {
+		write_after_flush = true;
+	}
+
+	pending[num_pending++] = *cmd;
+	max_pending = MAX(max_pending, num_pending);
+}
+
+/* Complete the newest, or with in_order the oldest, pending I/O command, if there is room in
+   the completion queue. */
+static void complete_io(void)
+{
+	struct sim_queue *cq = &sim_cq[1];
+	struct nvme_s_queue_entry cmd_buf;
+	const struct nvme_s_queue_entry *cmd = &cmd_buf;
+	const u16 posted = (cq->head + cq->size - io_cq_consumed) % cq->size;
+	const int oldest_cid = pending[0].dw[0] >> 16;
+	u16 status = 0;
+
+	if (!num_pending || posted == cq->size - 1)
+		return;
+
+	if (in_order) {
+		cmd_buf = pending[0];
+		memmove(&pending[0], &pending[1], --num_pending * sizeof(pending[0]));
+	} else {
+		cmd_buf = pending[--num_pending];
+	}
+	if ((cmd->dw[0] & 0xff) != NVME_OPC_FLUSH) {
+		const lba_t slba = cmd->dw[10] | (u64)cmd->dw[11] << 32;
+		const lba_t nlb = (cmd->dw[12] & 0xffff) + 1;
+
+		if (fail_lba < slba + nlb && slba < fail_lba + fail_blocks) {
+			status = 0x4;	/* Data Transfer Error */
+			failure_posted = true;
+		} else {
+			transfer(cmd, (cmd->dw[0] & 0xff) == NVME_OPC_WRITE);
+		}
+	}
+
+	if (num_pending && (cmd->dw[0] >> 16) != oldest_cid)
+		out_of_order = true;
+	post_completion(cq, cmd->dw[0] >> 16, status);
+}
+
+static uint32_t sim_read32(const volatile void *addr)
+{
+	if (sim_cq[1].base && (const u8 *)addr >= sim_cq[1].base &&
+	    (const u8 *)addr < sim_cq[1].base + sim_cq[1].size * NVME_CQ_ENTRY_SIZE)
+		complete_io();
+	return *(volatile uint32_t *)addr;
+}
+
+static void sim_write32(volatile void *addr, uint32_t val)
+{
+	struct sim_queue *q;
+	bool is_cq;
+
+	*(volatile uint32_t *)addr = val;
+
+	if ((u8 *)addr == regs + 0x14) {
+		/* CC.EN sets CSTS.RDY, the admin queues are read from AQA, ASQ and ACQ. */
+		*(u32 *)(regs + 0x1c) = val & 1;
+		if (val & 1) {
+			sim_sq[0] = (struct sim_queue){
+				.base = phys_to_virt(*(u32 *)(regs + 0x28)),
+				.size = (*(u32 *)(regs + 0x24) & 0xfff) + 1,
+			};
+			sim_cq[0] = (struct sim_queue){
+				.base = phys_to_virt(*(u32 *)(regs + 0x30)),
+				.size = (*(u32 *)(regs + 0x24) >> 16 & 0xfff) + 1,
+				.phase = 1,
+			};
+		}
+		return;
+	}
+
+	if ((u8 *)addr < regs + 0x1000 || (u8 *)addr >= regs + sizeof(regs))
+		return;
+
+	q = doorbell_queue(addr, &is_cq);
+	if (!q) {
+		printf("FAIL: doorbell of unknown queue\n");
+		return;
+	}
+	if (is_cq) {
+		if (q == &sim_cq[1])
+			io_cq_consumed = val;
+		return;
+	}
+
+	q->tail = val;
+	while (q->head != q->tail) {
+		const struct nvme_s_queue_entry *cmd = (const void *)(q->base +
+								q->head * NVME_SQ_ENTRY_SIZE);
+		if (q == &sim_sq[0]) {
+			admin_cmd(cmd);
+		} else if (num_pending == MAX_PENDING) {
+			printf("FAIL: more commands in flight than the queue holds\n");
+			break;
+		} else {
+			io_cmd(cmd);
+		}
+		q->head = (q->head + 1) % q->size;
+	}
+}
+
+u32 pci_read_config32(pcidev_t dev, u16 reg)
+{
+	return reg == 0x10 ? virt_to_phys(regs) : 0;
+}
+
+u16 pci_read_config16(pcidev_t dev, u16 reg)
+{
+	return 0;
+}
+
+void pci_write_config16(pcidev_t dev, u16 reg, u16 val)
+{
+}
+
+void arch_ndelay(uint64_t n)
+{
+}
+
+int storage_attach_device(storage_dev_t *dev)
+{
+	attached = dev;
+	return 0;
+}
+
+static int failures;
+
+static void check(int cond, const char *what)
+{
+	if (!cond) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void reset_stats(void)
+{
+	num_io_cmds = 0;
+	max_pending = 0;
+	out_of_order = false;
+	flushes = 0;
+	flush_with_pending_writes = false;
+	write_after_flush = false;
+	fail_blocks = 0;
+	failure_posted = false;
+	cmds_after_failure = 0;
+	in_order = false;
+}
+
+static u8 pattern(size_t block, size_t byte)
+{
+	return (block * 7 + byte) ^ (block >> 8);
+}
+
+static void fill_disk(void)
+{
+	for (size_t i = 0; i < DISK_BLOCKS * 512; i++)
+		disk[i] = pattern(i / 512, i % 512);
+}
+
+static bool check_data(const u8 *buf, lba_t start, size_t count)
+{
+	for (size_t i = 0; i < count * 512; i++) {
+		if (buf[i] != pattern(start + i / 512, i % 512))
+			return false;
+	}
+	return true;
+}
+
+static void sim_init(void)
+{
+	const u64 cap = SIM_MQES | 1ULL << 24 /* TO */ | 1ULL << 37 /* CSS: NVM */;
+
+	memset(regs, 0, sizeof(regs));
+	memcpy(regs, &cap, sizeof(cap));
+
+	nvme_initialize(&(struct pci_dev){ 0 });
+	check(attached != NULL, "init: device attached");
+	check(sim_cq[1].size == SIM_MQES + 1 && sim_sq[1].size == SIM_MQES + 1,
+	      "init: I/O queues sized by CAP.MQES");
+}
+
+/* 20 commands through queues of 8 entries, so both rings wrap a few times. */
+static void test_read(void)
+{
+	const size_t count = 20 * NVME_MAX_BLOCKS - 100;
+	const lba_t start = 1000;
+	u8 *const buf = io_buf;
+	u8 *const unaligned = buf + 0x208;
+
+	fill_disk();
+	reset_stats();
+	check(attached->read_blocks512(attached, start, count, unaligned) == count,
+	      "read: all blocks");
+	check(check_data(unaligned, start, count), "read: data");
+	check(num_io_cmds == 20, "read: split into commands of NVME_MAX_BLOCKS");
+	check(max_pending == SIM_MQES, "read: queue kept full");
+	check(out_of_order, "read: completions out of order");
+
+	/* Crossing a single page boundary only uses PRP2, no list. */
+	reset_stats();
+	memset(buf, 0, 0x2000);
+	check(attached->read_blocks512(attached, 3, 8, buf + 0x800) == 8, "read: short");
+	check(check_data(buf + 0x800, 3, 8), "read: short data");
+}
+
+static void test_write(void)
+{
+	const size_t count = 9 * NVME_MAX_BLOCKS + 17;
+	const lba_t start = 333;
+	u8 *const buf = io_buf;
+
+	memset(disk, 0, sizeof(disk));
+	for (size_t i = 0; i < count * 512; i++)
+		buf[i] = pattern(start + i / 512, i % 512);
+
+	reset_stats();
+	check(attached->write_blocks512(attached, start, count, buf) == count,
+	      "write: all blocks");
+	check(check_data(disk + start * 512, start, count), "write: data");
+	check(disk[start * 512 - 1] == 0 && disk[(start + count) * 512] == 0,
+	      "write: nothing outside the range");
+	check(max_pending == SIM_MQES && out_of_order, "write: queue kept full");
+	check(flushes == 1 && num_io_cmds == 11, "write: one Flush after 10 writes");
+	check(!flush_with_pending_writes && !write_after_flush,
+	      "write: Flush only after all writes completed");
+	check(num_pending == 0, "write: Flush completed");
+}
+
+/*
+ * A failed command ends the transfer at its first block, even when commands after it
+ * completed earlier. Everything in flight is reaped before returning.
+ */
+static void test_error(void)
+{
+	const size_t count = 12 * NVME_MAX_BLOCKS;
+	u8 *const buf = io_buf;
+
+	fill_disk();
+	reset_stats();
+	fail_lba = 3 * NVME_MAX_BLOCKS + 5;
+	fail_blocks = 1;
+	check(attached->read_blocks512(attached, 0, count, buf) == 3 * NVME_MAX_BLOCKS,
+	      "error: blocks before the failed command");
+	check(check_data(buf, 0, 3 * NVME_MAX_BLOCKS), "error: data before the failure");
+	check(failure_posted && cmds_after_failure == 0,
+	      "error: no commands queued after the failure");
+	check(num_pending == 0 && ((struct nvme_dev *)attached)->io_inflight == 0,
+	      "error: all commands reaped");
+
+	/*
+	 * In submission order, the failure is seen while commands are left to queue. The 6th
+	 * command fails as well, which must not move the end of the transfer.
+	 */
+	reset_stats();
+	in_order = true;
+	fail_lba = 3 * NVME_MAX_BLOCKS + 5;
+	fail_blocks = 2 * NVME_MAX_BLOCKS;
+	check(attached->read_blocks512(attached, 0, count, buf) == 3 * NVME_MAX_BLOCKS,
+	      "error: blocks before the failed command, in order");
+	check(num_io_cmds == 3 + SIM_MQES && cmds_after_failure == 0,
+	      "error: nothing queued after the failure, in order");
+	check(num_pending == 0 && ((struct nvme_dev *)attached)->io_inflight == 0,
+	      "error: all commands reaped, in order");
+
+	/* A failed write isn't flushed. */
+	reset_stats();
+	fail_lba = 0;
+	fail_blocks = 1;
+	check(attached->write_blocks512(attached, 0, 8, buf) == 0, "error: failed write");
+	check(flushes == 0, "error: no Flush after a failed write");
+
+	/* The queues are still usable. */
+	reset_stats();
+	check(attached->read_blocks512(attached, 77, count, buf) == count &&
+	      check_data(buf, 77, count), "error: read after failures");
+}
+
+int main(void)
+{
+	sim_init();
+	test_read();
+	test_write();
+	test_error();
+
+	attached->detach_device(attached);
+	check(!(*(u32 *)(regs + 0x1c) & 1), "detach: controller disabled");
+
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures != 0;
+}
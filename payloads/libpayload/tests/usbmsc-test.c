@@ -0,0 +1,522 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Runs drivers/usb/usbmsc.c on the host against a simulated Bulk-Only Transport device
+ * behind a host controller that takes bulk transfers as large as xHCI does. The device
+ * contents are computed from the block number, except for a window that is backed by memory
+ * and takes writes, so that a 3 TiB disk fits. The device can be made to stall data
+ * transfers above a size, like USB3 sticks that choke on large requests do, and to reject
+ * READ CAPACITY(16).
+ */
+
+#include <libpayload.h>
+#include <usb/usb.h>
+#include <usb/usbmsc.h>
+#include <usb/usbdisk.h>
+
+#include "../drivers/usb/usbmsc.c"
+
+/* What xhci.c advertises with its 32-entry transfer rings. */
+#define SIM_MAX_BULK	((32 - 3) << 16)
+#define WINDOW_BLOCKS	8192
+#define BUF_SIZE	(4 * MiB)
+
+#define TiB		(1024ULL * GiB)
+
+static struct {
+	u64 numblocks;
+	u32 blocksize;
+	u64 window_base;		/* first block of the writable window */
+	size_t stall_above;		/* stall data transfers larger than this, if set */
+	bool no_read_capacity16;
+
+	enum { CBW, DATA, STATUS } phase;
+	cbw_t cbw;
+	u8 response[32];
+	size_t response_len;
+	u8 csw_status;
+	u32 residue;
+	u8 sense_key;
+	u8 asc;
+} sim;
+
+static u8 window[WINDOW_BLOCKS * 4096];
+
+/* What the device saw since the last reset_stats(). */
+static struct {
+	int rw10;
+	int rw16;
+	int rw16_low;			/* READ(16)/WRITE(16) that READ(10)/WRITE(10) could do */
+	int rw10_high;			/* READ(10)/WRITE(10) that reach past block 2^32 - 1 */
+	int read_capacity16;
+	int stalls;
+	int clear_stalls;
+	size_t max_transfer;
+	u64 last_lba;
+	bool lba_out_of_range;
+	bool write_outside_window;
+} stats;
+
+static hci_t sim_hc;
+static usbdev_t sim_dev;
+static bool disk_created;
+
+static u8 dma_buf[BUF_SIZE] __aligned(4096);
+static u8 plain_buf[BUF_SIZE];
+
+static u8 pattern(u64 block, size_t byte)
+{
+	return (block * 7 + byte) ^ (block >> 29) ^ (block >> 37);
+}
+
+static u8 *disk_byte(u64 block, size_t byte)
+{
+	static u8 computed;
+
+	if (block >= sim.window_base && block < sim.window_base + WINDOW_BLOCKS)
+		return &window[(block - sim.window_base) * sim.blocksize + byte];
+	computed = pattern(block, byte);
+	return &computed;
+}
+
+static void put_be32(u8 *p, u32 val)
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+static u32 get_be32(const u8 *p)
+{
+	return (u32)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void check_condition(u8 sense_key, u8 asc)
+{
+	sim.csw_status = 1;
+	sim.sense_key = sense_key;
+	sim.asc = asc;
+}
+
+/* Decode the LBA and length of a READ/WRITE(10) or (16), return false for other commands. */
+static bool decode_rw(const u8 *cb, u64 *lba, u32 *blocks, bool *write)
+{
+	switch (cb[0]) {
+	case 0x28:
+	case 0x2a:
+		*lba = get_be32(&cb[2]);
+		*blocks = cb[7] << 8 | cb[8];
+		*write = cb[0] == 0x2a;
+		return true;
+	case 0x88:
+	case 0x8a:
+		*lba = (u64)get_be32(&cb[2]) << 32 | get_be32(&cb[6]);
+		*blocks = get_be32(&cb[10]);
+		*write = cb[0] == 0x8a;
+		return true;
+	}
+	return false;
+}
+
+static void command(void)
+{
+	const u8 *cb = sim.cbw.CBWCB;
+	u64 lba;
+	u32 blocks;
+	bool write;
+
+	sim.csw_status = 0;
+	sim.residue = 0;
+	sim.response_len = 0;
+
+	if (decode_rw(cb, &lba, &blocks, &write)) {
+		if (cb[0] & 0x80) {
+			stats.rw16++;
+			if (lba + blocks <= 0x100000000ULL)
+				stats.rw16_low++;
+		} else {
+			stats.rw10++;
+			if (lba + blocks > 0x100000000ULL)
+				stats.rw10_high++;
+		}
+		stats.last_lba = lba;
+		if (lba + blocks > sim.numblocks) {
+			stats.lba_out_of_range = true;
+			check_condition(5, 0x21);	/* LBA out of range */
+		}
+		if (blocks * sim.blocksize != sim.cbw.dCBWDataTransferLength)
+			printf("FAIL: transfer length doesn't match the CDB\n");
+		return;
+	}
+
+	switch (cb[0]) {
+	case 0x00:	/* TEST UNIT READY */
+	case 0x1b:	/* START STOP UNIT */
+		break;
+	case 0x03:	/* REQUEST SENSE */
+		memset(sim.response, 0, sizeof(sim.response));
+		sim.response[0] = 0x70;
+		sim.response[2] = sim.sense_key;
+		sim.response[7] = 10;
+		sim.response[12] = sim.asc;
+		sim.response_len = 18;
+		sim.sense_key = 0;
+		sim.asc = 0;
+		break;
+	case 0x25:	/* READ CAPACITY(10) */
+		put_be32(&sim.response[0], MIN(sim.numblocks - 1, 0xffffffff));
+		put_be32(&sim.response[4], sim.blocksize);
+		sim.response_len = 8;
+		break;
+	case 0x9e:	/* SERVICE ACTION IN(16) */
+		if ((cb[1] & 0x1f) != 0x10 || sim.no_read_capacity16) {
+			check_condition(5, 0x20);	/* Invalid command operation code */
+			break;
+		}
+		stats.read_capacity16++;
+		memset(sim.response, 0, sizeof(sim.response));
+		put_be32(&sim.response[0], (sim.numblocks - 1) >> 32);
+		put_be32(&sim.response[4], sim.numblocks - 1);
+		put_be32(&sim.response[8], sim.blocksize);
+		sim.response_len = 32;
+		break;
+	default:
+		check_condition(5, 0x20);
+	}
+}
+
+/* The data phase, returns what bulk() returns. */
+static int data(endpoint_t *ep, int size, u8 *buf)
+{
+	const u8 *cb = sim.cbw.CBWCB;
+	const bool in = sim.cbw.bmCBWFlags == cbw_direction_data_in;
+	u64 lba;
+	u32 blocks;
+	bool write;
+
+	if (ep->direction != (in ? IN : OUT) || size != sim.cbw.dCBWDataTransferLength) {
+		printf("FAIL: data phase doesn't match the CBW\n");
+		sim.csw_status = 2;
+		return -1;
+	}
+
+	if (sim.stall_above && size > sim.stall_above) {
+		stats.stalls++;
+		sim.residue = size;
+		check_condition(0xb, 0);	/* Aborted command */
+		return -1;
+	}
+
+	stats.max_transfer = MAX(stats.max_transfer, size);
+
+	if (!decode_rw(cb, &lba, &blocks, &write)) {
+		const int len = MIN(size, sim.response_len);
+		memcpy(buf, sim.response, len);
+		sim.residue = size - len;
+		return len;
+	}
+	if (sim.csw_status) {
+		sim.residue = size;
+		return -1;
+	}
+	for (u32 i = 0; i < blocks; i++) {
+		if (write && (lba + i < sim.window_base ||
+			      lba + i >= sim.window_base + WINDOW_BLOCKS)) {
+			stats.write_outside_window = true;
+			continue;
+		}
+		for (u32 j = 0; j < sim.blocksize; j++) {
+			u8 *byte = disk_byte(lba + i, j);
+			if (write)
+				*byte = buf[i * sim.blocksize + j];
+			else
+				buf[i * sim.blocksize + j] = *byte;
+		}
+	}
+	return size;
+}
+
+static int sim_bulk(endpoint_t *ep, int size, u8 *buf, int finalize)
+{
+	switch (sim.phase) {
+	case CBW:
+		if (ep->direction != OUT || size != sizeof(cbw_t)) {
+			printf("FAIL: expected a CBW\n");
+			return -1;
+		}
+		memcpy(&sim.cbw, buf, sizeof(cbw_t));
+		if (sim.cbw.dCBWSignature != cbw_signature)
+			printf("FAIL: bad CBW signature\n");
+		command();
+		sim.phase = sim.cbw.dCBWDataTransferLength ? DATA : STATUS;
+		return size;
+	case DATA:
+		sim.phase = STATUS;
+		return data(ep, size, buf);
+	case STATUS:
+		if (ep->direction != IN || size != sizeof(csw_t)) {
+			printf("FAIL: expected to send the CSW\n");
+			return -1;
+		}
+		const csw_t csw = {
+			.dCSWSignature = csw_signature,
+			.dCSWTag = sim.cbw.dCBWTag,
+			.dCSWDataResidue = sim.residue,
+			.bCSWStatus = sim.csw_status,
+		};
+		memcpy(buf, &csw, sizeof(csw));
+		sim.phase = CBW;
+		return sizeof(csw);
+	}
+	return -1;
+}
+
+static int sim_control(usbdev_t *dev, direction_t pid, int dr_length, void *devreq,
+		       int data_length, u8 *data)
+{
+	const dev_req_t *dr = devreq;
+
+	if (dr->bRequest == GET_MAX_LUN && data_length == 1) {
+		*data = 0;
+		return 1;
+	}
+	return 0;
+}
+
+int clear_stall(endpoint_t *ep)
+{
+	stats.clear_stalls++;
+	return 0;
+}
+
+void usb_detach_device(hci_t *controller, int devno)
+{
+	printf("FAIL: device detached\n");
+}
+
+void usbdisk_create(usbdev_t *dev)
+{
+	disk_created = true;
+}
+
+void usbdisk_remove(usbdev_t *dev)
+{
+	disk_created = false;
+}
+
+int dma_coherent(void *ptr)
+{
+	return (u8 *)ptr >= dma_buf && (u8 *)ptr < dma_buf + sizeof(dma_buf);
+}
+
+int gettimeofday(struct timeval *tv, void *tz)
+{
+	tv->tv_sec = 0;
+	tv->tv_usec = 0;
+	return 0;
+}
+
+void arch_ndelay(uint64_t n)
+{
+}
+
+void fatal(const char *msg)
+{
+	printf("FAIL: %s", msg);
+	exit(1);
+}
+
+static int failures;
+
+static void check(int cond, const char *what)
+{
+	if (!cond) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+static void attach(u64 numblocks, u32 blocksize, bool no_read_capacity16)
+{
+	if (sim_dev.data)
+		usb_msc_destroy(&sim_dev);
+
+	memset(&sim, 0, sizeof(sim));
+	sim.numblocks = numblocks;
+	sim.blocksize = blocksize;
+	sim.no_read_capacity16 = no_read_capacity16;
+
+	memset(&sim_hc, 0, sizeof(sim_hc));
+	sim_hc.bulk = sim_bulk;
+	sim_hc.control = sim_control;
+	sim_hc.max_bulk_size = SIM_MAX_BULK;
+
+	memset(&sim_dev, 0, sizeof(sim_dev));
+	sim_dev.controller = &sim_hc;
+	sim_dev.num_endp = 2;
+	sim_dev.endpoints[1] = (endpoint_t){ .dev = &sim_dev, .endpoint = 0x81,
+					     .direction = IN, .type = BULK };
+	sim_dev.endpoints[2] = (endpoint_t){ .dev = &sim_dev, .endpoint = 0x02,
+					     .direction = OUT, .type = BULK };
+
+	disk_created = false;
+	reset_stats();
+	usb_msc_force_init(&sim_dev, 0);
+}
+
+static bool check_data(const u8 *buf, u64 block, size_t blocks)
+{
+	for (size_t i = 0; i < blocks; i++) {
+		for (size_t j = 0; j < sim.blocksize; j++) {
+			if (buf[i * sim.blocksize + j] != *disk_byte(block + i, j))
+				return false;
+		}
+	}
+	return true;
+}
+
+static int rw(u64 block, int blocks, cbw_direction dir, u8 *buf)
+{
+	return readwrite_blocks(&sim_dev, block, blocks, dir, buf);
+}
+
+/* 16 MiB: READ CAPACITY(10), READ(10) and WRITE(10) only, in transfers as large as xHCI's. */
+static void test_small(void)
+{
+	const int blocks = 3 * SIM_MAX_BULK / 512 + 7;
+
+	attach(32768, 512, false);
+	check(disk_created, "small: disk created");
+	check(MSC_INST(&sim_dev)->numblocks == 32768 &&
+	      MSC_INST(&sim_dev)->blocksize == 512, "small: capacity");
+	check(stats.read_capacity16 == 0, "small: no READ CAPACITY(16)");
+
+	reset_stats();
+	check(rw(100, blocks, cbw_direction_data_in, dma_buf) == 0, "small: read");
+	check(check_data(dma_buf, 100, blocks), "small: read data");
+	check(stats.rw10 == 4 && stats.rw16 == 0, "small: READ(10) in 4 transfers");
+	check(stats.max_transfer == SIM_MAX_BULK, "small: transfers up to max_bulk_size");
+
+	/* Buffers that aren't DMA-coherent go through the 64KB bounce buffer. */
+	reset_stats();
+	check(rw(100, 1000, cbw_direction_data_in, plain_buf) == 0 &&
+	      check_data(plain_buf, 100, 1000), "small: read to a plain buffer");
+	check(stats.max_transfer == MAX_CHUNK_BYTES && stats.rw10 == 8,
+	      "small: 64KB transfers for a plain buffer");
+
+	reset_stats();
+	sim.window_base = 32768 - WINDOW_BLOCKS;
+	for (int i = 0; i < 5000 * 512; i++)
+		dma_buf[i] = i * 13;
+	check(rw(32768 - 5000, 5000, cbw_direction_data_out, dma_buf) == 0, "small: write");
+	check(!stats.write_outside_window && check_data(dma_buf, 32768 - 5000, 5000),
+	      "small: write data");
+	check(stats.rw10 == 2 && stats.rw16 == 0, "small: WRITE(10)");
+
+	reset_stats();
+	check(rw(32768 - 10, 11, cbw_direction_data_in, dma_buf) == 1 &&
+	      stats.lba_out_of_range, "small: read beyond the end fails");
+}
+
+/* 3 TiB: READ CAPACITY(16), and READ(16)/WRITE(16) only where the LBA needs 64 bits. */
+static void test_large(void)
+{
+	const u64 numblocks = 3 * TiB / 512;
+	const u64 boundary = 0x100000000ULL;
+
+	attach(numblocks, 512, false);
+	check(disk_created, "large: disk created");
+	check(stats.read_capacity16 == 1, "large: READ CAPACITY(16)");
+	check(MSC_INST(&sim_dev)->numblocks == numblocks &&
+	      MSC_INST(&sim_dev)->blocksize == 512, "large: capacity");
+
+	reset_stats();
+	check(rw(1000, 300, cbw_direction_data_in, dma_buf) == 0 &&
+	      check_data(dma_buf, 1000, 300), "large: read low");
+	check(stats.rw10 == 1 && stats.rw16 == 0, "large: READ(10) below 2 TiB");
+
+	reset_stats();
+	check(rw(numblocks - 4000, 4000, cbw_direction_data_in, dma_buf) == 0 &&
+	      check_data(dma_buf, numblocks - 4000, 4000), "large: read at the end");
+	check(stats.rw16 == 2 && stats.rw10 == 0 && stats.last_lba > boundary,
+	      "large: READ(16) above 2 TiB");
+
+	/* The transfer that straddles 2^32 blocks has to use READ(16). */
+	reset_stats();
+	check(rw(boundary - 2000, 6000, cbw_direction_data_in, dma_buf) == 0 &&
+	      check_data(dma_buf, boundary - 2000, 6000), "large: read across 2^32");
+	check(stats.rw10 + stats.rw16 == 2 && stats.rw10_high == 0 && stats.rw16_low == 0,
+	      "large: READ(16) only across and above 2^32");
+
+	reset_stats();
+	sim.window_base = boundary - 100;
+	for (int i = 0; i < 200 * 512; i++)
+		dma_buf[i] = i * 29;
+	check(rw(boundary - 100, 200, cbw_direction_data_out, dma_buf) == 0, "large: write");
+	check(!stats.write_outside_window && check_data(dma_buf, boundary - 100, 200),
+	      "large: write data across 2^32");
+	check(stats.rw16 == 1 && stats.rw10_high == 0, "large: WRITE(16)");
+
+	reset_stats();
+	check(rw(numblocks - 1, 2, cbw_direction_data_in, dma_buf) == 1 &&
+	      stats.lba_out_of_range, "large: read beyond the end fails");
+}
+
+/* A device that rejects READ CAPACITY(16) is used up to 2^32 blocks. */
+static void test_no_read_capacity16(void)
+{
+	attach(3 * TiB / 512, 512, true);
+	check(disk_created, "no READ CAPACITY(16): disk created");
+	check(MSC_INST(&sim_dev)->numblocks == 0x100000000ULL &&
+	      MSC_INST(&sim_dev)->blocksize == 512, "no READ CAPACITY(16): 2^32 blocks");
+}
+
+/* A device that chokes on large requests: the failed one is retried in 64KB chunks. */
+static void test_fallback(void)
+{
+	const int blocks = 2 * SIM_MAX_BULK / 512;
+
+	attach(32768, 512, false);
+	sim.stall_above = MAX_CHUNK_BYTES;
+
+	reset_stats();
+	check(rw(500, blocks, cbw_direction_data_in, dma_buf) == 0, "fallback: read");
+	check(check_data(dma_buf, 500, blocks), "fallback: read data");
+	check(stats.stalls == 1 && stats.clear_stalls >= 1,
+	      "fallback: one large request stalled");
+	check(stats.max_transfer == MAX_CHUNK_BYTES &&
+	      stats.rw10 == 1 + blocks * 512 / MAX_CHUNK_BYTES,
+	      "fallback: retried in 64KB chunks");
+	check(MSC_INST(&sim_dev)->max_chunk_bytes == MAX_CHUNK_BYTES,
+	      "fallback: stays at 64KB");
+
+	reset_stats();
+	sim.window_base = 0;
+	check(rw(0, 1000, cbw_direction_data_out, dma_buf) == 0 &&
+	      check_data(dma_buf, 0, 1000), "fallback: write");
+	check(stats.stalls == 0, "fallback: no more stalls");
+
+	/* Failures of 64KB requests are not retried. */
+	reset_stats();
+	sim.stall_above = 4096;
+	check(rw(0, 1000, cbw_direction_data_in, dma_buf) == 1 && stats.stalls == 1,
+	      "fallback: small request fails once");
+}
+
+int main(void)
+{
+	test_small();
+	test_large();
+	test_no_read_capacity16();
+	test_fallback();
+	usb_msc_destroy(&sim_dev);
+
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures != 0;
+}
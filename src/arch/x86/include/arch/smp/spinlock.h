@@ -62,6 +62,23 @@ static __always_inline void spin_lock(spinlock_t *lock)
 
 }
 
+/* Take the lock only if it is free. Returns 1 on success. */
+static __always_inline int spin_trylock(spinlock_t *lock)
+{
+	char oldval;
+
+	__asm__ __volatile__(
+		"xchgb %b0,%1"
+		: "=q" (oldval), "=m" (lock->lock)
+		: "0" (0) : "memory");
+
+	if (oldval <= 0)
+		return 0;
+
+	thread_coop_disable();
+	return 1;
+}
+
 static __always_inline void spin_unlock(spinlock_t *lock)
 {
 	thread_coop_enable();
@@ -77,6 +94,7 @@ static __always_inline void spin_unlock(spinlock_t *lock)
 #define spin_is_locked(lock)	0
 #define spin_unlock_wait(lock)	do {} while (0)
 #define spin_lock(lock)		do {} while (0)
+#define spin_trylock(lock)	1
 #define spin_unlock(lock)	do {} while (0)
 
 #endif
@@ -72,57 +72,6 @@ static u8 smbios_get_device_type_from_dev(struct device *dev)
 	}
 }
 
-int smbios_add_string(u8 *start, const char *str)
-{
-	int i = 1;
-	char *p = (char *)start;
-
-	/*
-	 * Return 0 as required for empty strings.
-	 * See Section 6.1.3 "Text Strings" of the SMBIOS specification.
-	 */
-	if (*str == '\0')
-		return 0;
-
-	for (;;) {
-		if (!*p) {
-			strcpy(p, str);
-			p += strlen(str);
-			*p++ = '\0';
-			*p++ = '\0';
-			return i;
-		}
-
-		if (!strcmp(p, str))
-			return i;
-
-		p += strlen(p)+1;
-		i++;
-	}
-}
-
-int smbios_string_table_len(u8 *start)
-{
-	char *p = (char *)start;
-	int i, len = 0;
-
-	while (*p) {
-		i = strlen(p) + 1;
-		p += i;
-		len += i;
-	}
-
-	if (!len)
-		return 2;
-
-	return len + 1;
-}
-
-int smbios_full_table_len(struct smbios_header *header, u8 *str_table_start)
-{
-	return header->length + smbios_string_table_len(str_table_start);
-}
-
 void *smbios_carve_table(unsigned long start, u8 type, u8 length, u16 handle)
 {
 	struct smbios_header *t = (struct smbios_header *)start;
@@ -173,21 +122,29 @@ static int smbios_processor_name(u8 *start)
 	return smbios_add_string(start, str);
 }
 
-/* this function will fill the corresponding manufacturer */
-void smbios_fill_dimm_manufacturer_from_id(uint16_t mod_id, struct smbios_type17 *t)
+static int smbios_dimm_manufacturer(struct smbios_strings *s, uint16_t mod_id)
 {
 	const char *const manufacturer = spd_manufacturer_name(mod_id);
 
 	if (manufacturer) {
-		t->manufacturer = smbios_add_string(t->eos, manufacturer);
+		return smbios_strings_add(s, manufacturer);
 	} else {
 		char string_buffer[256];
 
 		snprintf(string_buffer, sizeof(string_buffer), "Unknown (%x)", mod_id);
-		t->manufacturer = smbios_add_string(t->eos, string_buffer);
+		return smbios_strings_add(s, string_buffer);
 	}
 }
 
+/* this function will fill the corresponding manufacturer */
+void smbios_fill_dimm_manufacturer_from_id(uint16_t mod_id, struct smbios_type17 *t)
+{
+	struct smbios_strings s;
+
+	smbios_strings_init(&s, t->eos);
+	t->manufacturer = smbios_dimm_manufacturer(&s, mod_id);
+}
+
 static void trim_trailing_whitespace(char *buffer, size_t buffer_size)
 {
 	size_t len = strnlen(buffer, buffer_size);
@@ -204,7 +161,8 @@ static void trim_trailing_whitespace(char *buffer, size_t buffer_size)
 }
 
 /** This function will fill the corresponding part number */
-static void smbios_fill_dimm_part_number(const char *part_number, struct smbios_type17 *t)
+static void smbios_fill_dimm_part_number(const char *part_number, struct smbios_type17 *t,
+					 struct smbios_strings *s)
 {
 	int invalid;
 	size_t i, len;
@@ -231,28 +189,28 @@ static void smbios_fill_dimm_part_number(const char *part_number, struct smbios_
 
 	if (len == 0) {
 		/* Null String in Part Number will have "None" instead. */
-		t->part_number = smbios_add_string(t->eos, "None");
+		t->part_number = smbios_strings_add(s, "None");
 	} else if (invalid) {
 		char string_buffer[sizeof(trimmed_part_number) + 10];
 
 		snprintf(string_buffer, sizeof(string_buffer), "Invalid (%s)",
 			 trimmed_part_number);
-		t->part_number = smbios_add_string(t->eos, string_buffer);
+		t->part_number = smbios_strings_add(s, string_buffer);
 	} else {
-		t->part_number = smbios_add_string(t->eos, trimmed_part_number);
+		t->part_number = smbios_strings_add(s, trimmed_part_number);
 	}
 }
 
 /* Encodes the SPD serial number into hex */
 static void smbios_fill_dimm_serial_number(const struct dimm_info *dimm,
-					   struct smbios_type17 *t)
+					   struct smbios_type17 *t, struct smbios_strings *s)
 {
 	char serial[9];
 
 	snprintf(serial, sizeof(serial), "%02hhx%02hhx%02hhx%02hhx",
 		 dimm->serial[0], dimm->serial[1], dimm->serial[2], dimm->serial[3]);
 
-	t->serial_number = smbios_add_string(t->eos, serial);
+	t->serial_number = smbios_strings_add(s, serial);
 }
 
 static int create_smbios_type17_for_dimm(struct dimm_info *dimm,
@@ -261,6 +219,7 @@ static int create_smbios_type17_for_dimm(struct dimm_info *dimm,
 {
 	struct smbios_type17 *t = smbios_carve_table(*current, SMBIOS_MEMORY_DEVICE,
 						     sizeof(*t), *handle);
+	struct smbios_strings s;
 
 	t->memory_type = dimm->ddr_type;
 	if (dimm->configured_speed_mts != 0)
@@ -298,14 +257,18 @@ static int create_smbios_type17_for_dimm(struct dimm_info *dimm,
 		break;
 	}
 
-	smbios_fill_dimm_manufacturer_from_id(dimm->mod_id, t);
-	smbios_fill_dimm_serial_number(dimm, t);
+	smbios_strings_init(&s, t->eos);
+	t->manufacturer = smbios_dimm_manufacturer(&s, dimm->mod_id);
+	smbios_fill_dimm_serial_number(dimm, t, &s);
+
+	/* Mainboards may override these, they add their strings with smbios_add_string(). */
 	smbios_fill_dimm_asset_tag(dimm, t);
 	smbios_fill_dimm_locator(dimm, t);
+	smbios_strings_init(&s, t->eos);
 
 	/* put '\0' in the end of data */
 	dimm->module_part_number[DIMM_INFO_PART_NUMBER_SIZE - 1] = '\0';
-	smbios_fill_dimm_part_number((char *)dimm->module_part_number, t);
+	smbios_fill_dimm_part_number((char *)dimm->module_part_number, t, &s);
 
 	/* Voltage Levels */
 	t->configured_voltage = dimm->vdd_voltage;
@@ -334,7 +297,7 @@ static int create_smbios_type17_for_dimm(struct dimm_info *dimm,
 	t->phys_memory_array_handle = type16_handle;
 
 	*handle += 1;
-	return smbios_full_table_len(&t->header, t->eos);
+	return t->header.length + smbios_strings_len(&s);
 }
 
 #define VERSION_VPD "firmware_version"
@@ -691,13 +654,15 @@ static int smbios_write_type7(unsigned long *current,
 			      const size_t max_cache_size,
 			      const size_t cache_size)
 {
+	struct smbios_strings s;
 	char buf[8];
 
 	struct smbios_type7 *t = smbios_carve_table(*current, SMBIOS_CACHE_INFORMATION,
 						    sizeof(*t), handle);
 
+	smbios_strings_init(&s, t->eos);
 	snprintf(buf, sizeof(buf), "CACHE%x", level);
-	t->socket_designation = smbios_add_string(t->eos, buf);
+	t->socket_designation = smbios_strings_add(&s, buf);
 
 	t->cache_configuration = SMBIOS_CACHE_CONF_LEVEL(level) |
 		SMBIOS_CACHE_CONF_LOCATION(0) | /* Internal */
@@ -745,7 +710,7 @@ static int smbios_write_type7(unsigned long *current,
 	t->error_correction_type = smbios_cache_error_correction_type(level);
 	t->system_cache_type = type;
 
-	const int len = smbios_full_table_len(&t->header, t->eos);
+	const int len = t->header.length + smbios_strings_len(&s);
 	*current += len;
 	return len;
 }
@@ -922,8 +887,10 @@ int smbios_write_type9(unsigned long *current, int *handle,
 {
 	struct smbios_type9 *t = smbios_carve_table(*current, SMBIOS_SYSTEM_SLOTS,
 						    sizeof(*t), *handle);
+	struct smbios_strings s;
 
-	t->slot_designation = smbios_add_string(t->eos, name ? name : "SLOT");
+	smbios_strings_init(&s, t->eos);
+	t->slot_designation = smbios_strings_add(&s, name ? name : "SLOT");
 	t->slot_type = type;
 	/* TODO add slot_id supoort, will be "_SUN" for ACPI devices */
 	t->slot_id = id;
@@ -937,7 +904,7 @@ int smbios_write_type9(unsigned long *current, int *handle,
 	t->device_function_number = dev_func;
 	t->data_bus_width = SlotDataBusWidthOther;
 
-	const int len = smbios_full_table_len(&t->header, t->eos);
+	const int len = t->header.length + smbios_strings_len(&s);
 	*current += len;
 	*handle += 1;
 	return len;
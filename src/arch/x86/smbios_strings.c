@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <commonlib/helpers.h>
+#include <smbios.h>
+#include <string.h>
+
+/*
+ * The strings of an SMBIOS structure follow its formatted area, each terminated by a NUL, with
+ * another NUL after the last one (or two NULs if there are no strings). Strings are referred
+ * to by their 1-based position, equal strings are only stored once.
+ */
+
+/* Only this many strings are hashed, longer string sets are searched linearly. */
+#define SMBIOS_STRINGS_HASHED	(ARRAY_SIZE(((struct smbios_strings *)0)->slots) * 3 / 4)
+
+static u32 smbios_string_hash(const char *str)
+{
+	u32 hash = 0x811c9dc5;
+
+	while (*str) {
+		hash ^= (u8)*str++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+static void smbios_strings_insert(struct smbios_strings *s, const char *str, size_t offset)
+{
+	const size_t mask = ARRAY_SIZE(s->slots) - 1;
+	size_t i;
+
+	for (i = smbios_string_hash(str) & mask; s->slots[i].index; i = (i + 1) & mask)
+		;
+
+	s->slots[i].offset = offset;
+	s->slots[i].index = s->count;
+}
+
+/* Return the index of str if it is in the set, or 0 if it isn't. */
+static int smbios_strings_find(const struct smbios_strings *s, const char *str)
+{
+	const size_t mask = ARRAY_SIZE(s->slots) - 1;
+	const char *p;
+	size_t i;
+	int index;
+
+	for (i = smbios_string_hash(str) & mask; s->slots[i].index; i = (i + 1) & mask) {
+		if (!strcmp((const char *)s->start + s->slots[i].offset, str))
+			return s->slots[i].index;
+	}
+
+	if (s->count <= SMBIOS_STRINGS_HASHED)
+		return 0;
+
+	/* Look through the strings that didn't make it into the hash table. */
+	p = (const char *)s->start;
+	for (index = 1; index <= s->count; index++) {
+		if (index > SMBIOS_STRINGS_HASHED && !strcmp(p, str))
+			return index;
+		p += strlen(p) + 1;
+	}
+
+	return 0;
+}
+
+void smbios_strings_init(struct smbios_strings *s, u8 *start)
+{
+	const char *p = (const char *)start;
+
+	memset(s, 0, sizeof(*s));
+	s->start = start;
+
+	/* Pick up any strings that are already there. */
+	while (*p) {
+		s->count++;
+		if (s->count <= SMBIOS_STRINGS_HASHED)
+			smbios_strings_insert(s, p, (u8 *)p - start);
+		p += strlen(p) + 1;
+	}
+
+	s->end = (u8 *)p;
+}
+
+int smbios_strings_add(struct smbios_strings *s, const char *str)
+{
+	const size_t len = strlen(str);
+	int index;
+
+	/*
+	 * Return 0 as required for empty strings.
+	 * See Section 6.1.3 "Text Strings" of the SMBIOS specification.
+	 */
+	if (!len)
+		return 0;
+
+	index = smbios_strings_find(s, str);
+	if (index)
+		return index;
+
+	memcpy(s->end, str, len + 1);
+	s->count++;
+	if (s->count <= SMBIOS_STRINGS_HASHED)
+		smbios_strings_insert(s, str, s->end - s->start);
+	s->end += len + 1;
+	*s->end = '\0';
+
+	return s->count;
+}
+
+int smbios_strings_len(const struct smbios_strings *s)
+{
+	if (!s->count)
+		return 2;
+
+	return s->end - s->start + 1;
+}
+
+int smbios_add_string(u8 *start, const char *str)
+{
+	int i = 1;
+	char *p = (char *)start;
+
+	/*
+	 * Return 0 as required for empty strings.
+	 * See Section 6.1.3 "Text Strings" of the SMBIOS specification.
+	 */
+	if (*str == '\0')
+		return 0;
+
+	for (;;) {
+		if (!*p) {
+			strcpy(p, str);
+			p += strlen(str);
+			*p++ = '\0';
+			*p++ = '\0';
+			return i;
+		}
+
+		if (!strcmp(p, str))
+			return i;
+
+		p += strlen(p)+1;
+		i++;
+	}
+}
+
+int smbios_string_table_len(u8 *start)
+{
+	char *p = (char *)start;
+	int i, len = 0;
+
+	while (*p) {
+		i = strlen(p) + 1;
+		p += i;
+		len += i;
+	}
+
+	if (!len)
+		return 2;
+
+	return len + 1;
+}
+
+int smbios_full_table_len(struct smbios_header *header, u8 *str_table_start)
+{
+	return header->length + smbios_string_table_len(str_table_start);
+}
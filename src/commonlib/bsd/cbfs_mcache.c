@@ -20,11 +20,23 @@
  * metadata (entry->file.h.offset). The next mcache_entry begins at the next
  * CBFS_MCACHE_ALIGNMENT boundary after that. The cache is terminated by a special 4-byte
  * mcache_entry that consists only of a magic number (MCACHE_MAGIC_END or MCACHE_MAGIC_FULL).
+ *
+ * If the cache was terminated with MCACHE_MAGIC_END and enough space is left, the cache also
+ * contains a hash index that is placed flush against the end of the cache area (after the
+ * terminating magic, with unspecified padding in between). The last 4 bytes of the cache area
+ * are MCACHE_MAGIC_INDEX and the 4 bytes before that contain the number of slots (a power of
+ * two) in the open-addressing hash table which immediately precedes them. Each slot holds the
+ * hash of a filename and the offset of the corresponding mcache_entry from the start of the
+ * cache (or MCACHE_INDEX_EMPTY). Readers that don't know about the index just stop at the
+ * terminating magic, so the index doesn't change the format of the entries themselves.
  */
 
 #define MCACHE_MAGIC_FILE	0x454c4946	/* 'FILE' */
 #define MCACHE_MAGIC_FULL	0x4c4c5546	/* 'FULL' */
 #define MCACHE_MAGIC_END	0x444e4524	/* '$END' */
+#define MCACHE_MAGIC_INDEX	0x58444924	/* '$IDX' */
+
+#define MCACHE_INDEX_EMPTY	0xffffffff
 
 union mcache_entry {
 	union cbfs_mdata file;
@@ -34,6 +46,158 @@ union mcache_entry {
 	};
 };
 
+struct mcache_index_slot {
+	uint32_t hash;
+	uint32_t offset;
+};
+
+struct mcache_index_trailer {
+	uint32_t slots;
+	uint32_t magic;
+};
+
+/* 32-bit FNV-1a over the filename, including the trailing \0 counted in |namesize|. */
+static uint32_t mcache_hash_name(const char *name, size_t namesize)
+{
+	uint32_t hash = 0x811c9dc5;
+
+	while (namesize--) {
+		hash ^= (uint8_t)*name++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+static const struct mcache_index_trailer *mcache_find_index(const void *mcache,
+							    size_t mcache_size)
+{
+	const struct mcache_index_trailer *trailer;
+
+	if (mcache_size < sizeof(*trailer))
+		return NULL;
+
+	trailer = mcache + ALIGN_DOWN(mcache_size, CBFS_MCACHE_ALIGNMENT) - sizeof(*trailer);
+	if (trailer->magic != MCACHE_MAGIC_INDEX || !trailer->slots ||
+	    trailer->slots > ((void *)trailer - mcache) / sizeof(struct mcache_index_slot))
+		return NULL;
+
+	return trailer;
+}
+
+static size_t mcache_index_size(const struct mcache_index_trailer *trailer)
+{
+	return trailer->slots * sizeof(struct mcache_index_slot) + sizeof(*trailer);
+}
+
+/* Make sure stale data left in the unused part of the cache doesn't look like an index. */
+static void mcache_invalidate_index(void *mcache, size_t mcache_size, size_t used)
+{
+	struct mcache_index_trailer *trailer = mcache + mcache_size - sizeof(*trailer);
+
+	if (mcache_size - used >= sizeof(trailer->magic))
+		trailer->magic = 0;
+}
+
+/*
+ * Build the hash index for the |count| entries in the terminated cache at |mcache|. |used| is
+ * the amount of bytes taken by the entries and the terminating magic. The index is skipped if
+ * it doesn't fit into the remaining space, lookups will fall back to a linear scan then.
+ */
+static void mcache_build_index(void *mcache, size_t mcache_size, size_t used, int count)
+{
+	struct mcache_index_trailer *trailer = mcache + mcache_size - sizeof(*trailer);
+	struct mcache_index_slot *table;
+	uint32_t slots = 1;
+	void *current;
+
+	/* Keep the table at most 2/3 full so probe sequences stay short. */
+	while (slots < count + count / 2)
+		slots <<= 1;
+
+	if (mcache_size - used < slots * sizeof(*table) + sizeof(*trailer)) {
+		DEBUG("No space for mcache index (%d files)\n", count);
+		mcache_invalidate_index(mcache, mcache_size, used);
+		return;
+	}
+
+	table = (void *)trailer - slots * sizeof(*table);
+	for (uint32_t i = 0; i < slots; i++)
+		table[i].offset = MCACHE_INDEX_EMPTY;
+
+	for (current = mcache; current < mcache + used - sizeof(uint32_t);) {
+		const union mcache_entry *entry = current;
+		const uint32_t data_offset = be32toh(entry->file.h.offset);
+		const size_t maxlen = data_offset - offsetof(union cbfs_mdata, h.filename);
+		const uint32_t hash = mcache_hash_name(entry->file.h.filename,
+						       strnlen(entry->file.h.filename, maxlen) + 1);
+		uint32_t i = hash & (slots - 1);
+
+		/* Inserting in cache order keeps the first of duplicate names first in the
+		   probe sequence, just like with a linear scan. */
+		while (table[i].offset != MCACHE_INDEX_EMPTY)
+			i = (i + 1) & (slots - 1);
+		table[i].hash = hash;
+		table[i].offset = current - mcache;
+
+		current += ALIGN_UP(data_offset, CBFS_MCACHE_ALIGNMENT);
+	}
+
+	trailer->slots = slots;
+	trailer->magic = MCACHE_MAGIC_INDEX;
+}
+
+static cb_err_t mcache_found(const union mcache_entry *entry, const char *name,
+			     union cbfs_mdata *mdata_out, size_t *data_offset_out)
+{
+	const uint32_t data_offset = be32toh(entry->file.h.offset);
+
+	LOG("Found '%s' @%#x size %#x in mcache @%p\n",
+	    name, entry->offset, be32toh(entry->file.h.len), entry);
+	*data_offset_out = entry->offset + data_offset;
+	memcpy(mdata_out, &entry->file, data_offset);
+	return CB_SUCCESS;
+}
+
+static bool mcache_name_matches(const union mcache_entry *entry, const char *name,
+				size_t namesize)
+{
+	const uint32_t data_offset = be32toh(entry->file.h.offset);
+
+	return namesize <= data_offset - offsetof(union cbfs_mdata, h.filename) &&
+	       memcmp(name, entry->file.h.filename, namesize) == 0;
+}
+
+static cb_err_t mcache_index_lookup(const void *mcache,
+				    const struct mcache_index_trailer *trailer,
+				    const char *name, size_t namesize,
+				    union cbfs_mdata *mdata_out, size_t *data_offset_out)
+{
+	const struct mcache_index_slot *table = (const void *)trailer -
+						trailer->slots * sizeof(*table);
+	const uint32_t hash = mcache_hash_name(name, namesize);
+	const uint32_t mask = trailer->slots - 1;
+
+	for (uint32_t n = 0, i = hash & mask; n < trailer->slots; n++, i = (i + 1) & mask) {
+		if (table[i].offset == MCACHE_INDEX_EMPTY)
+			return CB_CBFS_NOT_FOUND;
+		if (table[i].hash != hash)
+			continue;
+
+		const union mcache_entry *entry = mcache + table[i].offset;
+		if ((void *)entry + sizeof(entry->file.h) > (void *)table) {
+			ERROR("CBFS mcache index is corrupted!\n");
+			return CB_ERR;
+		}
+
+		assert(entry->magic == MCACHE_MAGIC_FILE);
+		if (mcache_name_matches(entry, name, namesize))
+			return mcache_found(entry, name, mdata_out, data_offset_out);
+	}
+
+	return CB_CBFS_NOT_FOUND;
+}
+
 struct cbfs_mcache_build_args {
 	void *mcache;
 	void *end;
@@ -78,9 +242,13 @@ cb_err_t cbfs_mcache_build(cbfs_dev_t dev, void *mcache, size_t size,
 	if (ret == CB_CBFS_NOT_FOUND) {
 		ret = CB_SUCCESS;
 		entry->magic = MCACHE_MAGIC_END;
+		mcache_build_index(mcache, ALIGN_DOWN(size, CBFS_MCACHE_ALIGNMENT),
+				   args.mcache + sizeof(entry->magic) - mcache, args.count);
 	} else if (ret == CB_CBFS_CACHE_FULL) {
 		ERROR("mcache overflow, should increase CBFS_MCACHE size!\n");
 		entry->magic = MCACHE_MAGIC_FULL;
+		mcache_invalidate_index(mcache, ALIGN_DOWN(size, CBFS_MCACHE_ALIGNMENT),
+					args.mcache + sizeof(entry->magic) - mcache);
 	}
 
 	LOG("mcache @%p built for %d files, used %#zx of %#zx bytes\n", mcache,
@@ -95,6 +263,11 @@ cb_err_t cbfs_mcache_lookup(const void *mcache, size_t mcache_size, const char *
 	const void *end = mcache + mcache_size;
 	const void *current = mcache;
 
+	const struct mcache_index_trailer *trailer = mcache_find_index(mcache, mcache_size);
+	if (trailer)
+		return mcache_index_lookup(mcache, trailer, name, namesize, mdata_out,
+					   data_offset_out);
+
 	while (current + sizeof(uint32_t) <= end) {
 		const union mcache_entry *entry = current;
 
@@ -104,25 +277,17 @@ cb_err_t cbfs_mcache_lookup(const void *mcache, size_t mcache_size, const char *
 			return CB_CBFS_CACHE_FULL;
 
 		assert(entry->magic == MCACHE_MAGIC_FILE);
-		const uint32_t data_offset = be32toh(entry->file.h.offset);
-		const uint32_t data_length = be32toh(entry->file.h.len);
-		if (namesize <= data_offset - offsetof(union cbfs_mdata, h.filename) &&
-		    memcmp(name, entry->file.h.filename, namesize) == 0) {
-			LOG("Found '%s' @%#x size %#x in mcache @%p\n",
-			    name, entry->offset, data_length, current);
-			*data_offset_out = entry->offset + data_offset;
-			memcpy(mdata_out, &entry->file, data_offset);
-			return CB_SUCCESS;
-		}
+		if (mcache_name_matches(entry, name, namesize))
+			return mcache_found(entry, name, mdata_out, data_offset_out);
 
-		current += ALIGN_UP(data_offset, CBFS_MCACHE_ALIGNMENT);
+		current += ALIGN_UP(be32toh(entry->file.h.offset), CBFS_MCACHE_ALIGNMENT);
 	}
 
 	ERROR("CBFS mcache is not terminated!\n");	/* should never happen */
 	return CB_ERR;
 }
 
-size_t cbfs_mcache_real_size(const void *mcache, size_t mcache_size)
+static size_t mcache_entries_size(const void *mcache, size_t mcache_size)
 {
 	const void *end = mcache + mcache_size;
 	const void *current = mcache;
@@ -141,3 +306,30 @@ size_t cbfs_mcache_real_size(const void *mcache, size_t mcache_size)
 
 	return current - mcache;
 }
+
+size_t cbfs_mcache_real_size(const void *mcache, size_t mcache_size)
+{
+	const struct mcache_index_trailer *trailer = mcache_find_index(mcache, mcache_size);
+	size_t size = mcache_entries_size(mcache, mcache_size);
+
+	if (trailer)
+		size += mcache_index_size(trailer);
+
+	return size;
+}
+
+void cbfs_mcache_copy(void *dst, const void *mcache, size_t mcache_size)
+{
+	const struct mcache_index_trailer *trailer = mcache_find_index(mcache, mcache_size);
+	size_t size = mcache_entries_size(mcache, mcache_size);
+
+	memcpy(dst, mcache, size);
+
+	/* Entry offsets in the index are relative to the cache start, so the index stays valid
+	   when it gets moved right behind the terminating magic. */
+	if (trailer) {
+		const size_t index_size = mcache_index_size(trailer);
+		memcpy(dst + size, (const void *)trailer + sizeof(*trailer) - index_size,
+		       index_size);
+	}
+}
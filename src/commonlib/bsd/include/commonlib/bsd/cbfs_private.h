@@ -118,4 +118,8 @@ cb_err_t cbfs_mcache_lookup(const void *mcache, size_t mcache_size, const char *
 /* Returns the amount of bytes actually used by the CBFS metadata cache in |mcache|. */
 size_t cbfs_mcache_real_size(const void *mcache, size_t mcache_size);
 
+/* Copy the CBFS metadata cache in |mcache| (including its lookup index, if any) into a
+ * cbfs_mcache_real_size() bytes area at |dst|, which can then be used as a cache itself. */
+void cbfs_mcache_copy(void *dst, const void *mcache, size_t mcache_size);
+
 #endif	/* _COMMONLIB_BSD_CBFS_PRIVATE_H_ */
@@ -34,6 +34,7 @@
 #define CBMEM_ID_MMA_DATA	0x4D4D4144
 #define CBMEM_ID_MMC_STATUS	0x4d4d4353
 #define CBMEM_ID_MPTABLE	0x534d5054
+#define CBMEM_ID_MP_REPORT	0x4d505250
 #define CBMEM_ID_MRCDATA	0x4d524344
 #define CBMEM_ID_PMC_CRASHLOG	0x504d435f
 #define CBMEM_ID_VAR_MRCDATA	0x4d524345
@@ -60,6 +61,7 @@
 #define CBMEM_ID_TCPA_LOG	0x54435041
 #define CBMEM_ID_TCPA_TCG_LOG	0x54445041
 #define CBMEM_ID_TIMESTAMP	0x54494d45
+#define CBMEM_ID_TIMESTAMP_GROWN 0x54534700  /* + generation */
 #define CBMEM_ID_TPM2_TCG_LOG	0x54504d32
 #define CBMEM_ID_TPM_PPI	0x54505049
 #define CBMEM_ID_VBOOT_HANDOFF	0x780074f0  /* deprecated */
@@ -109,6 +111,7 @@
 	{ CBMEM_ID_MMA_DATA,		"MMA DATA   " }, \
 	{ CBMEM_ID_MMC_STATUS,		"MMC STATUS " }, \
 	{ CBMEM_ID_MPTABLE,		"SMP TABLE  " }, \
+	{ CBMEM_ID_MP_REPORT,		"MP REPORT  " }, \
 	{ CBMEM_ID_MRCDATA,		"MRC DATA   " }, \
 	{ CBMEM_ID_PMC_CRASHLOG,	"PMC CRASHLOG"}, \
 	{ CBMEM_ID_VAR_MRCDATA,		"VARMRC DATA" }, \
@@ -131,6 +134,7 @@
 	{ CBMEM_ID_TCPA_LOG,		"TCPA LOG   " }, \
 	{ CBMEM_ID_TCPA_TCG_LOG,	"TCPA TCGLOG" }, \
 	{ CBMEM_ID_TIMESTAMP,		"TIME STAMP " }, \
+	{ CBMEM_ID_TIMESTAMP_GROWN,	"TIME STAMP+" }, \
 	{ CBMEM_ID_TPM2_TCG_LOG,	"TPM2 TCGLOG" }, \
 	{ CBMEM_ID_VBOOT_HANDOFF,	"VBOOT      " }, \
 	{ CBMEM_ID_VBOOT_SEL_REG,	"VBOOT SEL  " }, \
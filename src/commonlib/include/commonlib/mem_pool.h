@@ -8,13 +8,17 @@
 
 /*
  * The memory pool allows one to allocate memory from a fixed size buffer that
- * also allows freeing semantics for reuse. However, the current limitation is
- * that only the two most recent allocations  can be freed (in exact reverse
- * order). If one tries to free any allocation that isn't at the top of the
- * allocation stack, or one allocates more than two buffers in a row without
- * freeing, it will result in a leak within the memory pool. (Two allocations
- * were chosen to optimize for the CBFS cache case which may need two buffers
- * to map a single compressed file, and will free them in reverse order.)
+ * also allows freeing semantics for reuse. Allocations are carved off the top
+ * of the pool and may be freed in any order. Every allocation is preceded by a
+ * small header, so a freed allocation is merged with its free neighbours and
+ * its space is handed out again by later allocations that fit into it. Freeing
+ * the topmost allocation returns its space (and that of any free allocations
+ * directly below it) to the top of the pool.
+ *
+ * mem_pool_mark() and mem_pool_rewind() can be used to release everything that
+ * was allocated after a certain point at once, and the high-water mark records
+ * the largest amount of the pool that was ever in use, which can be used to
+ * size the backing buffer.
  *
  * The memory returned by allocations are at least 8 byte aligned. Note
  * that this requires the backing buffer to start on at least an 8 byte
@@ -24,25 +28,25 @@
 struct mem_pool {
 	uint8_t *buf;
 	size_t size;
-	uint8_t *last_alloc;
-	uint8_t *second_to_last_alloc;
-	size_t free_offset;
+	size_t free_offset;	/* End of the topmost allocation */
+	size_t last_size;	/* Size of the topmost allocation including its header */
+	size_t high_water;	/* Largest value free_offset has ever had */
 };
 
 #define MEM_POOL_INIT(buf_, size_)		\
 	{					\
 		.buf = (buf_),			\
 		.size = (size_),		\
-		.last_alloc = NULL,		\
-		.second_to_last_alloc = NULL,	\
 		.free_offset = 0,		\
+		.last_size = 0,			\
+		.high_water = 0,		\
 	}
 
+/* Free all allocations. The high-water mark is retained. */
 static inline void mem_pool_reset(struct mem_pool *mp)
 {
-	mp->last_alloc = NULL;
-	mp->second_to_last_alloc = NULL;
 	mp->free_offset = 0;
+	mp->last_size = 0;
 }
 
 /* Initialize a memory pool. */
@@ -50,13 +54,32 @@ static inline void mem_pool_init(struct mem_pool *mp, void *buf, size_t sz)
 {
 	mp->buf = buf;
 	mp->size = sz;
+	mp->high_water = 0;
 	mem_pool_reset(mp);
 }
 
 /* Allocate requested size from the memory pool. NULL returned on error. */
 void *mem_pool_alloc(struct mem_pool *mp, size_t sz);
 
-/* Free allocation from memory pool. */
+/* Free allocation from memory pool. Pointers not allocated from the pool are ignored. */
 void mem_pool_free(struct mem_pool *mp, void *alloc);
 
+/* Return a checkpoint that mem_pool_rewind() can later return the pool to. */
+static inline size_t mem_pool_mark(const struct mem_pool *mp)
+{
+	return mp->free_offset;
+}
+
+/*
+ * Free every allocation that was carved off the top of the pool after |mark| was taken.
+ * Allocations made after the checkpoint that reused space freed below it stay live.
+ */
+void mem_pool_rewind(struct mem_pool *mp, size_t mark);
+
+/* Return the largest number of bytes of the pool that were ever in use at the same time. */
+static inline size_t mem_pool_high_water(const struct mem_pool *mp)
+{
+	return mp->high_water;
+}
+
 #endif /* _MEM_POOL_H_ */
@@ -18,6 +18,19 @@ struct timestamp_table {
 	struct timestamp_entry entries[0]; /* Variable number of entries */
 } __packed;
 
+/*
+ * Entries recorded on CPUs other than the boot CPU carry the CPU index in the upper bits of
+ * entry_id. The index is 0 for all entries from the boot CPU.
+ */
+#define TIMESTAMP_CPU_SHIFT	24
+#define TIMESTAMP_ID_MASK	((1U << TIMESTAMP_CPU_SHIFT) - 1)
+#define TIMESTAMP_MAX_CPU	((1U << (32 - TIMESTAMP_CPU_SHIFT)) - 1)
+
+static inline uint32_t timestamp_entry_cpu(const struct timestamp_entry *tse)
+{
+	return tse->entry_id >> TIMESTAMP_CPU_SHIFT;
+}
+
 enum timestamp_id {
 	TS_START_ROMSTAGE = 1,
 	TS_BEFORE_INITRAM = 2,
@@ -36,6 +49,8 @@ enum timestamp_id {
 	TS_END_ULZMA = 16,
 	TS_START_ULZ4F = 17,
 	TS_END_ULZ4F = 18,
+	TS_START_CBFS_LOAD = 19,
+	TS_END_CBFS_LOAD = 20,
 	TS_DEVICE_ENUMERATE = 30,
 	TS_DEVICE_CONFIGURE = 40,
 	TS_DEVICE_ENABLE = 50,
@@ -56,6 +71,13 @@ enum timestamp_id {
 	TS_DELAY_END = 111,
 	TS_READ_UCODE_START = 112,
 	TS_READ_UCODE_END = 113,
+	TS_START_AP_TASK = 114,
+	TS_END_AP_TASK = 115,
+	TS_MP_AP_CHECKIN = 116,
+	TS_MP_RECORD_START = 117,
+	TS_MP_RECORD_END = 118,
+	TS_PCIE_RETRAIN_START = 119,
+	TS_PCIE_RETRAIN_END = 120,
 
 	/* 500+ reserved for vendorcode extensions (500-600: google/chromeos) */
 	TS_START_COPYVER = 501,
@@ -177,6 +199,8 @@ static const struct timestamp_id_to_name {
 	{ TS_END_ULZMA,		"finished LZMA decompress (ignore for x86)" },
 	{ TS_START_ULZ4F,	"starting LZ4 decompress (ignore for x86)" },
 	{ TS_END_ULZ4F,		"finished LZ4 decompress (ignore for x86)" },
+	{ TS_START_CBFS_LOAD,	"starting to load and hash CBFS file" },
+	{ TS_END_CBFS_LOAD,	"finished loading and hashing CBFS file" },
 	{ TS_DEVICE_ENUMERATE,	"device enumeration" },
 	{ TS_DEVICE_CONFIGURE,	"device configuration" },
 	{ TS_DEVICE_ENABLE,	"device enable" },
@@ -195,6 +219,13 @@ static const struct timestamp_id_to_name {
 	{ TS_DELAY_END,		"Forced delay end" },
 	{ TS_READ_UCODE_START,	"started reading uCode" },
 	{ TS_READ_UCODE_END,	"finished reading uCode" },
+	{ TS_START_AP_TASK,	"started work on AP" },
+	{ TS_END_AP_TASK,	"finished work on AP" },
+	{ TS_MP_AP_CHECKIN,	"AP checked in" },
+	{ TS_MP_RECORD_START,	"entered MP flight record" },
+	{ TS_MP_RECORD_END,	"finished MP flight record" },
+	{ TS_PCIE_RETRAIN_START, "started PCIe link retraining" },
+	{ TS_PCIE_RETRAIN_END,	"finished PCIe link retraining" },
 
 	{ TS_START_COPYVER,	"starting to load verstage" },
 	{ TS_END_COPYVER,	"finished loading verstage" },
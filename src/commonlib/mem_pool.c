@@ -3,34 +3,186 @@
 #include <commonlib/helpers.h>
 #include <commonlib/mem_pool.h>
 
+/*
+ * Each allocation is preceded by this header. The pool is a contiguous sequence of blocks
+ * from buf to buf + free_offset, and prev_size allows walking it backwards from the top.
+ */
+struct mem_pool_block {
+	uint32_t size;		/* Including this header, ORed with BLOCK_FREE. */
+	uint32_t prev_size;	/* 0 for the first block in the pool. */
+};
+
+#define BLOCK_FREE		(1 << 0)
+#define BLOCK_HEADER_SIZE	sizeof(struct mem_pool_block)
+#define MIN_BLOCK_SIZE		(BLOCK_HEADER_SIZE + 8)
+
+_Static_assert(BLOCK_HEADER_SIZE % 8 == 0, "mem_pool block header breaks alignment");
+
+static inline size_t block_size(const struct mem_pool_block *b)
+{
+	return b->size & ~BLOCK_FREE;
+}
+
+static inline size_t block_offset(const struct mem_pool *mp, const struct mem_pool_block *b)
+{
+	return (const uint8_t *)b - mp->buf;
+}
+
+static inline struct mem_pool_block *block_at(const struct mem_pool *mp, size_t offset)
+{
+	return (struct mem_pool_block *)&mp->buf[offset];
+}
+
+/* Return the block following |b|, or NULL if |b| is the topmost one. */
+static struct mem_pool_block *next_block(const struct mem_pool *mp,
+					 const struct mem_pool_block *b)
+{
+	const size_t next = block_offset(mp, b) + block_size(b);
+
+	return next < mp->free_offset ? block_at(mp, next) : NULL;
+}
+
+static struct mem_pool_block *prev_block(const struct mem_pool *mp,
+					 const struct mem_pool_block *b)
+{
+	return b->prev_size ? block_at(mp, block_offset(mp, b) - b->prev_size) : NULL;
+}
+
+/* Update the block following |b| after the size of |b| changed. */
+static void set_block_size(struct mem_pool *mp, struct mem_pool_block *b, size_t size)
+{
+	struct mem_pool_block *next;
+
+	b->size = size | (b->size & BLOCK_FREE);
+	next = next_block(mp, b);
+	if (next)
+		next->prev_size = size;
+	else
+		mp->last_size = size;
+}
+
+/* Drop the topmost block if it is free. Free blocks never have free neighbours. */
+static void trim_top(struct mem_pool *mp)
+{
+	struct mem_pool_block *top;
+
+	if (!mp->last_size)
+		return;
+
+	top = block_at(mp, mp->free_offset - mp->last_size);
+	if (top->size & BLOCK_FREE) {
+		mp->free_offset -= mp->last_size;
+		mp->last_size = top->prev_size;
+	}
+}
+
 void *mem_pool_alloc(struct mem_pool *mp, size_t sz)
 {
-	void *p;
+	struct mem_pool_block *b;
 
 	/* Make all allocations be at least 8 byte aligned. */
-	sz = ALIGN_UP(sz, 8);
+	if (sz > UINT32_MAX - BLOCK_HEADER_SIZE - 8)
+		return NULL;
+	sz = ALIGN_UP(sz, 8) + BLOCK_HEADER_SIZE;
+
+	/* Reuse the first free block that is large enough. */
+	for (b = mp->free_offset ? block_at(mp, 0) : NULL; b; b = next_block(mp, b)) {
+		const size_t size = block_size(b);
+
+		if (!(b->size & BLOCK_FREE) || size < sz)
+			continue;
+
+		b->size &= ~BLOCK_FREE;
+		if (size - sz >= MIN_BLOCK_SIZE) {
+			struct mem_pool_block *rest = block_at(mp, block_offset(mp, b) + sz);
+
+			set_block_size(mp, b, sz);
+			rest->size = BLOCK_FREE;
+			rest->prev_size = sz;
+			set_block_size(mp, rest, size - sz);
+		}
+		return b + 1;
+	}
 
 	/* Determine if any space available. */
 	if ((mp->size - mp->free_offset) < sz)
 		return NULL;
 
-	p = &mp->buf[mp->free_offset];
+	b = block_at(mp, mp->free_offset);
+	b->size = sz;
+	b->prev_size = mp->last_size;
 
 	mp->free_offset += sz;
-	mp->second_to_last_alloc = mp->last_alloc;
-	mp->last_alloc = p;
+	mp->last_size = sz;
+	mp->high_water = MAX(mp->high_water, mp->free_offset);
+
+	return b + 1;
+}
+
+/*
+ * Return the live block whose allocation starts at |p|, or NULL if there is none. The blocks
+ * are walked down from the top, where most frees happen, so that a pointer into the middle
+ * of an allocation is never mistaken for a block header.
+ */
+static struct mem_pool_block *find_block(const struct mem_pool *mp, const void *p)
+{
+	struct mem_pool_block *b;
+
+	if (p == NULL || (const uint8_t *)p < mp->buf + BLOCK_HEADER_SIZE ||
+	    (const uint8_t *)p >= mp->buf + mp->free_offset)
+		return NULL;
 
-	return p;
+	for (b = block_at(mp, mp->free_offset - mp->last_size); b; b = prev_block(mp, b)) {
+		if ((const void *)(b + 1) > p)
+			continue;
+		if ((const void *)(b + 1) < p || (b->size & BLOCK_FREE))
+			return NULL;
+		return b;
+	}
+
+	return NULL;
 }
 
 void mem_pool_free(struct mem_pool *mp, void *p)
 {
-	/* Determine if p was the most recent allocation. */
-	if (p == NULL || mp->last_alloc != p)
+	struct mem_pool_block *b, *neighbour;
+
+	/* Ignore anything that isn't an allocation from this pool. */
+	b = find_block(mp, p);
+	if (!b)
+		return;
+	b->size |= BLOCK_FREE;
+
+	neighbour = next_block(mp, b);
+	if (neighbour && (neighbour->size & BLOCK_FREE))
+		set_block_size(mp, b, block_size(b) + block_size(neighbour));
+
+	neighbour = prev_block(mp, b);
+	if (neighbour && (neighbour->size & BLOCK_FREE))
+		set_block_size(mp, neighbour, block_size(neighbour) + block_size(b));
+
+	trim_top(mp);
+}
+
+void mem_pool_rewind(struct mem_pool *mp, size_t mark)
+{
+	struct mem_pool_block *b;
+
+	if (mark >= mp->free_offset)
+		return;
+
+	/* Find the topmost block that starts below the mark. */
+	for (b = block_at(mp, mp->free_offset - mp->last_size); b; b = prev_block(mp, b)) {
+		if (block_offset(mp, b) < mark)
+			break;
+	}
+
+	if (!b) {
+		mem_pool_reset(mp);
 		return;
+	}
 
-	mp->free_offset = mp->last_alloc - mp->buf;
-	mp->last_alloc = mp->second_to_last_alloc;
-	/* No way to track allocation before this one. */
-	mp->second_to_last_alloc = NULL;
+	mp->free_offset = block_offset(mp, b) + block_size(b);
+	mp->last_size = block_size(b);
+	trim_top(mp);
 }
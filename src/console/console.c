@@ -25,9 +25,8 @@ void console_hw_init(void)
 	__system76_ec_init();
 }
 
-void console_tx_byte(unsigned char byte)
+void console_hw_tx_byte(unsigned char byte)
 {
-	__cbmemc_tx_byte(byte);
 	__spkmodem_tx_byte(byte);
 	__qemu_debugcon_tx_byte(byte);
 
@@ -47,6 +46,19 @@ void console_tx_byte(unsigned char byte)
 	__system76_ec_tx_byte(byte);
 }
 
+void console_tx_byte(unsigned char byte)
+{
+	__cbmemc_tx_byte(byte);
+	console_hw_tx_byte(byte);
+}
+
+void console_tx_bytes(const char *buf, size_t len)
+{
+	__cbmemc_tx_bytes(buf, len);
+	while (len--)
+		console_hw_tx_byte(*buf++);
+}
+
 void console_tx_flush(void)
 {
 	__uart_tx_flush();
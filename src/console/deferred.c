@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <bootstate.h>
+#include <console/console.h>
+#include <console/streams.h>
+#include <thread.h>
+#include <types.h>
+
+/*
+ * With CONSOLE_DEFERRED, vprintk() writes messages to the CBMEM console and queues them in
+ * this ring instead of driving the slow consoles itself. A cooperative thread drains the ring
+ * a few bytes at a time whenever the boot thread yields (udelay(), thread_yield(), ...). The
+ * ring keeps its own copy of the output instead of replaying the CBMEM console, as the latter
+ * also holds messages that are only meant for the CBMEM console (CONSOLE_LOG_FAST).
+ */
+
+#define RING_SIZE	CONFIG_CONSOLE_DEFERRED_BUFFER_SIZE
+#define RING_MASK	(RING_SIZE - 1)
+
+/*
+ * Bytes written per slice of the drain thread. Cooperation is disabled while writing, so this
+ * bounds how long a yield of the boot thread can take (about 90us per byte at 115200 baud).
+ */
+#define DRAIN_CHUNK	8
+
+_Static_assert((RING_SIZE & RING_MASK) == 0,
+	       "CONSOLE_DEFERRED_BUFFER_SIZE must be a power of two");
+
+/*
+ * The ring is protected by console_lock, which also serializes all writes to the consoles. The
+ * functions below must be called with it held, see console_deferred_write() and friends in
+ * printk.c. Only ring_stopped may also be set without the lock, on the way to die() or a reset.
+ */
+static u8 ring[RING_SIZE];
+/* Free-running indices, only ever used modulo RING_SIZE. */
+static size_t ring_head;
+static size_t ring_tail;
+static volatile bool ring_stopped;
+
+static struct thread_handle drain_handle;
+
+void console_deferred_drain(size_t count)
+{
+	if (ring_tail == ring_head)
+		return;
+
+	/* Console drivers may call udelay(), which must not switch threads in here. */
+	thread_coop_disable();
+
+	while (count-- && ring_tail != ring_head)
+		console_hw_tx_byte(ring[ring_tail++ & RING_MASK]);
+
+	if (ring_tail == ring_head)
+		console_tx_flush();
+
+	thread_coop_enable();
+}
+
+void console_deferred_tx_bytes(const char *buf, size_t len)
+{
+	while (len--) {
+		if (ring_stopped) {
+			console_hw_tx_byte(*buf++);
+			continue;
+		}
+		if (ring_head - ring_tail == RING_SIZE)
+			console_deferred_drain(RING_SIZE / 2);
+		ring[ring_head++ & RING_MASK] = *buf++;
+	}
+}
+
+int console_deferred_active(void)
+{
+	return !ring_stopped;
+}
+
+void console_deferred_stop(void)
+{
+	ring_stopped = true;
+}
+
+static enum cb_err console_drain_thread(void *arg)
+{
+	while (!ring_stopped) {
+		console_deferred_write(DRAIN_CHUNK);
+		thread_yield();
+	}
+
+	return CB_SUCCESS;
+}
+
+static void console_deferred_start(void *unused)
+{
+	if (thread_run(&drain_handle, console_drain_thread, NULL)) {
+		printk(BIOS_ERR, "Failed to start console drain thread\n");
+		console_deferred_flush();
+	}
+}
+
+static void console_deferred_finish(void *unused)
+{
+	console_deferred_flush();
+}
+
+BOOT_STATE_INIT_ENTRY(BS_PRE_DEVICE, BS_ON_ENTRY, console_deferred_start, NULL);
+BOOT_STATE_INIT_ENTRY(BS_PAYLOAD_BOOT, BS_ON_ENTRY, console_deferred_finish, NULL);
+BOOT_STATE_INIT_ENTRY(BS_OS_RESUME, BS_ON_ENTRY, console_deferred_finish, NULL);
@@ -18,6 +18,8 @@ void __noreturn die(const char *fmt, ...)
 {
 	va_list args;
 
+	console_deferred_panic();
+
 	va_start(args, fmt);
 	vprintk(BIOS_EMERG, fmt, args);
 	va_end(args);
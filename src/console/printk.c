@@ -59,15 +59,52 @@ void do_putchar(unsigned char byte)
 	console_time_stop();
 }
 
-static void wrap_putchar(unsigned char byte, void *data)
+static void wrap_putchars(const char *buf, size_t len, void *data)
 {
-	console_tx_byte(byte);
+	console_tx_bytes(buf, len);
+}
+
+static void wrap_putchars_cbmemc(const char *buf, size_t len, void *data)
+{
+	__cbmemc_tx_bytes(buf, len);
+}
+
+static void wrap_putchars_deferred(const char *buf, size_t len, void *data)
+{
+	__cbmemc_tx_bytes(buf, len);
+	console_deferred_tx_bytes(buf, len);
 }
 
-static void wrap_putchar_cbmemc(unsigned char byte, void *data)
+#if CONSOLE_DEFERRED
+void console_deferred_write(size_t count)
 {
-	__cbmemc_tx_byte(byte);
+	spin_lock(&console_lock);
+	console_deferred_drain(count);
+	spin_unlock(&console_lock);
+}
+
+void console_deferred_flush(void)
+{
+	spin_lock(&console_lock);
+	console_deferred_stop();
+	console_deferred_drain(CONFIG_CONSOLE_DEFERRED_BUFFER_SIZE);
+	spin_unlock(&console_lock);
+}
+
+void console_deferred_panic(void)
+{
+	/*
+	 * Stop queueing in any case, so that the messages that follow are written right away.
+	 * If the lock is taken, e.g. by the console driver that failed, leave the queued output
+	 * behind. It can still be found in the CBMEM console.
+	 */
+	console_deferred_stop();
+	if (!spin_trylock(&console_lock))
+		return;
+	console_deferred_drain(CONFIG_CONSOLE_DEFERRED_BUFFER_SIZE);
+	spin_unlock(&console_lock);
 }
+#endif
 
 int vprintk(int msg_level, const char *fmt, va_list args)
 {
@@ -85,9 +122,11 @@ int vprintk(int msg_level, const char *fmt, va_list args)
 	console_time_run();
 
 	if (log_this == CONSOLE_LOG_FAST) {
-		i = vtxprintf(wrap_putchar_cbmemc, fmt, args, NULL);
+		i = vtxprintf_bulk(wrap_putchars_cbmemc, fmt, args, NULL);
+	} else if (CONSOLE_DEFERRED && console_deferred_active()) {
+		i = vtxprintf_bulk(wrap_putchars_deferred, fmt, args, NULL);
 	} else {
-		i = vtxprintf(wrap_putchar, fmt, args, NULL);
+		i = vtxprintf_bulk(wrap_putchars, fmt, args, NULL);
 		console_tx_flush();
 	}
 
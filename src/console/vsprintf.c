@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: GPL-2.0-only */
 
+#include <commonlib/helpers.h>
 #include <console/vtxprintf.h>
 #include <string.h>
 
@@ -8,14 +9,14 @@ struct vsnprintf_context {
 	size_t buf_limit;
 };
 
-static void str_tx_byte(unsigned char byte, void *data)
+static void str_tx_bytes(const char *buf, size_t len, void *data)
 {
 	struct vsnprintf_context *ctx = data;
-	if (ctx->buf_limit) {
-		*ctx->str_buf = byte;
-		ctx->str_buf++;
-		ctx->buf_limit--;
-	}
+	size_t n = MIN(len, ctx->buf_limit);
+
+	memcpy(ctx->str_buf, buf, n);
+	ctx->str_buf += n;
+	ctx->buf_limit -= n;
 }
 
 int vsnprintf(char *buf, size_t size, const char *fmt, va_list args)
@@ -25,7 +26,7 @@ int vsnprintf(char *buf, size_t size, const char *fmt, va_list args)
 
 	ctx.str_buf = buf;
 	ctx.buf_limit = size ? size - 1 : 0;
-	i = vtxprintf(str_tx_byte, fmt, args, &ctx);
+	i = vtxprintf_bulk(str_tx_bytes, fmt, args, &ctx);
 	if (size)
 		*ctx.str_buf = '\0';
 
@@ -9,8 +9,6 @@
 #include <string.h>
 #include <types.h>
 
-#define call_tx(x) tx_byte(x, data)
-
 #define ZEROPAD	1		/* pad with zero */
 #define SIGN	2		/* unsigned/signed long */
 #define PLUS	4		/* show plus */
@@ -19,14 +17,64 @@
 #define SPECIAL	32		/* 0x */
 #define LARGE	64		/* use 'ABCDEF' instead of 'abcdef' */
 
-static int number(void (*tx_byte)(unsigned char byte, void *data),
-	unsigned long long inum, int base, int size, int precision, int type,
-	void *data)
+/*
+ * Output is collected in a small buffer on the stack and handed to the
+ * tx_bytes() callback in spans, so that the consumer is called once per
+ * chunk instead of once per character.
+ */
+struct tx_state {
+	void (*tx_bytes)(const char *buf, size_t len, void *data);
+	void *data;
+	int count;
+	size_t len;
+	char buf[VTXPRINTF_CHUNK_SIZE];
+};
+
+static void tx_flush(struct tx_state *tx)
+{
+	if (tx->len) {
+		tx->tx_bytes(tx->buf, tx->len, tx->data);
+		tx->len = 0;
+	}
+}
+
+static inline void tx_char(struct tx_state *tx, char c)
+{
+	if (tx->len == sizeof(tx->buf))
+		tx_flush(tx);
+	tx->buf[tx->len++] = c;
+	tx->count++;
+}
+
+static void tx_span(struct tx_state *tx, const char *s, size_t n)
+{
+	tx->count += n;
+
+	/* Hand long spans to the consumer directly instead of copying them. */
+	if (n >= sizeof(tx->buf)) {
+		tx_flush(tx);
+		tx->tx_bytes(s, n, tx->data);
+		return;
+	}
+
+	if (tx->len + n > sizeof(tx->buf))
+		tx_flush(tx);
+	memcpy(&tx->buf[tx->len], s, n);
+	tx->len += n;
+}
+
+static void tx_repeat(struct tx_state *tx, char c, int n)
+{
+	while (n-- > 0)
+		tx_char(tx, c);
+}
+
+static void number(struct tx_state *tx, unsigned long long inum, int base, int size,
+		   int precision, int type)
 {
 	char c, sign, tmp[66];
 	const char *digits = "0123456789abcdef";
 	int i;
-	int count = 0;
 	unsigned long long num = inum;
 	long long snum = num;
 
@@ -55,56 +103,72 @@ static int number(void (*tx_byte)(unsigned char byte, void *data),
 		else if (base == 8)
 			size--;
 	}
-	i = 0;
-	if (num == 0) {
-		tmp[i++] = '0';
+
+	/*
+	 * Digits are generated from the end of tmp so that they can be sent in
+	 * one span. Avoid 64-bit divisions where possible, they are library
+	 * calls on 32-bit targets.
+	 */
+	i = sizeof(tmp);
+	if (base == 16) {
+		do {
+			tmp[--i] = digits[num & 0xf];
+			num >>= 4;
+		} while (num != 0);
+	} else if (base == 8) {
+		do {
+			tmp[--i] = digits[num & 0x7];
+			num >>= 3;
+		} while (num != 0);
 	} else {
-		while (num != 0) {
-			tmp[i++] = digits[num % base];
+		while (num > UINT32_MAX) {
+			tmp[--i] = digits[num % base];
 			num /= base;
 		}
+		uint32_t num32 = num;
+		do {
+			tmp[--i] = digits[num32 % base];
+			num32 /= base;
+		} while (num32 != 0);
 	}
-	if (i > precision) {
-		precision = i;
-	}
+	const int ndigits = sizeof(tmp) - i;
+
+	if (ndigits > precision)
+		precision = ndigits;
 	size -= precision;
 	if (!(type&(ZEROPAD+LEFT))) {
-		while (size-- > 0)
-			call_tx(' '), count++;
-	}
-	if (sign) {
-		call_tx(sign), count++;
+		tx_repeat(tx, ' ', size);
+		size = 0;
 	}
+	if (sign)
+		tx_char(tx, sign);
 	if (type & SPECIAL) {
-		if (base == 8)
-			call_tx('0'), count++;
-		else if (base == 16) {
-			call_tx('0'), count++;
-			if (type & LARGE)
-				call_tx('X'), count++;
-			else
-				call_tx('x'), count++;
+		if (base == 8) {
+			tx_char(tx, '0');
+		} else if (base == 16) {
+			tx_char(tx, '0');
+			tx_char(tx, (type & LARGE) ? 'X' : 'x');
 		}
 	}
 	if (!(type & LEFT)) {
-		while (size-- > 0)
-			call_tx(c), count++;
+		tx_repeat(tx, c, size);
+		size = 0;
 	}
-	while (i < precision--)
-		call_tx('0'), count++;
-	while (i-- > 0)
-		call_tx(tmp[i]), count++;
-	while (size-- > 0)
-		call_tx(' '), count++;
-	return count;
+	tx_repeat(tx, '0', precision - ndigits);
+	tx_span(tx, &tmp[i], ndigits);
+	tx_repeat(tx, ' ', size);
 }
 
-int vtxprintf(void (*tx_byte)(unsigned char byte, void *data),
-	       const char *fmt, va_list args, void *data)
+int vtxprintf_bulk(void (*tx_bytes)(const char *buf, size_t len, void *data),
+		   const char *fmt, va_list args, void *data)
 {
+	struct tx_state tx = {
+		.tx_bytes = tx_bytes,
+		.data = data,
+	};
 	int len;
 	unsigned long long num;
-	int i, base;
+	int base;
 	const char *s;
 
 	int flags;		/* flags to number() */
@@ -114,11 +178,13 @@ int vtxprintf(void (*tx_byte)(unsigned char byte, void *data),
 				   number of chars for from string */
 	int qualifier;		/* 'h', 'H', 'l', 'L', 'z', or 'j' for integer fields */
 
-	int count;
-
-	for (count = 0; *fmt ; ++fmt) {
+	for (; *fmt ; ++fmt) {
 		if (*fmt != '%') {
-			call_tx(*fmt), count++;
+			/* Send the whole run of literal text at once. */
+			s = fmt;
+			while (fmt[1] && fmt[1] != '%')
+				fmt++;
+			tx_span(&tx, s, fmt - s + 1);
 			continue;
 		}
 
@@ -185,11 +251,10 @@ repeat:
 		switch (*fmt) {
 		case 'c':
 			if (!(flags & LEFT))
-				while (--field_width > 0)
-					call_tx(' '), count++;
-			call_tx((unsigned char) va_arg(args, int)), count++;
-			while (--field_width > 0)
-				call_tx(' '), count++;
+				tx_repeat(&tx, ' ', field_width - 1);
+			tx_char(&tx, (unsigned char) va_arg(args, int));
+			if (flags & LEFT)
+				tx_repeat(&tx, ' ', field_width - 1);
 			continue;
 
 		case 's':
@@ -199,14 +264,11 @@ repeat:
 
 			len = strnlen(s, (size_t)precision);
 
-			if (!(flags & LEFT)) {
-				while (len < field_width--)
-					call_tx(' '), count++;
-			}
-			for (i = 0; i < len; ++i)
-				call_tx(*s++), count++;
-			while (len < field_width--)
-				call_tx(' '), count++;
+			if (!(flags & LEFT))
+				tx_repeat(&tx, ' ', field_width - len);
+			tx_span(&tx, s, len);
+			if (flags & LEFT)
+				tx_repeat(&tx, ' ', field_width - len);
 			continue;
 
 		case 'p':
@@ -215,26 +277,25 @@ repeat:
 			if (field_width == -1 && precision == -1)
 				precision = 2*sizeof(uint32_t);
 			flags |= SPECIAL;
-			count += number(tx_byte,
-				(unsigned long) va_arg(args, void *), 16,
-				field_width, precision, flags, data);
+			number(&tx, (unsigned long) va_arg(args, void *), 16,
+			       field_width, precision, flags);
 			continue;
 
 		case 'n':
 			if (qualifier == 'L') {
 				long long *ip = va_arg(args, long long *);
-				*ip = count;
+				*ip = tx.count;
 			} else if (qualifier == 'l') {
 				long *ip = va_arg(args, long *);
-				*ip = count;
+				*ip = tx.count;
 			} else {
 				int *ip = va_arg(args, int *);
-				*ip = count;
+				*ip = tx.count;
 			}
 			continue;
 
 		case '%':
-			call_tx('%'), count++;
+			tx_char(&tx, '%');
 			continue;
 
 		/* integer number formats - set up the flags and "break" */
@@ -256,9 +317,9 @@ repeat:
 			break;
 
 		default:
-			call_tx('%'), count++;
+			tx_char(&tx, '%');
 			if (*fmt)
-				call_tx(*fmt), count++;
+				tx_char(&tx, *fmt);
 			else
 				--fmt;
 			continue;
@@ -284,7 +345,34 @@ repeat:
 		} else {
 			num = va_arg(args, unsigned int);
 		}
-		count += number(tx_byte, num, base, field_width, precision, flags, data);
+		number(&tx, num, base, field_width, precision, flags);
 	}
-	return count;
+
+	tx_flush(&tx);
+
+	return tx.count;
+}
+
+struct tx_byte_context {
+	void (*tx_byte)(unsigned char byte, void *data);
+	void *data;
+};
+
+static void tx_bytes_to_tx_byte(const char *buf, size_t len, void *data)
+{
+	struct tx_byte_context *ctx = data;
+
+	while (len--)
+		ctx->tx_byte(*buf++, ctx->data);
+}
+
+int vtxprintf(void (*tx_byte)(unsigned char byte, void *data),
+	      const char *fmt, va_list args, void *data)
+{
+	struct tx_byte_context ctx = {
+		.tx_byte = tx_byte,
+		.data = data,
+	};
+
+	return vtxprintf_bulk(tx_bytes_to_tx_byte, fmt, args, &ctx);
 }
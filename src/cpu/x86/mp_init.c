@@ -6,6 +6,7 @@
 #include <string.h>
 #include <rmodule.h>
 #include <arch/cpu.h>
+#include <cbmem.h>
 #include <commonlib/helpers.h>
 #include <cpu/cpu.h>
 #include <cpu/intel/microcode.h>
@@ -24,6 +25,7 @@
 #include <smp/spinlock.h>
 #include <symbols.h>
 #include <timer.h>
+#include <timestamp.h>
 #include <thread.h>
 
 #include <security/intel/stm/SmmStm.h>
@@ -126,6 +128,15 @@ static struct mp_flight_plan mp_info;
 /* Keep track of device structure for each CPU. */
 static struct device *cpus_dev[CONFIG_MAX_CPUS];
 
+/* AP bring-up timing in timestamp_get() ticks, see mp_write_bringup_report(). */
+static struct {
+	uint64_t init;
+	uint64_t sipi[2];
+	uint64_t all_checked_in;
+	/* Written by each AP when it enters ap_init(). */
+	uint64_t ap_checkin[CONFIG_MAX_CPUS];
+} mp_timing;
+
 static inline void barrier_wait(atomic_t *b)
 {
 	while (atomic_read(b) == 0)
@@ -164,11 +175,13 @@ static void ap_do_flight_plan(void)
 	for (i = 0; i < mp_info.num_records; i++) {
 		struct mp_flight_record *rec = &mp_info.records[i];
 
+		timestamp_add_now(TS_MP_RECORD_START);
 		atomic_inc(&rec->cpus_entered);
 		barrier_wait(&rec->barrier);
 
 		if (rec->ap_call != NULL)
 			rec->ap_call();
+		timestamp_add_now(TS_MP_RECORD_END);
 	}
 }
 
@@ -182,6 +195,9 @@ static void park_this_cpu(void *unused)
 static void asmlinkage ap_init(unsigned int cpu)
 {
 	struct cpu_info *info;
+	const uint64_t checkin = timestamp_get();
+
+	mp_timing.ap_checkin[cpu] = checkin;
 
 	/* Ensure the local APIC is enabled */
 	enable_lapic();
@@ -189,6 +205,7 @@ static void asmlinkage ap_init(unsigned int cpu)
 	info = cpu_info();
 	info->index = cpu;
 	info->cpu = cpus_dev[cpu];
+	timestamp_add(TS_MP_AP_CHECKIN, checkin);
 
 	cpu_add_map_entry(info->index);
 	thread_init_cpu_info_non_bsp(info);
@@ -417,6 +434,9 @@ static int apic_wait_timeout(int total_delay, int delay_step)
 
 static int start_aps(struct bus *cpu_bus, int ap_count, atomic_t *num_aps)
 {
+	/* How often the ICR and the AP check-in count are polled while starting APs. */
+	const int poll_us = CONFIG(X86_FAST_INIT_SIPI) ? 1 : 50;
+	const int checkin_poll_us = CONFIG(X86_FAST_INIT_SIPI) ? 1 : 15;
 	int sipi_vector;
 	/* Max location is 4KiB below 1MiB */
 	const int max_vector_loc = ((1 << 20) - (1 << 12)) >> 12;
@@ -440,7 +460,7 @@ static int start_aps(struct bus *cpu_bus, int ap_count, atomic_t *num_aps)
 
 	if (lapic_busy()) {
 		printk(BIOS_DEBUG, "Waiting for ICR not to be busy...");
-		if (apic_wait_timeout(1000 /* 1 ms */, 50)) {
+		if (apic_wait_timeout(1000 /* 1 ms */, poll_us)) {
 			printk(BIOS_ERR, "timed out. Aborting.\n");
 			return -1;
 		}
@@ -449,8 +469,9 @@ static int start_aps(struct bus *cpu_bus, int ap_count, atomic_t *num_aps)
 
 	/* Send INIT IPI to all but self. */
 	lapic_send_ipi(LAPIC_DEST_ALLBUT | LAPIC_INT_ASSERT | LAPIC_DM_INIT, 0);
+	mp_timing.init = timestamp_get();
 
-	if (!CONFIG(X86_AMD_INIT_SIPI)) {
+	if (!CONFIG(X86_AMD_INIT_SIPI) && !CONFIG(X86_FAST_INIT_SIPI)) {
 		printk(BIOS_DEBUG, "Waiting for 10ms after sending INIT.\n");
 		mdelay(10);
 	}
@@ -458,7 +479,7 @@ static int start_aps(struct bus *cpu_bus, int ap_count, atomic_t *num_aps)
 	/* Send 1st SIPI */
 	if (lapic_busy()) {
 		printk(BIOS_DEBUG, "Waiting for ICR not to be busy...");
-		if (apic_wait_timeout(1000 /* 1 ms */, 50)) {
+		if (apic_wait_timeout(1000 /* 1 ms */, poll_us)) {
 			printk(BIOS_ERR, "timed out. Aborting.\n");
 			return -1;
 		}
@@ -467,23 +488,31 @@ static int start_aps(struct bus *cpu_bus, int ap_count, atomic_t *num_aps)
 
 	lapic_send_ipi(LAPIC_DEST_ALLBUT | LAPIC_INT_ASSERT | LAPIC_DM_STARTUP | sipi_vector,
 		       0);
+	mp_timing.sipi[0] = timestamp_get();
 	printk(BIOS_DEBUG, "Waiting for 1st SIPI to complete...");
-	if (apic_wait_timeout(10000 /* 10 ms */, 50 /* us */)) {
+	if (apic_wait_timeout(10000 /* 10 ms */, poll_us)) {
 		printk(BIOS_ERR, "timed out.\n");
 		return -1;
 	}
 	printk(BIOS_DEBUG, "done.\n");
 
 	/* Wait for CPUs to check in up to 200 us. */
-	wait_for_aps(num_aps, ap_count, 200 /* us */, 15 /* us */);
+	if (!wait_for_aps(num_aps, ap_count, 200 /* us */, checkin_poll_us))
+		mp_timing.all_checked_in = timestamp_get();
 
 	if (CONFIG(X86_AMD_INIT_SIPI))
 		return 0;
 
+	/* APs that are running ignore the 2nd SIPI, so don't bother if all checked in. */
+	if (CONFIG(X86_FAST_INIT_SIPI) && mp_timing.all_checked_in) {
+		printk(BIOS_DEBUG, "All APs checked in after the 1st SIPI.\n");
+		return 0;
+	}
+
 	/* Send 2nd SIPI */
 	if (lapic_busy()) {
 		printk(BIOS_DEBUG, "Waiting for ICR not to be busy...");
-		if (apic_wait_timeout(1000 /* 1 ms */, 50)) {
+		if (apic_wait_timeout(1000 /* 1 ms */, poll_us)) {
 			printk(BIOS_ERR, "timed out. Aborting.\n");
 			return -1;
 		}
@@ -492,23 +521,72 @@ static int start_aps(struct bus *cpu_bus, int ap_count, atomic_t *num_aps)
 
 	lapic_send_ipi(LAPIC_DEST_ALLBUT | LAPIC_INT_ASSERT | LAPIC_DM_STARTUP | sipi_vector,
 		       0);
+	mp_timing.sipi[1] = timestamp_get();
 	printk(BIOS_DEBUG, "Waiting for 2nd SIPI to complete...");
-	if (apic_wait_timeout(10000 /* 10 ms */, 50 /* us */)) {
+	if (apic_wait_timeout(10000 /* 10 ms */, poll_us)) {
 		printk(BIOS_ERR, "timed out.\n");
 		return -1;
 	}
 	printk(BIOS_DEBUG, "done.\n");
 
 	/* Wait for CPUs to check in. */
-	if (wait_for_aps(num_aps, ap_count, 100000 /* 100 ms */, 50 /* us */)) {
+	if (wait_for_aps(num_aps, ap_count, 100000 /* 100 ms */, poll_us)) {
 		printk(BIOS_ERR, "Not all APs checked in: %d/%d.\n",
 		       atomic_read(num_aps), ap_count);
 		return -1;
 	}
+	if (!mp_timing.all_checked_in)
+		mp_timing.all_checked_in = timestamp_get();
 
 	return 0;
 }
 
+static uint32_t ticks_to_usecs(uint64_t ticks)
+{
+	return ticks / MAX(timestamp_tick_freq_mhz(), 1);
+}
+
+/* Store the AP bring-up timing in CBMEM, so it can be tuned without a debug console. */
+static void mp_write_bringup_report(int num_cpus)
+{
+	struct mp_bringup_report *report;
+	int slowest = 0;
+	int i;
+
+	report = cbmem_add(CBMEM_ID_MP_REPORT,
+			   sizeof(*report) + num_cpus * sizeof(report->cpus[0]));
+	if (report == NULL) {
+		printk(BIOS_ERR, "Failed to add MP bring-up report to CBMEM.\n");
+		return;
+	}
+
+	report->num_cpus = num_cpus;
+	report->tick_freq_mhz = timestamp_tick_freq_mhz();
+	report->init_ts = mp_timing.init;
+	report->sipi_us[0] = mp_timing.sipi[0] ? ticks_to_usecs(mp_timing.sipi[0] -
+								mp_timing.init) : 0;
+	report->sipi_us[1] = mp_timing.sipi[1] ? ticks_to_usecs(mp_timing.sipi[1] -
+								mp_timing.init) : 0;
+	report->all_checked_in_us = ticks_to_usecs(mp_timing.all_checked_in - mp_timing.init);
+	report->flight_plan_us = ticks_to_usecs(timestamp_get() - mp_timing.init);
+
+	for (i = 0; i < num_cpus; i++) {
+		report->cpus[i].apic_id = cpus_dev[i] ? cpus_dev[i]->path.apic.apic_id : 0;
+		report->cpus[i].checkin_us = 0;
+		if (i == 0 || !mp_timing.ap_checkin[i])
+			continue;
+		report->cpus[i].checkin_us = ticks_to_usecs(mp_timing.ap_checkin[i] -
+							    mp_timing.init);
+		if (report->cpus[i].checkin_us > report->cpus[slowest].checkin_us)
+			slowest = i;
+	}
+
+	printk(BIOS_INFO, "MP: SIPI after %u us, %d APs checked in after %u us "
+	       "(slowest: slot %d at %u us), flight plan done after %u us.\n",
+	       report->sipi_us[0], num_cpus - 1, report->all_checked_in_us, slowest,
+	       report->cpus[slowest].checkin_us, report->flight_plan_us);
+}
+
 static int bsp_do_flight_plan(struct mp_params *mp_params)
 {
 	int i;
@@ -529,6 +607,8 @@ static int bsp_do_flight_plan(struct mp_params *mp_params)
 	for (i = 0; i < mp_params->num_records; i++) {
 		struct mp_flight_record *rec = &mp_params->flight_plan[i];
 
+		timestamp_add_now(TS_MP_RECORD_START);
+
 		/* Wait for APs if the record is not released. */
 		if (atomic_read(&rec->barrier) == 0) {
 			/* Wait for the APs to check in. */
@@ -543,6 +623,7 @@ static int bsp_do_flight_plan(struct mp_params *mp_params)
 			rec->bsp_call();
 
 		release_barrier(&rec->barrier);
+		timestamp_add_now(TS_MP_RECORD_END);
 	}
 
 	printk(BIOS_INFO, "%s done after %ld msecs.\n", __func__,
@@ -642,7 +723,13 @@ static int mp_init(struct bus *cpu_bus, struct mp_params *p)
 	}
 
 	/* Walk the flight plan for the BSP. */
-	return bsp_do_flight_plan(p);
+	if (bsp_do_flight_plan(p) < 0)
+		return -1;
+
+	if (CONFIG(MP_BRINGUP_REPORT))
+		mp_write_bringup_report(p->num_cpus);
+
+	return 0;
 }
 
 /* Calls cpu_initialize(info->index) which calls the coreboot CPU drivers. */
@@ -979,8 +1066,11 @@ static void ap_wait_for_instruction(void)
 		if (lcb.logical_cpu_number && (cur_cpu !=
 				lcb.logical_cpu_number))
 			continue;
-		else
+		else {
+			timestamp_add_now(TS_START_AP_TASK);
 			lcb.func(lcb.arg);
+			timestamp_add_now(TS_END_AP_TASK);
+		}
 	}
 }
 
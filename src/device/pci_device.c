@@ -924,6 +924,111 @@ static int device_id_match(struct pci_driver *driver, unsigned short device_id)
 	return (driver->device == device_id);
 }
 
+/*
+ * Hash table of all vendor/device ID pairs the PCI drivers match, built on first use so that
+ * probing a device doesn't have to compare it against every driver. A pair matched by more
+ * than one driver refers to the first of them, like the linear scan does. Slots hold the
+ * index of the driver plus one, zero marks an empty slot. The table is kept at most half
+ * full. If the drivers match more IDs than that, they are scanned as before.
+ */
+#define PCI_DRIVER_INDEX_BITS	10
+
+struct pci_driver_slot {
+	u16 vendor;
+	u16 device;
+	u16 driver;
+};
+
+static struct pci_driver_slot pci_driver_index[1 << PCI_DRIVER_INDEX_BITS];
+static bool pci_driver_index_valid;
+static bool pci_driver_index_done;
+
+static unsigned int pci_driver_hash(u16 vendor, u16 device)
+{
+	return (((u32)vendor << 16 | device) * 0x9e3779b1U) >> (32 - PCI_DRIVER_INDEX_BITS);
+}
+
+static void pci_driver_index_insert(u16 vendor, u16 device, size_t driver)
+{
+	const unsigned int mask = ARRAY_SIZE(pci_driver_index) - 1;
+	struct pci_driver_slot *slot;
+	unsigned int i;
+
+	for (i = pci_driver_hash(vendor, device);; i = (i + 1) & mask) {
+		slot = &pci_driver_index[i];
+		if (!slot->driver)
+			break;
+		if (slot->vendor == vendor && slot->device == device)
+			return;
+	}
+
+	slot->vendor = vendor;
+	slot->device = device;
+	slot->driver = driver + 1;
+}
+
+static void build_pci_driver_index(void)
+{
+	const size_t num_drivers = &_epci_drivers[0] - &_pci_drivers[0];
+	struct pci_driver *driver;
+	const unsigned short *id;
+	size_t num_ids = 0;
+	size_t i;
+
+	pci_driver_index_done = true;
+
+	for (driver = &_pci_drivers[0]; driver != &_epci_drivers[0]; driver++) {
+		num_ids++;
+		for (id = driver->devices; id && *id; id++)
+			num_ids++;
+	}
+
+	if (!num_ids)
+		return;
+
+	if (num_ids > ARRAY_SIZE(pci_driver_index) / 2) {
+		printk(BIOS_DEBUG, "PCI: Too many driver IDs (%zu) to index\n", num_ids);
+		return;
+	}
+
+	for (i = 0; i < num_drivers; i++) {
+		driver = &_pci_drivers[i];
+		for (id = driver->devices; id && *id; id++)
+			pci_driver_index_insert(driver->vendor, *id, i);
+		pci_driver_index_insert(driver->vendor, driver->device, i);
+	}
+
+	pci_driver_index_valid = true;
+}
+
+/* Return the first PCI driver for the given IDs, or NULL if there is none. */
+static struct pci_driver *find_pci_driver(u16 vendor, u16 device)
+{
+	const struct pci_driver_slot *slot;
+	struct pci_driver *driver;
+	unsigned int mask, i;
+
+	if (!pci_driver_index_done)
+		build_pci_driver_index();
+
+	if (!pci_driver_index_valid) {
+		for (driver = &_pci_drivers[0]; driver != &_epci_drivers[0]; driver++) {
+			if ((driver->vendor == vendor) && device_id_match(driver, device))
+				return driver;
+		}
+		return NULL;
+	}
+
+	mask = ARRAY_SIZE(pci_driver_index) - 1;
+	for (i = pci_driver_hash(vendor, device);; i = (i + 1) & mask) {
+		slot = &pci_driver_index[i];
+		if (!slot->driver)
+			return NULL;
+		if (slot->vendor == vendor && slot->device == device)
+			return &_pci_drivers[slot->driver - 1];
+	}
+}
+
 /**
  * Set up PCI device operation.
  *
@@ -944,13 +1049,9 @@ static void set_pci_ops(struct device *dev)
 	 * Look through the list of setup drivers and find one for
 	 * this PCI device.
 	 */
-	for (driver = &_pci_drivers[0]; driver != &_epci_drivers[0]; driver++) {
-		if ((driver->vendor == dev->vendor) &&
-		    device_id_match(driver, dev->device)) {
-			dev->ops = (struct device_operations *)driver->ops;
-			break;
-		}
-	}
+	driver = find_pci_driver(dev->vendor, dev->device);
+	if (driver)
+		dev->ops = (struct device_operations *)driver->ops;
 
 	if (dev->ops) {
 		printk(BIOS_SPEW, "%s [%04x/%04x] %sops\n", dev_path(dev),
@@ -986,6 +1087,44 @@ bad:
 	}
 }
 
+/*
+ * Static devices on the bus that is being scanned, indexed by devfn. An entry points at the
+ * link (the bus' children pointer or the previous device's sibling pointer) that currently
+ * points at the device, so it can be moved without walking the list. Only the first device
+ * with a given devfn is indexed, the one a walk of the list would find. The table is only
+ * used during the probe loop of pci_scan_bus(), which doesn't nest.
+ */
+static struct {
+	struct device **link[256];
+	struct device **tail;	/* The NULL link at the end of the list, or before it. */
+} pci_scan_index;
+
+static void pci_scan_index_bus(struct bus *bus)
+{
+	struct device **link = &bus->children;
+	struct device *dev;
+
+	memset(&pci_scan_index, 0, sizeof(pci_scan_index));
+
+	for (dev = bus->children; dev; dev = dev->sibling) {
+		if (dev->path.type == DEVICE_PATH_PCI &&
+		    dev->path.pci.devfn < ARRAY_SIZE(pci_scan_index.link) &&
+		    !pci_scan_index.link[dev->path.pci.devfn])
+			pci_scan_index.link[dev->path.pci.devfn] = link;
+		link = &dev->sibling;
+	}
+
+	pci_scan_index.tail = link;
+}
+
+/* Return the static device with the given devfn that hasn't been scanned yet, if any. */
+static struct device *pci_scan_find_dev(unsigned int devfn)
+{
+	struct device **link = pci_scan_index.link[devfn];
+
+	return link ? *link : NULL;
+}
+
 /**
  * See if we have already allocated a device structure for a given devfn.
  *
@@ -993,45 +1132,45 @@ bad:
  * corresponding to the devfn, if present. Then move the device structure
  * as the last child on the bus.
  *
- * @param bus Pointer to the bus structure.
+ * The bus has to be indexed with pci_scan_index_bus() first.
+ *
  * @param devfn A device/function number.
  * @return Pointer to the device structure found or NULL if we have not
  *	   allocated a device for this devfn yet.
  */
-static struct device *pci_scan_get_dev(struct bus *bus, unsigned int devfn)
+static struct device *pci_scan_get_dev(unsigned int devfn)
 {
-	struct device *dev, **prev;
+	struct device **link = pci_scan_index.link[devfn];
+	struct device *dev, *next;
 
-	prev = &bus->children;
-	for (dev = bus->children; dev; dev = dev->sibling) {
-		if (dev->path.type == DEVICE_PATH_PCI && dev->path.pci.devfn == devfn) {
-			/* Unlink from the list. */
-			*prev = dev->sibling;
-			dev->sibling = NULL;
-			break;
-		}
-		prev = &dev->sibling;
-	}
+	if (!link)
+		return NULL;
+
+	dev = *link;
+	next = dev->sibling;
+	pci_scan_index.link[devfn] = NULL;
+
+	/* Unlink from the list, the next device is now linked from where this one was. */
+	if (next && next->path.type == DEVICE_PATH_PCI &&
+	    next->path.pci.devfn < ARRAY_SIZE(pci_scan_index.link) &&
+	    pci_scan_index.link[next->path.pci.devfn] == &dev->sibling)
+		pci_scan_index.link[next->path.pci.devfn] = link;
+	if (pci_scan_index.tail == &dev->sibling)
+		pci_scan_index.tail = link;
+	*link = next;
+	dev->sibling = NULL;
 
 	/*
 	 * Just like alloc_dev() add the device to the list of devices on the
 	 * bus. When the list of devices was formed we removed all of the
 	 * parents children, and now we are interleaving static and dynamic
-	 * devices in order on the bus.
+	 * devices in order on the bus. alloc_dev() may have appended devices
+	 * since the tail was last seen.
 	 */
-	if (dev) {
-		struct device *child;
-
-		/* Find the last child on the bus. */
-		for (child = bus->children; child && child->sibling;)
-			child = child->sibling;
-
-		/* Place the device as last on the bus. */
-		if (child)
-			child->sibling = dev;
-		else
-			bus->children = dev;
-	}
+	while (*pci_scan_index.tail)
+		pci_scan_index.tail = &(*pci_scan_index.tail)->sibling;
+	*pci_scan_index.tail = dev;
+	pci_scan_index.tail = &dev->sibling;
 
 	return dev;
 }
@@ -1232,19 +1371,21 @@ void pci_scan_bus(struct bus *bus, unsigned int min_devfn,
 
 	post_code(0x24);
 
+	pci_scan_index_bus(bus);
+
 	/*
 	 * Probe all devices/functions on this bus with some optimization for
 	 * non-existence and single function devices.
 	 */
 	for (devfn = min_devfn; devfn <= max_devfn; devfn++) {
 		if (CONFIG(MINIMAL_PCI_SCANNING)) {
-			dev = pcidev_path_behind(bus, devfn);
+			dev = pci_scan_find_dev(devfn);
 			if (!dev || !dev->mandatory)
 				continue;
 		}
 
 		/* First thing setup the device structure. */
-		dev = pci_scan_get_dev(bus, devfn);
+		dev = pci_scan_get_dev(devfn);
 
 		/* Devices marked 'hidden' do not get probed */
 		if (dev && dev->hidden) {
@@ -1315,6 +1456,10 @@ void pci_scan_bus(struct bus *bus, unsigned int min_devfn,
 
 	scan_bridges(bus);
 
+	/* The bridges on this bus may have left their links retraining. */
+	if (CONFIG(PCIEXP_CONCURRENT_RETRAIN))
+		pciexp_finish_link_retrain(bus);
+
 	/*
 	 * We've scanned the bus and so we know all about what's on the other
 	 * side of any bridges that may be on this bus plus any devices.
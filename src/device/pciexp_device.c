@@ -7,6 +7,9 @@
 #include <device/pci.h>
 #include <device/pci_ops.h>
 #include <device/pciexp.h>
+#include <string.h>
+#include <timer.h>
+#include <timestamp.h>
 
 unsigned int pciexp_find_extended_cap(struct device *dev, unsigned int cap)
 {
@@ -35,10 +38,27 @@ unsigned int pciexp_find_extended_cap(struct device *dev, unsigned int cap)
  * Re-train a PCIe link
  */
 #define PCIE_TRAIN_RETRY 10000
+
+static bool pciexp_link_training(struct device *dev, unsigned int cap)
+{
+	return pci_read_config16(dev, cap + PCI_EXP_LNKSTA) & PCI_EXP_LNKSTA_LT;
+}
+
+static void pciexp_set_retrain_link(struct device *dev, unsigned int cap)
+{
+	u16 lnk;
+
+	lnk = pci_read_config16(dev, cap + PCI_EXP_LNKCTL);
+	lnk |= PCI_EXP_LNKCTL_RL;
+	pci_write_config16(dev, cap + PCI_EXP_LNKCTL, lnk);
+}
+
 static int pciexp_retrain_link(struct device *dev, unsigned int cap)
 {
+	struct stopwatch sw;
 	unsigned int try;
-	u16 lnk;
+
+	stopwatch_init(&sw);
 
 	/*
 	 * Implementation note (page 633) in PCIe Specification 3.0 suggests
@@ -48,8 +68,7 @@ static int pciexp_retrain_link(struct device *dev, unsigned int cap)
 	 * Retrain Link mechanism.
 	 */
 	for (try = PCIE_TRAIN_RETRY; try > 0; try--) {
-		lnk = pci_read_config16(dev, cap + PCI_EXP_LNKSTA);
-		if (!(lnk & PCI_EXP_LNKSTA_LT))
+		if (!pciexp_link_training(dev, cap))
 			break;
 		udelay(100);
 	}
@@ -59,15 +78,17 @@ static int pciexp_retrain_link(struct device *dev, unsigned int cap)
 	}
 
 	/* Start link retraining */
-	lnk = pci_read_config16(dev, cap + PCI_EXP_LNKCTL);
-	lnk |= PCI_EXP_LNKCTL_RL;
-	pci_write_config16(dev, cap + PCI_EXP_LNKCTL, lnk);
+	timestamp_add_now(TS_PCIE_RETRAIN_START);
+	pciexp_set_retrain_link(dev, cap);
 
 	/* Wait for training to complete */
 	for (try = PCIE_TRAIN_RETRY; try > 0; try--) {
-		lnk = pci_read_config16(dev, cap + PCI_EXP_LNKSTA);
-		if (!(lnk & PCI_EXP_LNKSTA_LT))
+		if (!pciexp_link_training(dev, cap)) {
+			timestamp_add_now(TS_PCIE_RETRAIN_END);
+			printk(BIOS_DEBUG, "%s: Link retrained in %ld usecs\n", dev_path(dev),
+			       stopwatch_duration_usecs(&sw));
 			return 0;
+		}
 		udelay(100);
 	}
 
@@ -78,9 +99,9 @@ static int pciexp_retrain_link(struct device *dev, unsigned int cap)
 /*
  * Check the Slot Clock Configuration for root port and endpoint
  * and enable Common Clock Configuration if possible.  If CCC is
- * enabled the link must be retrained.
+ * enabled the link must be retrained, which is left to the caller.
  */
-static void pciexp_enable_common_clock(struct device *root, unsigned int root_cap,
+static bool pciexp_enable_common_clock(struct device *root, unsigned int root_cap,
 				       struct device *endp, unsigned int endp_cap)
 {
 	u16 root_scc, endp_scc, lnkctl;
@@ -93,23 +114,23 @@ static void pciexp_enable_common_clock(struct device *root, unsigned int root_ca
 	endp_scc = pci_read_config16(endp, endp_cap + PCI_EXP_LNKSTA);
 	endp_scc &= PCI_EXP_LNKSTA_SLC;
 
-	/* Enable Common Clock Configuration and retrain */
-	if (root_scc && endp_scc) {
-		printk(BIOS_INFO, "Enabling Common Clock Configuration\n");
+	/* Enable Common Clock Configuration */
+	if (!root_scc || !endp_scc)
+		return false;
 
-		/* Set in endpoint */
-		lnkctl = pci_read_config16(endp, endp_cap + PCI_EXP_LNKCTL);
-		lnkctl |= PCI_EXP_LNKCTL_CCC;
-		pci_write_config16(endp, endp_cap + PCI_EXP_LNKCTL, lnkctl);
+	printk(BIOS_INFO, "Enabling Common Clock Configuration\n");
 
-		/* Set in root port */
-		lnkctl = pci_read_config16(root, root_cap + PCI_EXP_LNKCTL);
-		lnkctl |= PCI_EXP_LNKCTL_CCC;
-		pci_write_config16(root, root_cap + PCI_EXP_LNKCTL, lnkctl);
+	/* Set in endpoint */
+	lnkctl = pci_read_config16(endp, endp_cap + PCI_EXP_LNKCTL);
+	lnkctl |= PCI_EXP_LNKCTL_CCC;
+	pci_write_config16(endp, endp_cap + PCI_EXP_LNKCTL, lnkctl);
 
-		/* Retrain link if CCC was enabled */
-		pciexp_retrain_link(root, root_cap);
-	}
+	/* Set in root port */
+	lnkctl = pci_read_config16(root, root_cap + PCI_EXP_LNKCTL);
+	lnkctl |= PCI_EXP_LNKCTL_CCC;
+	pci_write_config16(root, root_cap + PCI_EXP_LNKCTL, lnkctl);
+
+	return true;
 }
 
 static void pciexp_enable_clock_power_pm(struct device *endp, unsigned int endp_cap)
@@ -466,23 +487,10 @@ static void pciexp_set_max_payload_size(struct device *root, unsigned int root_c
 	printk(BIOS_INFO, "PCIe: Max_Payload_Size adjusted to %d\n", (1 << (max_payload + 7)));
 }
 
-static void pciexp_tune_dev(struct device *dev)
+/* Configure the link between a port and the device below it, once it is trained. */
+static void pciexp_tune_link(struct device *root, unsigned int root_cap,
+			     struct device *dev, unsigned int cap)
 {
-	struct device *root = dev->bus->dev;
-	unsigned int root_cap, cap;
-
-	cap = pci_find_capability(dev, PCI_CAP_ID_PCIE);
-	if (!cap)
-		return;
-
-	root_cap = pci_find_capability(root, PCI_CAP_ID_PCIE);
-	if (!root_cap)
-		return;
-
-	/* Check for and enable Common Clock */
-	if (CONFIG(PCIEXP_COMMON_CLOCK))
-		pciexp_enable_common_clock(root, root_cap, dev, cap);
-
 	/* Check if per port CLK req is supported by endpoint*/
 	if (CONFIG(PCIEXP_CLK_PM))
 		pciexp_enable_clock_power_pm(dev, cap);
@@ -501,6 +509,151 @@ static void pciexp_tune_dev(struct device *dev)
 	pciexp_configure_ltr(root, root_cap, dev, cap);
 }
 
+/*
+ * Links that are retraining while the scan goes on. Their ports are on the bus that is being
+ * scanned, or one above it, and pciexp_finish_link_retrain() is called once the scan of that
+ * bus is done. This way all ports on a bus train their links at the same time. A link that
+ * is still training when it is queued only gets the Retrain Link bit set once that is done,
+ * which is also waited for in pciexp_finish_link_retrain().
+ *
+ * TS_PCIE_RETRAIN_START and TS_PCIE_RETRAIN_END mark when the first link was queued and the
+ * last one was done. The time of each port is logged.
+ */
+#define PCIE_MAX_RETRAINING 32
+
+static struct pciexp_retraining {
+	struct device *root;
+	unsigned int root_cap;
+	struct device *dev;
+	unsigned int cap;
+	bool started;
+	struct stopwatch sw;
+} retraining[PCIE_MAX_RETRAINING];
+static size_t num_retraining;
+
+static void pciexp_finish_retraining(size_t i, bool trained)
+{
+	struct pciexp_retraining *link = &retraining[i];
+
+	if (trained)
+		printk(BIOS_DEBUG, "%s: Link retrained in %ld usecs\n", dev_path(link->root),
+		       stopwatch_duration_usecs(&link->sw));
+	else
+		printk(BIOS_ERR, "%s: Link Retrain timeout\n", dev_path(link->root));
+
+	pciexp_tune_link(link->root, link->root_cap, link->dev, link->cap);
+
+	num_retraining--;
+	memmove(link, link + 1, (num_retraining - i) * sizeof(*link));
+
+	if (!num_retraining)
+		timestamp_add_now(TS_PCIE_RETRAIN_END);
+}
+
+static bool pciexp_retraining_on_bus(const struct pciexp_retraining *link,
+				     const struct bus *bus)
+{
+	return !bus || link->root->bus == bus;
+}
+
+/* Start retraining the link if it isn't training anymore. Return true once it is done. */
+static bool pciexp_poll_retraining(struct pciexp_retraining *link)
+{
+	if (pciexp_link_training(link->root, link->root_cap))
+		return false;
+
+	if (link->started)
+		return true;
+
+	pciexp_set_retrain_link(link->root, link->root_cap);
+	link->started = true;
+	return false;
+}
+
+void pciexp_finish_link_retrain(struct bus *bus)
+{
+	struct stopwatch sw;
+	bool pending;
+	size_t i;
+
+	/* All links get the time one link would have to retrain, counting from now. */
+	stopwatch_init_usecs_expire(&sw, PCIE_TRAIN_RETRY * 100);
+
+	do {
+		pending = false;
+		for (i = 0; i < num_retraining;) {
+			if (!pciexp_retraining_on_bus(&retraining[i], bus)) {
+				i++;
+				continue;
+			}
+			if (!pciexp_poll_retraining(&retraining[i])) {
+				pending = true;
+				i++;
+				continue;
+			}
+			pciexp_finish_retraining(i, true);
+		}
+		if (!pending)
+			return;
+		udelay(100);
+	} while (!stopwatch_expired(&sw));
+
+	for (i = 0; i < num_retraining;) {
+		if (pciexp_retraining_on_bus(&retraining[i], bus))
+			pciexp_finish_retraining(i, false);
+		else
+			i++;
+	}
+}
+
+static void pciexp_defer_tune_link(struct device *root, unsigned int root_cap,
+				   struct device *dev, unsigned int cap)
+{
+	struct pciexp_retraining *link;
+
+	if (num_retraining == ARRAY_SIZE(retraining))
+		pciexp_finish_link_retrain(NULL);
+
+	if (!num_retraining)
+		timestamp_add_now(TS_PCIE_RETRAIN_START);
+
+	link = &retraining[num_retraining++];
+	link->root = root;
+	link->root_cap = root_cap;
+	link->dev = dev;
+	link->cap = cap;
+	link->started = false;
+	stopwatch_init(&link->sw);
+
+	/* See the implementation note in pciexp_retrain_link(). */
+	pciexp_poll_retraining(link);
+}
+
+static void pciexp_tune_dev(struct device *dev)
+{
+	struct device *root = dev->bus->dev;
+	unsigned int root_cap, cap;
+
+	cap = pci_find_capability(dev, PCI_CAP_ID_PCIE);
+	if (!cap)
+		return;
+
+	root_cap = pci_find_capability(root, PCI_CAP_ID_PCIE);
+	if (!root_cap)
+		return;
+
+	/* Check for and enable Common Clock, the link has to be retrained for it. */
+	if (CONFIG(PCIEXP_COMMON_CLOCK) && pciexp_enable_common_clock(root, root_cap, dev, cap)) {
+		if (CONFIG(PCIEXP_CONCURRENT_RETRAIN)) {
+			pciexp_defer_tune_link(root, root_cap, dev, cap);
+			return;
+		}
+		pciexp_retrain_link(root, root_cap);
+	}
+
+	pciexp_tune_link(root, root_cap, dev, cap);
+}
+
 void pciexp_scan_bus(struct bus *bus, unsigned int min_devfn,
 			     unsigned int max_devfn)
 {
@@ -58,3 +58,80 @@ const struct device *largest_resource(struct bus *bus,
 	*result_res = state.result;
 	return state.result_dev;
 }
+
+struct sort_resources_state {
+	struct bus_resource *list;
+	size_t max;
+	size_t count;
+};
+
+static void gather_resource(void *gp, struct device *dev, struct resource *resource)
+{
+	struct sort_resources_state *state = gp;
+
+	if (resource->flags & IORESOURCE_FIXED)
+		return;
+
+	if (state->count < state->max) {
+		state->list[state->count].dev = dev;
+		state->list[state->count].res = resource;
+		state->list[state->count].seq = state->count;
+	}
+	state->count++;
+}
+
+/* Order in which largest_resource() picks resources, ties are broken by bus order. */
+static bool bus_resource_before(const struct bus_resource *a, const struct bus_resource *b)
+{
+	if (a->res->align != b->res->align)
+		return a->res->align > b->res->align;
+	if (a->res->size != b->res->size)
+		return a->res->size > b->res->size;
+	return a->seq < b->seq;
+}
+
+static void sift_down(struct bus_resource *list, size_t root, size_t count)
+{
+	struct bus_resource tmp;
+	size_t child;
+
+	while ((child = 2 * root + 1) < count) {
+		if (child + 1 < count && bus_resource_before(&list[child], &list[child + 1]))
+			child++;
+		if (!bus_resource_before(&list[root], &list[child]))
+			return;
+		tmp = list[root];
+		list[root] = list[child];
+		list[child] = tmp;
+		root = child;
+	}
+}
+
+size_t sort_bus_resources(struct bus *bus, unsigned long type_mask, unsigned long type,
+			  struct bus_resource *list, size_t max)
+{
+	struct sort_resources_state state = {
+		.list = list,
+		.max = max,
+	};
+	struct bus_resource tmp;
+	size_t i;
+
+	search_bus_resources(bus, type_mask, type, gather_resource, &state);
+
+	if (state.count > max)
+		return state.count;
+
+	/* Heapsort, which needs no extra memory. The sequence numbers make it stable. */
+	for (i = state.count / 2; i > 0; i--)
+		sift_down(list, i - 1, state.count);
+
+	for (i = state.count; i > 1; i--) {
+		tmp = list[0];
+		list[0] = list[i - 1];
+		list[i - 1] = tmp;
+		sift_down(list, 0, i - 1);
+	}
+
+	return state.count;
+}
@@ -34,6 +34,56 @@ static bool dev_has_children(const struct device *dev)
 	return bus && bus->children;
 }
 
+/*
+ * Scratch array for sort_bus_resources(). Resources on buses with more resources of a type
+ * than fit are picked with largest_resource() instead, which gives the same order but rescans
+ * the bus for every resource. Only one bus is walked at a time, so one array is enough.
+ */
+#define MAX_SORTED_RESOURCES	256
+
+static struct bus_resource sorted_resources[MAX_SORTED_RESOURCES];
+
+struct resource_iter {
+	struct bus *bus;
+	unsigned long type_mask;
+	unsigned long type_match;
+	struct resource *last;
+	size_t count;
+	size_t next;
+};
+
+static void resource_iter_init(struct resource_iter *iter, struct bus *bus,
+			       unsigned long type_mask, unsigned long type_match)
+{
+	iter->bus = bus;
+	iter->type_mask = type_mask;
+	iter->type_match = type_match;
+	iter->last = NULL;
+	iter->next = 0;
+	iter->count = sort_bus_resources(bus, type_mask, type_match, sorted_resources,
+					 ARRAY_SIZE(sorted_resources));
+}
+
+/* Return the next largest resource of the bus and its device, or NULL when done. */
+static const struct device *resource_iter_next(struct resource_iter *iter,
+					       struct resource **res)
+{
+	const struct device *dev;
+
+	if (iter->count > ARRAY_SIZE(sorted_resources)) {
+		dev = largest_resource(iter->bus, &iter->last, iter->type_mask,
+				       iter->type_match);
+		*res = iter->last;
+		return dev;
+	}
+
+	if (iter->next == iter->count)
+		return NULL;
+
+	*res = sorted_resources[iter->next].res;
+	return sorted_resources[iter->next++].dev;
+}
+
 #define res_printk(depth, str, ...)	printk(BIOS_DEBUG, "%*c"str, depth, ' ', __VA_ARGS__)
 
 /*
@@ -52,13 +102,12 @@ static void update_bridge_resource(const struct device *bridge, struct resource
 {
 	const struct device *child;
 	struct resource *child_res;
+	struct resource_iter iter;
 	resource_t base;
 	bool first_child_res = true;
 	const unsigned long type_mask = IORESOURCE_TYPE_MASK | IORESOURCE_PREFETCH;
 	struct bus *bus = bridge->link_list;
 
-	child_res = NULL;
-
 	/*
 	 * `base` keeps track of where the next allocation for child resource can take place
 	 * from within the bridge resource window. Since the bridge resource window allocation
@@ -73,7 +122,8 @@ static void update_bridge_resource(const struct device *bridge, struct resource
 	       dev_path(bridge), resource2str(bridge_res), bridge_res->size,
 	       bridge_res->align, bridge_res->gran, bridge_res->limit);
 
-	while ((child = largest_resource(bus, &child_res, type_mask, type_match))) {
+	resource_iter_init(&iter, bus, type_mask, type_match);
+	while ((child = resource_iter_next(&iter, &child_res))) {
 
 		/* Size 0 resources can be skipped. */
 		if (!child_res->size)
@@ -85,7 +135,7 @@ static void update_bridge_resource(const struct device *bridge, struct resource
 		 * resources, alignment is taken care of by updating the base to round up as per
 		 * the child resource alignment. It is guaranteed that pass 2 follows the exact
 		 * same method of picking the resource for allocation using
-		 * largest_resource(). Thus, as long as the alignment for first child resource
+		 * resource_iter_next(). Thus, as long as the alignment for first child resource
 		 * is propagated up to the bridge resource, it can be guaranteed that the
 		 * alignment for all resources is appropriately met.
 		 */
@@ -365,10 +415,12 @@ static void print_resource_ranges(const struct device *dev, const struct memrang
 static void allocate_child_resources(struct bus *bus, struct memranges *ranges,
 				     unsigned long type_mask, unsigned long type_match)
 {
-	struct resource *resource = NULL;
+	struct resource *resource;
+	struct resource_iter iter;
 	const struct device *dev;
 
-	while ((dev = largest_resource(bus, &resource, type_mask, type_match))) {
+	resource_iter_init(&iter, bus, type_mask, type_match);
+	while ((dev = resource_iter_next(&iter, &resource))) {
 
 		if (!resource->size)
 			continue;
@@ -7,6 +7,7 @@
 #include <commonlib/region.h>
 #include <console/console.h>
 #include <smmstore.h>
+#include <string.h>
 #include <types.h>
 
 /*
@@ -25,10 +26,12 @@
  * the constraint that entries are either complete or will be ignored, as long
  * as flash is written sequentially and into a fully erased block.
  *
- * Future additions to the format will split the region in half with an active
- * block marker to allow safe compaction (ie. write the new data in the unused
- * region, mark it active after the write completed). Otherwise a well-timed
- * crash/reboot could clear out all variables.
+ * With SMMSTORE_COMPACTION, superseded entries are dropped when an append
+ * doesn't fit anymore, see compact_store(). That is done in place, so a
+ * well-timed crash/reboot could clear out variables. Future additions to the
+ * format will split the region in half with an active block marker to allow
+ * safe compaction (ie. write the new data in the unused region, mark it
+ * active after the write completed).
  */
 
 static enum cb_err lookup_store_region(struct region *region)
@@ -121,49 +124,219 @@ int smmstore_read_region(void *buf, ssize_t *bufsize)
 	return 0;
 }
 
-static enum cb_err scan_end(struct region_device *store)
+/*
+ * In-RAM index of the store, so that appending doesn't need to walk all entries on flash.
+ *
+ * It caches the end of the used area and maps the FNV-1a hash of each key to the offset of
+ * its most recent active entry. The index is built with a single scan of the store on first
+ * use and then updated with every append. It's dropped whenever the store is modified through
+ * other means, and the cached end is verified before each append to cope with flash changing
+ * underneath.
+ */
+
+#define INDEX_SLOTS	256
+#define INDEX_MAX_KEYS	(INDEX_SLOTS * 3 / 4)
+#define INDEX_KEY_MAX	256
+#define NO_ENTRY	0xffffffff
+
+struct index_slot {
+	uint32_t hash;
+	uint32_t offset;
+	uint32_t size;
+};
+
+static struct {
+	bool valid;
+	/* All active keys are indexed, which is required to tell live and stale entries apart. */
+	bool complete;
+	uint32_t end;
+	uint32_t keys;
+	/* Bytes occupied by the most recent active entry of each key. */
+	uint32_t live_bytes;
+	struct index_slot slots[INDEX_SLOTS];
+} store_index;
+
+static uint8_t key_buf[INDEX_KEY_MAX];
+
+static uint32_t entry_size(uint32_t key_sz, uint32_t value_sz)
+{
+	return ALIGN_UP(2 * sizeof(uint32_t) + key_sz + value_sz + 1, sizeof(uint32_t));
+}
+
+static uint32_t key_hash(const uint8_t *key, uint32_t key_sz)
+{
+	uint32_t hash = 0x811c9dc5;
+
+	while (key_sz--) {
+		hash ^= *key++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+static void index_reset(void)
+{
+	store_index.valid = false;
+	store_index.complete = true;
+	store_index.end = 0;
+	store_index.keys = 0;
+	store_index.live_bytes = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(store_index.slots); i++)
+		store_index.slots[i].offset = NO_ENTRY;
+}
+
+/* Returns true if the entry at |offset| in the store has the key |key|. */
+static bool entry_key_matches(const struct region_device *store, uint32_t offset,
+			      const uint8_t *key, uint32_t key_sz)
+{
+	uint8_t buf[64];
+	uint32_t k_sz;
+
+	if (rdev_readat(store, &k_sz, offset, sizeof(k_sz)) != sizeof(k_sz) || k_sz != key_sz)
+		return false;
+
+	offset += 2 * sizeof(uint32_t);
+	while (key_sz) {
+		const size_t len = MIN(key_sz, sizeof(buf));
+
+		if (rdev_readat(store, buf, offset, len) != len || memcmp(buf, key, len))
+			return false;
+		key += len;
+		key_sz -= len;
+		offset += len;
+	}
+
+	return true;
+}
+
+static struct index_slot *index_find(const struct region_device *store, const uint8_t *key,
+				     uint32_t key_sz, uint32_t hash)
 {
-	/* scan for end */
-	ssize_t end = 0;
-	uint32_t k_sz, v_sz;
-	const ssize_t data_sz = region_device_sz(store);
+	for (uint32_t i = hash % INDEX_SLOTS;; i = (i + 1) % INDEX_SLOTS) {
+		struct index_slot *slot = &store_index.slots[i];
+
+		if (slot->offset == NO_ENTRY)
+			return slot;
+		if (slot->hash == hash && entry_key_matches(store, slot->offset, key, key_sz))
+			return slot;
+	}
+}
+
+/* Record that the entry at |offset| is the most recent one for |key|. */
+static void index_insert(const struct region_device *store, const uint8_t *key,
+			 uint32_t key_sz, uint32_t offset, uint32_t size)
+{
+	struct index_slot *slot;
+	const uint32_t hash = key_hash(key, key_sz);
+
+	if (!store_index.complete)
+		return;
+
+	slot = index_find(store, key, key_sz, hash);
+	if (slot->offset != NO_ENTRY) {
+		store_index.live_bytes -= slot->size;
+	} else if (store_index.keys == INDEX_MAX_KEYS) {
+		printk(BIOS_DEBUG, "smm store: index full, compaction disabled\n");
+		store_index.complete = false;
+		return;
+	} else {
+		store_index.keys++;
+	}
+
+	slot->hash = hash;
+	slot->offset = offset;
+	slot->size = size;
+	store_index.live_bytes += size;
+}
+
+/* Read the header of the entry at |offset|. Returns false on the end marker or on errors. */
+static bool read_entry_header(const struct region_device *store, uint32_t offset,
+			      uint32_t *k_sz, uint32_t *v_sz, enum cb_err *err)
+{
+	const size_t data_sz = region_device_sz(store);
+
+	*err = CB_ERR;
+
+	if (rdev_readat(store, k_sz, offset, sizeof(*k_sz)) < 0) {
+		printk(BIOS_WARNING, "failed reading key size\n");
+		return false;
+	}
+
+	/* found the end */
+	if (*k_sz == 0xffffffff) {
+		*err = CB_SUCCESS;
+		return false;
+	}
+
+	/* something is fishy here:
+	 * Avoid wrapping (since data_size < MAX_UINT32_T / 2) while
+	 * other problems are covered by the loop condition
+	 */
+	if (*k_sz > data_sz) {
+		printk(BIOS_WARNING, "key size out of bounds\n");
+		return false;
+	}
+
+	if (rdev_readat(store, v_sz, offset + sizeof(*k_sz), sizeof(*v_sz)) < 0) {
+		printk(BIOS_WARNING, "failed reading value size\n");
+		return false;
+	}
+
+	if (*v_sz > data_sz) {
+		printk(BIOS_WARNING, "value size out of bounds\n");
+		return false;
+	}
+
+	*err = CB_SUCCESS;
+	return true;
+}
+
+/* Read the key of the entry at |offset| into key_buf. Returns false if it is inactive. */
+static bool read_active_key(const struct region_device *store, uint32_t offset,
+			    uint32_t k_sz, uint32_t v_sz)
+{
+	uint8_t active;
+	const uint32_t key_offset = offset + 2 * sizeof(uint32_t);
+
+	if (rdev_readat(store, &active, key_offset + k_sz + v_sz, sizeof(active)) < 0 ||
+	    active != 0)
+		return false;
+
+	return rdev_readat(store, key_buf, key_offset, k_sz) == k_sz;
+}
+
+/* Scan the whole store once to find its end and index the active entries. */
+static enum cb_err index_build(const struct region_device *store)
+{
+	uint32_t end = 0;
+	uint32_t k_sz = 0, v_sz;
+	const size_t data_sz = region_device_sz(store);
+	enum cb_err err = CB_SUCCESS;
+
+	index_reset();
+
 	while (end < data_sz) {
 		/* make odd corner cases identifiable, eg. invalid v_sz */
 		k_sz = 0;
 
-		if (rdev_readat(store, &k_sz, end, sizeof(k_sz)) < 0) {
-			printk(BIOS_WARNING, "failed reading key size\n");
-			return CB_ERR;
-		}
-
-		/* found the end */
-		if (k_sz == 0xffffffff)
+		if (!read_entry_header(store, end, &k_sz, &v_sz, &err))
 			break;
 
-		/* something is fishy here:
-		 * Avoid wrapping (since data_size < MAX_UINT32_T / 2) while
-		 * other problems are covered by the loop condition
-		 */
-		if (k_sz > data_sz) {
-			printk(BIOS_WARNING, "key size out of bounds\n");
-			return CB_ERR;
-		}
-
-		if (rdev_readat(store, &v_sz, end + sizeof(k_sz), sizeof(v_sz)) < 0) {
-			printk(BIOS_WARNING, "failed reading value size\n");
-			return CB_ERR;
-		}
+		const uint32_t size = entry_size(k_sz, v_sz);
 
-		if (v_sz > data_sz) {
-			printk(BIOS_WARNING, "value size out of bounds\n");
-			return CB_ERR;
-		}
+		if (k_sz > INDEX_KEY_MAX)
+			store_index.complete = false;
+		else if (end + size <= data_sz && read_active_key(store, end, k_sz, v_sz))
+			index_insert(store, key_buf, k_sz, end, size);
 
-		end += sizeof(k_sz) + sizeof(v_sz) + k_sz + v_sz + 1;
-		end = ALIGN_UP(end, sizeof(uint32_t));
+		end += size;
 	}
 
-	printk(BIOS_DEBUG, "used smm store size might be 0x%zx bytes\n", end);
+	if (err != CB_SUCCESS)
+		return CB_ERR;
+
+	printk(BIOS_DEBUG, "used smm store size might be 0x%x bytes\n", end);
 
 	if (k_sz != 0xffffffff) {
 		printk(BIOS_WARNING,
@@ -171,12 +344,147 @@ static enum cb_err scan_end(struct region_device *store)
 		return CB_ERR;
 	}
 
-	if (rdev_chain(store, store, end, data_sz - end))
+	store_index.end = end;
+	store_index.valid = true;
+
+	return CB_SUCCESS;
+}
+
+/* Make sure the index describes the store, rebuilding it if necessary. */
+static enum cb_err index_prepare(const struct region_device *store)
+{
+	uint32_t marker;
+
+	if (store_index.valid && store_index.end < region_device_sz(store) &&
+	    rdev_readat(store, &marker, store_index.end, sizeof(marker)) == sizeof(marker) &&
+	    marker == 0xffffffff)
+		return CB_SUCCESS;
+
+	return index_build(store);
+}
+
+#if CONFIG(SMMSTORE_COMPACTION)
+#define COMPACT_BLOCK_SIZE	(4 * KiB)
+
+static uint8_t compact_buf[COMPACT_BLOCK_SIZE];
+
+/* Erase the block at |offset| and write back compact_buf, which holds |len| bytes of data. */
+static enum cb_err compact_flush(const struct region_device *store, uint32_t offset,
+				 uint32_t len)
+{
+	memset(&compact_buf[len], 0xff, sizeof(compact_buf) - len);
+
+	if (rdev_eraseat(store, offset, sizeof(compact_buf)) != sizeof(compact_buf) ||
+	    rdev_writeat(store, compact_buf, offset, len) != len) {
+		printk(BIOS_ERR, "smm store: failed writing compacted block\n");
 		return CB_ERR;
+	}
 
 	return CB_SUCCESS;
+}
 
+/*
+ * Find the slot pointing at the entry at |offset|. Unlike index_find() this doesn't read the
+ * keys from flash, which may not hold the entries that have already been moved.
+ */
+static struct index_slot *index_find_offset(uint32_t hash, uint32_t offset)
+{
+	for (uint32_t i = hash % INDEX_SLOTS;; i = (i + 1) % INDEX_SLOTS) {
+		struct index_slot *slot = &store_index.slots[i];
+
+		if (slot->offset == NO_ENTRY)
+			return NULL;
+		if (slot->hash == hash && slot->offset == offset)
+			return slot;
+	}
 }
+
+/*
+ * Drop all superseded and inactive entries by moving the live ones to the front of the store.
+ *
+ * Entries are copied into a RAM buffer holding one erase block of output, which is erased
+ * and written back once it is full. The output never overtakes the input, so a block is only
+ * erased after all entries in it have been read. This is not power-fail safe: a reset while
+ * a block is being rewritten loses the entries that were staged in RAM.
+ */
+static enum cb_err compact_store(const struct region_device *store)
+{
+	const uint32_t old_end = store_index.end;
+	uint32_t in = 0, out = 0, k_sz, v_sz, erase_from;
+	enum cb_err err = CB_SUCCESS;
+
+	if (!store_index.complete || store_index.live_bytes == old_end)
+		return CB_ERR;
+
+	if (!IS_ALIGNED(region_device_offset(store), COMPACT_BLOCK_SIZE) ||
+	    !IS_ALIGNED(region_device_sz(store), COMPACT_BLOCK_SIZE))
+		return CB_ERR;
+
+	printk(BIOS_INFO, "smm store: compacting, 0x%x of 0x%x bytes are live\n",
+	       store_index.live_bytes, old_end);
+
+	while (in < old_end && read_entry_header(store, in, &k_sz, &v_sz, &err)) {
+		const uint32_t size = entry_size(k_sz, v_sz);
+		struct index_slot *slot;
+
+		if (!read_active_key(store, in, k_sz, v_sz)) {
+			in += size;
+			continue;
+		}
+		slot = index_find_offset(key_hash(key_buf, k_sz), in);
+		if (!slot) {
+			in += size;
+			continue;
+		}
+		slot->offset = out;
+
+		for (uint32_t done = 0; done < size;) {
+			const uint32_t pos = out % COMPACT_BLOCK_SIZE;
+			const uint32_t len = MIN(size - done, COMPACT_BLOCK_SIZE - pos);
+
+			if (rdev_readat(store, &compact_buf[pos], in + done, len) != len)
+				goto fail;
+			done += len;
+			out += len;
+
+			if (out % COMPACT_BLOCK_SIZE == 0 &&
+			    compact_flush(store, out - COMPACT_BLOCK_SIZE, COMPACT_BLOCK_SIZE))
+				goto fail;
+		}
+		in += size;
+	}
+
+	if (err != CB_SUCCESS || in != old_end)
+		goto fail;
+
+	/* Write the partial last block and erase everything behind it that held old data. */
+	erase_from = ALIGN_UP(out, COMPACT_BLOCK_SIZE);
+	if (out % COMPACT_BLOCK_SIZE &&
+	    compact_flush(store, ALIGN_DOWN(out, COMPACT_BLOCK_SIZE), out % COMPACT_BLOCK_SIZE))
+		goto fail;
+	if (erase_from < old_end) {
+		const uint32_t len = ALIGN_UP(old_end, COMPACT_BLOCK_SIZE) - erase_from;
+
+		if (rdev_eraseat(store, erase_from, len) != len)
+			goto fail;
+	}
+
+	store_index.end = out;
+
+	return CB_SUCCESS;
+
+fail:
+	printk(BIOS_ERR, "smm store: compaction failed\n");
+	store_index.valid = false;
+	return CB_ERR;
+}
+#else
+static enum cb_err compact_store(const struct region_device *store)
+{
+	return CB_ERR;
+}
+#endif
+
 /*
  * Append data to region
  *
@@ -186,6 +494,8 @@ int smmstore_append_data(void *key, uint32_t key_sz, void *value,
 			 uint32_t value_sz)
 {
 	struct region_device store;
+	const struct region_device *full_store = &store;
+	struct region_device entry;
 
 	if (lookup_store(&store) < 0) {
 		printk(BIOS_WARNING, "reading region failed\n");
@@ -195,48 +505,68 @@ int smmstore_append_data(void *key, uint32_t key_sz, void *value,
 	ssize_t offset = 0;
 	ssize_t size;
 	uint8_t nul = 0;
-	if (scan_end(&store) != CB_SUCCESS)
+	if (index_prepare(full_store) != CB_SUCCESS)
 		return -1;
 
 	printk(BIOS_DEBUG, "used size looks legit\n");
 
-	printk(BIOS_DEBUG, "open (%zx, %zx) for writing\n",
-		region_device_offset(&store), region_device_sz(&store));
-
 	size = sizeof(key_sz) + sizeof(value_sz) + key_sz + value_sz
 		+ sizeof(nul);
-	if (rdev_chain(&store, &store, 0, size)) {
+
+	if (store_index.end + size > region_device_sz(full_store) &&
+	    store_index.live_bytes + size <= region_device_sz(full_store))
+		compact_store(full_store);
+
+	if (rdev_chain(&entry, full_store, store_index.end,
+		       region_device_sz(full_store) - store_index.end))
+		return -1;
+
+	printk(BIOS_DEBUG, "open (%zx, %zx) for writing\n",
+		region_device_offset(&entry), region_device_sz(&entry));
+
+	if (rdev_chain(&entry, &entry, 0, size)) {
 		printk(BIOS_WARNING, "not enough space for new data\n");
 		return -1;
 	}
 
-	if (rdev_writeat(&store, &key_sz, offset, sizeof(key_sz))
+	/* The entry is left in an undefined state if one of the writes below fails. */
+	store_index.valid = false;
+
+	if (rdev_writeat(&entry, &key_sz, offset, sizeof(key_sz))
 	    != sizeof(key_sz)) {
 		printk(BIOS_WARNING, "failed writing key size\n");
 		return -1;
 	}
 	offset += sizeof(key_sz);
-	if (rdev_writeat(&store, &value_sz, offset, sizeof(value_sz))
+	if (rdev_writeat(&entry, &value_sz, offset, sizeof(value_sz))
 	    != sizeof(value_sz)) {
 		printk(BIOS_WARNING, "failed writing value size\n");
 		return -1;
 	}
 	offset += sizeof(value_sz);
-	if (rdev_writeat(&store, key, offset, key_sz) != key_sz) {
+	if (rdev_writeat(&entry, key, offset, key_sz) != key_sz) {
 		printk(BIOS_WARNING, "failed writing key data\n");
 		return -1;
 	}
 	offset += key_sz;
-	if (rdev_writeat(&store, value, offset, value_sz) != value_sz) {
+	if (rdev_writeat(&entry, value, offset, value_sz) != value_sz) {
 		printk(BIOS_WARNING, "failed writing value data\n");
 		return -1;
 	}
 	offset += value_sz;
-	if (rdev_writeat(&store, &nul, offset, sizeof(nul)) != sizeof(nul)) {
+	if (rdev_writeat(&entry, &nul, offset, sizeof(nul)) != sizeof(nul)) {
 		printk(BIOS_WARNING, "failed writing termination\n");
 		return -1;
 	}
 
+	offset = store_index.end;
+	store_index.end += entry_size(key_sz, value_sz);
+	store_index.valid = true;
+	if (key_sz > INDEX_KEY_MAX)
+		store_index.complete = false;
+	else
+		index_insert(full_store, key, key_sz, offset, entry_size(key_sz, value_sz));
+
 	return 0;
 }
 
@@ -254,6 +584,8 @@ int smmstore_clear_region(void)
 		return -1;
 	}
 
+	store_index.valid = false;
+
 	ssize_t res = rdev_eraseat(&store, 0, region_device_sz(&store));
 	if (res != region_device_sz(&store)) {
 		printk(BIOS_WARNING, "smm store: erasing region failed\n");
@@ -429,6 +761,8 @@ int smmstore_rawwrite_region(uint32_t block_id, uint32_t offset, uint32_t bufsiz
 	printk(BIOS_DEBUG, "smm store: writing %p block %d, offset=0x%x, size=%x\n",
 	       ptr, block_id, offset, bufsize);
 
+	store_index.valid = false;
+
 	ssize_t ret = rdev_writeat(&store, ptr, 0, bufsize);
 	rdev_munmap(&com_buf, ptr);
 	if (ret < 0)
@@ -451,6 +785,8 @@ int smmstore_rawclear_region(uint32_t block_id)
 	if (lookup_block_in_store(&store, block_id) < 0)
 		return -1;
 
+	store_index.valid = false;
+
 	ssize_t ret = rdev_eraseat(&store, block_id * SMM_BLOCK_SIZE, SMM_BLOCK_SIZE);
 	if (ret != SMM_BLOCK_SIZE) {
 		printk(BIOS_ERR, "smm store: erasing block failed\n");
@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+ * Serial Flash Discoverable Parameters (JESD216). Only the Basic Flash Parameter Table is
+ * used, to find out which dual read modes a part supports, so that these don't have to be
+ * listed for every part in the vendor tables.
+ */
+
+#include <commonlib/helpers.h>
+#include <console/console.h>
+#include <endian.h>
+#include <spi_flash.h>
+#include <spi-generic.h>
+#include <types.h>
+
+#include "spi_flash_internal.h"
+
+#define SFDP_SIGNATURE			0x50444653	/* 'SFDP' */
+#define SFDP_BFPT_ID			0xff00
+
+struct sfdp_header {
+	uint32_t signature;
+	uint8_t minor;
+	uint8_t major;
+	uint8_t nph;		/* number of parameter headers - 1 */
+	uint8_t access_protocol;
+} __packed;
+
+struct sfdp_param_header {
+	uint8_t id_lsb;
+	uint8_t minor;
+	uint8_t major;
+	uint8_t length;		/* in dwords */
+	uint8_t pointer[3];
+	uint8_t id_msb;
+} __packed;
+
+/* Basic Flash Parameter Table dwords (numbered from 1 like in the spec) used here. */
+#define BFPT_DWORDS			4
+#define BFPT_DW1_ADDR_BYTES(x)		(((x) >> 17) & 0x3)
+#define   BFPT_DW1_ADDR_4B_ONLY		2
+#define BFPT_DW1_FAST_READ_112		(1 << 16)
+#define BFPT_DW1_FAST_READ_122		(1 << 20)
+
+/* Fast read settings are packed in 16-bit halves of dword 4. */
+#define BFPT_READ_DUMMY(x)		((x) & 0x1f)
+#define BFPT_READ_MODE(x)		(((x) >> 5) & 0x7)
+#define BFPT_READ_OPCODE(x)		(((x) >> 8) & 0xff)
+
+static uint32_t sfdp_pointer(const struct sfdp_param_header *param)
+{
+	return param->pointer[0] | param->pointer[1] << 8 | param->pointer[2] << 16;
+}
+
+/*
+ * Return the number of bytes to send after the address for a read mode described by
+ * |setting| (half a BFPT dword), transmitting |width| bits per clock, or -1 if the mode can't
+ * be used with the standard |opcode|.
+ */
+static int sfdp_dummy_bytes(uint16_t setting, uint8_t opcode, int width)
+{
+	const int clocks = BFPT_READ_DUMMY(setting) + BFPT_READ_MODE(setting);
+
+	if (BFPT_READ_OPCODE(setting) != opcode || (clocks * width) % 8)
+		return -1;
+
+	return clocks * width / 8;
+}
+
+int spi_flash_sfdp_read_modes(struct spi_flash *flash)
+{
+	struct sfdp_header header;
+	struct sfdp_param_header param;
+	uint32_t bfpt[BFPT_DWORDS];
+
+	if (spi_flash_cmd_read_sfdp(flash, 0, sizeof(header), &header) ||
+	    le32toh(header.signature) != SFDP_SIGNATURE)
+		return -1;
+
+	/* The first parameter header always describes the Basic Flash Parameter Table. */
+	if (spi_flash_cmd_read_sfdp(flash, sizeof(header), sizeof(param), &param) ||
+	    (param.id_msb << 8 | param.id_lsb) != SFDP_BFPT_ID || param.length < 9)
+		return -1;
+
+	if (spi_flash_cmd_read_sfdp(flash, sfdp_pointer(&param), sizeof(bfpt), bfpt))
+		return -1;
+	for (int i = 0; i < BFPT_DWORDS; i++)
+		bfpt[i] = le32toh(bfpt[i]);
+
+	if (CONFIG(DEBUG_SPI_FLASH))
+		printk(BIOS_SPEW, "SF: SFDP %d.%d, BFPT %d.%d with %d dwords\n",
+		       header.major, header.minor, param.major, param.minor, param.length);
+
+	/* All read commands are issued with 3-byte addresses. */
+	if (BFPT_DW1_ADDR_BYTES(bfpt[0]) == BFPT_DW1_ADDR_4B_ONLY)
+		return -1;
+
+	/* The dual modes are driven with exactly one byte after the address. */
+	if (bfpt[0] & BFPT_DW1_FAST_READ_112 &&
+	    sfdp_dummy_bytes(bfpt[3], CMD_READ_FAST_DUAL_OUTPUT, 1) == 1)
+		flash->flags.dual_output = 1;
+	if (bfpt[0] & BFPT_DW1_FAST_READ_122 &&
+	    sfdp_dummy_bytes(bfpt[3] >> 16, CMD_READ_FAST_DUAL_IO, 2) == 1)
+		flash->flags.dual_io = 1;
+
+	return 0;
+}
@@ -139,11 +139,37 @@ int spi_flash_cmd_write(const struct spi_slave *spi, const u8 *cmd,
 
 /* Perform the read operation honoring spi controller fifo size, reissuing
  * the read command until the full request completed. */
+static int spi_flash_read_chunked(const struct spi_flash *flash, u8 *cmd, size_t cmd_len,
+				  int (*do_cmd)(const struct spi_slave *spi, const u8 *din,
+						size_t in_bytes, void *out, size_t out_bytes),
+				  u32 offset, size_t len, void *buf)
+{
+	int ret;
+	uint8_t *data = buf;
+
+	while (len) {
+		size_t xfer_len = spi_crop_chunk(&flash->spi, cmd_len, len);
+		spi_flash_addr(offset, cmd);
+		ret = do_cmd(&flash->spi, cmd, cmd_len, data, xfer_len);
+		if (ret) {
+			printk(BIOS_WARNING,
+			       "SF: Failed to send read command %#.2x(%#x, %#zx): %d\n",
+			       cmd[0], offset, xfer_len, ret);
+			return ret;
+		}
+		offset += xfer_len;
+		data += xfer_len;
+		len -= xfer_len;
+	}
+
+	return 0;
+}
+
 int spi_flash_cmd_read(const struct spi_flash *flash, u32 offset,
 				  size_t len, void *buf)
 {
 	u8 cmd[5];
-	int ret, cmd_len;
+	int cmd_len;
 	int (*do_cmd)(const struct spi_slave *spi, const u8 *din,
 		      size_t in_bytes, void *out, size_t out_bytes);
 
@@ -168,23 +194,15 @@ int spi_flash_cmd_read(const struct spi_flash *flash, u32 offset,
 		do_cmd = do_spi_flash_cmd;
 	}
 
-	uint8_t *data = buf;
-	while (len) {
-		size_t xfer_len = spi_crop_chunk(&flash->spi, cmd_len, len);
-		spi_flash_addr(offset, cmd);
-		ret = do_cmd(&flash->spi, cmd, cmd_len, data, xfer_len);
-		if (ret) {
-			printk(BIOS_WARNING,
-			       "SF: Failed to send read command %#.2x(%#x, %#zx): %d\n",
-			       cmd[0], offset, xfer_len, ret);
-			return ret;
-		}
-		offset += xfer_len;
-		data += xfer_len;
-		len -= xfer_len;
-	}
+	return spi_flash_read_chunked(flash, cmd, cmd_len, do_cmd, offset, len, buf);
+}
 
-	return 0;
+int spi_flash_cmd_read_sfdp(const struct spi_flash *flash, u32 offset, size_t len, void *buf)
+{
+	u8 cmd[5] = { CMD_READ_SFDP };
+
+	return spi_flash_read_chunked(flash, cmd, sizeof(cmd), do_spi_flash_cmd, offset, len,
+				      buf);
 }
 
 int spi_flash_cmd_poll_bit(const struct spi_flash *flash, unsigned long timeout,
@@ -474,7 +492,14 @@ int spi_flash_generic_probe(const struct spi_slave *spi,
 	id[0] = (idcode[1] << 8) | idcode[2];
 	id[1] = (idcode[3] << 8) | idcode[4];
 
-	return find_match(spi, flash, manuf_id, id);
+	ret = find_match(spi, flash, manuf_id, id);
+	if (ret)
+		return ret;
+
+	if (CONFIG(SPI_FLASH_SFDP) && spi_flash_sfdp_read_modes(flash))
+		printk(BIOS_DEBUG, "SF: No usable SFDP parameters\n");
+
+	return 0;
 }
 
 int spi_flash_probe(unsigned int bus, unsigned int cs, struct spi_flash *flash)
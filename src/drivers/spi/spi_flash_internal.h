@@ -17,6 +17,8 @@
 #define CMD_READ_FAST_DUAL_OUTPUT	0x3b
 #define CMD_READ_FAST_DUAL_IO		0xbb
 
+#define CMD_READ_SFDP			0x5a
+
 #define CMD_READ_STATUS			0x05
 #define CMD_WRITE_ENABLE		0x06
 
@@ -58,6 +60,12 @@ int spi_flash_cmd_write_page_program(const struct spi_flash *flash, u32 offset,
 /* Read len bytes into buf at offset. */
 int spi_flash_cmd_read(const struct spi_flash *flash, u32 offset, size_t len, void *buf);
 
+/* Send the SFDP read command, reading len bytes of parameters at offset into buf. */
+int spi_flash_cmd_read_sfdp(const struct spi_flash *flash, u32 offset, size_t len, void *buf);
+
+/* Update the read modes of a probed part from its SFDP parameters. Returns 0 on success. */
+int spi_flash_sfdp_read_modes(struct spi_flash *flash);
+
 /* Release from deep sleep an provide alternative rdid information. */
 int stmicro_release_deep_sleep_identify(const struct spi_slave *spi, u8 *idcode);
 
@@ -104,6 +104,16 @@ void cbfs_unmap(void *mapping);
 /* Load stage into memory filling in prog. Return 0 on success. < 0 on error. */
 int cbfs_prog_stage_load(struct prog *prog);
 
+/*
+ * Start loading (and decompressing) the file |name| into the heap in a background thread.
+ * The next cbfs_map() or cbfs_alloc() (or their _type_ variants, but not the _ro_ ones) for
+ * the same file waits for the thread to finish and then uses the preloaded data instead of
+ * accessing the boot medium again: cbfs_map() returns the preload buffer itself, to be freed
+ * with cbfs_unmap(), and cbfs_alloc() copies it to the caller's allocation. Only available in
+ * ramstage with CONFIG(CBFS_PRELOAD), a no-op otherwise.
+ */
+void cbfs_preload(const char *name);
+
 
 /**********************************************************************************************
  *                                BOOT DEVICE HELPER APIs                                     *
@@ -47,6 +47,25 @@ static inline int get_console_loglevel(void)
 	 ENV_SEPARATE_VERSTAGE || ENV_ROMSTAGE || ENV_RAMSTAGE || \
 	 ENV_LIBAGESA || (ENV_SMM && CONFIG(DEBUG_SMI)))
 
+#define CONSOLE_DEFERRED (ENV_RAMSTAGE && CONFIG(CONSOLE_DEFERRED))
+
+#if CONSOLE_DEFERRED
+/*
+ * Write all deferred console output to the slow consoles and make printk()
+ * synchronous from now on. Called before leaving coreboot.
+ */
+void console_deferred_flush(void);
+/*
+ * Like console_deferred_flush(), for die() and reset paths. Never waits for
+ * the console lock. If it is taken, the queued output is only left in the
+ * CBMEM console.
+ */
+void console_deferred_panic(void);
+#else
+static inline void console_deferred_flush(void) {}
+static inline void console_deferred_panic(void) {}
+#endif
+
 #if __CONSOLE_ENABLE__
 asmlinkage void console_init(void);
 int console_log_level(int msg_level);
@@ -8,8 +8,27 @@
 
 void console_hw_init(void);
 void console_tx_byte(unsigned char byte);
+void console_tx_bytes(const char *buf, size_t len);
 void console_tx_flush(void);
 
+/* Write a byte to all consoles except the CBMEM console. */
+void console_hw_tx_byte(unsigned char byte);
+
+/*
+ * Queue bytes for the consoles written by console_hw_tx_byte(), see
+ * CONSOLE_DEFERRED. console_deferred_active() returns 0 once the queue has
+ * been stopped and output has to be written synchronously again. Except for
+ * console_deferred_write(), all of these must be called with the console
+ * lock held.
+ */
+void console_deferred_tx_bytes(const char *buf, size_t len);
+int console_deferred_active(void);
+void console_deferred_stop(void);
+/* Write up to |count| queued bytes to the consoles. */
+void console_deferred_drain(size_t count);
+/* Take the console lock and call console_deferred_drain(). */
+void console_deferred_write(size_t count);
+
 /*
  * Write number_of_bytes data bytes from buffer to the serial device.
  * If number_of_bytes is zero, wait until all serial data is output.
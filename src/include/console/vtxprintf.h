@@ -4,8 +4,19 @@
 #define __CONSOLE_VTXPRINTF_H
 
 #include <stdarg.h>
+#include <stddef.h>
+
+/* Size of the on-stack buffer vtxprintf_bulk() collects its output in. */
+#define VTXPRINTF_CHUNK_SIZE	64
 
 int vtxprintf(void (*tx_byte)(unsigned char byte, void *data),
 	const char *fmt, va_list args, void *data);
 
+/*
+ * Same as vtxprintf(), but hands the output to tx_bytes() in spans of one or
+ * more bytes instead of calling back for every single character.
+ */
+int vtxprintf_bulk(void (*tx_bytes)(const char *buf, size_t len, void *data),
+	const char *fmt, va_list args, void *data);
+
 #endif
@@ -105,6 +105,24 @@ struct mp_ops {
  */
 int mp_init_with_smm(struct bus *cpu_bus, const struct mp_ops *mp_ops);
 
+/*
+ * AP bring-up timing stored in CBMEM with MP_BRINGUP_REPORT. All times are in microseconds
+ * after the INIT IPI was sent (init_ts, in timestamp ticks). A SIPI time of 0 means it was not
+ * sent, and so does a check-in time of 0 for an AP that never reached ap_init().
+ */
+struct mp_bringup_report {
+	uint32_t num_cpus;
+	uint32_t tick_freq_mhz;
+	uint64_t init_ts;
+	uint32_t sipi_us[2];
+	uint32_t all_checked_in_us;
+	uint32_t flight_plan_us;
+	struct {
+		uint32_t apic_id;
+		uint32_t checkin_us;
+	} cpus[];
+} __packed;
+
 enum {
 	/* Function runs on all cores (both BSP and APs) */
 	MP_RUN_ON_ALL_CPUS,
@@ -31,4 +31,10 @@ void pciexp_hotplug_scan_bridge(struct device *dev);
 extern struct device_operations default_pciexp_hotplug_ops_bus;
 
 unsigned int pciexp_find_extended_cap(struct device *dev, unsigned int cap);
+
+/*
+ * With PCIEXP_CONCURRENT_RETRAIN, wait for the links of the ports on the given bus (or all
+ * ports if it is NULL) to finish retraining and finish configuring them.
+ */
+void pciexp_finish_link_retrain(struct bus *bus);
 #endif /* DEVICE_PCIEXP_H */
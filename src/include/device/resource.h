@@ -105,6 +105,25 @@ static inline void *res2mmio(const struct resource *res, unsigned long offset,
 const struct device *largest_resource(struct bus *bus, struct resource **result_res,
 				      unsigned long type_mask, unsigned long type);
 
+struct bus_resource {
+	const struct device *dev;
+	struct resource *res;
+	size_t seq;		/* Position on the bus, used to keep the sort stable. */
+};
+
+/*
+ * Collect the resources on the bus that largest_resource() would return, one after another,
+ * for the given mask and type, sorted in the same order (by descending alignment, then by
+ * descending size). This needs a single walk of the bus instead of one per resource.
+ * Params:
+ * list = Array with room for max entries that receives the resources.
+ *
+ * Returns:
+ * The number of resources found. If this is larger than max, the list is not valid.
+ */
+size_t sort_bus_resources(struct bus *bus, unsigned long type_mask, unsigned long type,
+			  struct bus_resource *list, size_t max);
+
 /* Compute and allocate resources. This is the main resource allocator entry point. */
 void allocate_resources(const struct device *root);
 
@@ -75,6 +75,9 @@ struct device_tree_reserve_map_entry
 	struct list_node list_node;
 };
 
+/* Hash index of an unflattened tree, see CONFIG_FLATTENED_DEVICE_TREE_INDEX. */
+struct device_tree_index;
+
 struct device_tree
 {
 	const void *header;
@@ -84,6 +87,9 @@ struct device_tree
 	struct list_node reserve_map;
 
 	struct device_tree_node *root;
+
+	/* NULL if the tree isn't indexed. */
+	struct device_tree_index *index;
 };
 
 /*
@@ -100,6 +106,33 @@ int fdt_node_name(const void *blob, uint32_t offset, const char **name);
 void fdt_print_node(const void *blob, uint32_t offset);
 int fdt_skip_node(const void *blob, uint32_t offset);
 
+/* Look up nodes and properties, returning their offset or 0 if not found. */
+uint32_t fdt_first_child(const void *blob, uint32_t node_offset);
+uint32_t fdt_find_child(const void *blob, uint32_t node_offset, const char *name);
+uint32_t fdt_find_node_by_path(const void *blob, const char *path, u32 *addrcp,
+			       u32 *sizecp);
+uint32_t fdt_find_prop(const void *blob, uint32_t node_offset, const char *name,
+		       struct fdt_property *prop);
+void fdt_read_u32_prop(const void *blob, uint32_t node_offset, const char *name, u32 *val);
+
+/* Edit a flattened tree in place, growing into the slack between the end of its strings
+   and totalsize. Edits move everything behind them, invalidating later offsets. Functions
+   returning int return 0 on success and -1 once out of slack. */
+int fdt_open_into(const void *blob, void *buf, uint32_t size);
+void fdt_pack(void *blob);
+int fdt_set_prop(void *blob, uint32_t node_offset, const char *name, const void *data,
+		 uint32_t size);
+int fdt_set_string_prop(void *blob, uint32_t node_offset, const char *name, const char *str);
+int fdt_set_u32_prop(void *blob, uint32_t node_offset, const char *name, u32 val);
+int fdt_set_u64_prop(void *blob, uint32_t node_offset, const char *name, u64 val);
+int fdt_set_reg_prop(void *blob, uint32_t node_offset, u64 *addrs, u64 *sizes, int count,
+		     u32 addr_cells, u32 size_cells);
+void fdt_delete_prop(void *blob, uint32_t node_offset, const char *name);
+uint32_t fdt_add_node(void *blob, uint32_t parent_offset, const char *name);
+uint32_t fdt_find_or_add_child(void *blob, uint32_t parent_offset, const char *name);
+void fdt_delete_node(void *blob, uint32_t node_offset);
+int fdt_add_reserve_map_entry(void *blob, uint64_t start, uint64_t size);
+
 /* Read a flattened device tree into a hierarchical structure which refers to
    the contents of the flattened tree in place. Modifying the flat tree
    invalidates the unflattened one. */
@@ -123,6 +156,9 @@ struct device_tree_node *dt_find_node(struct device_tree_node *parent, const cha
 			     u32 *addrcp, u32 *sizecp, int create);
 struct device_tree_node *dt_find_node_by_phandle(struct device_tree_node *root,
 						 uint32_t phandle);
+/* Look up a node in the tree through its phandle, using the tree's index if it has one. */
+struct device_tree_node *dt_find_tree_node_by_phandle(struct device_tree *tree,
+						      uint32_t phandle);
 /* Look up or create a node in the tree, through its path
    represented as a string of '/' separated node names. */
 struct device_tree_node *dt_find_node_by_path(struct device_tree *tree,
@@ -132,6 +168,9 @@ struct device_tree_node *dt_find_node_by_alias(struct device_tree *tree,
 					       const char *alias);
 /* Look up a node relative to a parent node, through its compatible string. */
 struct device_tree_node *dt_find_compat(struct device_tree_node *parent, const char *compatible);
+/* Look up a node in the tree with a compatible string, using the tree's index if it has one.
+   Indexed nodes win over nodes earlier in the tree, see the implementation. */
+struct device_tree_node *dt_find_tree_compat(struct device_tree *tree, const char *compatible);
 /* Look up the next child of a parent node, through its compatible string. It
    uses child pointer as the marker to find next. */
 struct device_tree_node *dt_find_next_compat_child(struct device_tree_node *parent,
@@ -83,4 +83,13 @@ struct fit_config_node *fit_load(void *fit);
 void fit_add_ramdisk(struct device_tree *tree, void *ramdisk_addr,
 		     size_t ramdisk_size);
 
+/*
+ * Same as fit_update_chosen(), fit_update_memory() and fit_add_ramdisk(), but
+ * editing a flattened devicetree in place (see fdt_open_into()).
+ * Return 0 on success, -1 if the devicetree ran out of space.
+ */
+int fit_update_chosen_fdt(void *blob, const char *cmd_line);
+int fit_update_memory_fdt(void *blob);
+int fit_add_ramdisk_fdt(void *blob, void *ramdisk_addr, size_t ramdisk_size);
+
 #endif /* __LIB_FIT_H__ */
@@ -10,6 +10,27 @@ unsigned long smbios_write_tables(unsigned long start);
 int smbios_add_string(u8 *start, const char *str);
 int smbios_string_table_len(u8 *start);
 
+/*
+ * Builder for the strings of one structure. It tracks where the next string goes and hashes
+ * the strings for deduplication, so adding a string doesn't rescan the ones already there.
+ * Strings added to the structure some other way, e.g. with smbios_add_string(), are only
+ * picked up by smbios_strings_init().
+ */
+struct smbios_strings {
+	u8 *start;	/* The structure's eos */
+	u8 *end;	/* Where the next string goes */
+	int count;
+	struct {
+		u16 offset;
+		u8 index;	/* 0 for an empty slot */
+	} slots[64];
+};
+
+void smbios_strings_init(struct smbios_strings *s, u8 *start);
+int smbios_strings_add(struct smbios_strings *s, const char *str);
+/* Length of the string set including its terminating NUL(s), like smbios_string_table_len(). */
+int smbios_strings_len(const struct smbios_strings *s);
+
 struct smbios_header;
 int smbios_full_table_len(struct smbios_header *header, u8 *str_table_start);
 void *smbios_carve_table(unsigned long start, u8 type, u8 length, u16 handle);
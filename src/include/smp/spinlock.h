@@ -9,6 +9,7 @@
 #define spin_is_locked(lock)	0
 #define spin_unlock_wait(lock)	do {} while (0)
 #define spin_lock(lock)		do {} while (0)
+#define spin_trylock(lock)	1
 #define spin_unlock(lock)	do {} while (0)
 #endif
 
@@ -8,4 +8,15 @@ void *malloc(size_t size);
 void *calloc(size_t nitems, size_t size);
 void free(void *ptr);
 
+struct heap_stats {
+	size_t live;		/* Number of live allocations (HEAP_FREE_LIST only) */
+	size_t used;		/* Bytes currently allocated, including overhead */
+	size_t peak;		/* Highest value of |used| so far */
+	size_t available;	/* Bytes available for allocation */
+	size_t largest_free;	/* Largest contiguous free block */
+};
+
+/* Fill out |stats| with the current state of the heap. */
+void heap_stats(struct heap_stats *stats);
+
 #endif /* STDLIB_H */
@@ -17,7 +17,9 @@ void timestamp_init(uint64_t base);
 /*
  * Add a new timestamp. For ENV_ROMSTAGE_OR_BEFORE, this timestamp will be stored
  * inside REGION(timestamp) before cbmem comes online. For later stages, timestamps
- * added before cbmem_[recovery|initialize] calls will be lost.
+ * added before cbmem_[recovery|initialize] calls will be lost. In ramstage on x86,
+ * APs may add timestamps as well; they are buffered per CPU and merged into the
+ * table (tagged with the CPU index) when the coreboot tables are written.
  */
 void timestamp_add(enum timestamp_id id, uint64_t ts_time);
 /* Calls timestamp_add with current timestamp. */
@@ -26,6 +28,12 @@ void timestamp_add_now(enum timestamp_id id);
 /* Apply a factor of N/M to all timestamps recorded so far. */
 void timestamp_rescale_table(uint16_t N, uint16_t M);
 
+/*
+ * Return the active timestamp table for the coreboot table to point to. In ramstage the table
+ * may move to a larger CBMEM area when it fills up, which this prevents from now on.
+ */
+struct timestamp_table *timestamp_lock_table(void);
+
 /*
  * Get the time since boot scaled in microseconds. Therefore use the base time
  * of the timestamps to get the initial value which is subtracted from
@@ -39,6 +47,7 @@ uint32_t get_us_since_boot(void);
 #define timestamp_add(id, time)
 #define timestamp_add_now(id)
 #define timestamp_rescale_table(N, M)
+#define timestamp_lock_table() NULL
 #define get_us_since_boot() 0
 #endif
 
@@ -1,40 +1,161 @@
 /* SPDX-License-Identifier: GPL-2.0-only */
 
+#include <boot/coreboot_tables.h>
+#include <bootstate.h>
 #include <cbfs.h>
 #include <vbe.h>
 #include <console/console.h>
 #include <endian.h>
 #include <bootsplash.h>
 #include <stdlib.h>
+#include <thread.h>
 
 #include "jpeg.h"
 
+/* Rows of 16 lines decoded before yielding, when decoding in a cooperative thread. */
+#define DECODE_ROWS_PER_SLICE	4
 
-void set_bootsplash(unsigned char *framebuffer, unsigned int x_resolution,
-		    unsigned int y_resolution, unsigned int fb_resolution)
+static struct {
+	bool started;
+	bool jpeg_in_heap;
+	unsigned char *framebuffer;
+	unsigned char *jpeg;
+	struct jpeg_decdata *decdata;
+	int ret;
+	struct thread_handle handle;
+} splash;
+
+/*
+ * For decoding in the background, the image is copied to the heap, so that the decoder never
+ * reads the boot medium while the main thread might be in the middle of writing to it. Only
+ * use up to half of the free heap, so that the rest of ramstage doesn't run out.
+ */
+static void *bootsplash_heap_allocator(void *arg, size_t size, const union cbfs_mdata *unused)
+{
+	struct heap_stats stats;
+
+	heap_stats(&stats);
+	if (size > stats.largest_free / 2)
+		return NULL;
+
+	return malloc(size);
+}
+
+static int bootsplash_prepare(unsigned char *framebuffer, unsigned int x_resolution,
+			      unsigned int y_resolution, unsigned int fb_resolution,
+			      bool background)
 {
 	printk(BIOS_INFO, "Setting up bootsplash in %dx%d@%d\n", x_resolution, y_resolution,
 	       fb_resolution);
-	struct jpeg_decdata *decdata;
-	unsigned char *jpeg = cbfs_map("bootsplash.jpg", NULL);
-	if (!jpeg) {
-		printk(BIOS_ERR, "Could not find bootsplash.jpg\n");
-		return;
+
+	/* Allocate this first, so that the image can be given back to the heap afterwards. */
+	if (!splash.decdata)
+		splash.decdata = malloc(sizeof(*splash.decdata));
+
+	splash.framebuffer = framebuffer;
+	splash.jpeg_in_heap = background;
+	if (background)
+		splash.jpeg = cbfs_alloc("bootsplash.jpg", bootsplash_heap_allocator, NULL, NULL);
+	else
+		splash.jpeg = cbfs_map("bootsplash.jpg", NULL);
+	if (!splash.jpeg) {
+		printk(background ? BIOS_DEBUG : BIOS_ERR, "Could not %s bootsplash.jpg\n",
+		       background ? "load" : "find");
+		return -1;
 	}
 
 	int image_width, image_height;
-	jpeg_fetch_size(jpeg, &image_width, &image_height);
+	jpeg_fetch_size(splash.jpeg, &image_width, &image_height);
 
 	printk(BIOS_DEBUG, "Bootsplash image resolution: %dx%d\n", image_width, image_height);
 
-	decdata = malloc(sizeof(*decdata));
-	int ret = jpeg_decode(jpeg, framebuffer, x_resolution, y_resolution, fb_resolution,
-			      decdata);
-	cbfs_unmap(jpeg);
-	if (ret != 0) {
+	splash.ret = jpeg_decode_start(splash.jpeg, framebuffer, x_resolution, y_resolution,
+				       fb_resolution, splash.decdata);
+
+	return 0;
+}
+
+static void bootsplash_release_image(void)
+{
+	if (splash.jpeg_in_heap)
+		free(splash.jpeg);
+	else
+		cbfs_unmap(splash.jpeg);
+	splash.jpeg = NULL;
+}
+
+static enum cb_err bootsplash_decode(void *unused)
+{
+	while (!splash.ret && !jpeg_decode_done(splash.decdata)) {
+		splash.ret = jpeg_decode_rows(splash.decdata, DECODE_ROWS_PER_SLICE);
+		thread_yield();
+	}
+
+	return splash.ret ? CB_ERR : CB_SUCCESS;
+}
+
+static void bootsplash_finish(void)
+{
+	bootsplash_release_image();
+	if (splash.ret != 0) {
 		printk(BIOS_ERR, "Bootsplash could not be decoded. jpeg_decode returned %d.\n",
-		       ret);
+		       splash.ret);
 		return;
 	}
 	printk(BIOS_INFO, "Bootsplash loaded\n");
 }
+
+/* Read the image while devices are enumerated, bootsplash_start() picks it up from the heap. */
+static void bootsplash_preload(void *unused)
+{
+	cbfs_preload("bootsplash.jpg");
+}
+
+BOOT_STATE_INIT_ENTRY(BS_PRE_DEVICE, BS_ON_EXIT, bootsplash_preload, NULL);
+
+/*
+ * Once graphics are up, decode the splash in a cooperative thread while the remaining boot
+ * states run. set_bootsplash() waits for it when the coreboot table is written. The decoder
+ * keeps its state in globals and isn't run on an AP.
+ */
+static void bootsplash_start(void *unused)
+{
+	struct lb_framebuffer fb = {0};
+
+	if (!CONFIG(COOP_MULTITASKING) || fill_lb_framebuffer(&fb))
+		return;
+
+	if (bootsplash_prepare((unsigned char *)(uintptr_t)fb.physical_address,
+			       fb.x_resolution, fb.y_resolution, fb.bits_per_pixel, true))
+		return;
+
+	if (thread_run(&splash.handle, bootsplash_decode, NULL)) {
+		/* set_bootsplash() will decode it instead. */
+		bootsplash_release_image();
+		return;
+	}
+
+	splash.started = true;
+}
+
+BOOT_STATE_INIT_ENTRY(BS_POST_DEVICE, BS_ON_ENTRY, bootsplash_start, NULL);
+
+void set_bootsplash(unsigned char *framebuffer, unsigned int x_resolution,
+		    unsigned int y_resolution, unsigned int fb_resolution)
+{
+	if (CONFIG(COOP_MULTITASKING) && splash.started) {
+		splash.started = false;
+		thread_join(&splash.handle);
+		if (splash.framebuffer == framebuffer) {
+			bootsplash_finish();
+			return;
+		}
+		bootsplash_release_image();
+	}
+
+	if (bootsplash_prepare(framebuffer, x_resolution, y_resolution, fb_resolution, false))
+		return;
+
+	bootsplash_decode(NULL);
+	bootsplash_finish();
+}
@@ -16,16 +16,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <symbols.h>
+#include <thread.h>
 #include <timestamp.h>
 
+/* Granularity in which file data is loaded and hashed when CBFS_VERIFICATION is enabled. */
+#define CBFS_LOAD_CHUNK_SIZE	(16 * KiB)
+
 #if CBFS_CACHE_AVAILABLE
 struct mem_pool cbfs_cache = MEM_POOL_INIT(_cbfs_cache, REGION_SIZE(cbfs_cache));
 
 static void switch_to_postram_cache(int unused)
 {
-	if (_preram_cbfs_cache != _postram_cbfs_cache)
-		mem_pool_init(&cbfs_cache, _postram_cbfs_cache,
-			      REGION_SIZE(postram_cbfs_cache));
+	if (_preram_cbfs_cache == _postram_cbfs_cache)
+		return;
+
+	printk(BIOS_DEBUG, "CBFS: pre-RAM cache high-water mark %zu of %zu bytes\n",
+	       mem_pool_high_water(&cbfs_cache), cbfs_cache.size);
+	mem_pool_init(&cbfs_cache, _postram_cbfs_cache, REGION_SIZE(postram_cbfs_cache));
 }
 ROMSTAGE_CBMEM_INIT_HOOK(switch_to_postram_cache);
 #endif
@@ -102,8 +109,13 @@ int cbfs_boot_locate(struct cbfsf *fh, const char *name, uint32_t *type)
 	return 0;
 }
 
+static bool cbfs_preload_unmap(void *mapping);
+
 void cbfs_unmap(void *mapping)
 {
+	if (cbfs_preload_unmap(mapping))
+		return;
+
 	/*
 	 * This is save to call with mappings that weren't allocated in the cache (e.g. x86
 	 * direct mappings) -- mem_pool_free() just does nothing for addresses it doesn't
@@ -201,6 +213,94 @@ static inline bool cbfs_file_hash_mismatch(const void *buffer, size_t size,
 	return true;
 }
 
+/*
+ * Read |rdev| into |buffer| and verify it against |file_hash|. With verification enabled, the
+ * data is read in CBFS_LOAD_CHUNK_SIZE pieces and each piece is hashed right after it was
+ * loaded (while it's still in the CPU cache), so the file only needs a single pass over the
+ * boot media and no second pass over memory for hashing. Returns false on I/O error or hash
+ * mismatch.
+ */
+static bool cbfs_load_and_verify(const struct region_device *rdev, void *buffer,
+				 const struct vb2_hash *file_hash)
+{
+	const size_t in_size = region_device_sz(rdev);
+	struct vb2_digest_context dc;
+	uint8_t real_hash[VB2_MAX_DIGEST_SIZE];
+	uint64_t read_ticks = 0, hash_ticks = 0;
+	size_t hash_size;
+	int tick_freq_mhz;
+
+	if (!CONFIG(CBFS_VERIFICATION))
+		return rdev_readat(rdev, buffer, 0, in_size) == in_size;
+
+	/* If there is no file hash, always count that as a mismatch. */
+	if (!file_hash || vb2_digest_init(&dc, file_hash->algo) != VB2_SUCCESS) {
+		printk(BIOS_CRIT, "CBFS file hash mismatch!\n");
+		return false;
+	}
+
+	timestamp_add_now(TS_START_CBFS_LOAD);
+	for (size_t offset = 0; offset < in_size; offset += CBFS_LOAD_CHUNK_SIZE) {
+		const size_t chunk = MIN(in_size - offset, CBFS_LOAD_CHUNK_SIZE);
+		uint64_t start = timestamp_get();
+
+		if (rdev_readat(rdev, buffer + offset, offset, chunk) != chunk)
+			return false;
+		read_ticks += timestamp_get() - start;
+
+		start = timestamp_get();
+		if (vb2_digest_extend(&dc, buffer + offset, chunk) != VB2_SUCCESS)
+			return false;
+		hash_ticks += timestamp_get() - start;
+	}
+	timestamp_add_now(TS_END_CBFS_LOAD);
+
+	/* The tick frequency may not be known (yet), in which case there's nothing to print. */
+	tick_freq_mhz = CONFIG(COLLECT_TIMESTAMPS) ? timestamp_tick_freq_mhz() : 0;
+	if (tick_freq_mhz > 0)
+		DEBUG("Loaded %zu bytes: %llu us reading, %llu us hashing\n", in_size,
+		      read_ticks / tick_freq_mhz, hash_ticks / tick_freq_mhz);
+
+	hash_size = vb2_digest_size(file_hash->algo);
+	if (vb2_digest_finalize(&dc, real_hash, hash_size) != VB2_SUCCESS ||
+	    memcmp(file_hash->raw, real_hash, hash_size) != 0) {
+		printk(BIOS_CRIT, "CBFS file hash mismatch!\n");
+		return false;
+	}
+
+	return true;
+}
+
+static size_t cbfs_decompress(const void *in, size_t in_size, void *buffer, size_t buffer_size,
+			      uint32_t compression)
+{
+	size_t out_size = 0;
+
+	switch (compression) {
+	case CBFS_COMPRESS_LZ4:
+		if (!cbfs_lz4_enabled())
+			return 0;
+
+		timestamp_add_now(TS_START_ULZ4F);
+		out_size = ulz4fn(in, in_size, buffer, buffer_size);
+		timestamp_add_now(TS_END_ULZ4F);
+		return out_size;
+
+	case CBFS_COMPRESS_LZMA:
+		if (!cbfs_lzma_enabled())
+			return 0;
+
+		/* Note: timestamp not useful for memory-mapped media (x86) */
+		timestamp_add_now(TS_START_ULZMA);
+		out_size = ulzman(in, in_size, buffer, buffer_size);
+		timestamp_add_now(TS_END_ULZMA);
+		return out_size;
+
+	default:
+		return 0;
+	}
+}
+
 static size_t cbfs_load_and_decompress(const struct region_device *rdev, void *buffer,
 				       size_t buffer_size, uint32_t compression,
 				       const struct vb2_hash *file_hash)
@@ -211,61 +311,70 @@ static size_t cbfs_load_and_decompress(const struct region_device *rdev, void *b
 
 	DEBUG("Decompressing %zu bytes to %p with algo %d\n", in_size, buffer, compression);
 
-	switch (compression) {
-	case CBFS_COMPRESS_NONE:
+	if (compression == CBFS_COMPRESS_NONE) {
 		if (buffer_size < in_size)
 			return 0;
-		if (rdev_readat(rdev, buffer, 0, in_size) != in_size)
-			return 0;
-		if (cbfs_file_hash_mismatch(buffer, in_size, file_hash))
+		if (!cbfs_load_and_verify(rdev, buffer, file_hash))
 			return 0;
 		return in_size;
+	}
 
-	case CBFS_COMPRESS_LZ4:
-		if (!cbfs_lz4_enabled())
-			return 0;
+	if ((compression == CBFS_COMPRESS_LZ4 && !cbfs_lz4_enabled()) ||
+	    (compression == CBFS_COMPRESS_LZMA && !cbfs_lzma_enabled()))
+		return 0;
 
-		/* cbfs_prog_stage_load() takes care of in-place LZ4 decompression by
-		   setting up the rdev to be in memory. */
-		map = rdev_mmap_full(rdev);
+	/*
+	 * On media that isn't memory-mapped, rdev_mmap() would read the whole file into the
+	 * cbfs_cache anyway. Do that ourselves so that reading and hashing can be done in one
+	 * pass. Other allocations (e.g. from preload threads) may have been made from the
+	 * cbfs_cache in the meantime, mem_pool_free() can release the buffer regardless.
+	 */
+	if (CBFS_CACHE_AVAILABLE && !CONFIG(BOOT_DEVICE_MEMORY_MAPPED)) {
+		map = mem_pool_alloc(&cbfs_cache, in_size);
 		if (map == NULL)
 			return 0;
 
-		if (!cbfs_file_hash_mismatch(map, in_size, file_hash)) {
-			timestamp_add_now(TS_START_ULZ4F);
-			out_size = ulz4fn(map, in_size, buffer, buffer_size);
-			timestamp_add_now(TS_END_ULZ4F);
-		}
+		if (cbfs_load_and_verify(rdev, map, file_hash))
+			out_size = cbfs_decompress(map, in_size, buffer, buffer_size,
+						   compression);
 
-		rdev_munmap(rdev, map);
+		mem_pool_free(&cbfs_cache, map);
 
 		return out_size;
+	}
 
-	case CBFS_COMPRESS_LZMA:
-		if (!cbfs_lzma_enabled())
-			return 0;
-		map = rdev_mmap_full(rdev);
-		if (map == NULL)
-			return 0;
+	map = rdev_mmap_full(rdev);
+	if (map == NULL)
+		return 0;
 
-		if (!cbfs_file_hash_mismatch(map, in_size, file_hash)) {
-			/* Note: timestamp not useful for memory-mapped media (x86) */
-			timestamp_add_now(TS_START_ULZMA);
-			out_size = ulzman(map, in_size, buffer, buffer_size);
-			timestamp_add_now(TS_END_ULZMA);
-		}
+	if (!cbfs_file_hash_mismatch(map, in_size, file_hash))
+		out_size = cbfs_decompress(map, in_size, buffer, buffer_size, compression);
 
-		rdev_munmap(rdev, map);
+	rdev_munmap(rdev, map);
 
-		return out_size;
+	return out_size;
+}
 
-	default:
-		return 0;
+static bool cbfs_type_mismatch(const union cbfs_mdata *mdata, enum cbfs_type *type)
+{
+	const enum cbfs_type real_type = be32toh(mdata->h.type);
+
+	if (!type)
+		return false;
+
+	if (*type == CBFS_TYPE_QUERY)
+		*type = real_type;
+	else if (*type != real_type) {
+		ERROR("'%s' type mismatch (is %u, expected %u)\n",
+		      mdata->h.filename, real_type, *type);
+		return true;
 	}
+
+	return false;
 }
 
-void *_cbfs_alloc(const char *name, cbfs_allocator_t allocator, void *arg,
-		  size_t *size_out, bool force_ro, enum cbfs_type *type)
+static void *cbfs_load_file(const char *name, cbfs_allocator_t allocator, void *arg,
+			    size_t *size_out, bool force_ro, enum cbfs_type *type)
 {
 	struct region_device rdev;
 	union cbfs_mdata mdata;
@@ -277,16 +386,8 @@ void *_cbfs_alloc(const char *name, cbfs_allocator_t allocator, void *arg,
 	if (cbfs_boot_lookup(name, force_ro, &mdata, &rdev))
 		return NULL;
 
-	if (type) {
-		const enum cbfs_type real_type = be32toh(mdata.h.type);
-		if (*type == CBFS_TYPE_QUERY)
-			*type = real_type;
-		else if (*type != real_type) {
-			ERROR("'%s' type mismatch (is %u, expected %u)\n",
-			      mdata.h.filename, real_type, *type);
-			return NULL;
-		}
-	}
+	if (cbfs_type_mismatch(&mdata, type))
+		return NULL;
 
 	size_t size = region_device_sz(&rdev);
 	uint32_t compression = CBFS_COMPRESS_NONE;
@@ -331,6 +432,167 @@ void *_cbfs_alloc(const char *name, cbfs_allocator_t allocator, void *arg,
 	return loc;
 }
 
+#if ENV_RAMSTAGE && CONFIG(CBFS_PRELOAD)
+
+#define CBFS_PRELOAD_MAX_FILES	8
+
+/*
+ * Preloaded files are kept in the heap: x86, the only architecture with COOP_MULTITASKING,
+ * has no cbfs_cache, and unlike CBMEM the heap takes buffers back in any order and isn't
+ * passed on to the OS.
+ */
+struct cbfs_preload_context {
+	const char *name;
+	struct thread_handle handle;
+	union cbfs_mdata mdata;
+	void *buffer;
+	size_t size;
+	bool mapped;	/* buffer was handed out by cbfs_map(), cbfs_unmap() frees it */
+};
+
+static struct cbfs_preload_context preload_contexts[CBFS_PRELOAD_MAX_FILES];
+static size_t preload_count;
+
+static struct cbfs_preload_context *cbfs_preload_find(const char *name)
+{
+	for (size_t i = 0; i < preload_count; i++) {
+		if (!strcmp(preload_contexts[i].name, name))
+			return &preload_contexts[i];
+	}
+
+	return NULL;
+}
+
+static void *cbfs_preload_allocator(void *arg, size_t size, const union cbfs_mdata *mdata)
+{
+	struct cbfs_preload_context *context = arg;
+
+	memcpy(&context->mdata, mdata, be32toh(mdata->h.offset));
+	context->buffer = malloc(size);
+
+	return context->buffer;
+}
+
+static enum cb_err cbfs_preload_thread_entry(void *arg)
+{
+	struct cbfs_preload_context *context = arg;
+
+	printk(BIOS_DEBUG, "Preloading %s\n", context->name);
+
+	if (!cbfs_load_file(context->name, cbfs_preload_allocator, context, &context->size,
+			    false, NULL)) {
+		printk(BIOS_ERR, "ERROR: Preloading %s failed\n", context->name);
+		free(context->buffer);
+		context->buffer = NULL;
+		return CB_ERR;
+	}
+
+	printk(BIOS_DEBUG, "Preloading %s complete\n", context->name);
+
+	return CB_SUCCESS;
+}
+
+void cbfs_preload(const char *name)
+{
+	struct cbfs_preload_context *context;
+
+	if (cbfs_preload_find(name))
+		return;
+
+	if (preload_count >= ARRAY_SIZE(preload_contexts)) {
+		printk(BIOS_ERR, "ERROR: Too many CBFS preloads, not preloading %s\n", name);
+		return;
+	}
+
+	context = &preload_contexts[preload_count];
+	context->name = name;
+
+	if (thread_run(&context->handle, cbfs_preload_thread_entry, context)) {
+		printk(BIOS_ERR, "ERROR: Failed to start preload thread for %s\n", name);
+		return;
+	}
+
+	preload_count++;
+}
+
+/*
+ * Serve a cbfs_map()/cbfs_alloc() from a finished preload. cbfs_map() gets the preload buffer
+ * itself, cbfs_alloc() a copy in the caller's allocation, after which the buffer is freed.
+ * Either way the preload is used up, later lookups load the file again.
+ */
+static void *cbfs_preload_use(struct cbfs_preload_context *context, cbfs_allocator_t allocator,
+			      void *arg, size_t *size_out, enum cbfs_type *type)
+{
+	void *loc;
+
+	if (cbfs_type_mismatch(&context->mdata, type))
+		return NULL;
+
+	if (size_out)
+		*size_out = context->size;
+
+	/* allocator == NULL means do a cbfs_map() */
+	if (!allocator) {
+		context->mapped = true;
+		return context->buffer;
+	}
+
+	loc = allocator(arg, context->size, &context->mdata);
+	if (!loc) {
+		ERROR("'%s' allocation failure\n", context->mdata.h.filename);
+		return NULL;
+	}
+
+	memcpy(loc, context->buffer, context->size);
+	free(context->buffer);
+	context->buffer = NULL;
+
+	return loc;
+}
+
+/* Free a preload buffer handed out by cbfs_map(). Returns whether |mapping| was one. */
+static bool cbfs_preload_unmap(void *mapping)
+{
+	for (size_t i = 0; i < preload_count; i++) {
+		struct cbfs_preload_context *context = &preload_contexts[i];
+
+		if (context->mapped && context->buffer == mapping) {
+			free(context->buffer);
+			context->buffer = NULL;
+			context->mapped = false;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+#else
+
+void cbfs_preload(const char *name) {}
+
+static bool cbfs_preload_unmap(void *mapping)
+{
+	return false;
+}
+
+#endif
+
+void *_cbfs_alloc(const char *name, cbfs_allocator_t allocator, void *arg,
+		  size_t *size_out, bool force_ro, enum cbfs_type *type)
+{
+#if ENV_RAMSTAGE && CONFIG(CBFS_PRELOAD)
+	struct cbfs_preload_context *context = force_ro ? NULL : cbfs_preload_find(name);
+
+	/* If the preload failed or was already used up, fall back to loading the file again. */
+	if (context && !context->mapped && thread_join(&context->handle) == CB_SUCCESS &&
+	    context->buffer)
+		return cbfs_preload_use(context, allocator, arg, size_out, type);
+#endif
+
+	return cbfs_load_file(name, allocator, arg, size_out, force_ro, type);
+}
+
 void *_cbfs_default_allocator(void *arg, size_t size, const union cbfs_mdata *unused)
 {
 	struct _cbfs_default_allocator_arg *darg = arg;
@@ -390,17 +652,19 @@ cb_err_t cbfs_prog_stage_load(struct prog *pstage)
 	}
 
 	/* LZ4 stages can be decompressed in-place to save mapping scratch space. Load the
-	   compressed data to the end of the buffer and point &rdev to that memory location. */
+	   compressed data to the end of the buffer and decompress it from there. */
+	size_t fsize;
 	if (cbfs_lz4_enabled() && compression == CBFS_COMPRESS_LZ4) {
 		size_t in_size = region_device_sz(&rdev);
 		void *compr_start = prog_start(pstage) + prog_size(pstage) - in_size;
-		if (rdev_readat(&rdev, compr_start, 0, in_size) != in_size)
+		if (!cbfs_load_and_verify(&rdev, compr_start, file_hash))
 			return CB_ERR;
-		rdev_chain_mem(&rdev, compr_start, in_size);
+		fsize = cbfs_decompress(compr_start, in_size, prog_start(pstage),
+					prog_size(pstage), compression);
+	} else {
+		fsize = cbfs_load_and_decompress(&rdev, prog_start(pstage), prog_size(pstage),
+						 compression, file_hash);
 	}
-
-	size_t fsize = cbfs_load_and_decompress(&rdev, prog_start(pstage), prog_size(pstage),
-						compression, file_hash);
 	if (!fsize)
 		return CB_ERR;
 
@@ -513,7 +777,7 @@ static void mcache_to_cbmem(const struct cbfs_boot_device *cbd, u32 cbmem_id)
 		       cbmem_id, real_size);
 		return;
 	}
-	memcpy(cbmem_mcache, cbd->mcache, real_size);
+	cbfs_mcache_copy(cbmem_mcache, cbd->mcache, cbd->mcache_size);
 }
 
 static void cbfs_mcache_migrate(int unused)
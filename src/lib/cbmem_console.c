@@ -3,6 +3,7 @@
 #include <console/cbmem_console.h>
 #include <console/uart.h>
 #include <cbmem.h>
+#include <string.h>
 #include <symbols.h>
 
 /*
@@ -103,6 +104,30 @@ void cbmemc_tx_byte(unsigned char data)
 	current_console->cursor = flags | cursor;
 }
 
+void cbmemc_tx_bytes(const char *buf, size_t len)
+{
+	if (!current_console || !current_console->size)
+		return;
+
+	u32 flags = current_console->cursor & ~CURSOR_MASK;
+	u32 cursor = current_console->cursor & CURSOR_MASK;
+
+	while (len) {
+		size_t n = MIN(len, current_console->size - cursor);
+
+		memcpy(&current_console->body[cursor], buf, n);
+		buf += n;
+		len -= n;
+		cursor += n;
+		if (cursor >= current_console->size) {
+			cursor = 0;
+			flags |= OVERFLOW;
+		}
+	}
+
+	current_console->cursor = flags | cursor;
+}
+
 /*
  * Copy the current console buffer (either from the cache as RAM area or from
  * the static buffer, pointed at by src_cons_p) into the newly initialized CBMEM
@@ -22,6 +22,7 @@
 #include <inttypes.h>
 #include <spi_flash.h>
 #include <smmstore.h>
+#include <timestamp.h>
 
 #if CONFIG(USE_OPTION_TABLE)
 #include <option_table.h>
@@ -258,7 +259,13 @@ static void add_cbmem_pointers(struct lb_header *header)
 	for (i = 0; i < ARRAY_SIZE(section_ids); i++) {
 		const struct section_id *sid = section_ids + i;
 		struct lb_cbmem_ref *cbmem_ref;
-		void *cbmem_addr = cbmem_find(sid->cbmem_id);
+		void *cbmem_addr;
+
+		/* The timestamp table may have moved to a larger CBMEM area. */
+		if (sid->cbmem_id == CBMEM_ID_TIMESTAMP)
+			cbmem_addr = timestamp_lock_table();
+		else
+			cbmem_addr = cbmem_find(sid->cbmem_id);
 
 		if (!cbmem_addr)
 			continue;  /* This section is not present */
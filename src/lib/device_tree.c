@@ -59,6 +59,281 @@ static int dt_prop_is_phandle(struct device_tree_property *prop)
 		 strcmp("linux,phandle", prop->prop.name));
 }
 
+static int dt_check_compat_match(struct device_tree_node *node,
+				 const char *compat);
+
+/*
+ * Hash index of an unflattened tree.
+ *
+ * One open addressing table maps (parent, name) to child nodes, phandles to nodes, and each
+ * compatible string to the nodes listing it. Entries only point at nodes and every hit is
+ * checked against the node itself, so entries made stale by later edits are skipped. Nodes
+ * and properties added without going through the tree (dt_find_node(), dt_add_bin_prop())
+ * are not indexed, which is why all lookups fall back to scanning on a miss.
+ */
+
+enum dt_index_kind {
+	DT_INDEX_CHILD = 1,
+	DT_INDEX_PHANDLE,
+	DT_INDEX_COMPAT,
+};
+
+struct dt_index_entry {
+	uint32_t hash;		/* 0 marks an empty slot. */
+	uint32_t seq;		/* Order in which the nodes were indexed (pre-order). */
+	const struct device_tree_node *parent;	/* Only for DT_INDEX_CHILD. */
+	struct device_tree_node *node;
+};
+
+struct device_tree_index {
+	struct dt_index_entry *slots;
+	uint32_t size;		/* Power of two. */
+	uint32_t used;
+	uint32_t seq;
+};
+
+static uint32_t dt_index_hash(enum dt_index_kind kind, const struct device_tree_node *parent,
+			      const void *key, size_t len)
+{
+	const uintptr_t p = (uintptr_t)parent;
+	const uint8_t *bytes;
+	uint32_t hash = 2166136261 ^ kind;	/* FNV-1a */
+	size_t i;
+
+	bytes = (const uint8_t *)&p;
+	for (i = 0; i < sizeof(p); i++)
+		hash = (hash ^ bytes[i]) * 16777619;
+	bytes = key;
+	for (i = 0; i < len; i++)
+		hash = (hash ^ bytes[i]) * 16777619;
+
+	return hash ? hash : 1;
+}
+
+static void dt_index_place(struct dt_index_entry *slots, uint32_t size,
+			   const struct dt_index_entry *entry)
+{
+	uint32_t i = entry->hash & (size - 1);
+
+	while (slots[i].hash)
+		i = (i + 1) & (size - 1);
+	slots[i] = *entry;
+}
+
+static struct device_tree_index *dt_index_alloc(uint32_t size)
+{
+	struct device_tree_index *index = malloc(sizeof(*index));
+
+	if (!index)
+		return NULL;
+	index->slots = calloc(size, sizeof(*index->slots));
+	if (!index->slots) {
+		free(index);
+		return NULL;
+	}
+	index->size = size;
+	index->used = 0;
+	index->seq = 0;
+
+	return index;
+}
+
+static int dt_index_grow(struct device_tree_index *index)
+{
+	const uint32_t size = index->size * 2;
+	struct dt_index_entry *slots = calloc(size, sizeof(*slots));
+
+	if (!slots)
+		return -1;
+	for (uint32_t i = 0; i < index->size; i++)
+		if (index->slots[i].hash)
+			dt_index_place(slots, size, &index->slots[i]);
+	free(index->slots);
+	index->slots = slots;
+	index->size = size;
+
+	return 0;
+}
+
+static void dt_index_insert(struct device_tree_index *index, uint32_t hash,
+			    const struct device_tree_node *parent,
+			    struct device_tree_node *node, uint32_t seq)
+{
+	const struct dt_index_entry entry = {
+		.hash = hash, .seq = seq, .parent = parent, .node = node,
+	};
+
+	/* Keep the table at most 3/4 full. If it can't grow, lookups will scan instead. */
+	if ((index->used + 1) * 4 > index->size * 3 && dt_index_grow(index))
+		return;
+	dt_index_place(index->slots, index->size, &entry);
+	index->used++;
+}
+
+static void dt_index_add_compat(struct device_tree_index *index, struct device_tree_node *node,
+				uint32_t seq)
+{
+	struct device_tree_property *prop;
+
+	list_for_each(prop, node->properties, list_node) {
+		if (strcmp("compatible", prop->prop.name))
+			continue;
+
+		const char *str = prop->prop.data;
+		size_t bytes = prop->prop.size;
+		while (bytes > 0) {
+			size_t len = strnlen(str, bytes);
+			dt_index_insert(index, dt_index_hash(DT_INDEX_COMPAT, NULL, str, len),
+					NULL, node, seq);
+			if (bytes <= len + 1)
+				break;
+			str += len + 1;
+			bytes -= len + 1;
+		}
+		break;
+	}
+}
+
+/* Index a node that was added under parent (NULL for the root node). */
+static void dt_index_add_node(struct device_tree_index *index,
+			      const struct device_tree_node *parent,
+			      struct device_tree_node *node)
+{
+	const uint32_t seq = index->seq++;
+
+	if (parent)
+		dt_index_insert(index, dt_index_hash(DT_INDEX_CHILD, parent, node->name,
+						     strlen(node->name)), parent, node, seq);
+	if (node->phandle)
+		dt_index_insert(index, dt_index_hash(DT_INDEX_PHANDLE, NULL, &node->phandle,
+						     sizeof(node->phandle)), NULL, node, seq);
+	dt_index_add_compat(index, node, seq);
+}
+
+static void dt_index_add_subtree(struct device_tree_index *index,
+				 const struct device_tree_node *parent,
+				 struct device_tree_node *node)
+{
+	struct device_tree_node *child;
+
+	if (!index)
+		return;
+
+	dt_index_add_node(index, parent, node);
+	list_for_each(child, node->children, list_node)
+		dt_index_add_subtree(index, node, child);
+}
+
+static uint32_t dt_index_count(const struct device_tree_node *node)
+{
+	const struct device_tree_property *prop;
+	const struct device_tree_node *child;
+	uint32_t count = 2;	/* Child and phandle entries. */
+
+	list_for_each(prop, node->properties, list_node)
+		if (!strcmp("compatible", prop->prop.name))
+			for (uint32_t i = 0; i < prop->prop.size; i++)
+				count += !((const char *)prop->prop.data)[i];
+
+	list_for_each(child, node->children, list_node)
+		count += dt_index_count(child);
+
+	return count;
+}
+
+static void dt_index_build(struct device_tree *tree)
+{
+	/* Leave room for nodes added by fixups and overlays before the table has to grow. */
+	const uint32_t entries = dt_index_count(tree->root) + 64;
+	uint32_t size = 64;
+
+	while (size * 3 < entries * 4)
+		size *= 2;
+
+	tree->index = dt_index_alloc(size);
+	if (!tree->index) {
+		printk(BIOS_DEBUG, "Not enough heap to index the device tree\n");
+		return;
+	}
+	dt_index_add_subtree(tree->index, NULL, tree->root);
+}
+
+static struct device_tree_node *dt_index_find_child(struct device_tree_index *index,
+						    const struct device_tree_node *parent,
+						    const char *name)
+{
+	const uint32_t hash = dt_index_hash(DT_INDEX_CHILD, parent, name, strlen(name));
+
+	for (uint32_t i = hash & (index->size - 1); index->slots[i].hash;
+	     i = (i + 1) & (index->size - 1)) {
+		const struct dt_index_entry *entry = &index->slots[i];
+		if (entry->hash == hash && entry->parent == parent &&
+		    !strcmp(entry->node->name, name))
+			return entry->node;
+	}
+
+	return NULL;
+}
+
+static struct device_tree_node *dt_index_find_phandle(struct device_tree_index *index,
+						      uint32_t phandle)
+{
+	const uint32_t hash = dt_index_hash(DT_INDEX_PHANDLE, NULL, &phandle, sizeof(phandle));
+
+	for (uint32_t i = hash & (index->size - 1); index->slots[i].hash;
+	     i = (i + 1) & (index->size - 1)) {
+		const struct dt_index_entry *entry = &index->slots[i];
+		if (entry->hash == hash && entry->node->phandle == phandle)
+			return entry->node;
+	}
+
+	return NULL;
+}
+
+static struct device_tree_node *dt_index_find_compat(struct device_tree_index *index,
+						     const char *compat)
+{
+	const uint32_t hash = dt_index_hash(DT_INDEX_COMPAT, NULL, compat, strlen(compat));
+	const struct dt_index_entry *found = NULL;
+
+	/* Several nodes can share a compatible string, return the one indexed first. */
+	for (uint32_t i = hash & (index->size - 1); index->slots[i].hash;
+	     i = (i + 1) & (index->size - 1)) {
+		const struct dt_index_entry *entry = &index->slots[i];
+		if (entry->hash == hash && (!found || entry->seq < found->seq) &&
+		    dt_check_compat_match(entry->node, compat))
+			found = entry;
+	}
+
+	return found ? found->node : NULL;
+}
+
+/* Find the child of a node by name, through the index if there is one. */
+static struct device_tree_node *dt_find_child(struct device_tree_index *index,
+					      struct device_tree_node *parent,
+					      const char *name)
+{
+	struct device_tree_node *node;
+
+	if (index) {
+		node = dt_index_find_child(index, parent, name);
+		if (node)
+			return node;
+	}
+
+	list_for_each(node, parent->children, list_node) {
+		if (!strcmp(node->name, name)) {
+			/* Added behind the index's back, add it now. */
+			if (index)
+				dt_index_insert(index, dt_index_hash(DT_INDEX_CHILD, parent,
+						name, strlen(name)), parent, node, index->seq++);
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
 
 
 /*
@@ -164,6 +439,366 @@ int fdt_skip_node(const void *blob, uint32_t start_offset)
 
 
 
+/*
+ * Functions for looking up and editing flattened trees in place.
+ *
+ * Editing expects the blocks in the order dtc and dt_flatten() write them: reserve map,
+ * structure, strings. Whatever lies between the end of the strings and totalsize is slack
+ * that edits can grow into, see fdt_open_into() and fdt_pack(). Every edit moves what comes
+ * after it, so offsets of later nodes and properties are stale afterwards, and property data
+ * passed in must not point into the blob itself.
+ */
+
+static uint32_t fdt_used_size(const void *blob)
+{
+	const struct fdt_header *header = blob;
+
+	return be32toh(header->strings_offset) + be32toh(header->strings_size);
+}
+
+/* Resize the old_len bytes at offset to new_len bytes, moving everything after them. */
+static int fdt_splice(void *blob, uint32_t offset, uint32_t old_len, uint32_t new_len)
+{
+	struct fdt_header *header = blob;
+	const uint32_t end = fdt_used_size(blob);
+	const uint32_t struct_offset = be32toh(header->structure_offset);
+	const uint32_t strings_offset = be32toh(header->strings_offset);
+	const uint32_t delta = new_len - old_len;	/* May wrap around, that's fine. */
+
+	if (end - old_len + new_len > be32toh(header->totalsize))
+		return -1;
+
+	memmove((uint8_t *)blob + offset + new_len, (uint8_t *)blob + offset + old_len,
+		end - offset - old_len);
+
+	if (offset < struct_offset)
+		header->structure_offset = htobe32(struct_offset + delta);
+	else if (offset < strings_offset)
+		header->structure_size = htobe32(be32toh(header->structure_size) + delta);
+	if (offset < strings_offset)
+		header->strings_offset = htobe32(strings_offset + delta);
+	else
+		header->strings_size = htobe32(be32toh(header->strings_size) + delta);
+
+	return 0;
+}
+
+/* Find a string in the strings block, or append it. Returns its offset in the block or -1. */
+static int fdt_find_add_string(void *blob, const char *str)
+{
+	const struct fdt_header *header = blob;
+	const char *strings = (const char *)blob + be32toh(header->strings_offset);
+	const uint32_t strings_size = be32toh(header->strings_size);
+	const uint32_t len = strlen(str) + 1;
+
+	/* Property names are shared, and so are suffixes of other names. */
+	for (uint32_t i = 0; i + len <= strings_size; i++)
+		if (!memcmp(&strings[i], str, len))
+			return i;
+
+	if (fdt_splice(blob, fdt_used_size(blob), 0, len))
+		return -1;
+	memcpy((char *)blob + fdt_used_size(blob) - len, str, len);
+
+	return strings_size;
+}
+
+/*
+ * Copy a flattened tree into a buffer of size bytes, which may be the one it's already in,
+ * and make the rest of the buffer slack for editing it.
+ *
+ * @return	0 on success, -1 if the tree doesn't fit or can't be edited in place.
+ */
+int fdt_open_into(const void *blob, void *buf, uint32_t size)
+{
+	const struct fdt_header *header = blob;
+	const uint32_t reserve_offset = be32toh(header->reserve_map_offset);
+	const uint32_t struct_offset = be32toh(header->structure_offset);
+	const uint32_t strings_offset = be32toh(header->strings_offset);
+
+	if (be32toh(header->magic) != FDT_HEADER_MAGIC ||
+	    be32toh(header->version) < FDT_SUPPORTED_VERSION)
+		return -1;
+	if (reserve_offset > struct_offset ||
+	    struct_offset + be32toh(header->structure_size) > strings_offset ||
+	    fdt_used_size(blob) > size)
+		return -1;
+
+	memmove(buf, blob, fdt_used_size(blob));
+	((struct fdt_header *)buf)->totalsize = htobe32(size);
+
+	return 0;
+}
+
+/* Give up the slack after the strings block, e.g. before handing the tree to a kernel. */
+void fdt_pack(void *blob)
+{
+	struct fdt_header *header = blob;
+
+	header->totalsize = htobe32(fdt_used_size(blob));
+}
+
+/*
+ * Skip the name and properties of a node. The children of a node follow each other, the
+ * next one is fdt_skip_node() bytes further, until fdt_node_name() finds no more.
+ *
+ * @return	The offset of the first child or, if there is none, of the node's end.
+ */
+uint32_t fdt_first_child(const void *blob, uint32_t node_offset)
+{
+	uint32_t offset = node_offset + fdt_node_name(blob, node_offset, NULL);
+	int size;
+
+	while ((size = fdt_next_property(blob, offset, NULL)))
+		offset += size;
+
+	return offset;
+}
+
+/*
+ * Find a child of a node by name.
+ *
+ * @return	The offset of the child node, or 0 if there is none.
+ */
+uint32_t fdt_find_child(const void *blob, uint32_t node_offset, const char *name)
+{
+	uint32_t offset = fdt_first_child(blob, node_offset);
+	const char *child_name;
+	int size;
+
+	while (fdt_node_name(blob, offset, &child_name)) {
+		if (!strcmp(child_name, name))
+			return offset;
+		size = fdt_skip_node(blob, offset);
+		offset += size;
+	}
+
+	return 0;
+}
+
+/*
+ * Find a node from a '/' separated path starting at the root, like
+ * dt_find_node_by_path() but without aliases or creating nodes.
+ *
+ * @return	The offset of the node, or 0 if it doesn't exist.
+ */
+uint32_t fdt_find_node_by_path(const void *blob, const char *path, u32 *addrcp,
+			       u32 *sizecp)
+{
+	const struct fdt_header *header = blob;
+	uint32_t offset = be32toh(header->structure_offset);
+	char name[64];
+
+	if (*path++ != '/')
+		return 0;
+
+	while (offset) {
+		if (addrcp)
+			fdt_read_u32_prop(blob, offset, "#address-cells", addrcp);
+		if (sizecp)
+			fdt_read_u32_prop(blob, offset, "#size-cells", sizecp);
+
+		if (!*path)
+			return offset;
+
+		const size_t len = strcspn(path, "/");
+		if (len >= sizeof(name))
+			return 0;
+		memcpy(name, path, len);
+		name[len] = '\0';
+		path += path[len] ? len + 1 : len;
+
+		offset = fdt_find_child(blob, offset, name);
+	}
+
+	return 0;
+}
+
+/*
+ * Find a property of a node.
+ *
+ * @return	The offset of the property, or 0 if the node doesn't have it.
+ */
+uint32_t fdt_find_prop(const void *blob, uint32_t node_offset, const char *name,
+		       struct fdt_property *prop)
+{
+	uint32_t offset = node_offset + fdt_node_name(blob, node_offset, NULL);
+	struct fdt_property fprop;
+	int size;
+
+	while ((size = fdt_next_property(blob, offset, &fprop))) {
+		if (!strcmp(fprop.name, name)) {
+			if (prop)
+				*prop = fprop;
+			return offset;
+		}
+		offset += size;
+	}
+
+	return 0;
+}
+
+/* Read a 32-bit property into *val, leaving it alone if the property doesn't exist. */
+void fdt_read_u32_prop(const void *blob, uint32_t node_offset, const char *name, u32 *val)
+{
+	struct fdt_property prop;
+
+	if (fdt_find_prop(blob, node_offset, name, &prop) && prop.size == sizeof(*val))
+		*val = be32dec(prop.data);
+}
+
+/*
+ * Add a property to a node, or update it if it already exists.
+ *
+ * @return	0 on success, -1 if the blob ran out of slack.
+ */
+int fdt_set_prop(void *blob, uint32_t node_offset, const char *name, const void *data,
+		 uint32_t size)
+{
+	struct fdt_property prop;
+	uint32_t offset = fdt_find_prop(blob, node_offset, name, &prop);
+	uint32_t *ptr;
+
+	if (offset) {
+		if (fdt_splice(blob, offset + 3 * sizeof(uint32_t),
+			       ALIGN_UP(prop.size, sizeof(uint32_t)),
+			       ALIGN_UP(size, sizeof(uint32_t))))
+			return -1;
+	} else {
+		/* Add the name first, it doesn't move anything in the structure block. */
+		const int name_offset = fdt_find_add_string(blob, name);
+		if (name_offset < 0)
+			return -1;
+
+		offset = fdt_first_child(blob, node_offset);
+		if (fdt_splice(blob, offset, 0, 3 * sizeof(uint32_t) +
+			       ALIGN_UP(size, sizeof(uint32_t))))
+			return -1;
+		be32enc((uint8_t *)blob + offset, FDT_TOKEN_PROPERTY);
+		be32enc((uint8_t *)blob + offset + 2 * sizeof(uint32_t), name_offset);
+	}
+
+	ptr = (uint32_t *)((uint8_t *)blob + offset);
+	be32enc(&ptr[1], size);
+	if (size % sizeof(uint32_t))
+		ptr[3 + size / sizeof(uint32_t)] = 0;	/* Zero the padding. */
+	memcpy(&ptr[3], data, size);
+
+	return 0;
+}
+
+int fdt_set_string_prop(void *blob, uint32_t node_offset, const char *name, const char *str)
+{
+	return fdt_set_prop(blob, node_offset, name, str, strlen(str) + 1);
+}
+
+int fdt_set_u32_prop(void *blob, uint32_t node_offset, const char *name, u32 val)
+{
+	const u32 be_val = htobe32(val);
+
+	return fdt_set_prop(blob, node_offset, name, &be_val, sizeof(be_val));
+}
+
+int fdt_set_u64_prop(void *blob, uint32_t node_offset, const char *name, u64 val)
+{
+	const u64 be_val = htobe64(val);
+
+	return fdt_set_prop(blob, node_offset, name, &be_val, sizeof(be_val));
+}
+
+/* Add a 'reg' address list property to a node, see dt_add_reg_prop(). */
+int fdt_set_reg_prop(void *blob, uint32_t node_offset, u64 *addrs, u64 *sizes, int count,
+		     u32 addr_cells, u32 size_cells)
+{
+	const size_t length = (addr_cells + size_cells) * sizeof(u32) * count;
+	u8 *data = xmalloc(length);
+	u8 *cur = data;
+	int ret;
+
+	for (int i = 0; i < count; i++) {
+		dt_write_int(cur, addrs[i], addr_cells * sizeof(u32));
+		cur += addr_cells * sizeof(u32);
+		dt_write_int(cur, sizes[i], size_cells * sizeof(u32));
+		cur += size_cells * sizeof(u32);
+	}
+
+	ret = fdt_set_prop(blob, node_offset, "reg", data, length);
+	free(data);
+
+	return ret;
+}
+
+/* Delete a property of a node if it exists. */
+void fdt_delete_prop(void *blob, uint32_t node_offset, const char *name)
+{
+	struct fdt_property prop;
+	uint32_t offset = fdt_find_prop(blob, node_offset, name, &prop);
+
+	if (offset)
+		fdt_splice(blob, offset, 3 * sizeof(uint32_t) +
+			   ALIGN_UP(prop.size, sizeof(uint32_t)), 0);
+}
+
+/*
+ * Add an empty child node to a node, as its first child.
+ *
+ * @return	The offset of the new node, or 0 if the blob ran out of slack.
+ */
+uint32_t fdt_add_node(void *blob, uint32_t parent_offset, const char *name)
+{
+	const uint32_t offset = fdt_first_child(blob, parent_offset);
+	const uint32_t name_size = ALIGN_UP(strlen(name) + 1, sizeof(uint32_t));
+	uint8_t *ptr = (uint8_t *)blob + offset;
+
+	if (fdt_splice(blob, offset, 0, 2 * sizeof(uint32_t) + name_size))
+		return 0;
+
+	be32enc(ptr, FDT_TOKEN_BEGIN_NODE);
+	memset(ptr + sizeof(uint32_t), 0, name_size);
+	strcpy((char *)ptr + sizeof(uint32_t), name);
+	be32enc(ptr + sizeof(uint32_t) + name_size, FDT_TOKEN_END_NODE);
+
+	return offset;
+}
+
+/* Find a child of a node by name, or add it if it doesn't exist. Returns 0 on failure. */
+uint32_t fdt_find_or_add_child(void *blob, uint32_t parent_offset, const char *name)
+{
+	const uint32_t offset = fdt_find_child(blob, parent_offset, name);
+
+	return offset ? offset : fdt_add_node(blob, parent_offset, name);
+}
+
+/* Delete a node and all of its children. */
+void fdt_delete_node(void *blob, uint32_t node_offset)
+{
+	fdt_splice(blob, node_offset, fdt_skip_node(blob, node_offset), 0);
+}
+
+/*
+ * Add an entry to the memory reservation map.
+ *
+ * @return	0 on success, -1 if the blob ran out of slack.
+ */
+int fdt_add_reserve_map_entry(void *blob, uint64_t start, uint64_t size)
+{
+	const struct fdt_header *header = blob;
+	uint32_t offset = be32toh(header->reserve_map_offset);
+
+	/* The map is terminated by an entry with size 0. */
+	while (be64dec((uint8_t *)blob + offset + sizeof(uint64_t)))
+		offset += 2 * sizeof(uint64_t);
+
+	if (fdt_splice(blob, offset, 0, 2 * sizeof(uint64_t)))
+		return -1;
+	be64enc((uint8_t *)blob + offset, start);
+	be64enc((uint8_t *)blob + offset + sizeof(uint64_t), size);
+
+	return 0;
+}
+
+
+
 /*
  * Functions to turn a flattened tree into an unflattened one.
  */
@@ -284,6 +919,9 @@ struct device_tree *fdt_unflatten(const void *blob)
 
 	fdt_unflatten_node(blob, struct_offset, tree, &tree->root);
 
+	if (CONFIG(FLATTENED_DEVICE_TREE_INDEX))
+		dt_index_build(tree);
+
 	return tree;
 }
 
@@ -529,11 +1167,12 @@ void dt_read_cell_props(const struct device_tree_node *node, u32 *addrcp,
  * @param create	1: Create node(s) if not found. 0: Return NULL instead.
  * @return		The found/created node, or NULL.
  */
-struct device_tree_node *dt_find_node(struct device_tree_node *parent,
-				      const char **path, u32 *addrcp,
-				      u32 *sizecp, int create)
+static struct device_tree_node *dt_find_node_indexed(struct device_tree_index *index,
+						     struct device_tree_node *parent,
+						     const char **path, u32 *addrcp,
+						     u32 *sizecp, int create)
 {
-	struct device_tree_node *node, *found = NULL;
+	struct device_tree_node *found;
 
 	/* Update #address-cells and #size-cells for this level. */
 	dt_read_cell_props(parent, addrcp, sizecp);
@@ -542,19 +1181,14 @@ struct device_tree_node *dt_find_node(struct device_tree_node *parent,
 		return parent;
 
 	/* Find the next node in the path, if it exists. */
-	list_for_each(node, parent->children, list_node) {
-		if (!strcmp(node->name, *path)) {
-			found = node;
-			break;
-		}
-	}
+	found = dt_find_child(index, parent, *path);
 
 	/* Otherwise create it or return NULL. */
 	if (!found) {
 		if (!create)
 			return NULL;
 
-		found = malloc(sizeof(*found));
+		found = calloc(1, sizeof(*found));
 		if (!found)
 			return NULL;
 		found->name = strdup(*path);
@@ -562,9 +1196,19 @@ struct device_tree_node *dt_find_node(struct device_tree_node *parent,
 			return NULL;
 
 		list_insert_after(&found->list_node, &parent->children);
+		if (index)
+			dt_index_insert(index, dt_index_hash(DT_INDEX_CHILD, parent, found->name,
+					strlen(found->name)), parent, found, index->seq++);
 	}
 
-	return dt_find_node(found, path + 1, addrcp, sizecp, create);
+	return dt_find_node_indexed(index, found, path + 1, addrcp, sizecp, create);
+}
+
+struct device_tree_node *dt_find_node(struct device_tree_node *parent,
+				      const char **path, u32 *addrcp,
+				      u32 *sizecp, int create)
+{
+	return dt_find_node_indexed(NULL, parent, path, addrcp, sizecp, create);
 }
 
 /*
@@ -649,8 +1293,8 @@ struct device_tree_node *dt_find_node_by_path(struct device_tree *tree,
 
 	if (!next_slash) {
 		path_array[i] = NULL;
-		node = dt_find_node(parent, path_array,
-				    addrcp, sizecp, create);
+		node = dt_find_node_indexed(tree->index, parent, path_array,
+					    addrcp, sizecp, create);
 	}
 
 	free(duped_str);
@@ -701,6 +1345,33 @@ struct device_tree_node *dt_find_node_by_phandle(struct device_tree_node *root,
 	return NULL;
 }
 
+/*
+ * Find a node in the tree from its phandle.
+ *
+ * @param tree		The device tree to search.
+ * @param phandle	The phandle of the node.
+ * @return		The found node, or NULL.
+ */
+struct device_tree_node *dt_find_tree_node_by_phandle(struct device_tree *tree,
+						      uint32_t phandle)
+{
+	struct device_tree_node *node;
+
+	if (tree->index) {
+		node = dt_index_find_phandle(tree->index, phandle);
+		if (node)
+			return node;
+	}
+
+	node = dt_find_node_by_phandle(tree->root, phandle);
+	/* Got its phandle behind the index's back, add it now. */
+	if (node && tree->index)
+		dt_index_insert(tree->index, dt_index_hash(DT_INDEX_PHANDLE, NULL, &phandle,
+				sizeof(phandle)), NULL, node, tree->index->seq++);
+
+	return node;
+}
+
 /*
  * Check if given node is compatible.
  *
@@ -757,6 +1428,33 @@ struct device_tree_node *dt_find_compat(struct device_tree_node *parent,
 	return NULL;
 }
 
+/*
+ * Find a node in the tree with a compatible string.
+ *
+ * Without an index, this is the first matching node in the tree like with dt_find_compat().
+ * With an index, nodes that are indexed win, and among them the one that was indexed first.
+ * That is the first one in the tree as unflattened, but nodes added later are indexed in the
+ * order they were added, and compatible properties added with dt_add_bin_prop() are not
+ * indexed at all. Use dt_find_compat() on the root node if tree order matters.
+ *
+ * @param tree		The device tree to search.
+ * @param compat	The compatible string to find.
+ * @return		The found node, or NULL.
+ */
+struct device_tree_node *dt_find_tree_compat(struct device_tree *tree,
+					     const char *compat)
+{
+	struct device_tree_node *node;
+
+	if (tree->index) {
+		node = dt_index_find_compat(tree->index, compat);
+		if (node)
+			return node;
+	}
+
+	return dt_find_compat(tree->root, compat);
+}
+
 /*
  * Find the next compatible child of a given parent. All children upto the
  * child passed in by caller are ignored. If child is NULL, it considers all the
@@ -1152,18 +1850,19 @@ static uint32_t dt_adjust_all_phandles(struct device_tree_node *node,
 /*
  * Apply a /__local_fixup__ subtree to the corresponding overlay subtree.
  *
+ * @param index		Index of the overlay, or NULL.
  * @param node		Root node of the overlay subtree to fix up.
  * @param node		Root node of the /__local_fixup__ subtree.
  * @param base		Adjustment that was added to phandles in the overlay.
  *
  * @return		0 on success, -1 on error.
  */
-static int dt_fixup_locals(struct device_tree_node *node,
-		    struct device_tree_node *fixup, uint32_t base)
+static int dt_fixup_locals(struct device_tree_index *index,
+			   struct device_tree_node *node,
+			   struct device_tree_node *fixup, uint32_t base)
 {
 	struct device_tree_property *prop;
 	struct device_tree_property *fixup_prop;
-	struct device_tree_node *child;
 	struct device_tree_node *fixup_child;
 	int i;
 
@@ -1196,18 +1895,14 @@ static int dt_fixup_locals(struct device_tree_node *node,
 	/* Now recursively descend both the base tree and the /__local_fixups__
 	   subtree in sync to apply all fixups. */
 	list_for_each(fixup_child, fixup->children, list_node) {
-		struct device_tree_node *base_child = NULL;
-		list_for_each(child, node->children, list_node)
-			if (!strcmp(child->name, fixup_child->name)) {
-				base_child = child;
-				break;
-			}
+		struct device_tree_node *base_child = dt_find_child(index, node,
+								    fixup_child->name);
 
 		/* All fixup nodes should have a corresponding base node. */
 		if (!base_child)
 			return -1;
 
-		if (dt_fixup_locals(base_child, fixup_child, base) < 0)
+		if (dt_fixup_locals(index, base_child, fixup_child, base) < 0)
 			return -1;
 	}
 
@@ -1365,11 +2060,13 @@ static int dt_fixup_all_externals(struct device_tree *tree,
  * Copy all nodes and properties from one DT subtree into another. This is a
  * shallow copy so both trees will point to the same property data afterwards.
  *
+ * @params index	Index of the destination tree, or NULL.
  * @params dst		Destination subtree to copy into.
  * @params src		Source subtree to copy from.
  * @params upd		1 to overwrite same-name properties, 0 to discard them.
  */
-static void dt_copy_subtree(struct device_tree_node *dst,
+static void dt_copy_subtree(struct device_tree_index *index,
+			    struct device_tree_node *dst,
 			    struct device_tree_node *src, int upd)
 {
 	struct device_tree_property *prop;
@@ -1404,24 +2101,22 @@ static void dt_copy_subtree(struct device_tree_node *dst,
 		}
 
 		dst_prop->prop = src_prop->prop;
+		if (index && !strcmp(dst_prop->prop.name, "compatible"))
+			dt_index_add_compat(index, dst, index->seq++);
 	}
 
-	struct device_tree_node *node;
 	struct device_tree_node *src_node;
 	list_for_each(src_node, src->children, list_node) {
-		struct device_tree_node *dst_node = NULL;
-		list_for_each(node, dst->children, list_node)
-			if (!strcmp(node->name, src_node->name)) {
-				dst_node = node;
-				break;
-			}
+		struct device_tree_node *dst_node = dt_find_child(index, dst,
+								  src_node->name);
 
 		if (!dst_node) {
 			dst_node = xzalloc(sizeof(*dst_node));
 			*dst_node = *src_node;
 			list_insert_after(&dst_node->list_node, &dst->children);
+			dt_index_add_subtree(index, dst, dst_node);
 		} else {
-			dt_copy_subtree(dst_node, src_node, upd);
+			dt_copy_subtree(index, dst_node, src_node, upd);
 		}
 	}
 }
@@ -1465,8 +2160,8 @@ static int dt_import_fragment(struct device_tree *tree,
 	if (phandle) {
 		if (phandle->prop.size != sizeof(uint32_t))
 			return -1;
-		target = dt_find_node_by_phandle(tree->root,
-						 be32dec(phandle->prop.data));
+		target = dt_find_tree_node_by_phandle(tree,
+						      be32dec(phandle->prop.data));
 		/* Symbols already updated as part of dt_fixup_external(). */
 	} else if (path) {
 		target = dt_find_node_by_path(tree, path->prop.data,
@@ -1476,7 +2171,7 @@ static int dt_import_fragment(struct device_tree *tree,
 	if (!target)
 		return -1;
 
-	dt_copy_subtree(target, overlay, 1);
+	dt_copy_subtree(tree->index, target, overlay, 1);
 	return 0;
 }
 
@@ -1510,8 +2205,8 @@ int dt_apply_overlay(struct device_tree *tree, struct device_tree *overlay)
 	   nodes referring to them. Those are listed in /__local_fixups__. */
 	struct device_tree_node *local_fixups = dt_find_node_by_path(overlay,
 					"/__local_fixups__", NULL, NULL, 0);
-	if (local_fixups && dt_fixup_locals(overlay->root, local_fixups,
-					    phandle_base) < 0) {
+	if (local_fixups && dt_fixup_locals(overlay->index, overlay->root,
+					    local_fixups, phandle_base) < 0) {
 		printk(BIOS_DEBUG, "ERROR: invalid local fixups in overlay\n");
 		return -1;
 	}
@@ -1559,11 +2254,20 @@ int dt_apply_overlay(struct device_tree *tree, struct device_tree *overlay)
 	 * /__symbols__ node into the base tree root.
 	 */
 	if (overlay_symbols) {
-		if (symbols)
-			dt_copy_subtree(symbols, overlay_symbols, 0);
-		else
+		if (symbols) {
+			dt_copy_subtree(tree->index, symbols, overlay_symbols, 0);
+		} else {
 			list_insert_after(&overlay_symbols->list_node,
 					  &tree->root->children);
+			dt_index_add_subtree(tree->index, tree->root, overlay_symbols);
+		}
+	}
+
+	/* The overlay's nodes belong to the base tree now, its own index is unused. */
+	if (overlay->index) {
+		free(overlay->index->slots);
+		free(overlay->index);
+		overlay->index = NULL;
 	}
 
 	return 0;
@@ -235,6 +235,35 @@ void fit_add_ramdisk(struct device_tree *tree, void *ramdisk_addr,
 	dt_add_u64_prop(node, "linux,initrd-end", end);
 }
 
+int fit_update_chosen_fdt(void *blob, const char *cmd_line)
+{
+	uint32_t root = fdt_find_node_by_path(blob, "/", NULL, NULL);
+	uint32_t node = fdt_find_or_add_child(blob, root, "chosen");
+
+	if (!node)
+		return -1;
+
+	return fdt_set_string_prop(blob, node, "bootargs", cmd_line);
+}
+
+int fit_add_ramdisk_fdt(void *blob, void *ramdisk_addr, size_t ramdisk_size)
+{
+	uint32_t root = fdt_find_node_by_path(blob, "/", NULL, NULL);
+	uint32_t node = fdt_find_or_add_child(blob, root, "chosen");
+
+	u64 start = (uintptr_t)ramdisk_addr;
+	u64 end = start + ramdisk_size;
+
+	if (!node)
+		return -1;
+
+	if (fdt_set_u64_prop(blob, node, "linux,initrd-start", start) ||
+	    fdt_set_u64_prop(blob, node, "linux,initrd-end", end))
+		return -1;
+
+	return 0;
+}
+
 static void update_reserve_map(uint64_t start, uint64_t end,
 			       struct device_tree *tree)
 {
@@ -333,6 +362,45 @@ void fit_add_compat_string(const char *str)
 	list_insert_after(&compat_node->list_node, &compat_strings);
 }
 
+static void fit_collect_memory(struct mem_map *map)
+{
+	memranges_init_empty(&map->mem, NULL, 0);
+	memranges_init_empty(&map->reserved, NULL, 0);
+
+	bootmem_walk_os_mem(walk_memory_table, map);
+}
+
+/* Build the 'reg' property of the memory node from the RAM ranges in map. */
+static void *fit_memory_reg_prop(struct mem_map *map, u32 addr_cells, u32 size_cells,
+				 size_t *length)
+{
+	const struct range_entry *r;
+
+	/*
+	 * Count the amount of 'reg' entries we need (account for size limits).
+	 */
+	size_t count = 0;
+	memranges_each_entry(r, &map->mem) {
+		uint64_t size = range_entry_size(r);
+		uint64_t max_size = max_range(size_cells);
+		count += DIV_ROUND_UP(size, max_size);
+	}
+
+	/* Allocate the right amount of space and fill up the entries. */
+	*length = count * (addr_cells + size_cells) * sizeof(u32);
+
+	void *data = xzalloc(*length);
+
+	struct entry_params add_params = { addr_cells, size_cells, data };
+	memranges_each_entry(r, &map->mem) {
+		update_mem_property(range_entry_base(r), range_entry_end(r),
+				    &add_params);
+	}
+	assert(add_params.data - data == *length);
+
+	return data;
+}
+
 void fit_update_memory(struct device_tree *tree)
 {
 	const struct range_entry *r;
@@ -359,10 +427,7 @@ void fit_update_memory(struct device_tree *tree)
 	list_insert_after(&node->list_node, &tree->root->children);
 	dt_add_string_prop(node, "device_type", (char *)"memory");
 
-	memranges_init_empty(&map.mem, NULL, 0);
-	memranges_init_empty(&map.reserved, NULL, 0);
-
-	bootmem_walk_os_mem(walk_memory_table, &map);
+	fit_collect_memory(&map);
 
 	/* CBMEM regions are both carved out and explicitly reserved. */
 	memranges_each_entry(r, &map.reserved) {
@@ -370,33 +435,71 @@ void fit_update_memory(struct device_tree *tree)
 				   tree);
 	}
 
+	/* Assemble the final property and add it to the device tree. */
+	size_t length;
+	void *data = fit_memory_reg_prop(&map, addr_cells, size_cells, &length);
+	dt_add_bin_prop(node, "reg", data, length);
+
+	memranges_teardown(&map.mem);
+	memranges_teardown(&map.reserved);
+}
+
+int fit_update_memory_fdt(void *blob)
+{
+	const struct range_entry *r;
+	u32 addr_cells = 1, size_cells = 1;
+	struct mem_map map;
+	uint32_t root, node;
+	const char *devtype;
+	struct fdt_property prop;
+	int ret = 0;
+
+	printk(BIOS_INFO, "FIT: Updating devicetree memory entries\n");
+
+	root = fdt_find_node_by_path(blob, "/", &addr_cells, &size_cells);
+
 	/*
-	 * Count the amount of 'reg' entries we need (account for size limits).
+	 * First remove all existing device_type="memory" nodes, then add ours.
 	 */
-	size_t count = 0;
-	memranges_each_entry(r, &map.mem) {
-		uint64_t size = range_entry_size(r);
-		uint64_t max_size = max_range(size_cells);
-		count += DIV_ROUND_UP(size, max_size);
+	node = fdt_first_child(blob, root);
+	while (fdt_node_name(blob, node, NULL)) {
+		if (fdt_find_prop(blob, node, "device_type", &prop)) {
+			devtype = prop.data;
+			if (prop.size && !strncmp(devtype, "memory", prop.size)) {
+				fdt_delete_node(blob, node);
+				continue;
+			}
+		}
+		node += fdt_skip_node(blob, node);
 	}
 
-	/* Allocate the right amount of space and fill up the entries. */
-	size_t length = count * (addr_cells + size_cells) * sizeof(u32);
+	node = fdt_add_node(blob, root, "memory");
+	if (!node)
+		return -1;
+	if (fdt_set_string_prop(blob, node, "device_type", "memory"))
+		return -1;
 
-	void *data = xzalloc(length);
+	fit_collect_memory(&map);
 
-	struct entry_params add_params = { addr_cells, size_cells, data };
-	memranges_each_entry(r, &map.mem) {
-		update_mem_property(range_entry_base(r), range_entry_end(r),
-				    &add_params);
+	/* CBMEM regions are both carved out and explicitly reserved. */
+	memranges_each_entry(r, &map.reserved) {
+		if (fdt_add_reserve_map_entry(blob, range_entry_base(r), range_entry_size(r)))
+			ret = -1;
 	}
-	assert(add_params.data - data == length);
 
-	/* Assemble the final property and add it to the device tree. */
-	dt_add_bin_prop(node, "reg", data, length);
+	/* The reserve map lies before the structure block, so the node moved. */
+	node = fdt_find_child(blob, fdt_find_node_by_path(blob, "/", NULL, NULL), "memory");
+
+	size_t length;
+	void *data = fit_memory_reg_prop(&map, addr_cells, size_cells, &length);
+	if (ret || fdt_set_prop(blob, node, "reg", data, length))
+		ret = -1;
+	free(data);
 
 	memranges_teardown(&map.mem);
 	memranges_teardown(&map.reserved);
+
+	return ret;
 }
 
 /*
@@ -6,6 +6,7 @@
 #include <bootmem.h>
 #include <cbmem.h>
 #include <device/resource.h>
+#include <endian.h>
 #include <stdlib.h>
 #include <commonlib/region.h>
 #include <fit.h>
@@ -15,6 +16,16 @@
 #include <lib.h>
 #include <boardid.h>
 
+/*
+ * Room for the changes made to an FDT that is edited in place: the coreboot
+ * node, memory node and reservations, and the kernel command line.
+ */
+#if defined(CONFIG_LINUX_COMMAND_LINE)
+#define FDT_EDIT_SLACK	(16 * KiB + sizeof(CONFIG_LINUX_COMMAND_LINE))
+#else
+#define FDT_EDIT_SLACK	(16 * KiB)
+#endif
+
 /* Pack the device_tree and place it at given position. */
 static void pack_fdt(struct region *fdt, struct device_tree *dt)
 {
@@ -103,35 +114,20 @@ static struct device_tree *unpack_fdt(struct fit_image_node *image_node)
 	return fdt_unflatten(data);
 }
 
-/**
- * Add coreboot tables, CBMEM information and optional board specific strapping
- * IDs to the device tree loaded via FIT.
+/*
+ * Find the coreboot table and CBMEM, which make up the 'reg' property of the
+ * /firmware/coreboot node.
  */
-static void add_cb_fdt_data(struct device_tree *tree)
+static bool get_cb_fdt_regs(u64 reg_addrs[2], u64 reg_sizes[2])
 {
-	u32 addr_cells = 1, size_cells = 1;
-	u64 reg_addrs[2], reg_sizes[2];
 	void *baseptr = NULL;
 	size_t size = 0;
 
-	static const char *firmware_path[] = {"firmware", NULL};
-	struct device_tree_node *firmware_node = dt_find_node(tree->root,
-		firmware_path, &addr_cells, &size_cells, 1);
-
-	/* Need to add 'ranges' to the intermediate node to make 'reg' work. */
-	dt_add_bin_prop(firmware_node, "ranges", NULL, 0);
-
-	static const char *coreboot_path[] = {"coreboot", NULL};
-	struct device_tree_node *coreboot_node = dt_find_node(firmware_node,
-		coreboot_path, &addr_cells, &size_cells, 1);
-
-	dt_add_string_prop(coreboot_node, "compatible", "coreboot");
-
 	/* Fetch CB tables from cbmem */
 	void *cbtable = cbmem_find(CBMEM_ID_CBTABLE);
 	if (!cbtable) {
 		printk(BIOS_WARNING, "FIT: No coreboot table found!\n");
-		return;
+		return false;
 	}
 
 	/* First 'reg' address range is the coreboot table. */
@@ -144,12 +140,40 @@ static void add_cb_fdt_data(struct device_tree *tree)
 	cbmem_get_region(&baseptr, &size);
 	if (!baseptr || size == 0) {
 		printk(BIOS_WARNING, "FIT: CBMEM pointer/size not found!\n");
-		return;
+		return false;
 	}
 
 	reg_addrs[1] = (uintptr_t)baseptr;
 	reg_sizes[1] = size;
 
+	return true;
+}
+
+/**
+ * Add coreboot tables, CBMEM information and optional board specific strapping
+ * IDs to the device tree loaded via FIT.
+ */
+static void add_cb_fdt_data(struct device_tree *tree)
+{
+	u32 addr_cells = 1, size_cells = 1;
+	u64 reg_addrs[2], reg_sizes[2];
+
+	static const char *firmware_path[] = {"firmware", NULL};
+	struct device_tree_node *firmware_node = dt_find_node(tree->root,
+		firmware_path, &addr_cells, &size_cells, 1);
+
+	/* Need to add 'ranges' to the intermediate node to make 'reg' work. */
+	dt_add_bin_prop(firmware_node, "ranges", NULL, 0);
+
+	static const char *coreboot_path[] = {"coreboot", NULL};
+	struct device_tree_node *coreboot_node = dt_find_node(firmware_node,
+		coreboot_path, &addr_cells, &size_cells, 1);
+
+	dt_add_string_prop(coreboot_node, "compatible", "coreboot");
+
+	if (!get_cb_fdt_regs(reg_addrs, reg_sizes))
+		return;
+
 	dt_add_reg_prop(coreboot_node, reg_addrs, reg_sizes, 2, addr_cells,
 			size_cells);
 
@@ -164,6 +188,98 @@ static void add_cb_fdt_data(struct device_tree *tree)
 		dt_add_u32_prop(coreboot_node, "ram-code", ram_code());
 }
 
+/* Same as add_cb_fdt_data(), editing the flattened device tree in place. */
+static int add_cb_fdt_data_flat(void *blob)
+{
+	u32 addr_cells = 1, size_cells = 1;
+	u64 reg_addrs[2], reg_sizes[2];
+	uint32_t root, firmware_node, coreboot_node;
+
+	root = fdt_find_node_by_path(blob, "/", &addr_cells, &size_cells);
+
+	firmware_node = fdt_find_or_add_child(blob, root, "firmware");
+	if (!firmware_node)
+		return -1;
+	fdt_read_u32_prop(blob, firmware_node, "#address-cells", &addr_cells);
+	fdt_read_u32_prop(blob, firmware_node, "#size-cells", &size_cells);
+
+	/* Need to add 'ranges' to the intermediate node to make 'reg' work. */
+	if (fdt_set_prop(blob, firmware_node, "ranges", NULL, 0))
+		return -1;
+
+	/* Edits only move what comes after them, so firmware_node is still valid. */
+	coreboot_node = fdt_find_or_add_child(blob, firmware_node, "coreboot");
+	if (!coreboot_node)
+		return -1;
+	fdt_read_u32_prop(blob, coreboot_node, "#address-cells", &addr_cells);
+	fdt_read_u32_prop(blob, coreboot_node, "#size-cells", &size_cells);
+
+	if (fdt_set_string_prop(blob, coreboot_node, "compatible", "coreboot"))
+		return -1;
+
+	if (!get_cb_fdt_regs(reg_addrs, reg_sizes))
+		return 0;
+
+	if (fdt_set_reg_prop(blob, coreboot_node, reg_addrs, reg_sizes, 2, addr_cells,
+			     size_cells))
+		return -1;
+
+	/* Expose board ID, SKU ID, and RAM code to payload.*/
+	if (board_id() != UNDEFINED_STRAPPING_ID &&
+	    fdt_set_u32_prop(blob, coreboot_node, "board-id", board_id()))
+		return -1;
+
+	if (sku_id() != UNDEFINED_STRAPPING_ID &&
+	    fdt_set_u32_prop(blob, coreboot_node, "sku-id", sku_id()))
+		return -1;
+
+	if (ram_code() != UNDEFINED_STRAPPING_ID &&
+	    fdt_set_u32_prop(blob, coreboot_node, "ram-code", ram_code()))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Without overlays or board fixups, which need the unflattened tree, all
+ * changes to an uncompressed FDT can be made in place where it is handed to
+ * the kernel. That saves unflattening it on the heap and flattening it again.
+ */
+static bool can_edit_fdt_in_place(struct fit_config_node *config)
+{
+	return config->fdt->compression == CBFS_COMPRESS_NONE &&
+	       !config->overlays.next && !device_tree_fixups.next;
+}
+
+/* Copy the FDT to its final place and update it there. */
+static int edit_fdt_in_place(struct region *fdt, struct fit_config_node *config,
+			     struct region *initrd)
+{
+	void *blob = (void *)fdt->offset;
+
+	printk(BIOS_INFO, "FIT: Updating FDT in place at %p\n", blob);
+
+	if (fdt_open_into(config->fdt->data, blob, fdt->size) ||
+	    add_cb_fdt_data_flat(blob))
+		return -1;
+
+#if defined(CONFIG_LINUX_COMMAND_LINE)
+	if (fit_update_chosen_fdt(blob, (char *)CONFIG_LINUX_COMMAND_LINE))
+		return -1;
+#endif
+	if (fit_update_memory_fdt(blob))
+		return -1;
+
+	if (config->ramdisk &&
+	    fit_add_ramdisk_fdt(blob, (void *)initrd->offset, initrd->size))
+		return -1;
+
+	fdt_pack(blob);
+	prog_segment_loaded(fdt->offset, fdt->size, 0);
+
+	return 0;
+}
+
 /*
  * Parse the uImage FIT, choose a configuration and extract images.
  */
@@ -181,35 +297,41 @@ void fit_payload(struct prog *payload, void *data)
 		return;
 	}
 
-	dt = unpack_fdt(config->fdt);
-	if (!dt) {
-		printk(BIOS_ERR, "ERROR: Failed to unflatten the FDT.\n");
-		return;
-	}
+	if (can_edit_fdt_in_place(config)) {
+		const struct fdt_header *header = config->fdt->data;
+		fdt.size = be32toh(header->totalsize) + FDT_EDIT_SLACK;
+	} else {
+		dt = unpack_fdt(config->fdt);
+		if (!dt) {
+			printk(BIOS_ERR, "ERROR: Failed to unflatten the FDT.\n");
+			return;
+		}
 
-	struct fit_overlay_chain *chain;
-	list_for_each(chain, config->overlays, list_node) {
-		struct device_tree *overlay = unpack_fdt(chain->overlay);
-		if (!overlay || dt_apply_overlay(dt, overlay)) {
-			printk(BIOS_ERR, "ERROR: Failed to apply overlay %s!\n",
-			       chain->overlay->name);
+		struct fit_overlay_chain *chain;
+		list_for_each(chain, config->overlays, list_node) {
+			struct device_tree *overlay = unpack_fdt(chain->overlay);
+			if (!overlay || dt_apply_overlay(dt, overlay)) {
+				printk(BIOS_ERR, "ERROR: Failed to apply overlay %s!\n",
+				       chain->overlay->name);
+			}
 		}
-	}
 
-	dt_apply_fixups(dt);
+		dt_apply_fixups(dt);
 
-	/* Insert coreboot specific information */
-	add_cb_fdt_data(dt);
+		/* Insert coreboot specific information */
+		add_cb_fdt_data(dt);
 
-	/* Update device_tree */
+		/* Update device_tree */
 #if defined(CONFIG_LINUX_COMMAND_LINE)
-	fit_update_chosen(dt, (char *)CONFIG_LINUX_COMMAND_LINE);
+		fit_update_chosen(dt, (char *)CONFIG_LINUX_COMMAND_LINE);
 #endif
-	fit_update_memory(dt);
+		fit_update_memory(dt);
+
+		fdt.size = dt_flat_size(dt);
+	}
 
 	/* Collect infos for fit_payload_arch */
 	kernel.size = config->kernel->size;
-	fdt.size = dt_flat_size(dt);
 	initrd.size = config->ramdisk ? config->ramdisk->size : 0;
 
 	/* Invoke arch specific payload placement and fixups */
@@ -219,12 +341,18 @@ void fit_payload(struct prog *payload, void *data)
 		return;
 	}
 
-	/* Update ramdisk location in FDT */
-	if (config->ramdisk)
-		fit_add_ramdisk(dt, (void *)initrd.offset, initrd.size);
+	if (dt) {
+		/* Update ramdisk location in FDT */
+		if (config->ramdisk)
+			fit_add_ramdisk(dt, (void *)initrd.offset, initrd.size);
 
-	/* Repack FDT for handoff to kernel */
-	pack_fdt(&fdt, dt);
+		/* Repack FDT for handoff to kernel */
+		pack_fdt(&fdt, dt);
+	} else if (edit_fdt_in_place(&fdt, config, &initrd)) {
+		printk(BIOS_ERR, "ERROR: Not enough space to update the FDT\n");
+		prog_set_entry(payload, NULL, NULL);
+		return;
+	}
 
 	if (config->ramdisk &&
 	    extract(&initrd, config->ramdisk)) {
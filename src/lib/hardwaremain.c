@@ -198,8 +198,28 @@ static boot_state_t bs_payload_load(void *arg)
 	return BS_PAYLOAD_BOOT;
 }
 
+static void heap_report(void)
+{
+	struct heap_stats stats;
+
+	if (!CONFIG(DEBUG_MALLOC))
+		return;
+
+	heap_stats(&stats);
+
+	printk(BIOS_DEBUG, "Heap: %zu bytes used", stats.used);
+	if (CONFIG(HEAP_FREE_LIST))
+		printk(BIOS_DEBUG, " by %zu allocations", stats.live);
+	printk(BIOS_DEBUG, ", peak %zu bytes, %zu bytes free", stats.peak, stats.available);
+	if (stats.available)
+		printk(BIOS_DEBUG, " (%zu%% fragmented)",
+		       100 - stats.largest_free * 100 / stats.available);
+	printk(BIOS_DEBUG, "\n");
+}
+
 static boot_state_t bs_payload_boot(void *arg)
 {
+	heap_report();
 	arch_bootstate_coreboot_exit();
 	payload_run();
 
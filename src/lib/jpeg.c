@@ -8,6 +8,8 @@
  */
 
 #define __LITTLE_ENDIAN
+#include <commonlib/endian.h>
+#include <stdint.h>
 #include <string.h>
 #include "jpeg.h"
 #define ISHIFT 11
@@ -266,15 +268,15 @@ int jpeg_check_size(unsigned char *buf, int width, int height)
 	return 1;
 }
 
-int jpeg_decode(unsigned char *buf, unsigned char *pic,
+int jpeg_decode_start(unsigned char *buf, unsigned char *pic,
 		int width, int height, int depth, struct jpeg_decdata *decdata)
 {
 	int i, j, m, tac, tdc;
-	int mcusx, mcusy, mx, my;
-	int max[6];
 
 	if (!decdata || !buf || !pic)
 		return -1;
+	if (depth != 32 && depth != 24 && depth != 16)
+		return ERR_DEPTH_MISMATCH;
 	datap = buf;
 	if (getbyte() != 0xff)
 		return ERR_NO_SOI;
@@ -345,9 +347,11 @@ int jpeg_decode(unsigned char *buf, unsigned char *pic,
 		|| dscans[2].hv != 0x11)
 		return ERR_NOT_YCBCR_221111;
 
-	mcusx = width >> 4;
-	mcusy = height >> 4;
-
+	decdata->pic = pic;
+	decdata->depth = depth;
+	decdata->mcusx = width >> 4;
+	decdata->mcusy = height >> 4;
+	decdata->my = 0;
 
 	idctqtab(quant[dscans[0].tq], decdata->dquant[0]);
 	idctqtab(quant[dscans[1].tq], decdata->dquant[1]);
@@ -360,7 +364,18 @@ int jpeg_decode(unsigned char *buf, unsigned char *pic,
 	dscans[0].next = 6 - 4;
 	dscans[1].next = 6 - 4 - 1;
 	dscans[2].next = 6 - 4 - 1 - 1;	/* 411 encoding */
-	for (my = 0; my < mcusy; my++) {
+
+	return 0;
+}
+
+int jpeg_decode_rows(struct jpeg_decdata *decdata, int rows)
+{
+	const int mcusx = decdata->mcusx;
+	unsigned char *pic = decdata->pic;
+	int mx, my, m;
+	int max[6];
+
+	for (my = decdata->my; my < decdata->mcusy && rows > 0; my++, rows--) {
 		for (mx = 0; mx < mcusx; mx++) {
 			if (info.dri && !--info.nm)
 				if (dec_checkmarker())
@@ -380,7 +395,7 @@ int jpeg_decode(unsigned char *buf, unsigned char *pic,
 			idct(decdata->dcts + 320, decdata->out + 320,
 				decdata->dquant[2], IFIX(0.5), max[5]);
 
-			switch (depth) {
+			switch (decdata->depth) {
 			case 32:
 				col221111_32(decdata->out, pic
 					+ (my * 16 * mcusx + mx) * 16 * 4,
@@ -396,11 +411,13 @@ int jpeg_decode(unsigned char *buf, unsigned char *pic,
 					+ (my * 16 * mcusx + mx) * (16 * 2),
 					mcusx * (16 * 2));
 				break;
-			default:
-				return ERR_DEPTH_MISMATCH;
 			}
 		}
 	}
+	decdata->my = my;
+
+	if (my < decdata->mcusy)
+		return 0;
 
 	m = dec_readmarker(&glob_in);
 	if (m != M_EOI)
@@ -409,6 +426,18 @@ int jpeg_decode(unsigned char *buf, unsigned char *pic,
 	return 0;
 }
 
+int jpeg_decode(unsigned char *buf, unsigned char *pic,
+		int width, int height, int depth, struct jpeg_decdata *decdata)
+{
+	int ret;
+
+	ret = jpeg_decode_start(buf, pic, width, height, depth, decdata);
+	if (ret)
+		return ret;
+
+	return jpeg_decode_rows(decdata, height >> 4);
+}
+
 /****************************************************************/
 /**************       huffman decoder             ***************/
 /****************************************************************/
@@ -890,15 +919,6 @@ static void initcol(PREC q[][64])
 #endif
 #endif
 
-#define PIC_32(yin, xin, p, xout)		\
-(						\
-	y = outy[(yin) * 8 + xin],		\
-	STORECLAMP(p[(xout) * 4 + 0], y + cr),	\
-	STORECLAMP(p[(xout) * 4 + 1], y - cg),	\
-	STORECLAMP(p[(xout) * 4 + 2], y + cb),	\
-	p[(xout) * 4 + 3] = 0			\
-)
-
 #define PIC221111(xin)							\
 (									\
 	CBCRCG(0, xin),							\
@@ -917,15 +937,6 @@ static void initcol(PREC q[][64])
 	PIC_16(xin / 4 * 8 + 1, (xin & 3) * 2 + 1, pic1, xin * 2 + 1, 2)       \
 )
 
-#define PIC221111_32(xin)						\
-(									\
-	CBCRCG(0, xin),							\
-	PIC_32(xin / 4 * 8 + 0, (xin & 3) * 2 + 0, pic0, xin * 2 + 0),	\
-	PIC_32(xin / 4 * 8 + 0, (xin & 3) * 2 + 1, pic0, xin * 2 + 1),	\
-	PIC_32(xin / 4 * 8 + 1, (xin & 3) * 2 + 0, pic1, xin * 2 + 0),	\
-	PIC_32(xin / 4 * 8 + 1, (xin & 3) * 2 + 1, pic1, xin * 2 + 1)	\
-)
-
 static void col221111(int *out, unsigned char *pic, int width)
 {
 	int i, j, k;
@@ -974,26 +985,40 @@ static void col221111_16(int *out, unsigned char *pic, int width)
 	}
 }
 
+static inline unsigned int clamp8(int x)
+{
+	return (unsigned int)x >= 256 ? (x < 0 ? 0 : 255) : x;
+}
+
+/* Store one pixel as a single 32-bit word: R, G, B and 0 in memory order. */
+static inline void pic_32(unsigned char *p, int y, int cr, int cg, int cb)
+{
+	const uint32_t px = clamp8(y + cr) | clamp8(y - cg) << 8 | clamp8(y + cb) << 16;
+
+	write_le32(p, px);
+}
+
 static void col221111_32(int *out, unsigned char *pic, int width)
 {
-	int i, j, k;
+	int i, j;
 	unsigned char *pic0, *pic1;
 	int *outy, *outc;
-	int cr, cg, cb, y;
+	int cr, cg, cb;
 
-	pic0 = pic;
-	pic1 = pic + width;
-	outy = out;
-	outc = out + 64 * 4;
-	for (i = 2; i > 0; i--) {
-		for (j = 4; j > 0; j--) {
-			for (k = 0; k < 8; k++)
-				PIC221111_32(k);
-			outc += 8;
-			outy += 16;
-			pic0 += 2 * width;
-			pic1 += 2 * width;
+	/* Each chroma sample covers 2x2 pixels, i.e. two pixels in two lines. */
+	for (i = 0; i < 8; i++) {
+		pic0 = pic + 2 * i * width;
+		pic1 = pic0 + width;
+		outc = out + 64 * 4 + i * 8;
+		outy = out + i / 4 * 128 + i % 4 * 16;
+		for (j = 0; j < 8; j++) {
+			const int *y = outy + j / 4 * 64 + j % 4 * 2;
+
+			CBCRCG(0, j);
+			pic_32(pic0 + j * 8 + 0, y[0], cr, cg, cb);
+			pic_32(pic0 + j * 8 + 4, y[1], cr, cg, cb);
+			pic_32(pic1 + j * 8 + 0, y[8], cr, cg, cb);
+			pic_32(pic1 + j * 8 + 4, y[9], cr, cg, cb);
 		}
-		outy += 64 * 2 - 16 * 4;
 	}
 }
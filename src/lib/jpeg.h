@@ -29,10 +29,30 @@ struct jpeg_decdata {
 	int dcts[6 * 64 + 16];
 	int out[64 * 6];
 	int dquant[3][64];
+
+	/* Progress of the decode started by jpeg_decode_start(). */
+	unsigned char *pic;
+	int depth;
+	int mcusx, mcusy;
+	int my;
 };
 
 int jpeg_decode(unsigned char *, unsigned char *, int, int, int,
 	struct jpeg_decdata *);
+
+/*
+ * Decode incrementally: jpeg_decode_start() parses the headers, then each call to
+ * jpeg_decode_rows() decodes up to the given number of 16 pixel high rows. Only one image
+ * can be decoded at a time.
+ */
+int jpeg_decode_start(unsigned char *, unsigned char *, int, int, int,
+	struct jpeg_decdata *);
+int jpeg_decode_rows(struct jpeg_decdata *, int);
+
+static inline int jpeg_decode_done(const struct jpeg_decdata *decdata)
+{
+	return decdata->my == decdata->mcusy;
+}
 void jpeg_fetch_size(unsigned char *buf, int *width, int *height);
 int jpeg_check_size(unsigned char *, int, int);
 
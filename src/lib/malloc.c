@@ -1,4 +1,5 @@
 #include <console/console.h>
+#include <smp/spinlock.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -9,6 +10,360 @@
 #endif
 
 extern unsigned char _heap, _eheap;
+
+#if CONFIG(HEAP_FREE_LIST)
+
+/*
+ * Segregated free-list allocator. The heap is a contiguous sequence of blocks that each start
+ * with a struct heap_block header and is terminated by a zero-sized, always used sentinel
+ * block. Free blocks are kept on one doubly-linked list per size class: exact classes in
+ * HEAP_ALIGN steps for small blocks and power-of-two classes above that, like libpayload's
+ * allocator has. A bitmap records which classes are non-empty.
+ *
+ * malloc() of a small block takes the head of its exact class, or of the next non-empty class,
+ * in constant time. Larger requests take the best fit from their power-of-two class, which is
+ * searched and thus costs time linear in the number of free blocks of that class. If it has
+ * none large enough, any block of a larger class is taken in constant time. free() runs in
+ * constant time and coalesces a block with both of its neighbours: every header records the
+ * size of the block before it and whether that one is free. The heap is protected by a
+ * spinlock, so APs may allocate while the BSP does.
+ */
+
+#define BLOCK_USED		(1 << 0)
+#define BLOCK_PREV_FREE		(1 << 1)
+#define BLOCK_FLAGS		(BLOCK_USED | BLOCK_PREV_FREE)
+
+#define HEAP_ALIGN		sizeof(u64)
+#define ZERO_SIZE_ALIGN		16
+
+struct heap_block {
+	size_t prev_size;	/* 0 for the first block */
+	size_t size;		/* Including this header, ORed with BLOCK_* flags. */
+	/* The payload starts here. Free blocks keep their list pointers in it. */
+	struct heap_block *next_free;
+	struct heap_block *prev_free;
+};
+
+#define BLOCK_HEADER_SIZE	offsetof(struct heap_block, next_free)
+#define MIN_BLOCK_SIZE		ALIGN_UP(sizeof(struct heap_block), HEAP_ALIGN)
+
+/* Blocks smaller than this have one class per size, larger ones per power of two. */
+#define SMALL_BLOCK_LIMIT	256
+#define NUM_SMALL_BINS		(SMALL_BLOCK_LIMIT / HEAP_ALIGN)
+#define NUM_BINS		64
+
+static struct heap_block *bins[NUM_BINS];
+static u64 bin_bitmap;
+static struct heap_block *heap_start;
+static struct heap_block *heap_end;		/* The sentinel block */
+
+DECLARE_SPIN_LOCK(heap_lock);
+
+static size_t heap_live;			/* Number of live allocations */
+static size_t heap_used;			/* Bytes in used blocks */
+static size_t heap_peak;			/* Highest value of heap_used */
+
+static inline size_t block_size(const struct heap_block *b)
+{
+	return b->size & ~BLOCK_FLAGS;
+}
+
+static inline struct heap_block *next_block(const struct heap_block *b)
+{
+	return (void *)b + block_size(b);
+}
+
+static inline void *block_payload(struct heap_block *b)
+{
+	return (void *)b + BLOCK_HEADER_SIZE;
+}
+
+static inline unsigned int bin_index(size_t size)
+{
+	if (size < SMALL_BLOCK_LIMIT)
+		return size / HEAP_ALIGN;
+
+	const unsigned int idx = NUM_SMALL_BINS + __builtin_clzl(SMALL_BLOCK_LIMIT)
+		- __builtin_clzl(size);
+	return MIN(idx, NUM_BINS - 1);
+}
+
+static void insert_free(struct heap_block *b)
+{
+	const unsigned int idx = bin_index(block_size(b));
+	struct heap_block *next = next_block(b);
+
+	b->prev_free = NULL;
+	b->next_free = bins[idx];
+	if (b->next_free)
+		b->next_free->prev_free = b;
+	bins[idx] = b;
+	bin_bitmap |= 1ULL << idx;
+
+	next->prev_size = block_size(b);
+	next->size |= BLOCK_PREV_FREE;
+}
+
+static void remove_free(struct heap_block *b)
+{
+	const unsigned int idx = bin_index(block_size(b));
+
+	if (b->prev_free)
+		b->prev_free->next_free = b->next_free;
+	else
+		bins[idx] = b->next_free;
+	if (b->next_free)
+		b->next_free->prev_free = b->prev_free;
+
+	if (!bins[idx])
+		bin_bitmap &= ~(1ULL << idx);
+}
+
+/* Find the best fitting free block of at least |size| bytes. */
+static struct heap_block *find_free(size_t size)
+{
+	const unsigned int idx = bin_index(size);
+	struct heap_block *b, *best = NULL;
+	u64 mask;
+
+	if (idx < NUM_SMALL_BINS) {
+		/* Every block in a small class has the same size. */
+		if (bins[idx])
+			return bins[idx];
+	} else {
+		/* Blocks in the matching class may be too small, so it has to be searched. */
+		for (b = bins[idx]; b; b = b->next_free) {
+			if (block_size(b) < size)
+				continue;
+			if (!best || block_size(b) < block_size(best))
+				best = b;
+			if (block_size(b) == size)
+				break;
+		}
+		if (best)
+			return best;
+	}
+
+	/* Every block in a larger class is large enough, use the smallest class. */
+	if (idx + 1 >= NUM_BINS)
+		return NULL;
+	mask = bin_bitmap & (~0ULL << (idx + 1));
+	if (!mask)
+		return NULL;
+
+	return bins[__builtin_ctzll(mask)];
+}
+
+/* Mark the (already unlisted) free block |b| used, returning any excess to the free lists. */
+static void take_block(struct heap_block *b, size_t size)
+{
+	const size_t total = block_size(b);
+
+	if (total - size >= MIN_BLOCK_SIZE) {
+		struct heap_block *rest = (void *)b + size;
+
+		rest->size = total - size;
+		rest->prev_size = size;
+		b->size = size | (b->size & BLOCK_PREV_FREE);
+		insert_free(rest);
+	} else {
+		next_block(b)->size &= ~BLOCK_PREV_FREE;
+		next_block(b)->prev_size = total;
+	}
+
+	b->size |= BLOCK_USED;
+
+	heap_live++;
+	heap_used += block_size(b);
+	if (heap_used > heap_peak)
+		heap_peak = heap_used;
+}
+
+static void heap_init(void)
+{
+	uintptr_t start = ALIGN_UP((uintptr_t)&_heap, HEAP_ALIGN);
+	uintptr_t end = ALIGN_DOWN((uintptr_t)&_eheap, ZERO_SIZE_ALIGN) - BLOCK_HEADER_SIZE;
+
+	if (end < start + MIN_BLOCK_SIZE)
+		die("Error! Heap is too small for the free-list allocator");
+
+	memset(bins, 0, sizeof(bins));
+	bin_bitmap = 0;
+	heap_live = heap_used = heap_peak = 0;
+
+	heap_start = (struct heap_block *)start;
+	heap_end = (struct heap_block *)end;
+	heap_end->size = BLOCK_USED;
+
+	heap_start->size = end - start;
+	heap_start->prev_size = 0;
+	insert_free(heap_start);
+}
+
+/*
+ * Zero-sized allocations don't take any heap space, they all return the (never dereferenced)
+ * payload address of the sentinel block, like the bump allocator returns the same pointer.
+ * Only alignments up to ZERO_SIZE_ALIGN are guaranteed, larger ones get a minimal block.
+ */
+static inline void *zero_size_alloc(void)
+{
+	return block_payload(heap_end);
+}
+
+void *memalign(size_t boundary, size_t size)
+{
+	struct heap_block *b;
+	size_t block_sz;
+
+	MALLOCDBG("%s Enter, boundary %zu, size %zu\n", __func__, boundary, size);
+
+	spin_lock(&heap_lock);
+
+	if (!heap_start)
+		heap_init();
+
+	if (!size && IS_ALIGNED((uintptr_t)zero_size_alloc(), boundary)) {
+		spin_unlock(&heap_lock);
+		return zero_size_alloc();
+	}
+
+	if (boundary < HEAP_ALIGN)
+		boundary = HEAP_ALIGN;
+
+	b = NULL;
+	if (size < (size_t)((void *)heap_end - (void *)heap_start) &&
+	    boundary < (size_t)((void *)heap_end - (void *)heap_start)) {
+		block_sz = ALIGN_UP(MAX(size + BLOCK_HEADER_SIZE, MIN_BLOCK_SIZE), HEAP_ALIGN);
+		/* Leave room for a free block in front of the aligned payload. */
+		b = find_free(boundary > HEAP_ALIGN ?
+			      block_sz + boundary + MIN_BLOCK_SIZE : block_sz);
+	}
+
+	if (!b) {
+		spin_unlock(&heap_lock);
+		printk(BIOS_ERR, "memalign(boundary=%zu, size=%zu): failed: ", boundary, size);
+		printk(BIOS_ERR, "no free block large enough in heap %p-%p\n",
+		       heap_start, heap_end);
+		die("Error! memalign: Out of memory");
+		return NULL;
+	}
+
+	remove_free(b);
+
+	if (!IS_ALIGNED((uintptr_t)block_payload(b), boundary)) {
+		struct heap_block *aligned;
+		uintptr_t payload;
+		size_t front;
+
+		/*
+		 * Free blocks never border on free blocks, so the one before |b| is in use. Hand
+		 * the gap in front of the aligned payload to it rather than leaving a small free
+		 * block behind. Only the first block has no predecessor to give the gap to.
+		 */
+		if (b->prev_size) {
+			struct heap_block *prev = (void *)b - b->prev_size;
+
+			payload = ALIGN_UP((uintptr_t)block_payload(b), boundary);
+			aligned = (void *)(payload - BLOCK_HEADER_SIZE);
+			front = (void *)aligned - (void *)b;
+
+			prev->size += front;
+			heap_used += front;
+			aligned->size = block_size(b) - front;
+			aligned->prev_size = block_size(prev);
+		} else {
+			payload = ALIGN_UP((uintptr_t)block_payload(b) + MIN_BLOCK_SIZE, boundary);
+			aligned = (void *)(payload - BLOCK_HEADER_SIZE);
+			front = (void *)aligned - (void *)b;
+
+			aligned->size = block_size(b) - front;
+			aligned->prev_size = front;
+			b->size = front;
+			insert_free(b);
+		}
+		b = aligned;
+	}
+
+	take_block(b, block_sz);
+
+	spin_unlock(&heap_lock);
+
+	MALLOCDBG("memalign %p\n", block_payload(b));
+
+	return block_payload(b);
+}
+
+void free(void *ptr)
+{
+	struct heap_block *b, *next;
+
+	if (ptr == NULL || (heap_start && ptr == zero_size_alloc()))
+		return;
+
+	if (!heap_start || ptr < (void *)heap_start || ptr >= (void *)heap_end) {
+		printk(BIOS_WARNING, "Warning - Pointer passed to %s is not "
+					"pointing to the heap\n", __func__);
+		return;
+	}
+
+	spin_lock(&heap_lock);
+
+	b = ptr - BLOCK_HEADER_SIZE;
+	if (!(b->size & BLOCK_USED)) {
+		spin_unlock(&heap_lock);
+		printk(BIOS_WARNING, "Warning - %s called on free pointer %p\n",
+		       __func__, ptr);
+		return;
+	}
+
+	heap_live--;
+	heap_used -= block_size(b);
+	b->size &= ~BLOCK_USED;
+
+	next = next_block(b);
+	if (!(next->size & BLOCK_USED)) {
+		remove_free(next);
+		b->size += block_size(next);
+	}
+
+	if (b->size & BLOCK_PREV_FREE) {
+		struct heap_block *prev = (void *)b - b->prev_size;
+
+		remove_free(prev);
+		prev->size += block_size(b);
+		b = prev;
+	}
+
+	insert_free(b);
+
+	spin_unlock(&heap_lock);
+}
+
+void heap_stats(struct heap_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	spin_lock(&heap_lock);
+
+	if (!heap_start)
+		heap_init();
+
+	stats->live = heap_live;
+	stats->used = heap_used;
+	stats->peak = heap_peak;
+
+	for (unsigned int i = 0; i < NUM_BINS; i++) {
+		for (struct heap_block *b = bins[i]; b; b = b->next_free) {
+			stats->available += block_size(b);
+			stats->largest_free = MAX(stats->largest_free, block_size(b));
+		}
+	}
+
+	spin_unlock(&heap_lock);
+}
+
+#else
+
 static void *free_mem_ptr = &_heap;		/* Start of heap */
 static void *free_mem_end_ptr = &_eheap;	/* End of heap */
 static void *free_last_alloc_ptr = &_heap;	/* End of heap before
@@ -50,20 +405,6 @@ void *memalign(size_t boundary, size_t size)
 	return p;
 }
 
-void *malloc(size_t size)
-{
-	return memalign(sizeof(u64), size);
-}
-
-void *calloc(size_t nitems, size_t size)
-{
-	void *p = malloc(nitems * size);
-	if (p)
-		memset(p, 0, nitems * size);
-
-	return p;
-}
-
 void free(void *ptr)
 {
 	if (ptr == NULL)
@@ -84,3 +425,30 @@ void free(void *ptr)
 		free_last_alloc_ptr = NULL;
 	}
 }
+
+void heap_stats(struct heap_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	/* The bump allocator doesn't track individual allocations. */
+	stats->used = free_mem_ptr - (void *)&_heap;
+	stats->peak = stats->used;
+	stats->available = free_mem_end_ptr - free_mem_ptr;
+	stats->largest_free = stats->available;
+}
+
+#endif
+
+void *malloc(size_t size)
+{
+	return memalign(sizeof(u64), size);
+}
+
+void *calloc(size_t nitems, size_t size)
+{
+	void *p = malloc(nitems * size);
+	if (p)
+		memset(p, 0, nitems * size);
+
+	return p;
+}
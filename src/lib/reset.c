@@ -8,6 +8,7 @@
 __noreturn void board_reset(void)
 {
 	printk(BIOS_INFO, "%s() called!\n", __func__);
+	console_deferred_panic();
 	dcache_clean_all();
 	do_board_reset();
 	halt();
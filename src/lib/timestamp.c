@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
 #include <console/console.h>
 #include <cbmem.h>
 #include <symbols.h>
@@ -9,12 +10,24 @@
 #include <timestamp.h>
 #include <smp/node.h>
 
+/* Per-CPU buffers for timestamps recorded by APs in ramstage. */
+#define AP_TIMESTAMPS (ENV_PAYLOAD_LOADER && ENV_X86 && CONFIG(SMP) && \
+		       CONFIG(COLLECT_TIMESTAMPS))
+
+#if AP_TIMESTAMPS
+#include <arch/cpu.h>
+#include <bootstate.h>
+#endif
+
 #define MAX_TIMESTAMPS 192
 
 /* This points to the active timestamp_table and can change within a stage
    as CBMEM comes available. */
 static struct timestamp_table *glob_ts_table;
 
+/* Set once the coreboot table points at glob_ts_table, so it can't move anymore. */
+static bool glob_ts_table_locked;
+
 static void timestamp_cache_init(struct timestamp_table *ts_cache,
 				 uint64_t base)
 {
@@ -101,8 +114,42 @@ static const char *timestamp_name(enum timestamp_id id)
 	return "Unknown timestamp ID";
 }
 
+static bool timestamp_table_can_grow(void)
+{
+	return ENV_PAYLOAD_LOADER && !glob_ts_table_locked;
+}
+
+/*
+ * In ramstage the CBMEM table is moved to a CBMEM area of twice the size when it fills up.
+ * Every move needs a new CBMEM ID, because an existing CBMEM entry can't be resized.
+ */
+static struct timestamp_table *timestamp_grow_table(struct timestamp_table *ts_table)
+{
+	static uint32_t generation;
+	struct timestamp_table *tst;
+	size_t max_entries;
+
+	max_entries = MIN(ts_table->max_entries * 2, UINT16_MAX);
+	if (!timestamp_table_can_grow() || max_entries <= ts_table->num_entries)
+		return ts_table;
+
+	tst = cbmem_add(CBMEM_ID_TIMESTAMP_GROWN + ++generation,
+			sizeof(struct timestamp_table) +
+			max_entries * sizeof(struct timestamp_entry));
+	if (!tst)
+		return ts_table;
+
+	memcpy(tst, ts_table, sizeof(struct timestamp_table) +
+	       ts_table->num_entries * sizeof(struct timestamp_entry));
+	tst->max_entries = max_entries;
+
+	timestamp_table_set(tst);
+
+	return tst;
+}
+
 static void timestamp_add_table_entry(struct timestamp_table *ts_table,
-				      enum timestamp_id id, uint64_t ts_time)
+				      uint32_t id, uint64_t ts_time)
 {
 	struct timestamp_entry *tse;
 
@@ -113,14 +160,104 @@ static void timestamp_add_table_entry(struct timestamp_table *ts_table,
 	tse->entry_id = id;
 	tse->entry_stamp = ts_time;
 
-	if (ts_table->num_entries == ts_table->max_entries)
+	if (ts_table->num_entries == ts_table->max_entries && !timestamp_table_can_grow())
 		printk(BIOS_ERR, "ERROR: Timestamp table full\n");
 }
 
+/* Add an entry to the active table, growing it if necessary. */
+static void timestamp_add_entry(uint32_t id, uint64_t ts_time)
+{
+	struct timestamp_table *ts_table = timestamp_table_get();
+
+	if (ts_table->num_entries >= ts_table->max_entries)
+		ts_table = timestamp_grow_table(ts_table);
+
+	timestamp_add_table_entry(ts_table, id, ts_time - ts_table->base_time);
+}
+
+#if AP_TIMESTAMPS
+/*
+ * Every AP appends to its own buffer without taking any lock. Only the AP itself writes
+ * num_entries, and only after the entry is complete; the BSP keeps track of how many of them
+ * it has already merged into the timestamp table. Entries that don't fit are counted, so the
+ * BSP can report them.
+ */
+struct ap_timestamps {
+	volatile uint32_t num_entries;
+	volatile uint32_t num_dropped;
+	uint32_t num_merged;
+	uint32_t num_dropped_reported;
+	struct timestamp_entry entries[CONFIG_TIMESTAMP_AP_ENTRIES];
+};
+
+static struct ap_timestamps ap_timestamps[CONFIG_MAX_CPUS];
+
+static void timestamp_add_ap(enum timestamp_id id, uint64_t ts_time)
+{
+	const int cpu = cpu_index();
+	struct ap_timestamps *ap_ts;
+	struct timestamp_entry *tse;
+
+	if (cpu <= 0 || cpu >= ARRAY_SIZE(ap_timestamps) || cpu > TIMESTAMP_MAX_CPU)
+		return;
+
+	ap_ts = &ap_timestamps[cpu];
+	if (ap_ts->num_entries >= ARRAY_SIZE(ap_ts->entries)) {
+		ap_ts->num_dropped++;
+		return;
+	}
+
+	tse = &ap_ts->entries[ap_ts->num_entries];
+	tse->entry_id = id | ((uint32_t)cpu << TIMESTAMP_CPU_SHIFT);
+	tse->entry_stamp = ts_time;
+
+	/* x86 doesn't reorder stores, so only the compiler needs to be kept in check. */
+	__asm__ __volatile__("" : : : "memory");
+	ap_ts->num_entries++;
+}
+
+static void timestamp_merge_ap_entries(void *unused)
+{
+	int cpu;
+
+	if (!timestamp_table_get())
+		return;
+
+	for (cpu = 0; cpu < ARRAY_SIZE(ap_timestamps); cpu++) {
+		struct ap_timestamps *ap_ts = &ap_timestamps[cpu];
+		const uint32_t num_entries = ap_ts->num_entries;
+		const uint32_t num_dropped = ap_ts->num_dropped;
+
+		for (; ap_ts->num_merged < num_entries; ap_ts->num_merged++) {
+			const struct timestamp_entry *tse = &ap_ts->entries[ap_ts->num_merged];
+
+			timestamp_add_entry(tse->entry_id, tse->entry_stamp);
+		}
+
+		if (num_dropped != ap_ts->num_dropped_reported) {
+			printk(BIOS_WARNING, "Timestamps: CPU %d dropped %u entries, "
+			       "consider raising TIMESTAMP_AP_ENTRIES.\n", cpu, num_dropped);
+			ap_ts->num_dropped_reported = num_dropped;
+		}
+	}
+}
+
+/* Merge before the coreboot table is written, and once more for anything recorded after. */
+BOOT_STATE_INIT_ENTRY(BS_WRITE_TABLES, BS_ON_ENTRY, timestamp_merge_ap_entries, NULL);
+BOOT_STATE_INIT_ENTRY(BS_PAYLOAD_BOOT, BS_ON_ENTRY, timestamp_merge_ap_entries, NULL);
+#endif
+
 void timestamp_add(enum timestamp_id id, uint64_t ts_time)
 {
 	struct timestamp_table *ts_table;
 
+#if AP_TIMESTAMPS
+	if (!boot_cpu()) {
+		timestamp_add_ap(id, ts_time);
+		return;
+	}
+#endif
+
 	if (!timestamp_should_run())
 		return;
 
@@ -131,11 +268,11 @@ void timestamp_add(enum timestamp_id id, uint64_t ts_time)
 		return;
 	}
 
-	ts_time -= ts_table->base_time;
-	timestamp_add_table_entry(ts_table, id, ts_time);
+	timestamp_add_entry(id, ts_time);
 
 	if (CONFIG(TIMESTAMPS_ON_CONSOLE))
-		printk(BIOS_INFO, "Timestamp - %s: %llu\n", timestamp_name(id), ts_time);
+		printk(BIOS_INFO, "Timestamp - %s: %llu\n", timestamp_name(id),
+		       ts_time - glob_ts_table->base_time);
 }
 
 void timestamp_add_now(enum timestamp_id id)
@@ -266,6 +403,13 @@ void timestamp_rescale_table(uint16_t N, uint16_t M)
 	}
 }
 
+struct timestamp_table *timestamp_lock_table(void)
+{
+	glob_ts_table_locked = true;
+
+	return timestamp_table_get();
+}
+
 /*
  * Get the time in microseconds since boot (or more precise: since timestamp
  * table was initialized).
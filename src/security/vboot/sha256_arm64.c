@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <arch/barrier.h>
+#include <arch/lib_helpers.h>
+#include <commonlib/bsd/helpers.h>
+#include <commonlib/endian.h>
+#include <console/console.h>
+#include <stddef.h>
+#include <string.h>
+#include <vb2_api.h>
+
+/*
+ * SHA-256 using the ARMv8 Cryptography Extensions. This plugs into vboot as a "hardware
+ * crypto" backend; vboot falls back to its software implementation for other algorithms or
+ * when the CPU lacks the instructions.
+ */
+
+#define SHA256_BLOCK_SIZE	64
+
+#define ID_AA64ISAR0_SHA2_SHIFT	12
+#define ID_AA64ISAR0_SHA2_MASK	0xf
+
+/* Process |blocks| 64-byte blocks of |data|, see sha256_arm64_ce.S. */
+void sha256_ce_transform(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+static struct {
+	uint32_t state[8];
+	uint8_t buf[SHA256_BLOCK_SIZE];
+	size_t buf_len;
+	uint64_t total;
+} sha256;
+
+static const uint32_t sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+/* SHA-256("abc"), to check the transform once before it is trusted with the firmware body. */
+static const uint32_t sha256_abc[8] = {
+	0xba7816bf, 0x8f01cfea, 0x414140de, 0x5dae2223,
+	0xb00361a3, 0x96177a9c, 0xb410ff61, 0xf20015ad,
+};
+
+static bool sha256_ce_self_test(void)
+{
+	uint8_t block[SHA256_BLOCK_SIZE] = { 'a', 'b', 'c', 0x80 };
+	uint32_t state[8];
+
+	block[SHA256_BLOCK_SIZE - 1] = 3 * 8;
+	memcpy(state, sha256_iv, sizeof(state));
+	sha256_ce_transform(state, block, 1);
+
+	return !memcmp(state, sha256_abc, sizeof(state));
+}
+
+static bool sha256_ce_probe(void)
+{
+	uint64_t isar0;
+
+	__asm__ __volatile__("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+	if (!((isar0 >> ID_AA64ISAR0_SHA2_SHIFT) & ID_AA64ISAR0_SHA2_MASK))
+		return false;
+
+	/*
+	 * Verstage may be the first stage on this core that runs at EL3, and nothing before it
+	 * sets up CPTR_EL3, whose TFP bit is UNKNOWN out of reset. Clear it so that the SIMD
+	 * instructions don't trap. Nothing else in coreboot touches SIMD registers (it is built
+	 * with -mgeneral-regs-only), and transition.c sets CPTR_EL3 up for the payload anyway.
+	 */
+	if (((raw_read_currentel() >> CURRENT_EL_SHIFT) & CURRENT_EL_MASK) == EL3) {
+		raw_write_cptr_el3(raw_read_cptr_el3() & ~CPTR_EL3_TFP_ENABLE);
+		isb();
+	}
+
+	if (!sha256_ce_self_test()) {
+		printk(BIOS_ERR, "VB2:%s() SHA-256 self-test failed, using software\n",
+		       __func__);
+		return false;
+	}
+
+	return true;
+}
+
+static bool sha256_ce_supported(void)
+{
+	static enum { UNKNOWN, SUPPORTED, UNSUPPORTED } state;
+
+	if (state == UNKNOWN)
+		state = sha256_ce_probe() ? SUPPORTED : UNSUPPORTED;
+
+	return state == SUPPORTED;
+}
+
+vb2_error_t vb2ex_hwcrypto_digest_init(enum vb2_hash_algorithm hash_alg, uint32_t data_size)
+{
+	if (hash_alg != VB2_HASH_SHA256 || !sha256_ce_supported())
+		return VB2_ERROR_EX_HWCRYPTO_UNSUPPORTED;
+
+	memcpy(sha256.state, sha256_iv, sizeof(sha256.state));
+	sha256.buf_len = 0;
+	sha256.total = 0;
+
+	return VB2_SUCCESS;
+}
+
+vb2_error_t vb2ex_hwcrypto_digest_extend(const uint8_t *buf, uint32_t size)
+{
+	sha256.total += size;
+
+	if (sha256.buf_len) {
+		const size_t n = MIN(size, SHA256_BLOCK_SIZE - sha256.buf_len);
+
+		memcpy(&sha256.buf[sha256.buf_len], buf, n);
+		sha256.buf_len += n;
+		buf += n;
+		size -= n;
+		if (sha256.buf_len < SHA256_BLOCK_SIZE)
+			return VB2_SUCCESS;
+		sha256_ce_transform(sha256.state, sha256.buf, 1);
+		sha256.buf_len = 0;
+	}
+
+	if (size >= SHA256_BLOCK_SIZE) {
+		sha256_ce_transform(sha256.state, buf, size / SHA256_BLOCK_SIZE);
+		buf += ALIGN_DOWN(size, SHA256_BLOCK_SIZE);
+		size %= SHA256_BLOCK_SIZE;
+	}
+
+	memcpy(sha256.buf, buf, size);
+	sha256.buf_len = size;
+
+	return VB2_SUCCESS;
+}
+
+vb2_error_t vb2ex_hwcrypto_digest_finalize(uint8_t *digest, uint32_t digest_size)
+{
+	const uint64_t bits = sha256.total * 8;
+
+	if (digest_size < sizeof(sha256.state))
+		return VB2_ERROR_SHA_FINALIZE_DIGEST_SIZE;
+
+	sha256.buf[sha256.buf_len++] = 0x80;
+	if (sha256.buf_len > SHA256_BLOCK_SIZE - sizeof(bits)) {
+		memset(&sha256.buf[sha256.buf_len], 0, SHA256_BLOCK_SIZE - sha256.buf_len);
+		sha256_ce_transform(sha256.state, sha256.buf, 1);
+		sha256.buf_len = 0;
+	}
+	memset(&sha256.buf[sha256.buf_len], 0,
+	       SHA256_BLOCK_SIZE - sizeof(bits) - sha256.buf_len);
+	write_be64(&sha256.buf[SHA256_BLOCK_SIZE - sizeof(bits)], bits);
+	sha256_ce_transform(sha256.state, sha256.buf, 1);
+
+	for (size_t i = 0; i < ARRAY_SIZE(sha256.state); i++)
+		write_be32(&digest[i * sizeof(uint32_t)], sha256.state[i]);
+
+	return VB2_SUCCESS;
+}
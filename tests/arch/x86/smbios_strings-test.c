@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <commonlib/helpers.h>
+#include <smbios.h>
+#include <string.h>
+#include <tests/test.h>
+
+#define TABLE_SIZE	0x4000
+#define MAX_STRINGS	40
+
+/* The original implementation, which rescans all strings for every one added. */
+static int ref_add_string(u8 *start, const char *str)
+{
+	int i = 1;
+	char *p = (char *)start;
+
+	if (*str == '\0')
+		return 0;
+
+	for (;;) {
+		if (!*p) {
+			strcpy(p, str);
+			p += strlen(str);
+			*p++ = '\0';
+			*p++ = '\0';
+			return i;
+		}
+
+		if (!strcmp(p, str))
+			return i;
+
+		p += strlen(p) + 1;
+		i++;
+	}
+}
+
+static int ref_string_table_len(u8 *start)
+{
+	char *p = (char *)start;
+	int i, len = 0;
+
+	while (*p) {
+		i = strlen(p) + 1;
+		p += i;
+		len += i;
+	}
+
+	if (!len)
+		return 2;
+
+	return len + 1;
+}
+
+static u8 table[TABLE_SIZE];
+static u8 ref_table[TABLE_SIZE];
+
+static u32 rng_state;
+
+static u32 rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+/* Strings like the ones SMBIOS tables are made of: lots of repeats, some prefixes of others. */
+static void random_string(char *buf, size_t size)
+{
+	static const char *const words[] = {
+		"", "Not Specified", "To Be Filled By O.E.M.", "Default string", "0",
+		"DIMM", "DIMM-A0", "DIMM-A", "Channel-0-DIMM-0", "BANK 0", "BANK 1",
+		"coreboot", "Intel(R) Core(TM)", "PCIe Slot", "J6B2", "1.0",
+	};
+	const char *word = words[rng() % ARRAY_SIZE(words)];
+
+	if (rng() % 4)
+		snprintf(buf, size, "%s", word);
+	else
+		snprintf(buf, size, "%s %u", word, rng() % 16);
+}
+
+static void add_and_compare(struct smbios_strings *s, u8 *ref_start, const char *str)
+{
+	assert_int_equal(smbios_strings_add(s, str), ref_add_string(ref_start, str));
+	assert_int_equal(smbios_strings_len(s), ref_string_table_len(ref_start));
+	assert_memory_equal(table, ref_table, TABLE_SIZE);
+}
+
+static void test_add_string_empty(void **state)
+{
+	struct smbios_strings s;
+
+	memset(table, 0, sizeof(table));
+
+	assert_int_equal(smbios_add_string(table, ""), 0);
+	assert_int_equal(smbios_string_table_len(table), 2);
+	assert_int_equal(smbios_add_string(table, "coreboot"), 1);
+	assert_int_equal(smbios_add_string(table, ""), 0);
+	assert_int_equal(smbios_add_string(table, "core"), 2);
+	assert_int_equal(smbios_add_string(table, "coreboot"), 1);
+	assert_int_equal(smbios_string_table_len(table), sizeof("coreboot") + sizeof("core") + 1);
+	assert_memory_equal(table, "coreboot\0core\0\0", 15);
+
+	memset(table, 0, sizeof(table));
+	smbios_strings_init(&s, table);
+
+	assert_int_equal(smbios_strings_add(&s, ""), 0);
+	assert_int_equal(smbios_strings_len(&s), 2);
+	assert_int_equal(smbios_strings_add(&s, "coreboot"), 1);
+	assert_int_equal(smbios_strings_add(&s, ""), 0);
+	assert_int_equal(smbios_strings_add(&s, "core"), 2);
+	assert_int_equal(smbios_strings_add(&s, "coreboot"), 1);
+	assert_int_equal(smbios_strings_len(&s), sizeof("coreboot") + sizeof("core") + 1);
+	assert_memory_equal(table, "coreboot\0core\0\0", 15);
+}
+
+/*
+ * Fill structures the way smbios_write_tables() does: clear the formatted area and the
+ * strings, then add a random number of strings. Some strings are added with
+ * smbios_add_string(), like mainboard code does, after which the builder is initialized
+ * again. Structures are placed in eight slots, so the same address gets reused after it was
+ * cleared.
+ */
+static void test_add_string_random(void **state)
+{
+	const size_t slot_size = TABLE_SIZE / 8;
+	struct smbios_strings s;
+	char str[64];
+	size_t offset;
+
+	rng_state = 0x5eed5eed;
+	memset(table, 0, sizeof(table));
+	memset(ref_table, 0, sizeof(ref_table));
+
+	for (int round = 0; round < 2000; round++) {
+		const int strings = rng() % MAX_STRINGS;
+
+		offset = (rng() % 8) * slot_size + rng() % 64;
+		memset(table + offset, 0, slot_size - 64);
+		memset(ref_table + offset, 0, slot_size - 64);
+		smbios_strings_init(&s, table + offset);
+
+		for (int i = 0; i < strings; i++) {
+			random_string(str, sizeof(str));
+
+			if (rng() % 8 == 0) {
+				assert_int_equal(smbios_add_string(table + offset, str),
+						 ref_add_string(ref_table + offset, str));
+				smbios_strings_init(&s, table + offset);
+				continue;
+			}
+
+			add_and_compare(&s, ref_table + offset, str);
+		}
+
+		assert_int_equal(smbios_string_table_len(table + offset), smbios_strings_len(&s));
+	}
+}
+
+/* Many distinct strings, more than what fits into the hash table. */
+static void test_add_string_many(void **state)
+{
+	struct smbios_strings s;
+	char str[16];
+
+	memset(table, 0, sizeof(table));
+	memset(ref_table, 0, sizeof(ref_table));
+	smbios_strings_init(&s, table);
+
+	for (int round = 0; round < 3; round++) {
+		for (int i = 0; i < 200; i++) {
+			snprintf(str, sizeof(str), "String %d", (i * 37) % 200);
+			add_and_compare(&s, ref_table, str);
+		}
+	}
+
+	/* Picking up a set larger than the hash table. */
+	smbios_strings_init(&s, table);
+	for (int i = 0; i < 200; i++) {
+		snprintf(str, sizeof(str), "String %d", i);
+		add_and_compare(&s, ref_table, str);
+	}
+	add_and_compare(&s, ref_table, "String 200");
+}
+
+static void test_strings_builder(void **state)
+{
+	struct smbios_strings s;
+
+	memset(table, 0, sizeof(table));
+	assert_int_equal(smbios_add_string(table, "a"), 1);
+	assert_int_equal(smbios_add_string(table, "bc"), 2);
+
+	/* The builder picks up what's already there. */
+	smbios_strings_init(&s, table);
+	assert_int_equal(smbios_strings_len(&s), smbios_string_table_len(table));
+	assert_int_equal(smbios_strings_add(&s, "bc"), 2);
+	assert_int_equal(smbios_strings_add(&s, "a"), 1);
+	assert_int_equal(smbios_strings_add(&s, "d"), 3);
+	assert_int_equal(smbios_strings_len(&s), 8);
+	assert_memory_equal(table, "a\0bc\0d\0\0", 8);
+
+	/* And smbios_add_string() finds what the builder added. */
+	assert_int_equal(smbios_add_string(table, "d"), 3);
+	assert_int_equal(smbios_string_table_len(table), 8);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_add_string_empty),
+		cmocka_unit_test(test_add_string_random),
+		cmocka_unit_test(test_add_string_many),
+		cmocka_unit_test(test_strings_builder),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
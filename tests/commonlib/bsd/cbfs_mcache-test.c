@@ -0,0 +1,216 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <commonlib/bsd/cbfs_private.h>
+#include <commonlib/helpers.h>
+#include <commonlib/region.h>
+#include <string.h>
+#include <tests/test.h>
+
+#define CBFS_SIZE	(16 * KiB)
+#define MCACHE_SIZE	(8 * KiB)
+#define NUM_FILES	40
+
+/* Last 8 bytes of an mcache that carries a hash index, see cbfs_mcache.c. */
+#define MCACHE_MAGIC_INDEX	0x58444924	/* '$IDX' */
+
+static u8 cbfs_buf[CBFS_SIZE];
+static struct mem_region_device cbfs_mdev;
+
+static u8 mcache[MCACHE_SIZE] __aligned(CBFS_MCACHE_ALIGNMENT);
+static u8 mcache_copy[MCACHE_SIZE + 64] __aligned(CBFS_MCACHE_ALIGNMENT);
+
+static struct {
+	char name[16];
+	size_t data_offset;	/* Absolute offset of the file data in the CBFS */
+} files[NUM_FILES];
+
+/* Bytes the entries and the terminating magic take up in an mcache. */
+static size_t entries_size;
+
+static size_t add_file(size_t offset, const char *name, u32 type, size_t len)
+{
+	struct cbfs_file *file = (void *)&cbfs_buf[offset];
+	const size_t data_offset = ALIGN_UP(sizeof(*file) + strlen(name) + 1, 16);
+
+	memcpy(file->magic, CBFS_FILE_MAGIC, sizeof(file->magic));
+	file->len = htobe32(len);
+	file->type = htobe32(type);
+	file->attributes_offset = 0;
+	file->offset = htobe32(data_offset);
+	strcpy(file->filename, name);
+
+	if (type != CBFS_TYPE_DELETED)
+		entries_size += ALIGN_UP(data_offset, CBFS_MCACHE_ALIGNMENT);
+
+	return ALIGN_UP(offset + data_offset + len, CBFS_ALIGNMENT);
+}
+
+/*
+ * NUM_FILES files named "file0" to "file39" with some deleted space in between. The two
+ * files named "dup" come first and are there to make sure that the first one wins.
+ */
+static int setup_cbfs(void **state)
+{
+	size_t offset = 0;
+
+	memset(cbfs_buf, 0xff, sizeof(cbfs_buf));
+	entries_size = sizeof(u32);
+
+	offset = add_file(offset, "dup", CBFS_TYPE_RAW, 8);
+	offset = add_file(offset, "dup", CBFS_TYPE_RAW, 16);
+	for (int i = 0; i < NUM_FILES; i++) {
+		if (i % 8 == 7)
+			offset = add_file(offset, "deleted", CBFS_TYPE_DELETED, 100);
+		snprintf(files[i].name, sizeof(files[i].name), "file%d", i);
+		files[i].data_offset = offset + ALIGN_UP(sizeof(struct cbfs_file) +
+							 strlen(files[i].name) + 1, 16);
+		offset = add_file(offset, files[i].name, CBFS_TYPE_RAW, 3 * i);
+	}
+	assert_true(offset < CBFS_SIZE);
+
+	mem_region_device_ro_init(&cbfs_mdev, cbfs_buf, sizeof(cbfs_buf));
+
+	/* Make any stale index left over from an earlier test show up. */
+	memset(mcache, 0xa5, sizeof(mcache));
+	memset(mcache_copy, 0xa5, sizeof(mcache_copy));
+
+	return 0;
+}
+
+static bool has_index(const void *cache, size_t size)
+{
+	const u32 *trailer = cache + size - 2 * sizeof(u32);
+
+	return trailer[1] == MCACHE_MAGIC_INDEX;
+}
+
+static void check_lookups(const void *cache, size_t size, int num_cached)
+{
+	union cbfs_mdata mdata;
+	size_t data_offset;
+
+	for (int i = 0; i < NUM_FILES; i++) {
+		if (i >= num_cached) {
+			assert_int_equal(cbfs_mcache_lookup(cache, size, files[i].name, &mdata,
+							    &data_offset), CB_CBFS_CACHE_FULL);
+			continue;
+		}
+		assert_int_equal(cbfs_mcache_lookup(cache, size, files[i].name, &mdata,
+						    &data_offset), CB_SUCCESS);
+		assert_string_equal(mdata.h.filename, files[i].name);
+		assert_int_equal(be32toh(mdata.h.len), 3 * i);
+		assert_int_equal(data_offset, files[i].data_offset);
+	}
+
+	/* The first of two files with the same name is found. */
+	assert_int_equal(cbfs_mcache_lookup(cache, size, "dup", &mdata, &data_offset),
+			 CB_SUCCESS);
+	assert_int_equal(be32toh(mdata.h.len), 8);
+
+	if (num_cached < NUM_FILES)
+		return;
+
+	/* Misses, including prefixes and extensions of names that are there. */
+	assert_int_equal(cbfs_mcache_lookup(cache, size, "file", &mdata, &data_offset),
+			 CB_CBFS_NOT_FOUND);
+	assert_int_equal(cbfs_mcache_lookup(cache, size, "file400", &mdata, &data_offset),
+			 CB_CBFS_NOT_FOUND);
+	assert_int_equal(cbfs_mcache_lookup(cache, size, "deleted", &mdata, &data_offset),
+			 CB_CBFS_NOT_FOUND);
+	assert_int_equal(cbfs_mcache_lookup(cache, size, "", &mdata, &data_offset),
+			 CB_CBFS_NOT_FOUND);
+}
+
+static void test_mcache_index(void **state)
+{
+	assert_int_equal(cbfs_mcache_build(&cbfs_mdev.rdev, mcache, sizeof(mcache), NULL),
+			 CB_SUCCESS);
+	assert_true(has_index(mcache, sizeof(mcache)));
+	assert_true(cbfs_mcache_real_size(mcache, sizeof(mcache)) > entries_size);
+
+	check_lookups(mcache, sizeof(mcache), NUM_FILES);
+}
+
+static void test_mcache_full(void **state)
+{
+	const size_t size = entries_size / 2;
+	union cbfs_mdata mdata;
+	size_t data_offset;
+	int num_cached = 0;
+
+	/* A stale index at the end of the area must not be picked up. */
+	assert_int_equal(cbfs_mcache_build(&cbfs_mdev.rdev, mcache, sizeof(mcache), NULL),
+			 CB_SUCCESS);
+	memmove(mcache + ALIGN_DOWN(size, CBFS_MCACHE_ALIGNMENT) - 2 * sizeof(u32),
+		mcache + sizeof(mcache) - 2 * sizeof(u32), 2 * sizeof(u32));
+
+	assert_int_equal(cbfs_mcache_build(&cbfs_mdev.rdev, mcache, size, NULL),
+			 CB_CBFS_CACHE_FULL);
+	assert_false(has_index(mcache, ALIGN_DOWN(size, CBFS_MCACHE_ALIGNMENT)));
+
+	while (num_cached < NUM_FILES &&
+	       cbfs_mcache_lookup(mcache, size, files[num_cached].name, &mdata,
+				  &data_offset) == CB_SUCCESS)
+		num_cached++;
+	assert_true(num_cached > 0 && num_cached < NUM_FILES);
+
+	check_lookups(mcache, size, num_cached);
+	assert_int_equal(cbfs_mcache_lookup(mcache, size, "missing", &mdata, &data_offset),
+			 CB_CBFS_CACHE_FULL);
+}
+
+static void test_mcache_copy(void **state)
+{
+	size_t real_size;
+
+	assert_int_equal(cbfs_mcache_build(&cbfs_mdev.rdev, mcache, sizeof(mcache), NULL),
+			 CB_SUCCESS);
+	real_size = cbfs_mcache_real_size(mcache, sizeof(mcache));
+	assert_true(real_size < sizeof(mcache));
+	assert_true(IS_ALIGNED(real_size, CBFS_MCACHE_ALIGNMENT));
+
+	/* The index moves along to the end of the smaller copy. */
+	cbfs_mcache_copy(mcache_copy, mcache, sizeof(mcache));
+	assert_true(has_index(mcache_copy, real_size));
+	assert_int_equal(mcache_copy[real_size], 0xa5);
+	assert_int_equal(cbfs_mcache_real_size(mcache_copy, real_size), real_size);
+
+	/* The original may be gone after the copy, e.g. when CAR is torn down. */
+	memset(mcache, 0, sizeof(mcache));
+	check_lookups(mcache_copy, real_size, NUM_FILES);
+}
+
+static void test_mcache_no_index(void **state)
+{
+	size_t real_size;
+
+	/* Just enough space for the entries, the index doesn't fit. */
+	assert_int_equal(cbfs_mcache_build(&cbfs_mdev.rdev, mcache, entries_size, NULL),
+			 CB_SUCCESS);
+	assert_false(has_index(mcache, entries_size));
+	assert_int_equal(cbfs_mcache_real_size(mcache, entries_size), entries_size);
+	check_lookups(mcache, entries_size, NUM_FILES);
+
+	/* Without its trailer, a full-size mcache is scanned linearly. */
+	assert_int_equal(cbfs_mcache_build(&cbfs_mdev.rdev, mcache, sizeof(mcache), NULL),
+			 CB_SUCCESS);
+	memset(mcache + sizeof(mcache) - sizeof(u32), 0, sizeof(u32));
+	real_size = cbfs_mcache_real_size(mcache, sizeof(mcache));
+	assert_int_equal(real_size, entries_size);
+	check_lookups(mcache, sizeof(mcache), NUM_FILES);
+
+	cbfs_mcache_copy(mcache_copy, mcache, sizeof(mcache));
+	check_lookups(mcache_copy, real_size, NUM_FILES);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup(test_mcache_index, setup_cbfs),
+		cmocka_unit_test_setup(test_mcache_full, setup_cbfs),
+		cmocka_unit_test_setup(test_mcache_copy, setup_cbfs),
+		cmocka_unit_test_setup(test_mcache_no_index, setup_cbfs),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <commonlib/helpers.h>
+#include <commonlib/mem_pool.h>
+#include <string.h>
+#include <tests/test.h>
+
+#define POOL_SIZE (8 * KiB)
+
+static uint8_t pool_buf[POOL_SIZE] __aligned(8);
+static struct mem_pool pool;
+
+static int setup_test(void **state)
+{
+	mem_pool_init(&pool, pool_buf, sizeof(pool_buf));
+	return 0;
+}
+
+static void test_mem_pool_alloc(void **state)
+{
+	uint8_t *p1, *p2;
+
+	p1 = mem_pool_alloc(&pool, 13);
+	p2 = mem_pool_alloc(&pool, 100);
+	assert_non_null(p1);
+	assert_non_null(p2);
+	assert_true(IS_ALIGNED((uintptr_t)p1, 8));
+	assert_true(IS_ALIGNED((uintptr_t)p2, 8));
+	assert_true(p2 >= p1 + 13);
+
+	assert_null(mem_pool_alloc(&pool, POOL_SIZE));
+}
+
+static void test_mem_pool_free_reverse_order(void **state)
+{
+	void *p1 = mem_pool_alloc(&pool, 100);
+	void *p2 = mem_pool_alloc(&pool, 200);
+
+	mem_pool_free(&pool, p2);
+	mem_pool_free(&pool, p1);
+	assert_int_equal(pool.free_offset, 0);
+
+	/* Memory that isn't part of the pool is ignored. */
+	mem_pool_free(&pool, &pool);
+	mem_pool_free(&pool, NULL);
+	assert_int_equal(pool.free_offset, 0);
+}
+
+static void test_mem_pool_free_interior_pointer(void **state)
+{
+	uint8_t *p1 = mem_pool_alloc(&pool, 64);
+	uint8_t *p2 = mem_pool_alloc(&pool, 64);
+	const size_t free_offset = pool.free_offset;
+
+	/* Data that looks like a used block header must not be taken for one. */
+	memset(p1, 0, 64);
+	p1[16] = 24;
+	mem_pool_free(&pool, p1 + 24);
+	mem_pool_free(&pool, p2 + 8);
+	mem_pool_free(&pool, p2 + 1);
+	assert_int_equal(pool.free_offset, free_offset);
+
+	/* Both allocations are still live and can be freed. */
+	mem_pool_free(&pool, p2);
+	mem_pool_free(&pool, p1);
+	assert_int_equal(pool.free_offset, 0);
+}
+
+static void test_mem_pool_free_any_order(void **state)
+{
+	void *p[8];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(p); i++)
+		p[i] = mem_pool_alloc(&pool, 64);
+
+	/* Free every other allocation, then reuse the holes. */
+	for (i = 0; i < ARRAY_SIZE(p); i += 2)
+		mem_pool_free(&pool, p[i]);
+	for (i = 0; i < ARRAY_SIZE(p); i += 2)
+		assert_ptr_equal(mem_pool_alloc(&pool, 64), p[i]);
+
+	/* Free out of order, neighbours are merged and the pool ends up empty. */
+	for (i = 0; i < ARRAY_SIZE(p); i += 2)
+		mem_pool_free(&pool, p[i]);
+	for (i = 1; i < ARRAY_SIZE(p); i += 2)
+		mem_pool_free(&pool, p[i]);
+	assert_int_equal(pool.free_offset, 0);
+}
+
+static void test_mem_pool_reuse_merged_space(void **state)
+{
+	uint8_t *p1 = mem_pool_alloc(&pool, 1 * KiB);
+	uint8_t *p2 = mem_pool_alloc(&pool, 1 * KiB);
+	uint8_t *p3 = mem_pool_alloc(&pool, 1 * KiB);
+	uint8_t *big;
+
+	mem_pool_free(&pool, p1);
+	mem_pool_free(&pool, p2);
+
+	/* The two freed neighbours were merged and can hold a larger allocation. */
+	big = mem_pool_alloc(&pool, 2 * KiB);
+	assert_ptr_equal(big, p1);
+	memset(big, 0xa5, 2 * KiB);
+
+	mem_pool_free(&pool, p3);
+	mem_pool_free(&pool, big);
+	assert_int_equal(pool.free_offset, 0);
+}
+
+static void test_mem_pool_mark_rewind(void **state)
+{
+	void *p1 = mem_pool_alloc(&pool, 100);
+	const size_t mark = mem_pool_mark(&pool);
+
+	assert_non_null(mem_pool_alloc(&pool, 200));
+	assert_non_null(mem_pool_alloc(&pool, 300));
+	mem_pool_rewind(&pool, mark);
+	assert_int_equal(pool.free_offset, mark);
+
+	/* Allocations below the mark that were freed in the meantime are released too. */
+	assert_non_null(mem_pool_alloc(&pool, 200));
+	mem_pool_free(&pool, p1);
+	mem_pool_rewind(&pool, mark);
+	assert_int_equal(pool.free_offset, 0);
+}
+
+static void test_mem_pool_high_water(void **state)
+{
+	void *p1 = mem_pool_alloc(&pool, 1 * KiB);
+	void *p2 = mem_pool_alloc(&pool, 2 * KiB);
+	const size_t high_water = pool.free_offset;
+
+	assert_int_equal(mem_pool_high_water(&pool), high_water);
+
+	mem_pool_free(&pool, p2);
+	mem_pool_free(&pool, p1);
+	assert_int_equal(mem_pool_high_water(&pool), high_water);
+
+	mem_pool_reset(&pool);
+	assert_int_equal(mem_pool_high_water(&pool), high_water);
+	mem_pool_init(&pool, pool_buf, sizeof(pool_buf));
+	assert_int_equal(mem_pool_high_water(&pool), 0);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup(test_mem_pool_alloc, setup_test),
+		cmocka_unit_test_setup(test_mem_pool_free_reverse_order, setup_test),
+		cmocka_unit_test_setup(test_mem_pool_free_interior_pointer, setup_test),
+		cmocka_unit_test_setup(test_mem_pool_free_any_order, setup_test),
+		cmocka_unit_test_setup(test_mem_pool_reuse_merged_space, setup_test),
+		cmocka_unit_test_setup(test_mem_pool_mark_rewind, setup_test),
+		cmocka_unit_test_setup(test_mem_pool_high_water, setup_test),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,144 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <console/vtxprintf.h>
+#include <stdio.h>
+#include <string.h>
+#include <tests/test.h>
+
+struct byte_sink {
+	char buf[256];
+	size_t len;
+};
+
+struct span_sink {
+	char buf[256];
+	size_t len;
+	size_t calls;
+};
+
+static void sink_tx_byte(unsigned char byte, void *data)
+{
+	struct byte_sink *sink = data;
+
+	if (sink->len < sizeof(sink->buf))
+		sink->buf[sink->len++] = byte;
+}
+
+static void sink_tx_bytes(const char *buf, size_t len, void *data)
+{
+	struct span_sink *sink = data;
+
+	assert_true(len > 0);
+	assert_true(sink->len + len <= sizeof(sink->buf));
+	memcpy(&sink->buf[sink->len], buf, len);
+	sink->len += len;
+	sink->calls++;
+}
+
+static int format_bytes(struct byte_sink *sink, const char *fmt, ...)
+{
+	va_list args;
+	int i;
+
+	memset(sink, 0, sizeof(*sink));
+	va_start(args, fmt);
+	i = vtxprintf(sink_tx_byte, fmt, args, sink);
+	va_end(args);
+
+	return i;
+}
+
+static int format_spans(struct span_sink *sink, const char *fmt, ...)
+{
+	va_list args;
+	int i;
+
+	memset(sink, 0, sizeof(*sink));
+	va_start(args, fmt);
+	i = vtxprintf_bulk(sink_tx_bytes, fmt, args, sink);
+	va_end(args);
+
+	return i;
+}
+
+#define assert_format(expected, fmt, ...) do {						\
+		struct byte_sink bs;							\
+		struct span_sink ss;							\
+		assert_int_equal(format_bytes(&bs, fmt, ##__VA_ARGS__), strlen(expected)); \
+		assert_int_equal(format_spans(&ss, fmt, ##__VA_ARGS__), strlen(expected)); \
+		assert_int_equal(bs.len, strlen(expected));				\
+		assert_int_equal(ss.len, strlen(expected));				\
+		assert_memory_equal(bs.buf, expected, bs.len);				\
+		assert_memory_equal(ss.buf, expected, ss.len);				\
+	} while (0)
+
+static void test_vtxprintf_formats(void **state)
+{
+	assert_format("", "");
+	assert_format("plain text\n", "plain text\n");
+	assert_format("100%", "100%%");
+	assert_format("a=0x1f b=-42 c=42", "a=%#x b=%d c=%u", 0x1f, -42, 42);
+	assert_format("[   ff][00ff][ff   ]", "[%5x][%04x][%-5x]", 0xff, 0xff, 0xff);
+	assert_format("[+7][ 7][007][-0007]", "[%+d][% d][%.3d][%05d]", 7, 7, 7, -7);
+	assert_format("DEADBEEF 0X1A", "%X %#X", 0xdeadbeef, 0x1a);
+	assert_format("777 0777", "%o %#o", 0777, 0777);
+	assert_format("18446744073709551615 ffffffffffffffff", "%llu %llx",
+		      (unsigned long long)-1, (unsigned long long)-1);
+	assert_format("-9223372036854775808", "%lld", (long long)(1ULL << 63));
+	assert_format("4294967296 12345678901", "%zu %lld", (size_t)1 << 32, 12345678901LL);
+	assert_format("-1 255 -128", "%hd %hhu %hhd", 0xffff, 0x1ff, 0x80);
+	assert_format("[abc][  abc][abc  ][ab]", "[%s][%5s][%-5s][%.2s]", "abc", "abc", "abc",
+		      "abc");
+	assert_format("<NULL>", "%s", (char *)NULL);
+	assert_format("[x][  x][x  ]", "[%c][%3c][%-3c]", 'x', 'x', 'x');
+	assert_format("0x00001000", "%p", (void *)0x1000);
+	assert_format("%y", "%y");
+}
+
+static void test_vtxprintf_bulk_spans(void **state)
+{
+	struct span_sink sink;
+	char long_string[200];
+
+	/* Short messages are handed over in a single span. */
+	format_spans(&sink, "PCI: %02x:%02x.%01x [%04x/%04x] %s\n", 0, 0x1f, 3, 0x8086,
+		     0x1234, "enabled");
+	assert_int_equal(sink.calls, 1);
+
+	/* Long output is split into chunks of at most VTXPRINTF_CHUNK_SIZE bytes, except for
+	   long strings and literal runs which are passed through without copying. */
+	memset(long_string, 'a', sizeof(long_string) - 1);
+	long_string[sizeof(long_string) - 1] = '\0';
+	format_spans(&sink, "x%sy", long_string);
+	assert_int_equal(sink.len, sizeof(long_string) + 1);
+	assert_int_equal(sink.calls, 3);
+	assert_int_equal(sink.buf[0], 'x');
+	assert_int_equal(sink.buf[sink.len - 1], 'y');
+}
+
+static void test_vsnprintf_truncation(void **state)
+{
+	char buf[16];
+
+	memset(buf, 'z', sizeof(buf));
+	assert_int_equal(snprintf(buf, 8, "%s-%d", "abcdef", 12345), 12);
+	assert_string_equal(buf, "abcdef-");
+	assert_int_equal(buf[8], 'z');
+
+	assert_int_equal(snprintf(buf, 0, "%d", 1), 1);
+	assert_int_equal(buf[0], 'a');
+
+	assert_int_equal(snprintf(buf, sizeof(buf), "%x", 0xc0ffee), 6);
+	assert_string_equal(buf, "c0ffee");
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vtxprintf_formats),
+		cmocka_unit_test(test_vtxprintf_bulk_spans),
+		cmocka_unit_test(test_vsnprintf_truncation),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
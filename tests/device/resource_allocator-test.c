@@ -0,0 +1,372 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <commonlib/helpers.h>
+#include <device/device.h>
+#include <device/resource.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tests/test.h>
+
+/*
+ * Synthetic device tree: a domain with devices and bridges on its bus, every bridge with a
+ * bus full of devices, each with a few BARs. This roughly models many SR-IOV functions
+ * behind PCIe switches.
+ */
+#define BRIDGES			8
+#define BRIDGE_DEVS		96
+#define DOMAIN_DEVS		96
+#define BARS_PER_DEV		2
+#define FLAT_BARS		2048
+
+/*
+ * Zero-sized resources of each type added to every bus, more than the allocator sorts at once
+ * (MAX_SORTED_RESOURCES). They don't take any space, but make it fall back to
+ * largest_resource(). Without them, every bus fits.
+ */
+#define PAD_TYPES		4
+#define PAD_RES			300
+
+#define NUM_DEVS		(3 + 2 * BRIDGES + BRIDGES * BRIDGE_DEVS + DOMAIN_DEVS)
+#define NUM_RES			(16 + BRIDGES * 3 + NUM_DEVS * (BARS_PER_DEV + 1) + \
+				 (BRIDGES + 1) * PAD_TYPES * PAD_RES)
+
+#define DOMAIN_IO_BASE		0x1000
+#define DOMAIN_IO_LIMIT		0xffff
+#define DOMAIN_MEM_BASE		0x80000000
+#define DOMAIN_MEM_LIMIT	0x3fffffffffffULL
+#define FIXED_BASE		0xfec00000
+#define FIXED_SIZE		0x100000
+
+static struct device devs[NUM_DEVS];
+static struct resource res[NUM_RES];
+static struct bus buses[BRIDGES + 2];
+static size_t num_devs, num_res;
+
+static struct device *root, *domain;
+
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+void die(const char *msg, ...)
+{
+	fail_msg("die() called: %s", msg);
+}
+
+static struct device *add_dev(struct bus *bus, enum device_path_type type)
+{
+	struct device *dev = &devs[num_devs++];
+	struct device **link;
+
+	assert_true(num_devs <= NUM_DEVS);
+	dev->path.type = type;
+	dev->enabled = 1;
+	dev->bus = bus;
+	if (type == DEVICE_PATH_PCI)
+		dev->path.pci.devfn = num_devs;
+	if (!bus)
+		return dev;
+
+	for (link = &bus->children; *link; link = &(*link)->sibling)
+		;
+	*link = dev;
+	return dev;
+}
+
+static struct resource *add_res(struct device *dev, unsigned long flags, resource_t size,
+				unsigned char align, resource_t limit)
+{
+	struct resource *r = &res[num_res++];
+	struct resource **link;
+
+	assert_true(num_res <= NUM_RES);
+	r->index = num_res;
+	r->flags = flags;
+	r->size = size;
+	r->align = align;
+	r->gran = align;
+	r->limit = limit;
+
+	for (link = &dev->resource_list; *link; link = &(*link)->next)
+		;
+	*link = r;
+	return r;
+}
+
+/* Adds memory BARs of 4 KiB to 1 MiB, aligned to their size, with plenty of duplicates. */
+static void add_bars(struct device *dev, bool above_4g, bool io)
+{
+	for (int i = 0; i < BARS_PER_DEV; i++) {
+		const unsigned char align = 12 + rng() % 9;
+		unsigned long flags = IORESOURCE_MEM;
+		resource_t limit = 0xffffffff;
+
+		if (rng() % 4 == 0) {
+			flags |= IORESOURCE_PREFETCH | IORESOURCE_PCI64;
+			if (above_4g) {
+				flags |= IORESOURCE_ABOVE_4G;
+				limit = 0xffffffffffffffffULL;
+			}
+		}
+		add_res(dev, flags, POWER_OF_2(align), align, limit);
+	}
+
+	if (io && rng() % 4 == 0) {
+		const unsigned char align = 4 + rng() % 4;
+
+		add_res(dev, IORESOURCE_IO, POWER_OF_2(align), align, 0xffff);
+	}
+}
+
+static void build_tree(uint32_t seed)
+{
+	struct resource *r;
+	struct device *bridge;
+	int i, j;
+
+	memset(devs, 0, sizeof(devs));
+	memset(res, 0, sizeof(res));
+	memset(buses, 0, sizeof(buses));
+	num_devs = 0;
+	num_res = 0;
+	rng_state = seed;
+
+	root = add_dev(NULL, DEVICE_PATH_ROOT);
+	root->link_list = &buses[0];
+	buses[0].dev = root;
+
+	domain = add_dev(&buses[0], DEVICE_PATH_DOMAIN);
+	domain->link_list = &buses[1];
+	buses[1].dev = domain;
+
+	r = add_res(domain, IORESOURCE_IO | IORESOURCE_ASSIGNED, 0, 0, DOMAIN_IO_LIMIT);
+	r->base = DOMAIN_IO_BASE;
+	r = add_res(domain, IORESOURCE_MEM | IORESOURCE_ASSIGNED, 0, 0, DOMAIN_MEM_LIMIT);
+	r->base = DOMAIN_MEM_BASE;
+
+	for (i = 0; i < DOMAIN_DEVS + BRIDGES; i++) {
+		/* Interleave bridges with the devices on the domain's bus. */
+		if (i % (DOMAIN_DEVS / BRIDGES + 1)) {
+			add_bars(add_dev(&buses[1], DEVICE_PATH_PCI), false, true);
+			continue;
+		}
+
+		bridge = add_dev(&buses[1], DEVICE_PATH_PCI);
+		bridge->link_list = &buses[2 + i / (DOMAIN_DEVS / BRIDGES + 1)];
+		bridge->link_list->dev = bridge;
+		add_res(bridge, IORESOURCE_IO | IORESOURCE_BRIDGE, 0, 12, 0xffff);
+		add_res(bridge, IORESOURCE_MEM | IORESOURCE_BRIDGE, 0, 20, 0xffffffff);
+		add_res(bridge, IORESOURCE_MEM | IORESOURCE_PREFETCH | IORESOURCE_BRIDGE, 0, 20,
+			0xffffffffffffffffULL);
+
+		for (j = 0; j < BRIDGE_DEVS; j++)
+			add_bars(add_dev(bridge->link_list, DEVICE_PATH_PCI), i % 2, false);
+	}
+
+	/* An IOAPIC-like fixed resource the allocator has to steer around. */
+	r = add_res(buses[1].children->sibling, IORESOURCE_MEM | IORESOURCE_FIXED |
+		    IORESOURCE_ASSIGNED, FIXED_SIZE, 0, 0);
+	r->base = FIXED_BASE;
+}
+
+static void pad_buses(void)
+{
+	static const unsigned long types[PAD_TYPES] = {
+		IORESOURCE_IO,
+		IORESOURCE_MEM,
+		IORESOURCE_MEM | IORESOURCE_PREFETCH,
+		IORESOURCE_MEM | IORESOURCE_PREFETCH | IORESOURCE_ABOVE_4G,
+	};
+
+	for (int i = 1; i < BRIDGES + 2; i++) {
+		struct device *dev = add_dev(&buses[i], DEVICE_PATH_PCI);
+
+		for (int j = 0; j < PAD_TYPES; j++)
+			for (int k = 0; k < PAD_RES; k++)
+				add_res(dev, types[j], 0, 0, 0xffffffffffffffffULL);
+	}
+}
+
+static bool is_bridge(const struct device *dev)
+{
+	return dev->link_list != NULL;
+}
+
+static struct resource *bridge_window(const struct device *bridge,
+				      const struct resource *child)
+{
+	const unsigned long type_mask = IORESOURCE_TYPE_MASK | IORESOURCE_PREFETCH;
+	struct resource *r;
+
+	for (r = bridge->resource_list; r; r = r->next)
+		if ((r->flags & type_mask) == (child->flags & type_mask))
+			return r;
+
+	fail_msg("No bridge window for resource %lu", child->index);
+	return NULL;
+}
+
+static bool overlap(const struct resource *a, const struct resource *b)
+{
+	return a->base < b->base + b->size && b->base < a->base + a->size;
+}
+
+/* Checks that the resources in list don't overlap each other. */
+static void check_disjoint(struct resource **list, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		for (size_t j = i + 1; j < count; j++)
+			if (overlap(list[i], list[j]))
+				fail_msg("Resources %lu [%llx-%llx] and %lu [%llx-%llx] overlap",
+					 list[i]->index, list[i]->base,
+					 list[i]->base + list[i]->size - 1,
+					 list[j]->index, list[j]->base,
+					 list[j]->base + list[j]->size - 1);
+}
+
+static void check_allocation(void)
+{
+	static struct resource *leaves[NUM_RES], *top[NUM_RES];
+	size_t num_leaves = 0, num_top = 0;
+	struct resource *r;
+	size_t i;
+
+	for (i = 0; i < num_devs; i++) {
+		const struct device *dev = &devs[i];
+
+		if (!dev->bus || dev->path.type == DEVICE_PATH_DOMAIN)
+			continue;
+
+		for (r = dev->resource_list; r; r = r->next) {
+			if (!r->size)
+				continue;
+
+			if (r->flags & IORESOURCE_FIXED) {
+				leaves[num_leaves++] = r;
+				top[num_top++] = r;
+				continue;
+			}
+
+			assert_true(r->flags & IORESOURCE_ASSIGNED);
+			assert_true(IS_ALIGNED(r->base, POWER_OF_2(r->align)));
+			assert_true(r->base + r->size - 1 <= r->limit);
+
+			if (dev->bus->dev == domain) {
+				top[num_top++] = r;
+				if (r->flags & IORESOURCE_IO) {
+					assert_true(r->base >= DOMAIN_IO_BASE);
+					assert_true(r->limit <= DOMAIN_IO_LIMIT);
+				} else {
+					assert_true(r->base >= DOMAIN_MEM_BASE);
+					assert_true(r->limit <= DOMAIN_MEM_LIMIT);
+				}
+			} else {
+				const struct resource *w = bridge_window(dev->bus->dev, r);
+
+				assert_true(r->base >= w->base);
+				assert_true(r->base + r->size <= w->base + w->size);
+			}
+
+			if (r->flags & IORESOURCE_ABOVE_4G)
+				assert_true(r->base > 0xffffffff);
+
+			if (!is_bridge(dev))
+				leaves[num_leaves++] = r;
+		}
+	}
+
+	assert_true(num_leaves > 1000);
+
+	/* I/O resources are all below the memory ones, so one pass checks both spaces. */
+	check_disjoint(leaves, num_leaves);
+	check_disjoint(top, num_top);
+}
+
+static void test_allocate_resources(void **state)
+{
+	static resource_t bases[NUM_RES];
+	size_t i;
+
+	/* With too many resources on every bus, the allocator falls back to largest_resource(). */
+	build_tree(0x12345678);
+	pad_buses();
+	allocate_resources(root);
+	check_allocation();
+	for (i = 0; i < num_res; i++)
+		bases[i] = res[i].base;
+
+	build_tree(0x12345678);
+	allocate_resources(root);
+	check_allocation();
+
+	/* Both must place every resource at the same address. */
+	for (i = 0; i < num_res; i++)
+		assert_int_equal(res[i].base, bases[i]);
+}
+
+static void test_sort_bus_resources(void **state)
+{
+	static struct bus_resource list[FLAT_BARS + 1];
+	const unsigned long type_mask = IORESOURCE_TYPE_MASK | IORESOURCE_PREFETCH;
+	struct resource *last = NULL;
+	struct device *dev = NULL;
+	size_t count, i;
+
+	memset(devs, 0, sizeof(devs));
+	memset(res, 0, sizeof(res));
+	memset(buses, 0, sizeof(buses));
+	num_devs = 0;
+	num_res = 0;
+	rng_state = 0xcafe;
+
+	for (i = 0; i < FLAT_BARS; i++) {
+		const unsigned char align = 12 + rng() % 4;
+		unsigned long flags = IORESOURCE_MEM;
+
+		if (i % 8 == 0)
+			dev = add_dev(&buses[0], DEVICE_PATH_PCI);
+		/* Few distinct sizes, so the tie-break on bus order matters. */
+		if (rng() % 16 == 0)
+			flags |= IORESOURCE_FIXED;
+		add_res(dev, flags, POWER_OF_2(align + rng() % 2), align, 0xffffffff);
+	}
+
+	/* A disabled device's resources are not allocated. */
+	dev = add_dev(&buses[0], DEVICE_PATH_PCI);
+	dev->enabled = 0;
+	add_res(dev, IORESOURCE_MEM, 4 * KiB, 12, 0xffffffff);
+
+	count = sort_bus_resources(&buses[0], type_mask, IORESOURCE_MEM, list, ARRAY_SIZE(list));
+	assert_true(count > 1000 && count < FLAT_BARS);
+
+	for (i = 0; i < count; i++) {
+		const struct device *found = largest_resource(&buses[0], &last, type_mask,
+							      IORESOURCE_MEM);
+
+		assert_ptr_equal(found, list[i].dev);
+		assert_ptr_equal(last, list[i].res);
+	}
+	assert_null(largest_resource(&buses[0], &last, type_mask, IORESOURCE_MEM));
+
+	/* Without room for all of them, only the count is returned. */
+	assert_int_equal(sort_bus_resources(&buses[0], type_mask, IORESOURCE_MEM, list,
+					    count - 1), count);
+	assert_int_equal(sort_bus_resources(&buses[0], type_mask, IORESOURCE_IO, list,
+					    ARRAY_SIZE(list)), 0);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_sort_bus_resources),
+		cmocka_unit_test(test_allocate_resources),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,233 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <boot_device.h>
+#include <commonlib/helpers.h>
+#include <commonlib/region.h>
+#include <fmap.h>
+#include <smmstore.h>
+#include <string.h>
+#include <tests/test.h>
+
+#define FLASH_SIZE	(64 * KiB)
+#define STORE_OFFSET	(16 * KiB)
+#define STORE_SIZE	(8 * KiB)
+
+static uint8_t flash[FLASH_SIZE];
+
+/* Behaves like NOR flash: writes can only clear bits and erasing sets all bits. */
+static void *flash_mmap(const struct region_device *rd, size_t offset, size_t size)
+{
+	return &flash[offset];
+}
+
+static int flash_munmap(const struct region_device *rd, void *mapping)
+{
+	return 0;
+}
+
+static ssize_t flash_readat(const struct region_device *rd, void *b, size_t offset,
+			    size_t size)
+{
+	memcpy(b, &flash[offset], size);
+	return size;
+}
+
+static ssize_t flash_writeat(const struct region_device *rd, const void *b, size_t offset,
+			     size_t size)
+{
+	const uint8_t *data = b;
+
+	for (size_t i = 0; i < size; i++)
+		flash[offset + i] &= data[i];
+	return size;
+}
+
+static ssize_t flash_eraseat(const struct region_device *rd, size_t offset, size_t size)
+{
+	assert_true(IS_ALIGNED(offset, 4 * KiB));
+	assert_true(IS_ALIGNED(size, 4 * KiB));
+	memset(&flash[offset], 0xff, size);
+	return size;
+}
+
+static const struct region_device_ops flash_ops = {
+	.mmap = flash_mmap,
+	.munmap = flash_munmap,
+	.readat = flash_readat,
+	.writeat = flash_writeat,
+	.eraseat = flash_eraseat,
+};
+
+static struct region_device flash_rdev = REGION_DEV_INIT(&flash_ops, 0, FLASH_SIZE);
+
+const struct region_device *boot_device_ro(void)
+{
+	return &flash_rdev;
+}
+
+const struct region_device *boot_device_rw(void)
+{
+	return &flash_rdev;
+}
+
+void boot_device_init(void)
+{
+}
+
+int fmap_locate_area(const char *name, struct region *r)
+{
+	if (strcmp(name, "SMMSTORE"))
+		return -1;
+
+	r->offset = STORE_OFFSET;
+	r->size = STORE_SIZE;
+	return 0;
+}
+
+static int setup_store(void **state)
+{
+	memset(flash, 0xff, sizeof(flash));
+	/* Make sure the index of the previous test is dropped. */
+	assert_int_equal(0, smmstore_clear_region());
+	return 0;
+}
+
+struct store_stats {
+	size_t entries;
+	size_t end;
+};
+
+/* Walk the store like a payload would. Returns the value of the last active entry of |key|. */
+static const uint8_t *find_value(const char *key, uint32_t *value_sz, struct store_stats *stats)
+{
+	const uint8_t *store = &flash[STORE_OFFSET];
+	const uint8_t *value = NULL;
+	size_t end = 0;
+	uint32_t k_sz, v_sz;
+
+	memset(stats, 0, sizeof(*stats));
+	while (end + 8 <= STORE_SIZE) {
+		memcpy(&k_sz, &store[end], sizeof(k_sz));
+		if (k_sz == 0xffffffff)
+			break;
+		memcpy(&v_sz, &store[end + 4], sizeof(v_sz));
+		assert_true(end + 8 + k_sz + v_sz < STORE_SIZE);
+		if (store[end + 8 + k_sz + v_sz] == 0 && k_sz == strlen(key) &&
+		    !memcmp(&store[end + 8], key, k_sz)) {
+			value = &store[end + 8 + k_sz];
+			*value_sz = v_sz;
+		}
+		stats->entries++;
+		end = ALIGN_UP(end + 8 + k_sz + v_sz + 1, 4);
+	}
+	stats->end = end;
+
+	return value;
+}
+
+static int append(const char *key, const void *value, uint32_t value_sz)
+{
+	return smmstore_append_data((void *)key, strlen(key), (void *)value, value_sz);
+}
+
+static void assert_value(const char *key, const void *expected, uint32_t expected_sz)
+{
+	struct store_stats stats;
+	uint32_t value_sz;
+	const uint8_t *value = find_value(key, &value_sz, &stats);
+
+	assert_non_null(value);
+	assert_int_equal(expected_sz, value_sz);
+	assert_memory_equal(expected, value, value_sz);
+}
+
+static void test_smmstore_append(void **state)
+{
+	struct store_stats stats;
+	uint32_t value_sz;
+
+	assert_int_equal(0, append("Boot0000", "abc", 3));
+	assert_int_equal(0, append("BootOrder", "\x00\x00", 2));
+	assert_int_equal(0, append("Boot0000", "defgh", 5));
+
+	assert_value("Boot0000", "defgh", 5);
+	assert_value("BootOrder", "\x00\x00", 2);
+	assert_null(find_value("Lang", &value_sz, &stats));
+	assert_int_equal(3, stats.entries);
+	/* 8 + 8 + 3 + 1, 8 + 9 + 2 + 1, 8 + 8 + 5 + 1 */
+	assert_int_equal(20 + 20 + 24, stats.end);
+}
+
+static void test_smmstore_external_changes(void **state)
+{
+	struct store_stats stats;
+	uint32_t value_sz;
+
+	assert_int_equal(0, append("Timeout", "\x05", 1));
+
+	/* Another entry written behind the back of the index, e.g. by a flash update. */
+	const uint32_t sizes[2] = { 3, 1 };
+	memcpy(&flash[STORE_OFFSET + 20], sizes, sizeof(sizes));
+	memcpy(&flash[STORE_OFFSET + 28], "Key\x07\x00", 5);
+
+	assert_int_equal(0, append("Timeout", "\x01", 1));
+	assert_value("Key", "\x07", 1);
+	assert_value("Timeout", "\x01", 1);
+	find_value("Timeout", &value_sz, &stats);
+	assert_int_equal(3, stats.entries);
+
+	/* Clearing the store drops the index. */
+	assert_int_equal(0, smmstore_clear_region());
+	assert_int_equal(0, append("Timeout", "\x02", 1));
+	find_value("Timeout", &value_sz, &stats);
+	assert_int_equal(1, stats.entries);
+}
+
+static void test_smmstore_compaction(void **state)
+{
+	struct store_stats stats;
+	uint8_t value[300];
+	uint32_t value_sz;
+	char key[16];
+
+	/* Rewrite a few variables many times, so the store fills up with stale entries. */
+	for (int i = 0; i < 200; i++) {
+		snprintf(key, sizeof(key), "Var%d", i % 5);
+		memset(value, i, sizeof(value));
+		assert_int_equal(0, append(key, value, sizeof(value) - i % 5));
+	}
+
+	for (int i = 195; i < 200; i++) {
+		snprintf(key, sizeof(key), "Var%d", i % 5);
+		memset(value, i, sizeof(value));
+		assert_value(key, value, sizeof(value) - i % 5);
+	}
+	find_value("Var0", &value_sz, &stats);
+	assert_true(stats.entries < 200);
+	for (size_t i = stats.end; i < STORE_SIZE; i++)
+		assert_int_equal(0xff, flash[STORE_OFFSET + i]);
+
+	/* Live data that doesn't fit can't be compacted away. */
+	uint8_t big[STORE_SIZE / 2];
+	memset(big, 0xaa, sizeof(big));
+	assert_int_equal(0, append("Big", big, sizeof(big) - 512));
+	assert_int_not_equal(0, append("Big2", big, sizeof(big)));
+	assert_value("Big", big, sizeof(big) - 512);
+
+	/* Nothing outside of the store is touched. */
+	for (size_t i = 0; i < STORE_OFFSET; i++)
+		assert_int_equal(0xff, flash[i]);
+	for (size_t i = STORE_OFFSET + STORE_SIZE; i < FLASH_SIZE; i++)
+		assert_int_equal(0xff, flash[i]);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup(test_smmstore_append, setup_store),
+		cmocka_unit_test_setup(test_smmstore_external_changes, setup_store),
+		cmocka_unit_test_setup(test_smmstore_compaction, setup_store),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
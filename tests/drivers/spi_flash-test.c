@@ -0,0 +1,243 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <commonlib/helpers.h>
+#include <endian.h>
+#include <spi_flash.h>
+#include <spi-generic.h>
+#include <string.h>
+#include <tests/test.h>
+
+#include "../../src/drivers/spi/spi_flash_internal.h"
+
+#define FLASH_SIZE	(64 * KiB)
+#define BFPT_OFFSET	0x30
+
+static uint8_t flash_data[FLASH_SIZE];
+static uint8_t sfdp[0x100];
+
+/* Bytes sent since the bus was claimed, and the widths of the last command's phases. */
+static uint8_t cmd[16];
+static size_t cmd_len;
+static int addr_width;
+static uint8_t last_read_cmd;
+
+static int ctrlr_claim_bus(const struct spi_slave *slave)
+{
+	cmd_len = 0;
+	addr_width = 1;
+	return 0;
+}
+
+static uint32_t cmd_addr(void)
+{
+	return cmd[1] << 16 | cmd[2] << 8 | cmd[3];
+}
+
+/* Emulates a flash part answering the command in cmd[] on |width| data lines. */
+static void respond(void *din, size_t len, int width)
+{
+	switch (cmd[0]) {
+	case CMD_READ_STATUS:
+		memset(din, 0, len);
+		return;
+	case CMD_READ_SFDP:
+		assert_int_equal(cmd_len, 5);
+		assert_true(cmd_addr() + len <= sizeof(sfdp));
+		memcpy(din, &sfdp[cmd_addr()], len);
+		return;
+	case CMD_READ_ARRAY_FAST:
+		assert_int_equal(cmd_len, 5);
+		assert_int_equal(width, 1);
+		break;
+	case CMD_READ_FAST_DUAL_OUTPUT:
+		assert_int_equal(cmd_len, 5);
+		assert_int_equal(addr_width, 1);
+		assert_int_equal(width, 2);
+		break;
+	case CMD_READ_FAST_DUAL_IO:
+		assert_int_equal(cmd_len, 5);
+		assert_int_equal(addr_width, 2);
+		assert_int_equal(width, 2);
+		break;
+	default:
+		fail_msg("Unexpected command %#x", cmd[0]);
+	}
+
+	assert_true(cmd_addr() + len <= FLASH_SIZE);
+	memcpy(din, &flash_data[cmd_addr()], len);
+	last_read_cmd = cmd[0];
+}
+
+static int xfer_width(const void *dout, size_t bytesout, void *din, size_t bytesin,
+		      int width)
+{
+	if (bytesout) {
+		assert_true(cmd_len + bytesout <= sizeof(cmd));
+		if (cmd_len)
+			addr_width = width;
+		memcpy(&cmd[cmd_len], dout, bytesout);
+		cmd_len += bytesout;
+	}
+	if (bytesin)
+		respond(din, bytesin, width);
+	return 0;
+}
+
+static int ctrlr_xfer(const struct spi_slave *slave, const void *dout, size_t bytesout,
+		      void *din, size_t bytesin)
+{
+	return xfer_width(dout, bytesout, din, bytesin, 1);
+}
+
+static int ctrlr_xfer_dual(const struct spi_slave *slave, const void *dout, size_t bytesout,
+			   void *din, size_t bytesin)
+{
+	return xfer_width(dout, bytesout, din, bytesin, 2);
+}
+
+static const struct spi_ctrlr dual_ctrlr = {
+	.claim_bus = ctrlr_claim_bus,
+	.xfer = ctrlr_xfer,
+	.xfer_dual = ctrlr_xfer_dual,
+	.max_xfer_size = 64,
+};
+
+static const struct spi_ctrlr single_ctrlr = {
+	.claim_bus = ctrlr_claim_bus,
+	.xfer = ctrlr_xfer,
+	.max_xfer_size = 64,
+};
+
+const struct spi_ctrlr_buses spi_ctrlr_bus_map[] = {
+	{ .ctrlr = &dual_ctrlr, .bus_start = 0, .bus_end = 0 },
+};
+const size_t spi_ctrlr_bus_map_count = ARRAY_SIZE(spi_ctrlr_bus_map);
+
+static const struct spi_flash_ops flash_ops = {
+	.read = spi_flash_cmd_read,
+};
+
+static void setup_sfdp(void)
+{
+	uint32_t *bfpt = (uint32_t *)&sfdp[BFPT_OFFSET];
+	const uint8_t header[] = {
+		'S', 'F', 'D', 'P', 6, 1, 0, 0xff,
+		0x00, 6, 1, 16, BFPT_OFFSET, 0, 0, 0xff,	/* BFPT, 16 dwords */
+	};
+
+	memset(sfdp, 0xff, sizeof(sfdp));
+	memcpy(sfdp, header, sizeof(header));
+	memset(bfpt, 0, 16 * sizeof(uint32_t));
+	/* 1-1-2, 1-2-2, 1-4-4 and 1-1-4 fast reads with 3-byte addresses */
+	bfpt[0] = htole32(1 << 16 | 1 << 20 | 1 << 21 | 1 << 22);
+	/* 1-1-4: 0x6b, 8 dummy clocks; 1-4-4: 0xeb, 2 mode and 4 dummy clocks */
+	bfpt[2] = htole32(0x6b08 << 16 | 0xeb44);
+	/* 1-2-2: 0xbb, 4 mode clocks; 1-1-2: 0x3b, 8 dummy clocks */
+	bfpt[3] = htole32(0xbb80 << 16 | 0x3b08);
+}
+
+static int setup_flash(void **state)
+{
+	for (size_t i = 0; i < FLASH_SIZE; i++)
+		flash_data[i] = i * 7 + (i >> 8);
+	setup_sfdp();
+	last_read_cmd = 0;
+	return 0;
+}
+
+static void init_flash(struct spi_flash *flash, const struct spi_ctrlr *ctrlr)
+{
+	memset(flash, 0, sizeof(*flash));
+	flash->spi.ctrlr = ctrlr;
+	flash->size = FLASH_SIZE;
+	flash->ops = &flash_ops;
+}
+
+static void check_read(const struct spi_flash *flash, uint8_t read_cmd)
+{
+	uint8_t buf[1000];
+
+	assert_int_equal(spi_flash_read(flash, 0x1234, sizeof(buf), buf), 0);
+	assert_memory_equal(buf, &flash_data[0x1234], sizeof(buf));
+	assert_int_equal(last_read_cmd, read_cmd);
+}
+
+static void test_sfdp_dual(void **state)
+{
+	struct spi_flash flash;
+
+	init_flash(&flash, &dual_ctrlr);
+	assert_int_equal(spi_flash_sfdp_read_modes(&flash), 0);
+
+	assert_true(flash.flags.dual_output);
+	assert_true(flash.flags.dual_io);
+	check_read(&flash, CMD_READ_FAST_DUAL_IO);
+
+	flash.flags.dual_io = 0;
+	check_read(&flash, CMD_READ_FAST_DUAL_OUTPUT);
+}
+
+static void test_sfdp_single_ctrlr(void **state)
+{
+	struct spi_flash flash;
+
+	/* The part reports its dual modes, but the controller can't drive them. */
+	init_flash(&flash, &single_ctrlr);
+	assert_int_equal(spi_flash_sfdp_read_modes(&flash), 0);
+
+	assert_true(flash.flags.dual_io);
+	check_read(&flash, CMD_READ_ARRAY_FAST);
+}
+
+static void test_sfdp_unusable_modes(void **state)
+{
+	uint32_t *bfpt = (uint32_t *)&sfdp[BFPT_OFFSET];
+	struct spi_flash flash;
+
+	/* 1-2-2 with 2 mode clocks only, which is half a byte on 2 lines. */
+	bfpt[3] = htole32(0xbb40 << 16 | 0x3b08);
+	init_flash(&flash, &dual_ctrlr);
+	assert_int_equal(spi_flash_sfdp_read_modes(&flash), 0);
+	assert_true(flash.flags.dual_output);
+	assert_false(flash.flags.dual_io);
+	check_read(&flash, CMD_READ_FAST_DUAL_OUTPUT);
+
+	/* 1-1-2 with a non-standard opcode, and 1-2-2 not supported at all. */
+	bfpt[0] = htole32(1 << 16);
+	bfpt[3] = htole32(0xbb80 << 16 | 0x3c08);
+	init_flash(&flash, &dual_ctrlr);
+	assert_int_equal(spi_flash_sfdp_read_modes(&flash), 0);
+	assert_int_equal(flash.flags.raw, 0);
+
+	/* Parts that only take 4-byte addresses can't be read with these commands. */
+	setup_sfdp();
+	bfpt[0] |= htole32(2 << 17);
+	init_flash(&flash, &dual_ctrlr);
+	assert_int_not_equal(spi_flash_sfdp_read_modes(&flash), 0);
+	assert_int_equal(flash.flags.raw, 0);
+	check_read(&flash, CMD_READ_ARRAY_FAST);
+}
+
+static void test_sfdp_missing(void **state)
+{
+	struct spi_flash flash;
+
+	memset(sfdp, 0xff, sizeof(sfdp));
+	init_flash(&flash, &dual_ctrlr);
+	assert_int_not_equal(spi_flash_sfdp_read_modes(&flash), 0);
+
+	assert_int_equal(flash.flags.raw, 0);
+	check_read(&flash, CMD_READ_ARRAY_FAST);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup(test_sfdp_dual, setup_flash),
+		cmocka_unit_test_setup(test_sfdp_single_ctrlr, setup_flash),
+		cmocka_unit_test_setup(test_sfdp_unusable_modes, setup_flash),
+		cmocka_unit_test_setup(test_sfdp_missing, setup_flash),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -116,6 +116,28 @@ void test_cbmemc_tx_byte_overflow(void **state)
 	free(check_buffer);
 }
 
+void test_cbmemc_tx_bytes_overflow(void **state)
+{
+	int i;
+	const uint32_t console_size = current_console->size;
+	const char data[] = "0123456789abcdefghijklmnopqrstuvwxyz\n";
+	const int data_size = ARRAY_SIZE(data) - 1;
+	unsigned char *expected = malloc(console_size);
+
+	/* Write more than the buffer holds in spans that straddle its end. */
+	for (i = 0; i < console_size + data_size; i += data_size) {
+		cbmemc_tx_bytes(data, data_size);
+		for (int j = 0; j < data_size; ++j)
+			expected[(i + j) % console_size] = data[j];
+	}
+
+	assert_int_equal(OVERFLOW, current_console->cursor & OVERFLOW);
+	assert_int_equal(i % console_size, current_console->cursor & CURSOR_MASK);
+	assert_memory_equal(expected, current_console->body, console_size);
+
+	free(expected);
+}
+
 int main(void)
 {
 #if ENV_ROMSTAGE_OR_BEFORE
@@ -130,6 +152,8 @@ int main(void)
 						setup_cbmemc, teardown_cbmemc),
 		cmocka_unit_test_setup_teardown(test_cbmemc_tx_byte_overflow,
 						setup_cbmemc, teardown_cbmemc),
+		cmocka_unit_test_setup_teardown(test_cbmemc_tx_bytes_overflow,
+						setup_cbmemc, teardown_cbmemc),
 	};
 
 	return cmocka_run_group_tests_name(test_name, tests, NULL, NULL);
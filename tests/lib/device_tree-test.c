@@ -0,0 +1,354 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#include <commonlib/stdlib.h>
+#include <device_tree.h>
+#include <endian.h>
+#include <halt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tests/test.h>
+
+/* Roughly the size of an arm64 kernel device tree, with all devices on one bus. */
+#define BASE_DEVICES		3000
+#define OVERLAY_FRAGMENTS	1000
+
+static struct fdt_header header_template;
+
+/* xmalloc() halts when out of memory. */
+void halt(void)
+{
+	fail_msg("Out of memory");
+}
+
+static struct device_tree *new_tree(void)
+{
+	struct device_tree *tree = xzalloc(sizeof(*tree));
+
+	header_template.magic = htobe32(FDT_HEADER_MAGIC);
+	header_template.version = htobe32(FDT_SUPPORTED_VERSION);
+	header_template.last_comp_version = htobe32(16);
+	header_template.reserve_map_offset = htobe32(sizeof(header_template));
+	tree->header = &header_template;
+	tree->header_size = sizeof(header_template);
+	tree->root = xzalloc(sizeof(*tree->root));
+	tree->root->name = "";
+
+	return tree;
+}
+
+static struct device_tree_node *new_node(struct device_tree_node *parent, const char *fmt, ...)
+{
+	struct device_tree_node *node = xzalloc(sizeof(*node));
+	char name[64];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(name, sizeof(name), fmt, args);
+	va_end(args);
+	node->name = strdup(name);
+	list_insert_after(&node->list_node, &parent->children);
+
+	return node;
+}
+
+static void add_string_prop(struct device_tree_node *node, const char *name, const char *fmt,
+			    ...)
+{
+	char str[64];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(str, sizeof(str), fmt, args);
+	va_end(args);
+	dt_add_string_prop(node, strdup(name), strdup(str));
+}
+
+/* Flatten a tree built by hand, so that it can be unflattened as a real tree. */
+static void *flatten(struct device_tree *tree, size_t *size)
+{
+	*size = dt_flat_size(tree);
+	void *blob = malloc(*size);
+	dt_flatten(tree, blob);
+
+	return blob;
+}
+
+static void *unflatten_copy(const void *blob, size_t size, struct device_tree **tree)
+{
+	void *copy = malloc(size);
+
+	memcpy(copy, blob, size);
+	*tree = fdt_unflatten(copy);
+	assert_non_null(*tree);
+
+	return copy;
+}
+
+static void *build_base(size_t *size)
+{
+	struct device_tree *tree = new_tree();
+	struct device_tree_node *soc = new_node(tree->root, "soc");
+	struct device_tree_node *symbols = new_node(tree->root, "__symbols__");
+	char compat[64];
+
+	dt_add_u32_prop(tree->root, "#address-cells", 2);
+	dt_add_u32_prop(tree->root, "#size-cells", 2);
+	dt_add_string_prop(tree->root, "compatible", "vendor,board");
+	dt_add_u32_prop(soc, "#address-cells", 1);
+	dt_add_u32_prop(soc, "#size-cells", 1);
+
+	for (int i = 0; i < BASE_DEVICES; i++) {
+		struct device_tree_node *dev = new_node(soc, "dev@%x", 0x10000 * i);
+
+		/* Two compatible strings, the second one shared by all devices. */
+		int len = snprintf(compat, sizeof(compat), "vendor,dev-%d", i) + 1;
+		len += snprintf(compat + len, sizeof(compat) - len, "vendor,dev") + 1;
+		dt_add_bin_prop(dev, "compatible", memcpy(malloc(len), compat, len), len);
+		dt_add_u32_prop(dev, "phandle", i + 1);
+		dt_add_u32_prop(dev, "reg", 0x10000 * i);
+		new_node(dev, "port@0");
+		dt_add_u32_prop(new_node(dev, "port@1"), "reg", 1);
+
+		snprintf(compat, sizeof(compat), "dev%d", i);
+		add_string_prop(symbols, compat, "/soc/dev@%x", 0x10000 * i);
+	}
+
+	return flatten(tree, size);
+}
+
+/*
+ * Every fragment targets a base device through an external phandle reference (/__fixups__)
+ * and adds a node with its own phandle that another property refers to (/__local_fixups__).
+ */
+static void *build_overlay(size_t *size)
+{
+	struct device_tree *tree = new_tree();
+	struct device_tree_node *fixups = new_node(tree->root, "__fixups__");
+	struct device_tree_node *local_fixups = new_node(tree->root, "__local_fixups__");
+
+	for (int i = 0; i < OVERLAY_FRAGMENTS; i++) {
+		struct device_tree_node *fragment = new_node(tree->root, "fragment@%d", i);
+		struct device_tree_node *overlay = new_node(fragment, "__overlay__");
+		struct device_tree_node *node = new_node(overlay, "ovl-%d", i);
+
+		dt_add_u32_prop(fragment, "target", 0xffffffff);
+		dt_add_string_prop(overlay, "status", "okay");
+		add_string_prop(node, "compatible", "vendor,ovl-%d", i);
+		dt_add_u32_prop(node, "phandle", i + 1);
+		dt_add_u32_prop(node, "link", i + 1);
+
+		char label[16];
+		snprintf(label, sizeof(label), "dev%d", (i * 7) % BASE_DEVICES);
+		add_string_prop(fixups, label, "/fragment@%d:target:0", i);
+
+		struct device_tree_node *fixup = new_node(new_node(new_node(local_fixups,
+							"fragment@%d", i), "__overlay__"), "ovl-%d", i);
+		dt_add_u32_prop(fixup, "link", 0);
+	}
+
+	return flatten(tree, size);
+}
+
+static void test_dt_index_lookups(void **state)
+{
+	static const char *late_path[] = { "soc", "late", NULL };
+	struct device_tree_node *node, *late;
+	struct device_tree *tree;
+	size_t size;
+	void *blob = build_base(&size);
+	char path[64];
+
+	unflatten_copy(blob, size, &tree);
+	assert_non_null(tree->index);
+
+	for (int i = 0; i < BASE_DEVICES; i += 97) {
+		snprintf(path, sizeof(path), "/soc/dev@%x/port@1", 0x10000 * i);
+		node = dt_find_node_by_path(tree, path, NULL, NULL, 0);
+		assert_non_null(node);
+		assert_string_equal(node->name, "port@1");
+
+		snprintf(path, sizeof(path), "/soc/dev@%x", 0x10000 * i);
+		node = dt_find_node_by_path(tree, path, NULL, NULL, 0);
+		assert_ptr_equal(dt_find_tree_node_by_phandle(tree, i + 1), node);
+		assert_ptr_equal(dt_find_node_by_phandle(tree->root, i + 1), node);
+
+		snprintf(path, sizeof(path), "vendor,dev-%d", i);
+		assert_ptr_equal(dt_find_tree_compat(tree, path), node);
+	}
+	assert_ptr_equal(dt_find_tree_compat(tree, "vendor,dev"),
+			 dt_find_compat(tree->root, "vendor,dev"));
+	assert_null(dt_find_node_by_path(tree, "/soc/dev@1", NULL, NULL, 0));
+	assert_null(dt_find_tree_node_by_phandle(tree, BASE_DEVICES + 1));
+	assert_null(dt_find_tree_compat(tree, "vendor,dev-"));
+
+	/* Nodes and properties added without going through the tree are still found. */
+	late = dt_find_node(tree->root, late_path, NULL, NULL, 1);
+	assert_non_null(late);
+	assert_ptr_equal(dt_find_node_by_path(tree, "/soc/late", NULL, NULL, 0), late);
+	dt_add_string_prop(late, "compatible", "vendor,late");
+	assert_ptr_equal(dt_find_tree_compat(tree, "vendor,late"), late);
+	dt_add_u32_prop(late, "phandle", 0x1000);
+	late->phandle = 0x1000;
+	assert_ptr_equal(dt_find_tree_node_by_phandle(tree, 0x1000), late);
+
+	/*
+	 * Indexed nodes win over unindexed ones, even if those come first in the tree. Nodes
+	 * created below a parent are inserted at the head of its children.
+	 */
+	node = dt_find_tree_compat(tree, "vendor,dev");
+	dt_add_string_prop(late, "compatible", "vendor,dev");
+	assert_ptr_equal(dt_find_compat(tree->root, "vendor,dev"), late);
+	assert_ptr_equal(dt_find_tree_compat(tree, "vendor,dev"), node);
+
+	/* Stale entries are skipped. */
+	node = dt_find_tree_compat(tree, "vendor,dev-5");
+	dt_delete_prop(node, "compatible");
+	assert_null(dt_find_tree_compat(tree, "vendor,dev-5"));
+
+	/* Nodes created through the tree are indexed right away. */
+	node = dt_find_node_by_path(tree, "/soc/new/child", NULL, NULL, 1);
+	assert_non_null(node);
+	assert_ptr_equal(dt_find_node_by_path(tree, "/soc/new/child", NULL, NULL, 0), node);
+}
+
+static void *apply_overlay(const void *base, size_t base_size, const void *overlay,
+			   size_t overlay_size, int indexed, size_t *size)
+{
+	struct device_tree *tree, *ovl;
+	char str[64];
+
+	unflatten_copy(base, base_size, &tree);
+	unflatten_copy(overlay, overlay_size, &ovl);
+	if (!indexed)
+		tree->index = ovl->index = NULL;
+
+	assert_int_equal(dt_apply_overlay(tree, ovl), 0);
+
+	/* The kind of lookups board fixups do afterwards. */
+	for (int i = 0; i < OVERLAY_FRAGMENTS; i++) {
+		snprintf(str, sizeof(str), "/soc/dev@%x/ovl-%d", 0x10000 * ((i * 7) % BASE_DEVICES),
+			 i);
+		struct device_tree_node *node = dt_find_node_by_path(tree, str, NULL, NULL, 0);
+		assert_non_null(node);
+		assert_ptr_equal(dt_find_tree_node_by_phandle(tree, BASE_DEVICES + i + 1), node);
+		snprintf(str, sizeof(str), "vendor,ovl-%d", i);
+		assert_ptr_equal(dt_find_tree_compat(tree, str), node);
+		dt_add_u32_prop(node, "fixed-up", 1);
+	}
+
+	return flatten(tree, size);
+}
+
+/* The index must not change the result of applying an overlay. */
+static void test_dt_apply_overlay(void **state)
+{
+	size_t base_size, overlay_size, size[2];
+	void *base = build_base(&base_size);
+	void *overlay = build_overlay(&overlay_size);
+	void *result[2];
+
+	for (int indexed = 0; indexed < 2; indexed++)
+		result[indexed] = apply_overlay(base, base_size, overlay, overlay_size, indexed,
+						&size[indexed]);
+
+	assert_int_equal(size[0], size[1]);
+	assert_memory_equal(result[0], result[1], size[0]);
+}
+
+static void test_fdt_edit_in_place(void **state)
+{
+	const size_t slack = 4 * KiB;
+	struct fdt_header *header;
+	struct device_tree *tree;
+	struct device_tree_node *node;
+	uint32_t chosen, dev, offset;
+	u32 addr_cells = 0, size_cells = 0;
+	size_t size;
+	void *base = build_base(&size);
+	void *blob = malloc(size + slack);
+	const void *data;
+
+	header = blob;
+	assert_int_equal(fdt_open_into(base, blob, size), 0);
+	assert_int_equal(fdt_open_into(base, blob, size - 1), -1);
+	assert_int_equal(fdt_open_into(base, blob, size + slack), 0);
+	assert_int_equal(be32toh(header->totalsize), size + slack);
+
+	/* Lookups */
+	dev = fdt_find_node_by_path(blob, "/soc/dev@20000/port@1", &addr_cells, &size_cells);
+	assert_int_not_equal(dev, 0);
+	assert_int_equal(addr_cells, 1);
+	assert_int_equal(size_cells, 1);
+	assert_int_equal(fdt_find_node_by_path(blob, "/soc/dev@20000/port@2", NULL, NULL), 0);
+	assert_int_equal(fdt_find_node_by_path(blob, "/soc/dev@1", NULL, NULL), 0);
+
+	/* New nodes and properties, with names already in the strings block being reused. */
+	const uint32_t strings_size = be32toh(header->strings_size);
+	chosen = fdt_find_or_add_child(blob, fdt_find_node_by_path(blob, "/", NULL, NULL),
+				       "chosen");
+	assert_int_not_equal(chosen, 0);
+	assert_int_equal(fdt_set_u32_prop(blob, chosen, "reg", 0x1234), 0);
+	assert_int_equal(fdt_set_u32_prop(blob, chosen, "cells", 1), 0);
+	assert_int_equal(be32toh(header->strings_size), strings_size);
+	assert_int_equal(fdt_set_string_prop(blob, chosen, "bootargs", "console=ttyS0"), 0);
+	assert_int_equal(be32toh(header->strings_size), strings_size + sizeof("bootargs"));
+
+	/* Growing, shrinking and deleting properties in the middle of the tree. */
+	dev = fdt_find_node_by_path(blob, "/soc/dev@20000", NULL, NULL);
+	assert_int_equal(fdt_set_string_prop(blob, dev, "compatible", "vendor,longer-name"), 0);
+	assert_int_equal(fdt_set_string_prop(blob, dev, "status", "okay"), 0);
+	assert_int_equal(fdt_set_string_prop(blob, dev, "status", "disabled"), 0);
+	assert_int_equal(fdt_set_string_prop(blob, dev, "status", "ok"), 0);
+	fdt_delete_prop(blob, dev, "reg");
+	fdt_delete_node(blob, fdt_find_child(blob, dev, "port@0"));
+	offset = fdt_find_node_by_path(blob, "/soc/dev@30000", NULL, NULL);
+	fdt_delete_node(blob, offset);
+	assert_int_equal(fdt_add_reserve_map_entry(blob, 0x80000000, 0x100000), 0);
+	assert_int_equal(fdt_add_reserve_map_entry(blob, 0x90000000, 0x200000), 0);
+
+	/* Running out of slack fails cleanly. */
+	void *big = calloc(1, size + slack);
+	assert_int_equal(fdt_set_prop(blob, chosen, "big", big, size + slack), -1);
+	free(big);
+
+	fdt_pack(blob);
+	assert_int_equal(be32toh(header->totalsize),
+			 be32toh(header->strings_offset) + be32toh(header->strings_size));
+
+	/* Check the result through the unflattened tree. */
+	tree = fdt_unflatten(blob);
+	assert_non_null(tree);
+	node = dt_find_node_by_path(tree, "/chosen", NULL, NULL, 0);
+	assert_non_null(node);
+	assert_string_equal(dt_find_string_prop(node, "bootargs"), "console=ttyS0");
+	dt_find_bin_prop(node, "reg", &data, &size);
+	assert_int_equal(size, sizeof(u32));
+	assert_int_equal(be32dec(data), 0x1234);
+	node = dt_find_node_by_path(tree, "/soc/dev@20000", NULL, NULL, 0);
+	assert_string_equal(dt_find_string_prop(node, "compatible"), "vendor,longer-name");
+	assert_string_equal(dt_find_string_prop(node, "status"), "ok");
+	assert_null(dt_find_string_prop(node, "reg"));
+	assert_null(dt_find_node_by_path(tree, "/soc/dev@20000/port@0", NULL, NULL, 0));
+	assert_non_null(dt_find_node_by_path(tree, "/soc/dev@20000/port@1", NULL, NULL, 0));
+	assert_null(dt_find_node_by_path(tree, "/soc/dev@30000", NULL, NULL, 0));
+	assert_non_null(dt_find_node_by_path(tree, "/soc/dev@40000", NULL, NULL, 0));
+
+	struct device_tree_reserve_map_entry *entry;
+	size = 0;
+	list_for_each(entry, tree->reserve_map, list_node)
+		size += entry->size;
+	assert_int_equal(size, 0x300000);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_dt_index_lookups),
+		cmocka_unit_test(test_dt_apply_overlay),
+		cmocka_unit_test(test_fdt_edit_in_place),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
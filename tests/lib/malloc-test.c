@@ -41,9 +41,14 @@ void die(const char *msg, ...)
 
 static int setup_test(void **state)
 {
+#if CONFIG(HEAP_FREE_LIST)
+	/* Next allocation will reinitialize the heap. */
+	heap_start = NULL;
+#else
 	free_mem_ptr = &_heap;
 	free_mem_end_ptr = &_eheap;
 	free_last_alloc_ptr = &_heap;
+#endif
 
 	return 0;
 }
@@ -151,6 +156,135 @@ static void test_calloc_memory_is_zeroed(void **state)
 	}
 }
 
+#if CONFIG(HEAP_FREE_LIST)
+static void test_free_reuses_memory(void **state)
+{
+	struct heap_stats stats;
+	void *ptrs[64];
+
+	/* Without reuse this would need 64 MiB. */
+	for (int i = 0; i < 1000; ++i) {
+		for (int j = 0; j < ARRAY_SIZE(ptrs); ++j) {
+			ptrs[j] = cb_malloc(1024);
+			assert_non_null(ptrs[j]);
+		}
+		/* Free in an order that forces coalescing with both neighbours. */
+		for (int j = 0; j < ARRAY_SIZE(ptrs); j += 2)
+			cb_free(ptrs[j]);
+		for (int j = 1; j < ARRAY_SIZE(ptrs); j += 2)
+			cb_free(ptrs[j]);
+	}
+
+	heap_stats(&stats);
+	assert_int_equal(stats.live, 0);
+	assert_int_equal(stats.used, 0);
+	assert_true(stats.peak >= ARRAY_SIZE(ptrs) * 1024);
+	/* Everything must have been coalesced back into a single free block. */
+	assert_int_equal(stats.largest_free, stats.available);
+}
+
+static void test_malloc_searches_size_class(void **state)
+{
+	struct heap_stats stats;
+	void *small, *large, *ptr;
+
+	/* Two free blocks of the same size class, separated by used ones. */
+	small = cb_malloc(1100);
+	assert_non_null(cb_malloc(8));
+	large = cb_malloc(1500);
+	assert_non_null(cb_malloc(8));
+
+	/* Use up the rest of the heap. */
+	heap_stats(&stats);
+	assert_non_null(cb_malloc(stats.largest_free - BLOCK_HEADER_SIZE));
+	heap_stats(&stats);
+	assert_int_equal(stats.available, 0);
+
+	/* The too small block ends up first in the list and must be skipped. */
+	cb_free(large);
+	cb_free(small);
+	heap_stats(&stats);
+	assert_true(stats.largest_free >= 1400 + BLOCK_HEADER_SIZE);
+
+	ptr = cb_malloc(1400);
+	assert_ptr_equal(ptr, large);
+}
+
+static void test_malloc_takes_best_fit(void **state)
+{
+	struct heap_stats stats;
+	void *small, *large, *tiny, *medium;
+
+	/* Free blocks of the same power-of-two class and of two small classes. */
+	small = cb_malloc(1100);
+	assert_non_null(cb_malloc(8));
+	large = cb_malloc(1500);
+	assert_non_null(cb_malloc(8));
+	tiny = cb_malloc(40);
+	assert_non_null(cb_malloc(8));
+	medium = cb_malloc(200);
+	assert_non_null(cb_malloc(8));
+
+	heap_stats(&stats);
+	assert_non_null(cb_malloc(stats.largest_free - BLOCK_HEADER_SIZE));
+
+	/* The larger blocks end up first in their lists. */
+	cb_free(small);
+	cb_free(large);
+	cb_free(tiny);
+	cb_free(medium);
+
+	assert_ptr_equal(cb_malloc(1050), small);
+	assert_ptr_equal(cb_malloc(1050), large);
+	assert_ptr_equal(cb_malloc(40), tiny);
+	assert_ptr_equal(cb_malloc(200), medium);
+}
+
+static void test_free_out_of_order_stress(void **state)
+{
+	static uint8_t *ptrs[1024];
+	static size_t sizes[ARRAY_SIZE(ptrs)];
+	struct heap_stats stats;
+	const int iterations = 500000;
+	uint32_t seed = 1;
+
+	for (int i = 0; i < iterations; ++i) {
+		seed = seed * 1103515245 + 12345;
+		const size_t idx = (seed >> 8) % ARRAY_SIZE(ptrs);
+
+		if (ptrs[idx]) {
+			/* Check that no other allocation overwrote this one. */
+			for (size_t j = 0; j < sizes[idx]; ++j)
+				assert_int_equal(ptrs[idx][j], (uint8_t)idx);
+			cb_free(ptrs[idx]);
+			ptrs[idx] = NULL;
+			continue;
+		}
+
+		sizes[idx] = (seed >> 16) % ((seed & 7) ? 64 : 2048);
+		if (seed & 0x18) {
+			ptrs[idx] = cb_malloc(sizes[idx]);
+			assert_true(IS_ALIGNED((uintptr_t)ptrs[idx], sizeof(u64)));
+		} else {
+			const size_t align = 1 << ((seed >> 24) % 10);
+			ptrs[idx] = cb_memalign(align, sizes[idx]);
+			assert_true(IS_ALIGNED((uintptr_t)ptrs[idx], align));
+		}
+		assert_non_null(ptrs[idx]);
+		memset(ptrs[idx], (uint8_t)idx, sizes[idx]);
+	}
+
+	for (int i = 0; i < ARRAY_SIZE(ptrs); ++i) {
+		cb_free(ptrs[i]);
+		ptrs[i] = NULL;
+	}
+
+	heap_stats(&stats);
+	assert_int_equal(stats.live, 0);
+	assert_int_equal(stats.largest_free, stats.available);
+}
+#endif
+
 int main(void)
 {
 	const struct CMUnitTest tests[] = {
@@ -162,6 +296,12 @@ int main(void)
 		cmocka_unit_test_setup(test_memalign_zero, setup_test),
 		cmocka_unit_test_setup(test_memalign_multiple_small_allocations, setup_test),
 		cmocka_unit_test_setup(test_calloc_memory_is_zeroed, setup_calloc_test),
+#if CONFIG(HEAP_FREE_LIST)
+		cmocka_unit_test_setup(test_free_reuses_memory, setup_test),
+		cmocka_unit_test_setup(test_malloc_searches_size_class, setup_test),
+		cmocka_unit_test_setup(test_malloc_takes_best_fit, setup_test),
+		cmocka_unit_test_setup(test_free_out_of_order_stress, setup_test),
+#endif
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
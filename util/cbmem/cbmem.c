@@ -529,6 +529,7 @@ static void print_norm(u64 v)
 
 static const char *timestamp_name(uint32_t id)
 {
+	id &= TIMESTAMP_ID_MASK;
 	for (size_t i = 0; i < ARRAY_SIZE(timestamp_ids); i++) {
 		if (timestamp_ids[i].id == id)
 			return timestamp_ids[i].name;
@@ -547,7 +548,7 @@ static uint64_t timestamp_print_parseable_entry(uint32_t id, uint64_t stamp,
 	step_time = arch_convert_raw_ts_entry(stamp - prev_stamp);
 
 	/* ID<tab>absolute time<tab>relative time<tab>description */
-	printf("%d\t", id);
+	printf("%u\t", id);
 	printf("%llu\t", (long long)arch_convert_raw_ts_entry(stamp));
 	printf("%llu\t", (long long)step_time);
 	printf("%s\n", name);
@@ -562,7 +563,7 @@ static uint64_t timestamp_print_entry(uint32_t id, uint64_t stamp, uint64_t prev
 
 	name = timestamp_name(id);
 
-	printf("%4d:", id);
+	printf("%4d:", id & TIMESTAMP_ID_MASK);
 	printf("%-50s", name);
 	print_norm(arch_convert_raw_ts_entry(stamp));
 	step_time = arch_convert_raw_ts_entry(stamp - prev_stamp);
@@ -589,6 +590,36 @@ static int compare_timestamp_entries(const void *a, const void *b)
 	return 0;
 }
 
+/*
+ * Print one timeline per AP that recorded timestamps. Machine readable output keeps the CPU
+ * index in the upper bits of the ID, so it can be told apart from the boot CPU's entries.
+ */
+static void dump_ap_timestamps(const struct timestamp_table *sorted_tst_p, int mach_readable)
+{
+	for (uint32_t cpu = 1; cpu <= TIMESTAMP_MAX_CPU; cpu++) {
+		uint64_t prev_stamp = 0;
+
+		for (uint32_t i = 0; i < sorted_tst_p->num_entries; i++) {
+			const struct timestamp_entry *tse = &sorted_tst_p->entries[i];
+			uint64_t stamp;
+
+			if (timestamp_entry_cpu(tse) != cpu)
+				continue;
+
+			if (!prev_stamp && !mach_readable)
+				printf("\nCPU %u:\n", cpu);
+
+			stamp = tse->entry_stamp + sorted_tst_p->base_time;
+			if (mach_readable)
+				timestamp_print_parseable_entry(tse->entry_id, stamp,
+							prev_stamp ? prev_stamp : stamp);
+			else
+				timestamp_print_entry(tse->entry_id, stamp, prev_stamp);
+			prev_stamp = stamp;
+		}
+	}
+}
+
 /* dump the timestamp table */
 static void dump_timestamps(int mach_readable)
 {
@@ -643,6 +674,10 @@ static void dump_timestamps(int mach_readable)
 		uint64_t stamp;
 		const struct timestamp_entry *tse = &sorted_tst_p->entries[i];
 
+		/* Entries from other CPUs are shown in their own timelines below. */
+		if (timestamp_entry_cpu(tse))
+			continue;
+
 		/* Make all timestamps absolute. */
 		stamp = tse->entry_stamp + sorted_tst_p->base_time;
 		if (mach_readable)
@@ -661,6 +696,8 @@ static void dump_timestamps(int mach_readable)
 		printf("\n");
 	}
 
+	dump_ap_timestamps(sorted_tst_p, mach_readable);
+
 	unmap_memory(&timestamp_mapping);
 	free(sorted_tst_p);
 }